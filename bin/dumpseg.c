@@ -68,6 +68,7 @@ static const struct option long_option[] = {
 
 #define DUMPSEG_BASE	10
 #define DUMPSEG_BUFSIZE	128
+#define DUMPSEG_NSEGS	16	/* segments read at once */
 
 static void dumpseg_print_psegment_error(const struct nilfs_psegment *pseg,
 					 const char *errstr)
@@ -252,14 +253,61 @@ static void dumpseg_print_segment(const struct nilfs_segment *segment)
 		dumpseg_print_psegment_error(&pseg, errstr);
 }
 
+/**
+ * dumpseg_dump_segments - print segments
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array
+ *
+ * The segments are read at once.  If that fails, they are read one by
+ * one so that the segments before the offending one are still printed.
+ */
+static int dumpseg_dump_segments(struct nilfs *nilfs, const uint64_t *segnums,
+				 size_t nsegs)
+{
+	struct nilfs_segment segments[DUMPSEG_NSEGS];
+	size_t i;
+	int ret;
+
+	ret = nilfs_get_segment_summaries(nilfs, segnums, nsegs, segments);
+	if (ret == 0) {
+		for (i = 0; i < nsegs; i++)
+			dumpseg_print_segment(&segments[i]);
+
+		ret = nilfs_put_segments(segments, nsegs);
+		if (ret < 0) {
+			warn("failed to release segment");
+			return -1;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < nsegs; i++) {
+		ret = nilfs_get_segment_summary(nilfs, segnums[i],
+						&segments[0]);
+		if (ret < 0) {
+			warn("failed to read segment");
+			return -1;
+		}
+
+		dumpseg_print_segment(&segments[0]);
+
+		ret = nilfs_put_segment(&segments[0]);
+		if (ret < 0) {
+			warn("failed to release segment");
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	struct nilfs *nilfs;
-	uint64_t segnum;
+	uint64_t segnums[DUMPSEG_NSEGS];
 	char *dev, *endptr, *progname, *last;
-	struct nilfs_segment segment;
+	size_t nsegs = 0;
 	int c, i, status;
-	int ret;
 #ifdef _GNU_SOURCE
 	int option_index;
 #endif	/* _GNU_SOURCE */
@@ -306,28 +354,23 @@ int main(int argc, char *argv[])
 
 	status = EXIT_SUCCESS;
 	for (i = optind; i < argc; i++) {
-		segnum = strtoull(argv[i], &endptr, DUMPSEG_BASE);
+		segnums[nsegs] = strtoull(argv[i], &endptr, DUMPSEG_BASE);
 		if (*endptr != '\0') {
 			warnx("%s: invalid segment number", argv[i]);
 			status = EXIT_FAILURE;
 			continue;
 		}
-		ret = nilfs_get_segment(nilfs, segnum, &segment);
-		if (ret < 0) {
-			warn("failed to read segment");
-			status = EXIT_FAILURE;
-			goto out;
-		}
-
-		dumpseg_print_segment(&segment);
+		if (++nsegs < DUMPSEG_NSEGS)
+			continue;
 
-		ret = nilfs_put_segment(&segment);
-		if (ret < 0) {
-			warn("failed to release segment");
+		if (dumpseg_dump_segments(nilfs, segnums, nsegs) < 0) {
 			status = EXIT_FAILURE;
 			goto out;
 		}
+		nsegs = 0;
 	}
+	if (nsegs > 0 && dumpseg_dump_segments(nilfs, segnums, nsegs) < 0)
+		status = EXIT_FAILURE;
 
  out:
 	nilfs_close(nilfs);
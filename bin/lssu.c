@@ -118,22 +118,33 @@ static uint64_t param_lines;
 
 static size_t blocks_per_segment;
 static struct nilfs_suinfo suinfos[LSSU_NSEGS];
+static uint64_t segnumv[LSSU_NSEGS];
+static struct nilfs_reclaim_stat stats[LSSU_NSEGS];
+static ssize_t liveblks[LSSU_NSEGS];
 
 static void lssu_print_header(void)
 {
 	puts(lssu_format[disp_mode].header);
 }
 
-static ssize_t lssu_get_latest_usage(struct nilfs *nilfs,
-				     uint64_t segnum, uint64_t protseq,
-				     nilfs_cno_t protcno)
+/**
+ * lssu_get_latest_usages - assess live blocks of listed segments in bulk
+ * @nilfs: nilfs object
+ * @segnum: segment number of the first element of suinfos
+ * @nsi: number of valid elements in suinfos
+ * @protseq: start of sequence number of protected segments
+ *
+ * Stores the number of live blocks of each dirty segment in
+ * liveblks, or -2 if the segment is protected.
+ */
+static int lssu_get_latest_usages(struct nilfs *nilfs, uint64_t segnum,
+				  ssize_t nsi, uint64_t protseq)
 {
-	struct nilfs_reclaim_stat stat;
 	struct nilfs_reclaim_params params = {
 		.flags = NILFS_RECLAIM_PARAM_PROTSEQ,
 		.protseq = protseq
 	};
-	uint64_t segnums[1];
+	ssize_t i, nsegs = 0;
 	int ret;
 
 	if (protcno != NILFS_CNO_MAX) {
@@ -141,17 +152,22 @@ static ssize_t lssu_get_latest_usage(struct nilfs *nilfs,
 		params.protcno = protcno;
 	}
 
-	memset(&stat, 0, sizeof(stat));
-	segnums[0] = segnum;
+	for (i = 0; i < nsi; i++) {
+		if (!nilfs_suinfo_dirty(&suinfos[i]) ||
+		    nilfs_suinfo_error(&suinfos[i]))
+			continue;
+		segnumv[nsegs++] = segnum + i;
+	}
 
-	ret = nilfs_assess_segment(nilfs, segnums, 1, &params, &stat);
+	ret = nilfs_assess_segments_nolock(nilfs, segnumv, nsegs, &params,
+					   stats);
 	if (unlikely(ret < 0))
 		return -1;
 
-	if (stat.protected_segs > 0)
-		return -2;
-
-	return stat.live_blks;
+	for (i = 0; i < nsegs; i++)
+		liveblks[segnumv[i] - segnum] = stats[i].protected_segs > 0 ?
+			-2 : stats[i].live_blks;
+	return 0;
 }
 
 static ssize_t lssu_print_suinfo(struct nilfs *nilfs, uint64_t segnum,
@@ -165,6 +181,12 @@ static ssize_t lssu_print_suinfo(struct nilfs *nilfs, uint64_t segnum,
 	int protected;
 	size_t nliveblks;
 
+	if (disp_mode == LSSU_MODE_LATEST_USAGE &&
+	    lssu_get_latest_usages(nilfs, segnum, nsi, protseq) < 0) {
+		warn("failed to get usage");
+		return -1;
+	}
+
 	for (i = 0; i < nsi; i++, segnum++) {
 		if (!all && nilfs_suinfo_clean(&suinfos[i]))
 			continue;
@@ -196,18 +218,14 @@ static ssize_t lssu_print_suinfo(struct nilfs *nilfs, uint64_t segnum,
 			    nilfs_suinfo_error(&suinfos[i]))
 				goto skip_scan;
 
-			ret = lssu_get_latest_usage(nilfs, segnum, protseq,
-						    protcno);
+			ret = liveblks[i];
 			if (ret >= 0) {
 				nliveblks = ret;
 				ratio = (ret * 100 + 99) / blocks_per_segment;
-			} else if (likely(ret == -2)) {
+			} else {
 				nliveblks = suinfos[i].sui_nblocks;
 				ratio = 100;
 				protected = 1;
-			} else {
-				warn("failed to get usage");
-				return -1;
 			}
 
 skip_scan:
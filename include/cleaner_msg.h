@@ -21,6 +21,9 @@
 #define NILFS_CLEANER_MSG_MAX_PATH	4064 /* max pathname length */
 #define NILFS_CLEANER_MSG_MAX_REQSZ	4096 /* max request size */
 
+#define NILFS_CLEANER_QUEUE_PREFIX	"/nilfs-cleanerq"
+#define NILFS_CLEANER_STATS_PREFIX	"/nilfs-cleanerstat"
+
 enum {
 	NILFS_CLEANER_CMD_GET_STATUS,	/* get status */
 	NILFS_CLEANER_CMD_RUN,		/* run gc */
@@ -71,4 +74,29 @@ struct nilfs_cleaner_response {
 	uint32_t pad;
 };
 
+#define NILFS_CLEANER_STATS_MAGIC	0x4e435354	/* "NCST" */
+#define NILFS_CLEANER_STATS_VERSION	1
+
+/**
+ * struct nilfs_cleaner_stats_page - statistics page published by cleanerd
+ * @magic: NILFS_CLEANER_STATS_MAGIC
+ * @version: layout version of the page
+ * @size: size of @stats in bytes
+ * @seq: sequence counter, odd while cleanerd is updating @stats
+ * @pid: process ID of cleanerd
+ * @stats: statistics
+ *
+ * The page is a POSIX shared memory object named after the device like
+ * the request queue of cleanerd.  Readers copy @stats and retry if @seq
+ * was odd or changed during the copy, so neither side takes a lock.
+ */
+struct nilfs_cleaner_stats_page {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t seq;
+	int64_t pid;
+	struct nilfs_cleaner_stats stats;
+};
+
 #endif /* NILFS_CLEANER_MSG_H */
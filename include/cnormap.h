@@ -18,5 +18,7 @@ struct nilfs_cnormap *nilfs_cnormap_create(struct nilfs *nilfs);
 void nilfs_cnormap_destroy(struct nilfs_cnormap *cnormap);
 int nilfs_cnormap_track_back(struct nilfs_cnormap *cnormap, uint64_t period,
 			     nilfs_cno_t *cnop);
+int nilfs_cnormap_cno_to_time(struct nilfs_cnormap *cnormap, nilfs_cno_t cno,
+			      int64_t *timep);
 
 #endif /* NILFS_CNORMAP_H */
@@ -31,6 +31,7 @@ typedef uint64_t nilfs_cno_t;
 
 struct nilfs_super_block;
 struct nilfs;
+struct nilfs_segpool;
 
 /**
  * struct nilfs_layout - layout information of nilfs
@@ -102,6 +103,41 @@ static inline int nilfs_opt_clear_##name(struct nilfs *nilfs)		\
 
 NILFS_OPT_FNS(mmap, 0)
 NILFS_OPT_FNS(set_suinfo, 1)
+NILFS_OPT_FNS(hugepage, 2)
+
+void nilfs_copy_options(struct nilfs *dst, const struct nilfs *src);
+
+/* ioctl requests whose number of items per call is tunable */
+enum {
+	NILFS_IOCTL_BATCH_VINFO,
+	NILFS_IOCTL_BATCH_BDESCS,
+	NILFS_IOCTL_BATCH_CPINFO,
+	__NR_NILFS_IOCTL_BATCH,
+};
+
+#define NILFS_IOCTL_BATCH_AUTO		0	/* adapt to latency target */
+#define NILFS_IOCTL_BATCH_DEFAULT	512
+#define NILFS_IOCTL_BATCH_MIN		16
+#define NILFS_IOCTL_BATCH_MAX		65536
+
+/**
+ * struct nilfs_ioctl_stat - statistics of an ioctl request
+ * @ncalls: number of calls
+ * @nitems: number of items requested
+ * @nsecs: total time spent in the calls in nanoseconds
+ */
+struct nilfs_ioctl_stat {
+	uint64_t ncalls;
+	uint64_t nitems;
+	uint64_t nsecs;
+};
+
+int nilfs_set_ioctl_batch(struct nilfs *nilfs, unsigned int type,
+			  size_t nitems);
+size_t nilfs_get_ioctl_batch(const struct nilfs *nilfs, unsigned int type);
+int nilfs_set_ioctl_latency(struct nilfs *nilfs, unsigned long usecs);
+int nilfs_get_ioctl_stat(const struct nilfs *nilfs, unsigned int type,
+			 struct nilfs_ioctl_stat *stat);
 
 nilfs_cno_t nilfs_get_oldest_cno(struct nilfs *nilfs);
 
@@ -145,6 +181,10 @@ int nilfs_sb_write(int devfd, struct nilfs_super_block *sbp, int mask);
  * @seed: crc seed
  * @mmapped: flag to indicate that @addr is mapped with mmap()
  * @adjusted: flag to indicate that @addr is adjusted to page boundary
+ * @sumonly: flag to indicate that only summary blocks were read to @addr
+ * @pooled: flag to indicate that @addr belongs to the nilfs object, either
+ *          a buffer of its segment buffer pool or its mapping of the device
+ * @pool: segment buffer pool holding @addr for the segment if @pooled
  */
 struct nilfs_segment {
 	void *addr;
@@ -158,13 +198,25 @@ struct nilfs_segment {
 	uint32_t seed;
 	unsigned int mmapped : 1;
 	unsigned int adjusted : 1;
+	unsigned int sumonly : 1;
+	unsigned int pooled : 1;
+	struct nilfs_segpool *pool;
 };
 
 int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
 		      struct nilfs_segment *segment);
+int nilfs_get_segment_summary(struct nilfs *nilfs, uint64_t segnum,
+			      struct nilfs_segment *segment);
 int nilfs_put_segment(struct nilfs_segment *segment);
+int nilfs_get_segments(struct nilfs *nilfs, const uint64_t *segnums,
+		       size_t nsegs, struct nilfs_segment *segments);
+int nilfs_get_segment_summaries(struct nilfs *nilfs, const uint64_t *segnums,
+				size_t nsegs, struct nilfs_segment *segments);
+int nilfs_put_segments(struct nilfs_segment *segments, size_t nsegs);
 int nilfs_get_segment_seqnum(const struct nilfs *nilfs, uint64_t segnum,
 			     uint64_t *seqnum);
+int nilfs_readahead_segment(const struct nilfs *nilfs, uint64_t segnum,
+			    uint32_t nblocks);
 
 size_t nilfs_get_block_size(const struct nilfs *nilfs);
 uint64_t nilfs_get_nsegments(const struct nilfs *nilfs);
@@ -176,6 +228,8 @@ ssize_t nilfs_get_cpinfo(struct nilfs *nilfs, nilfs_cno_t cno, int mode,
 			 struct nilfs_cpinfo *cpinfo, size_t nci);
 int nilfs_delete_checkpoint(struct nilfs *nilfs, nilfs_cno_t cno);
 int nilfs_get_cpstat(const struct nilfs *nilfs, struct nilfs_cpstat *cpstat);
+ssize_t nilfs_get_snapshot_list(struct nilfs *nilfs, int refresh,
+				const nilfs_cno_t **ssp, uint64_t *nsssp);
 ssize_t nilfs_get_suinfo(const struct nilfs *nilfs, uint64_t segnum,
 			 struct nilfs_suinfo *suinfo, size_t nsi);
 int nilfs_set_suinfo(const struct nilfs *nilfs,
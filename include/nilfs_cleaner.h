@@ -102,6 +102,43 @@ int nilfs_cleaner_wait_r(struct nilfs_cleaner *cleaner, uint32_t jobid,
 int nilfs_cleaner_stop(struct nilfs_cleaner *cleaner);
 int nilfs_cleaner_shutdown(struct nilfs_cleaner *cleaner);
 
+/**
+ * struct nilfs_cleaner_stats - cumulative statistics of cleanerd
+ * @update_time: time of the last update (nanoseconds since the epoch)
+ * @ncycles: number of iterations of the main loop
+ * @segs_selected: number of segments selected to be cleaned
+ * @segs_cleaned: number of cleaned segments
+ * @segs_deferred: number of deferred segments
+ * @segs_protected: number of selected segments found protected
+ * @live_blks: number of live blocks moved
+ * @defunct_blks: number of defunct blocks freed
+ * @bytes_read: bytes of the blocks read from selected segments
+ * @select_nsecs: time spent selecting segments, including @assess_nsecs
+ * @assess_nsecs: time spent counting live blocks in nanoseconds
+ * @clean_nsecs: time spent cleaning segments in nanoseconds
+ * @sleep_nsecs: time spent waiting for the next cycle in nanoseconds
+ *
+ * New members are only appended to keep readers of older layouts working.
+ */
+struct nilfs_cleaner_stats {
+	uint64_t update_time;
+	uint64_t ncycles;
+	uint64_t segs_selected;
+	uint64_t segs_cleaned;
+	uint64_t segs_deferred;
+	uint64_t segs_protected;
+	uint64_t live_blks;
+	uint64_t defunct_blks;
+	uint64_t bytes_read;
+	uint64_t select_nsecs;
+	uint64_t assess_nsecs;
+	uint64_t clean_nsecs;
+	uint64_t sleep_nsecs;
+};
+
+int nilfs_cleaner_get_stats(struct nilfs_cleaner *cleaner,
+			    struct nilfs_cleaner_stats *stats);
+
 extern void (*nilfs_cleaner_logger)(int priority, const char *fmt, ...);
 extern void (*nilfs_cleaner_printf)(const char *fmt, ...);
 extern void (*nilfs_cleaner_flush)(void);
@@ -7,6 +7,7 @@
 struct nilfs_cleanerd;
 struct nilfs_sustat;
 struct nilfs_suinfo;
+struct nilfs_reclaim_stat;
 
 /**
  * struct nilfs_segment_candidate - segment cleaning candidate
@@ -21,15 +22,60 @@ struct nilfs_segment_candidate {
   double util;
 };
 
+/**
+ * struct nilfs_policy_env - cycle-wide inputs of batch evaluation
+ * @now: current wall clock time
+ * @prottime: lower limit of the protection period
+ * @nongc_ctime: creation time of the latest non-gc log
+ * @blocks_per_segment: number of blocks per segment
+ * @oldest: earliest lastmod of reclaimable segments
+ */
+struct nilfs_policy_env {
+	int64_t now;
+	int64_t prottime;
+	int64_t nongc_ctime;
+	uint32_t blocks_per_segment;
+	int64_t oldest;
+};
+
+/* orders in which indexed selection walks the victim index */
+enum {
+	NILFS_POLICY_WALK_NONE = 0,	/* score every segment */
+	NILFS_POLICY_WALK_LIVE,		/* fewest live blocks first */
+	NILFS_POLICY_WALK_NEWEST,	/* latest lastmod first */
+	NILFS_POLICY_WALK_OLDEST,	/* earliest lastmod first */
+};
+
+/* SIMD instruction sets usable by batch evaluation kernels */
+enum {
+	NILFS_POLICY_SIMD_NONE = 0,
+	NILFS_POLICY_SIMD_SSE2,
+	NILFS_POLICY_SIMD_AVX2,
+};
+
 /**
  * struct nilfs_cleaning_policy - pluggable cleaning policy interface
  * @name: human-readable policy name
  * @init: initialize policy-specific state
  * @destroy: cleanup policy-specific state
  * @evaluate_segment: calculate score for a single segment
+ * @evaluate_batch: optional: calculate scores for a dense batch of
+ *                  reclaimable segments; NaN marks an ineligible one
  * @compare: comparison function for sorting candidates
  * @select: optional: custom selection logic (overrides default)
+ * @walk: order of the victim index in which the best candidates come
+ *        early (NILFS_POLICY_WALK_*); needs @evaluate_batch and @bound
+ * @bound: best score that a segment at or after the given live block
+ *         count and lastmod in the order of @walk can have
+ * @delegate: optional: policy that selects segments on behalf of this
+ *            one in the coming cycle; set by meta policies only
+ * @feedback: optional: reclaim statistics of each cleaning step
  * @policy_data: pointer to policy-specific global state
+ *
+ * With @walk and @bound, the segments are scored in the order of @walk
+ * and the selection stops as soon as @bound tells that no segment left
+ * can beat the candidates held, which picks the same segments as
+ * scoring all of them.
  */
 struct nilfs_cleaning_policy {
 	const char *name;
@@ -49,6 +95,12 @@ struct nilfs_cleaning_policy {
 				int64_t prottime,
 				struct nilfs_segment_candidate *candidate);
 	
+	/* Optional: batch evaluation over flat arrays */
+	void (*evaluate_batch)(struct nilfs_cleaning_policy *policy,
+			       const struct nilfs_policy_env *env, size_t n,
+			       const double *lastmod, const double *live,
+			       double *scores);
+
 	/* Sorting */
 	int (*compare)(const void *elem1, const void *elem2);
 	
@@ -59,6 +111,18 @@ struct nilfs_cleaning_policy {
         int64_t now,
 			  uint64_t *segnums,
         int64_t prottime);
+
+	/* Optional: indexed selection */
+	int walk;
+	double (*bound)(struct nilfs_cleaning_policy *policy,
+			const struct nilfs_policy_env *env,
+			double live, double lastmod);
+
+	/* Optional: meta policies */
+	struct nilfs_cleaning_policy *(*delegate)(
+		struct nilfs_cleaning_policy *policy);
+	void (*feedback)(struct nilfs_cleaning_policy *policy,
+			 const struct nilfs_reclaim_stat *stat);
 	
 	/* Policy-specific state */
 	void *policy_data;
@@ -67,15 +131,21 @@ struct nilfs_cleaning_policy {
 /* Built-in policies */
 extern struct nilfs_cleaning_policy nilfs_policy_timestamp;
 extern struct nilfs_cleaning_policy nilfs_policy_cost_benefit;
+extern struct nilfs_cleaning_policy nilfs_policy_cost_benefit_age;
 extern struct nilfs_cleaning_policy nilfs_policy_greedy;
 extern struct nilfs_cleaning_policy nilfs_policy_hot_cold;
+extern struct nilfs_cleaning_policy nilfs_policy_adaptive;
 
 /* Policy registration */
 int nilfs_register_policy(struct nilfs_cleaning_policy *policy);
 struct nilfs_cleaning_policy *nilfs_get_policy(const char *name);
+struct nilfs_cleaning_policy *nilfs_get_policy_at(int index);
+
+int nilfs_policy_simd_level(void);
 
 int nilfs_get_live_blk(struct nilfs_cleanerd *cleanerd,
                          const struct nilfs_sustat *sustat,
+                         const struct nilfs_suinfo *si,
                          uint64_t segnum, ssize_t *live_blocks);
 
 #endif /* NILFS_CLEANING_POLICY_H */
\ No newline at end of file
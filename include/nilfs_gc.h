@@ -20,7 +20,23 @@
 #define NILFS_RECLAIM_PARAM_PROTSEQ			(1UL << 0)
 #define NILFS_RECLAIM_PARAM_PROTCNO			(1UL << 1)
 #define NILFS_RECLAIM_PARAM_MIN_RECLAIMABLE_BLKS	(1UL << 2)
-#define __NR_NILFS_RECLAIM_PARAMS	3
+#define NILFS_RECLAIM_PARAM_SUMCACHE			(1UL << 3)
+#define NILFS_RECLAIM_PARAM_ORDER			(1UL << 4)
+#define __NR_NILFS_RECLAIM_PARAMS	5
+
+/* order of live blocks handed to the kernel (nilfs_reclaim_params.order) */
+enum nilfs_reclaim_order {
+	NILFS_RECLAIM_ORDER_BLOCKNR = 0,	/* disk block address */
+	NILFS_RECLAIM_ORDER_AGE,		/* birth checkpoint of blocks */
+	NILFS_RECLAIM_ORDER_FILE,		/* inode, checkpoint, offset */
+	__NR_NILFS_RECLAIM_ORDERS
+};
+
+/* flags for nilfs_assess_info struct */
+#define NILFS_ASSESS_INFO_BIRTH				(1UL << 0)
+#define NILFS_ASSESS_INFO_EXPIRE			(1UL << 1)
+
+struct nilfs_sumcache;
 
 /**
  * struct nilfs_reclaim_params - structure to specify GC parameters
@@ -28,12 +44,16 @@
  * @min_reclaimable_blks: minimum number of reclaimable blocks
  * @protseq: start of sequence number of protected segments
  * @protcno: start number of checkpoint to be protected
+ * @sumcache: cache of parsed segment summaries (see sumcache.h)
+ * @order: order in which live blocks are moved (NILFS_RECLAIM_ORDER_*)
  */
 struct nilfs_reclaim_params {
 	unsigned long flags;
 	unsigned long min_reclaimable_blks;
 	uint64_t protseq;
 	nilfs_cno_t protcno;
+	struct nilfs_sumcache *sumcache;
+	int order;
 };
 
 /**
@@ -64,6 +84,21 @@ struct nilfs_reclaim_stat {
 	size_t freed_vblks;
 };
 
+/**
+ * struct nilfs_assess_info - per-segment details of an assessment
+ * @flags: flags of valid fields (NILFS_ASSESS_INFO_*)
+ * @birth_cno: mean checkpoint number at which the live virtual blocks
+ * were written
+ * @expire_cno: smallest end checkpoint of the blocks that are dead but
+ * counted as live because they are still protected; the live block
+ * count drops once the protection checkpoint reaches it
+ */
+struct nilfs_assess_info {
+	unsigned long flags;
+	nilfs_cno_t birth_cno;
+	nilfs_cno_t expire_cno;
+};
+
 int assess_segment_if_dirty(struct nilfs *nilfs,
                             const struct nilfs_sustat *sustat,
                             uint64_t segnum,
@@ -79,6 +114,37 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 			   const struct nilfs_reclaim_params *params,
 			   struct nilfs_reclaim_stat *stat);
 
+struct nilfs_reclaim_batch;
+
+struct nilfs_reclaim_batch *nilfs_reclaim_batch_create(void);
+void nilfs_reclaim_batch_destroy(struct nilfs_reclaim_batch *batch);
+
+int nilfs_prepare_reclaim(struct nilfs *nilfs,
+			  struct nilfs_reclaim_batch *batch,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params);
+
+int nilfs_submit_reclaim(struct nilfs *nilfs,
+			 struct nilfs_reclaim_batch *batch,
+			 const struct nilfs_reclaim_params *params,
+			 uint64_t *segnums, struct nilfs_reclaim_stat *stat);
+
+int nilfs_assess_segments(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  struct nilfs_reclaim_stat *stats);
+
+int nilfs_assess_segments_nolock(struct nilfs *nilfs,
+				 const uint64_t *segnums, size_t nsegs,
+				 const struct nilfs_reclaim_params *params,
+				 struct nilfs_reclaim_stat *stats);
+
+int nilfs_xassess_segments_nolock(struct nilfs *nilfs,
+				  const uint64_t *segnums, size_t nsegs,
+				  const struct nilfs_reclaim_params *params,
+				  struct nilfs_reclaim_stat *stats,
+				  struct nilfs_assess_info *infos);
+
 int nilfs_segment_is_protected(struct nilfs *nilfs, uint64_t segnum,
 			       uint64_t protseq);
 
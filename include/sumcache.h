@@ -0,0 +1,30 @@
+/*
+ * sumcache.h - cache of parsed segment summaries
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ */
+
+#ifndef NILFS_SUMCACHE_H
+#define NILFS_SUMCACHE_H
+
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint64_t, etc */
+#include "vector.h"	/* struct nilfs_vector */
+
+struct nilfs_sumcache;
+
+struct nilfs_sumcache *nilfs_sumcache_create(size_t limit);
+void nilfs_sumcache_destroy(struct nilfs_sumcache *cache);
+void nilfs_sumcache_invalidate(struct nilfs_sumcache *cache, uint64_t segnum);
+int nilfs_sumcache_lookup(struct nilfs_sumcache *cache, uint64_t segnum,
+			  uint64_t seqnum, uint32_t nblocks,
+			  struct nilfs_vector *vdescv,
+			  struct nilfs_vector *bdescv);
+int nilfs_sumcache_insert(struct nilfs_sumcache *cache, uint64_t segnum,
+			  uint64_t seqnum, uint32_t nblocks,
+			  struct nilfs_vector *vdescv, size_t vstart,
+			  struct nilfs_vector *bdescv, size_t bstart);
+
+#endif /* NILFS_SUMCACHE_H */
@@ -11,6 +11,7 @@
 #ifndef NILFS_VECTOR_H
 #define NILFS_VECTOR_H
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
@@ -31,6 +32,19 @@ struct nilfs_vector {
 #define NILFS_VECTOR_INIT_MAXELEMS	256
 #define NILFS_VECTOR_FACTOR		2
 
+/**
+ * struct nilfs_vector_key - unsigned integer sort key in an element
+ * @k_offset: byte offset of the key in the element
+ * @k_size: size of the key (4 or 8 bytes)
+ */
+struct nilfs_vector_key {
+	size_t k_offset;
+	size_t k_size;
+};
+
+#define NILFS_VECTOR_KEY(type, member)					\
+	{ offsetof(type, member), sizeof(((type *)0)->member) }
+
 
 struct nilfs_vector *nilfs_vector_create(size_t elemsize);
 void nilfs_vector_destroy(struct nilfs_vector *vector);
@@ -40,6 +54,11 @@ int nilfs_vector_delete_elements(struct nilfs_vector *vector,
 void *nilfs_vector_insert_elements(struct nilfs_vector *vector,
 				   unsigned int index, size_t nelems);
 void nilfs_vector_clear(struct nilfs_vector *vector);
+int nilfs_vector_sort_keys(struct nilfs_vector *vector,
+			   const struct nilfs_vector_key *keys, int nkeys);
+int nilfs_vector_filter(struct nilfs_vector *vector,
+			int (*filter)(void *prev, void *elem, void *arg),
+			void *arg);
 
 static inline void *nilfs_vector_get_data(const struct nilfs_vector *vector)
 {
@@ -24,11 +24,20 @@ for label, path in csv_files.items():
     if 'util' not in df.columns:
         raise ValueError(f"{path} missing 'util' column")
 
+    # Histograms decoded by "nilfs-telemetry -u" carry a count per
+    # utilization; use the latest one in the file.
+    weights = None
+    if 'count' in df.columns:
+        df = df[df['cycle'] == df['cycle'].max()]
+
     # Exclude zero utilization rows
     df = df[df['util'] > 0]
+    if 'count' in df.columns:
+        weights = df['count']
 
     # Compute histogram (density=True gives fraction of total segments)
-    counts, edges = np.histogram(df['util'], bins=bins, density=True)
+    counts, edges = np.histogram(df['util'], bins=bins, weights=weights,
+                                 density=True)
     centers = (edges[:-1] + edges[1:]) / 2  # bin centers for smooth x-axis
 
     plt.plot(centers, counts, label=label, linewidth=2)
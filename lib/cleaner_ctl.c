@@ -54,6 +54,10 @@
 #include <sys/wait.h>
 #endif	/* HAVE_SYS_WAIT_H */
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif	/* HAVE_SYS_MMAN_H */
+
 #if HAVE_MNTENT_H && HAVE_GETMNTENT_R
 #include <mntent.h>
 #endif  /* HAVE_GETMNT_H && HAVE_GETMNTENT_R */
@@ -71,6 +75,7 @@
 #endif	/* HAVE_POLL_H */
 
 #include <signal.h>
+#include <sched.h>	/* sched_yield() */
 #include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
@@ -94,8 +99,12 @@ struct nilfs_cleaner {
 	mqd_t recvq;
 	char *recvq_name;
 	uuid_t client_uuid;
+	struct nilfs_cleaner_stats_page *stats_page;
+	size_t stats_size;
 };
 
+#define NILFS_CLEANER_STATS_NRETRIES	1000
+
 #ifndef LINE_MAX
 #define LINE_MAX	2048
 #endif	/* LINE_MAX */
@@ -279,6 +288,25 @@ abort:
 	return -1;
 }
 
+/**
+ * nilfs_cleaner_ipc_name - make the name of an ipc object of cleanerd
+ * @cleaner: cleaner object
+ * @prefix: prefix of the name (NILFS_CLEANER_*_PREFIX)
+ * @buf: buffer to store the name
+ * @size: size of @buf
+ */
+static int nilfs_cleaner_ipc_name(const struct nilfs_cleaner *cleaner,
+				  const char *prefix, char *buf, size_t size)
+{
+	if (cleaner->dev_ino == 0)
+		return snprintf(buf, size, "%s-%llu", prefix,
+				(unsigned long long)cleaner->dev_id);
+
+	return snprintf(buf, size, "%s-%llu-%llu", prefix,
+			(unsigned long long)cleaner->dev_id,
+			(unsigned long long)cleaner->dev_ino);
+}
+
 static int nilfs_cleaner_open_queue(struct nilfs_cleaner *cleaner)
 {
 	char nambuf[NAME_MAX - 4];
@@ -293,7 +321,8 @@ static int nilfs_cleaner_open_queue(struct nilfs_cleaner *cleaner)
 	uuid_unparse_lower(cleaner->client_uuid, uuidbuf);
 
 	/* receive queue */
-	ret = snprintf(nambuf, sizeof(nambuf), "/nilfs-cleanerq-%s", uuidbuf);
+	ret = snprintf(nambuf, sizeof(nambuf), NILFS_CLEANER_QUEUE_PREFIX "-%s",
+		       uuidbuf);
 	if (unlikely(ret < 0))
 		goto error;
 
@@ -312,16 +341,8 @@ static int nilfs_cleaner_open_queue(struct nilfs_cleaner *cleaner)
 		goto abort;
 	}
 	/* send queue */
-	if (cleaner->dev_ino == 0) {
-		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu",
-			       (unsigned long long)cleaner->dev_id);
-	} else {
-		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu-%llu",
-			       (unsigned long long)cleaner->dev_id,
-			       (unsigned long long)cleaner->dev_ino);
-	}
+	ret = nilfs_cleaner_ipc_name(cleaner, NILFS_CLEANER_QUEUE_PREFIX,
+				     nambuf, sizeof(nambuf));
 	if (unlikely(ret < 0))
 		goto error;
 
@@ -473,8 +494,18 @@ const char *nilfs_cleaner_device(const struct nilfs_cleaner *cleaner)
 	return cleaner->device;
 }
 
+static void nilfs_cleaner_unmap_stats(struct nilfs_cleaner *cleaner)
+{
+	if (cleaner->stats_page) {
+		munmap(cleaner->stats_page, cleaner->stats_size);
+		cleaner->stats_page = NULL;
+		cleaner->stats_size = 0;
+	}
+}
+
 void nilfs_cleaner_close(struct nilfs_cleaner *cleaner)
 {
+	nilfs_cleaner_unmap_stats(cleaner);
 	nilfs_cleaner_close_queue(cleaner);
 	free(cleaner->device);
 	free(cleaner->mountdir);
@@ -847,3 +878,101 @@ int nilfs_cleaner_shutdown(struct nilfs_cleaner *cleaner)
 {
 	return nilfs_cleaner_command(cleaner, NILFS_CLEANER_CMD_SHUTDOWN);
 }
+
+/**
+ * nilfs_cleaner_map_stats - map the statistics page of cleanerd
+ * @cleaner: cleaner object
+ */
+static int nilfs_cleaner_map_stats(struct nilfs_cleaner *cleaner)
+{
+	struct nilfs_cleaner_stats_page *page;
+	char nambuf[NAME_MAX - 4];
+	struct stat stbuf;
+	int fd, ret;
+
+	ret = nilfs_cleaner_ipc_name(cleaner, NILFS_CLEANER_STATS_PREFIX,
+				     nambuf, sizeof(nambuf));
+	if (unlikely(ret < 0))
+		return -1;
+
+	assert(ret < sizeof(nambuf));
+
+	fd = shm_open(nambuf, O_RDONLY, 0);
+	if (unlikely(fd < 0))
+		return -1;
+
+	ret = fstat(fd, &stbuf);
+	if (unlikely(ret < 0))
+		goto out_fd;
+
+	ret = -1;
+	if (unlikely(stbuf.st_size <
+		     offsetof(struct nilfs_cleaner_stats_page, stats))) {
+		errno = EPROTO;
+		goto out_fd;
+	}
+
+	page = mmap(NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (unlikely(page == MAP_FAILED))
+		goto out_fd;
+
+	if (unlikely(page->magic != NILFS_CLEANER_STATS_MAGIC ||
+		     page->version != NILFS_CLEANER_STATS_VERSION ||
+		     offsetof(struct nilfs_cleaner_stats_page, stats) +
+		     page->size > stbuf.st_size)) {
+		munmap(page, stbuf.st_size);
+		errno = EPROTO;
+		goto out_fd;
+	}
+
+	cleaner->stats_page = page;
+	cleaner->stats_size = stbuf.st_size;
+	ret = 0;
+out_fd:
+	close(fd);
+	return ret;
+}
+
+/**
+ * nilfs_cleaner_get_stats - read statistics published by cleanerd
+ * @cleaner: cleaner object
+ * @stats: buffer to store the statistics
+ *
+ * This reads the shared statistics page of cleanerd without sending a
+ * request, so it does not need the queue and is cheap enough to poll.
+ * Members unknown to the running cleanerd are zero.
+ */
+int nilfs_cleaner_get_stats(struct nilfs_cleaner *cleaner,
+			    struct nilfs_cleaner_stats *stats)
+{
+	const struct nilfs_cleaner_stats_page *page;
+	uint32_t seq;
+	size_t size;
+	int i;
+
+	/* a restarted cleanerd publishes a new page */
+	if (cleaner->stats_page &&
+	    kill(cleaner->stats_page->pid, 0) < 0 && errno == ESRCH)
+		nilfs_cleaner_unmap_stats(cleaner);
+
+	if (!cleaner->stats_page && nilfs_cleaner_map_stats(cleaner) < 0)
+		return -1;
+
+	page = cleaner->stats_page;
+	size = min_t(size_t, page->size, sizeof(*stats));
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < NILFS_CLEANER_STATS_NRETRIES; i++) {
+		seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(stats, &page->stats, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq)
+			return 0;
+	}
+	errno = EAGAIN;
+	return -1;
+}
@@ -139,7 +139,8 @@ static int nilfs_enum_cpinfo_forward(struct nilfs *nilfs,
 						void *),
 				     void *ctx)
 {
-	const size_t _NCPINFO = 512;
+	const size_t _NCPINFO =
+		nilfs_get_ioctl_batch(nilfs, NILFS_IOCTL_BATCH_CPINFO);
 	struct nilfs_cpinfo *cpibuf, *cpi;
 	nilfs_cno_t sidx; /* start index (inclusive) */
 	uint64_t rest;
@@ -214,7 +215,8 @@ static int nilfs_enum_cpinfo_backward(struct nilfs *nilfs,
 				      void *ctx)
 {
 	const size_t _MINDELTA = 64;	/* Minimum delta for backward search */
-	const size_t _NCPINFO = 512;
+	const size_t _NCPINFO =
+		nilfs_get_ioctl_batch(nilfs, NILFS_IOCTL_BATCH_CPINFO);
 	struct nilfs_cpinfo *cpibuf, *cpi;
 	nilfs_cno_t sidx; /* start index (inclusive) */
 	nilfs_cno_t eidx; /* end index (exclusive) */
@@ -901,3 +903,31 @@ int nilfs_cnormap_track_back(struct nilfs_cnormap *cnormap, uint64_t period,
 out:
 	return ret;
 }
+
+/**
+ * nilfs_cnormap_cno_to_time - get the time a checkpoint was created
+ * @cnormap: nilfs_cnormap struct
+ * @cno: checkpoint number
+ * @timep: buffer to store resultant time
+ *
+ * If checkpoint @cno has been deleted, the creation time of the next
+ * checkpoint still present is given, which is the closest bound that is
+ * left.  If there is none, the current time is given.
+ */
+int nilfs_cnormap_cno_to_time(struct nilfs_cnormap *cnormap, nilfs_cno_t cno,
+			      int64_t *timep)
+{
+	struct nilfs_cpinfo cpinfo;
+	ssize_t n;
+
+	n = nilfs_get_cpinfo(cnormap->nilfs, max_t(nilfs_cno_t, cno,
+						   NILFS_CNO_MIN),
+			     NILFS_CHECKPOINT, &cpinfo, 1);
+	if (unlikely(n < 0))
+		return -1;
+	if (n == 0)
+		return nilfs_cnormap_get_realtime_clock(cnormap, timep);
+
+	*timep = cpinfo.ci_create;
+	return 0;
+}
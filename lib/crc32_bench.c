@@ -0,0 +1,99 @@
+/*
+ * crc32_bench.c - measure the throughput of the crc32 implementations
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ *
+ * Usage: crc32_bench [size]...
+ *
+ * Each implementation checksums a buffer of every given size (in bytes;
+ * by default the sizes of a segment summary, a block and a segment) for
+ * about a fixed amount of data, and the throughput is printed in MB/s.
+ */
+
+#include "crc32.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CRC32_BENCH_TOTAL	(256UL << 20)	/* bytes per measurement */
+
+static double crc32_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void crc32_bench_one(const char *name,
+			    uint32_t (*fn)(uint32_t, const unsigned char *,
+					   size_t),
+			    const unsigned char *buf, size_t size)
+{
+	unsigned long i, n = CRC32_BENCH_TOTAL / size + 1;
+	volatile uint32_t sink;
+	uint32_t crc = 0;
+	double start, elapsed;
+
+	start = crc32_bench_now();
+	for (i = 0; i < n; i++)
+		crc = fn(crc, buf, size);
+	elapsed = crc32_bench_now() - start;
+	sink = crc;
+	(void)sink;
+
+	printf("%-10s %10zu %12.1f\n", name, size,
+	       (double)n * size / elapsed / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t defaults[] = { 512, 4096, 8 << 20 };
+	size_t sizes[64], nsizes = 0, maxsize = 0, i;
+	unsigned char *buf;
+	char *endptr;
+	int j;
+
+	for (j = 1; j < argc && nsizes < 64; j++) {
+		sizes[nsizes] = strtoul(argv[j], &endptr, 0);
+		if (*endptr != '\0' || sizes[nsizes] == 0) {
+			fprintf(stderr, "%s: invalid size: %s\n", argv[0],
+				argv[j]);
+			return EXIT_FAILURE;
+		}
+		nsizes++;
+	}
+	if (nsizes == 0) {
+		memcpy(sizes, defaults, sizeof(defaults));
+		nsizes = sizeof(defaults) / sizeof(defaults[0]);
+	}
+	for (i = 0; i < nsizes; i++)
+		if (sizes[i] > maxsize)
+			maxsize = sizes[i];
+
+	buf = malloc(maxsize);
+	if (!buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < maxsize; i++)
+		buf[i] = i * 131 + 7;
+
+	printf("%-10s %10s %12s\n", "impl", "size", "MB/s");
+	for (i = 0; i < nsizes; i++) {
+		crc32_bench_one("bytes", crc32_le_bytes, buf, sizes[i]);
+		crc32_bench_one("slice8", crc32_le_slice8, buf, sizes[i]);
+#ifdef CRC32_X86_PCLMUL
+		if (__builtin_cpu_supports("pclmul"))
+			crc32_bench_one("pclmul", crc32_le_pclmul, buf,
+					sizes[i]);
+#endif
+		crc32_bench_one("crc32_le", crc32_le, buf, sizes[i]);
+	}
+	free(buf);
+	return EXIT_SUCCESS;
+}
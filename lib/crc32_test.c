@@ -0,0 +1,105 @@
+/*
+ * crc32_test.c - check the crc32 implementations against each other
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ *
+ * The byte-at-a-time loop over crc32tab is the original implementation
+ * and serves as the reference.  Slicing-by-8, the PCLMULQDQ folding (if
+ * the CPU supports it) and the dispatcher behind crc32_le() must agree
+ * with it bit for bit for every length and alignment, since checksums
+ * stored on disk are verified with whichever one is picked at run time.
+ */
+
+#include "crc32.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CRC32_TEST_BUFSIZE	(70000 + 64)
+
+static int nfailures;
+
+static void crc32_test_fill(unsigned char *buf, size_t size)
+{
+	uint32_t x = 0x2545f491;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x >> 24;
+	}
+}
+
+static void crc32_test_one(const char *name,
+			   uint32_t (*fn)(uint32_t, const unsigned char *,
+					  size_t),
+			   uint32_t seed, const unsigned char *p, size_t len,
+			   size_t align)
+{
+	uint32_t want = crc32_le_bytes(seed, p, len);
+	uint32_t got = fn(seed, p, len);
+
+	if (got == want)
+		return;
+	if (nfailures++ < 20)
+		fprintf(stderr,
+			"%s: seed %08x len %zu align %zu: got %08x, want %08x\n",
+			name, seed, len, align, got, want);
+}
+
+static void crc32_test_all(uint32_t seed, const unsigned char *p,
+			   size_t len, size_t align)
+{
+	crc32_test_one("slice8", crc32_le_slice8, seed, p, len, align);
+#ifdef CRC32_X86_PCLMUL
+	if (__builtin_cpu_supports("pclmul"))
+		crc32_test_one("pclmul", crc32_le_pclmul, seed, p, len,
+			       align);
+#endif
+	crc32_test_one("crc32_le", crc32_le, seed, p, len, align);
+}
+
+int main(void)
+{
+	static const uint32_t seeds[] = { 0, ~0U, 0x12345678 };
+	static const size_t large[] = { 4096, 4096 + 13, 65536, 70000 };
+	const unsigned char check[] = "123456789";
+	unsigned char *buf;
+	size_t s, len, align, i;
+
+	/* the standard check value of CRC-32 */
+	if ((crc32_le_bytes(~0U, check, 9) ^ ~0U) != 0xcbf43926) {
+		fprintf(stderr, "reference: wrong check value\n");
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc(CRC32_TEST_BUFSIZE);
+	if (!buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	crc32_test_fill(buf, CRC32_TEST_BUFSIZE);
+
+	for (s = 0; s < sizeof(seeds) / sizeof(seeds[0]); s++) {
+		for (align = 0; align < 16; align++) {
+			for (len = 0; len <= 1100; len++)
+				crc32_test_all(seeds[s], buf + align, len,
+					       align);
+			for (i = 0; i < sizeof(large) / sizeof(large[0]); i++)
+				crc32_test_all(seeds[s], buf + align,
+					       large[i], align);
+		}
+	}
+	free(buf);
+
+	if (nfailures) {
+		fprintf(stderr, "%d mismatches\n", nfailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -41,10 +41,10 @@
 #include "segment.h"
 #include "vector.h"
 #include "nilfs_gc.h"
+#include "sumcache.h"
 
-#define NILFS_GC_NBDESCS	512
-#define NILFS_GC_NVINFO	512
-#define NILFS_GC_NCPINFO	512
+#define NILFS_GC_NASSESS	64	/* segments accumulated at once */
+#define NILFS_GC_NSEGREAD	16	/* segments read at once */
 
 
 static void default_logger(int priority, const char *fmt, ...)
@@ -74,6 +74,31 @@ static int nilfs_comp_vdesc_vblocknr(const void *elem1, const void *elem2)
 	return (vdesc1->vd_vblocknr < vdesc2->vd_vblocknr) ? -1 : 1;
 }
 
+static int nilfs_comp_vdesc_age(const void *elem1, const void *elem2)
+{
+	const struct nilfs_vdesc *vdesc1 = elem1, *vdesc2 = elem2;
+
+	if (vdesc1->vd_period.p_start != vdesc2->vd_period.p_start)
+		return (vdesc1->vd_period.p_start <
+			vdesc2->vd_period.p_start) ? -1 : 1;
+	if (vdesc1->vd_ino != vdesc2->vd_ino)
+		return (vdesc1->vd_ino < vdesc2->vd_ino) ? -1 : 1;
+	if (vdesc1->vd_cno != vdesc2->vd_cno)
+		return (vdesc1->vd_cno < vdesc2->vd_cno) ? -1 : 1;
+	return (vdesc1->vd_blocknr < vdesc2->vd_blocknr) ? -1 : 1;
+}
+
+static int nilfs_comp_vdesc_file(const void *elem1, const void *elem2)
+{
+	const struct nilfs_vdesc *vdesc1 = elem1, *vdesc2 = elem2;
+
+	if (vdesc1->vd_ino != vdesc2->vd_ino)
+		return (vdesc1->vd_ino < vdesc2->vd_ino) ? -1 : 1;
+	if (vdesc1->vd_cno != vdesc2->vd_cno)
+		return (vdesc1->vd_cno < vdesc2->vd_cno) ? -1 : 1;
+	return (vdesc1->vd_offset < vdesc2->vd_offset) ? -1 : 1;
+}
+
 static int nilfs_comp_period(const void *elem1, const void *elem2)
 {
 	const struct nilfs_period *period1 = elem1, *period2 = elem2;
@@ -82,6 +107,37 @@ static int nilfs_comp_period(const void *elem1, const void *elem2)
 		(period1->p_start == period2->p_start) ? 0 : 1;
 }
 
+static const struct nilfs_vector_key nilfs_vdesc_blocknr_key[] = {
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_blocknr),
+};
+
+static const struct nilfs_vector_key nilfs_vdesc_vblocknr_key[] = {
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_vblocknr),
+};
+
+static const struct nilfs_vector_key nilfs_vdesc_age_keys[] = {
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_period.p_start),
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_ino),
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_cno),
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_blocknr),
+};
+
+static const struct nilfs_vector_key nilfs_vdesc_file_keys[] = {
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_ino),
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_cno),
+	NILFS_VECTOR_KEY(struct nilfs_vdesc, vd_offset),
+};
+
+static const struct nilfs_vector_key nilfs_period_key[] = {
+	NILFS_VECTOR_KEY(struct nilfs_period, p_start),
+};
+
+static const struct nilfs_vector_key nilfs_bdesc_keys[] = {
+	NILFS_VECTOR_KEY(struct nilfs_bdesc, bd_ino),
+	NILFS_VECTOR_KEY(struct nilfs_bdesc, bd_level),
+	NILFS_VECTOR_KEY(struct nilfs_bdesc, bd_offset),
+};
+
 static int nilfs_comp_bdesc(const void *elem1, const void *elem2)
 {
 	const struct nilfs_bdesc *bdesc1 = elem1, *bdesc2 = elem2;
@@ -125,7 +181,6 @@ int assess_segment_if_dirty(struct nilfs *nilfs,
 {
     struct nilfs_suinfo si;
     struct nilfs_reclaim_params params;
-    uint64_t segnums[1];
     int ret;
 
     // Fetch segment usage info
@@ -145,9 +200,7 @@ int assess_segment_if_dirty(struct nilfs *nilfs,
     params.protcno = protcno;
 
     // Assess segment
-    memset(stat, 0, sizeof(*stat));
-    segnums[0] = segnum;
-    ret = nilfs_assess_segment(nilfs, segnums, 1, &params, stat);
+    ret = nilfs_assess_segments_nolock(nilfs, &segnum, 1, &params, stat);
 
     if (ret < 0) {
         fprintf(stderr, "Error assessing segment %lu\n", segnum);
@@ -282,6 +335,64 @@ static int nilfs_acc_blocks_segment(const struct nilfs_segment *segment,
 	return 0;
 }
 
+/**
+ * nilfs_reclaim_sumcache - get the summary cache given to reclaim functions
+ * @params: reclaim parameters
+ */
+static inline struct nilfs_sumcache *
+nilfs_reclaim_sumcache(const struct nilfs_reclaim_params *params)
+{
+	return (params->flags & NILFS_RECLAIM_PARAM_SUMCACHE) ?
+		params->sumcache : NULL;
+}
+
+/**
+ * nilfs_acc_blocks_cached - collect summary of blocks from the cache
+ * @nilfs: nilfs object
+ * @cache: summary cache (optional)
+ * @segnum: segment number
+ * @nblocks: size of valid logs in the segment (per block)
+ * @protseq: start of sequence number of protected segments
+ * @seqnum: place to store the sequence number of the segment
+ * @vdescv: vector object to store (descriptors of) virtual block numbers
+ * @bdescv: vector object to store (descriptors of) disk block numbers
+ *
+ * With a cache, the sequence number is read from the head of the
+ * segment first; it tells whether the segment is protected, and whether
+ * the cached descriptors of the segment, if any, are still valid.
+ *
+ * Return: 1 if the summaries of the segment need not be read, either
+ * because the segment is protected or because its descriptors were
+ * taken from @cache, 0 if they have to be read, or -1 on error.
+ * @seqnum is only set in the first case.
+ */
+static int nilfs_acc_blocks_cached(struct nilfs *nilfs,
+				   struct nilfs_sumcache *cache,
+				   uint64_t segnum, uint32_t nblocks,
+				   uint64_t protseq, uint64_t *seqnum,
+				   struct nilfs_vector *vdescv,
+				   struct nilfs_vector *bdescv)
+{
+	uint64_t sn;
+	int ret;
+
+	if (cache == NULL)
+		return 0;
+
+	ret = nilfs_get_segment_seqnum(nilfs, segnum, &sn);
+	if (unlikely(ret < 0))
+		return -1;
+
+	if (!cnt64_ge(sn, protseq)) {
+		ret = nilfs_sumcache_lookup(cache, segnum, sn, nblocks,
+					    vdescv, bdescv);
+		if (ret <= 0)
+			return ret;
+	}
+	*seqnum = sn;
+	return 1;
+}
+
 /**
  * nilfs_deselect_segment - deselect a segment
  * @segnums: array of selected segments
@@ -302,69 +413,148 @@ static ssize_t nilfs_deselect_segment(uint64_t *segnums, size_t nsegs, int nr)
 	return nsegs - 1;
 }
 
+/**
+ * struct nilfs_reclaim_seg - state of a segment selected to be reclaimed
+ * @segnum: segment number
+ * @seqnum: sequence number of the segment (0 if its summary was not read)
+ * @lastmod: last modified time of the segment
+ * @nblocks: number of blocks in the segment
+ */
+struct nilfs_reclaim_seg {
+	uint64_t segnum;
+	uint64_t seqnum;
+	int64_t lastmod;
+	uint32_t nblocks;
+};
+
 /**
  * nilfs_acc_blocks - collect summary of blocks contained in segments
  * @nilfs: nilfs object
  * @segnums: array of selected segments
  * @nsegs: size of @segnums array
  * @protseq: start of sequence number of protected segments
+ * @cache: summary cache (optional)
  * @vdescv: vector object to store (descriptors of) virtual block numbers
  * @bdescv: vector object to store (descriptors of) disk block numbers
+ * @segv: vector object to store state of selected segments (optional)
  */
 static ssize_t nilfs_acc_blocks(struct nilfs *nilfs,
 				uint64_t *segnums, size_t nsegs,
 				uint64_t protseq,
+				struct nilfs_sumcache *cache,
 				struct nilfs_vector *vdescv,
-				struct nilfs_vector *bdescv)
+				struct nilfs_vector *bdescv,
+				struct nilfs_vector *segv)
 {
-	struct nilfs_suinfo si;
-	struct nilfs_segment segment;
+	struct nilfs_suinfo si[NILFS_GC_NSEGREAD];
+	struct nilfs_segment segments[NILFS_GC_NSEGREAD];
+	uint64_t readv[NILFS_GC_NSEGREAD], seqv[NILFS_GC_NSEGREAD];
+	int slot[NILFS_GC_NSEGREAD];
+	struct nilfs_reclaim_seg *seg;
+	size_t vstart, bstart;
+	uint64_t seqnum;
+	size_t count, nread, k;
 	int ret, i = 0;
 	ssize_t n = nsegs;
 
 	while (i < n) {
-		ret = nilfs_get_suinfo(nilfs, segnums[i], &si, 1);
+		/* read the summaries of the next segments at once */
+		count = min_t(size_t, n - i, NILFS_GC_NSEGREAD);
+		nread = 0;
+		for (k = 0; k < count; k++) {
+			ret = nilfs_get_suinfo(nilfs, segnums[i + k], &si[k], 1);
+			if (unlikely(ret < 0))
+				return -1;
+			slot[k] = -1;
+			seqv[k] = 0;
+			if (!nilfs_suinfo_reclaimable(&si[k]) ||
+			    nilfs_suinfo_empty(&si[k]))
+				continue;
+
+			ret = nilfs_acc_blocks_cached(nilfs, cache,
+						      segnums[i + k],
+						      si[k].sui_nblocks,
+						      protseq, &seqv[k],
+						      vdescv, bdescv);
+			if (unlikely(ret < 0))
+				return -1;
+			if (ret > 0) {
+				slot[k] = -2;	/* no need to read */
+				continue;
+			}
+			readv[nread] = segnums[i + k];
+			slot[k] = nread++;
+		}
+		ret = nilfs_get_segment_summaries(nilfs, readv, nread,
+						  segments);
 		if (unlikely(ret < 0))
 			return -1;
 
-		if (!nilfs_suinfo_reclaimable(&si)) {
-			/*
-			 * Recheck status of the segment and drop it
-			 * if not reclaimable.  This prevents the
-			 * target segments from being cleaned twice or
-			 * more by duplicate cleaner daemons.
-			 */
-			n = nilfs_deselect_segment(segnums, n, i);
-			continue;
-		}
-
-		if (nilfs_suinfo_empty(&si)) {
-			/*
-			 * "Scrapped" segment - the information in the segment
-			 * summary is not valid because it's unwritten.
-			 * Make it subject to reclaim without comparing
-			 * sequence numbers.
-			 */
-			i++;
-			continue;
-		}
+		/*
+		 * Deselecting segnums[i] shifts the following segments
+		 * down, so segnums[i] is always the k-th segment here.
+		 */
+		for (k = 0; k < count; k++) {
+			if (!nilfs_suinfo_reclaimable(&si[k])) {
+				/*
+				 * Recheck status of the segment and drop it
+				 * if not reclaimable.  This prevents the
+				 * target segments from being cleaned twice or
+				 * more by duplicate cleaner daemons.
+				 */
+				n = nilfs_deselect_segment(segnums, n, i);
+				continue;
+			}
 
-		ret = nilfs_get_segment(nilfs, segnums[i], &segment);
-		if (unlikely(ret < 0))
-			return -1;
+			if (slot[k] == -1) {
+				/*
+				 * "Scrapped" segment - the information in the
+				 * segment summary is not valid because it's
+				 * unwritten.  Make it subject to reclaim
+				 * without comparing sequence numbers.
+				 */
+				seqnum = 0;
+				goto selected;
+			}
 
-		if (cnt64_ge(segment.seqnum, protseq)) {
-			n = nilfs_deselect_segment(segnums, n, i);
-			ret = nilfs_put_segment(&segment);
+			seqnum = slot[k] >= 0 ? segments[slot[k]].seqnum :
+				seqv[k];
+			if (cnt64_ge(seqnum, protseq)) {
+				n = nilfs_deselect_segment(segnums, n, i);
+				continue;
+			}
+			if (slot[k] < 0)
+				goto selected;	/* taken from the cache */
+
+			vstart = nilfs_vector_get_size(vdescv);
+			bstart = nilfs_vector_get_size(bdescv);
+			ret = nilfs_acc_blocks_segment(&segments[slot[k]],
+						       si[k].sui_nblocks,
+						       vdescv, bdescv);
 			if (unlikely(ret < 0))
-				return -1;
-			continue;
+				break;
+			if (cache)
+				nilfs_sumcache_insert(cache, segnums[i], seqnum,
+						      si[k].sui_nblocks,
+						      vdescv, vstart,
+						      bdescv, bstart);
+selected:
+			if (segv) {
+				seg = nilfs_vector_get_new_element(segv);
+				if (unlikely(!seg)) {
+					ret = -1;
+					break;
+				}
+				seg->segnum = segnums[i];
+				seg->seqnum = seqnum;
+				seg->lastmod = si[k].sui_lastmod;
+				seg->nblocks = si[k].sui_nblocks;
+			}
+			i++;
 		}
-		ret = nilfs_acc_blocks_segment(&segment, si.sui_nblocks,
-					       vdescv, bdescv);
-		if (unlikely(nilfs_put_segment(&segment) < 0 || ret < 0))
+		if (unlikely(nilfs_put_segments(segments, nread) < 0 ||
+			     ret < 0))
 			return -1;
-		i++;
 	}
 	return n;
 }
@@ -377,24 +567,36 @@ static ssize_t nilfs_acc_blocks(struct nilfs *nilfs,
 static int nilfs_get_vdesc(struct nilfs *nilfs, struct nilfs_vector *vdescv)
 {
 	struct nilfs_vdesc *vdesc;
-	struct nilfs_vinfo vinfo[NILFS_GC_NVINFO];
+	struct nilfs_vinfo *vinfo = NULL;
+	size_t nvinfo = 0, count;
 	ssize_t n;
-	int i, j;
+	int i, j, ret = -1;
 
-	nilfs_vector_sort(vdescv, nilfs_comp_vdesc_vblocknr);
+	if (nilfs_vector_sort_keys(vdescv, nilfs_vdesc_vblocknr_key,
+				   ARRAY_SIZE(nilfs_vdesc_vblocknr_key)) < 0)
+		nilfs_vector_sort(vdescv, nilfs_comp_vdesc_vblocknr);
 
 	for (i = 0; i < nilfs_vector_get_size(vdescv); i += n) {
-		for (j = 0;
-		     (j < NILFS_GC_NVINFO) &&
-			     (i + j < nilfs_vector_get_size(vdescv));
-		     j++) {
+		/* the batch size may change between calls */
+		count = min_t(size_t, nilfs_vector_get_size(vdescv) - i,
+			      nilfs_get_ioctl_batch(nilfs,
+						    NILFS_IOCTL_BATCH_VINFO));
+		if (count > nvinfo) {
+			void *p = realloc(vinfo, sizeof(*vinfo) * count);
+
+			if (unlikely(p == NULL))
+				goto out;
+			vinfo = p;
+			nvinfo = count;
+		}
+		for (j = 0; j < count; j++) {
 			vdesc = nilfs_vector_get_element(vdescv, i + j);
 			assert(vdesc != NULL);
 			vinfo[j].vi_vblocknr = vdesc->vd_vblocknr;
 		}
-		n = nilfs_get_vinfo(nilfs, vinfo, j);
+		n = nilfs_get_vinfo(nilfs, vinfo, count);
 		if (unlikely(n < 0))
-			return -1;
+			goto out;
 		for (j = 0; j < n; j++) {
 			vdesc = nilfs_vector_get_element(vdescv, i + j);
 			assert((vdesc != NULL) &&
@@ -403,85 +605,176 @@ static int nilfs_get_vdesc(struct nilfs *nilfs, struct nilfs_vector *vdescv)
 			vdesc->vd_period.p_end = vinfo[j].vi_end;
 		}
 	}
-
-	return 0;
+	ret = 0;
+out:
+	free(vinfo);
+	return ret;
 }
 
 /**
  * nilfs_get_snapshot - get checkpoint numbers of snapshots
  * @nilfs: nilfs object
+ * @refresh: flag to bypass the snapshot list cached in @nilfs
  * @ssp: pointer to store array of checkpoint numbers which are snapshots
  */
-static ssize_t nilfs_get_snapshot(struct nilfs *nilfs, nilfs_cno_t **ssp)
+static ssize_t nilfs_get_snapshot(struct nilfs *nilfs, int refresh,
+				  const nilfs_cno_t **ssp)
 {
-	struct nilfs_cpstat cpstat;
-	struct nilfs_cpinfo cpinfo[NILFS_GC_NCPINFO];
-	nilfs_cno_t cno, *ss, prev = 0;
-	ssize_t n;
-	uint64_t nss = 0;
-	int i, j;
-	int ret;
-
-	ret = nilfs_get_cpstat(nilfs, &cpstat);
-	if (unlikely(ret < 0))
-		return -1;
-	if (cpstat.cs_nsss == 0)
-		return 0;
+	uint64_t nsss;
+	ssize_t nss;
+
+	nss = nilfs_get_snapshot_list(nilfs, refresh, ssp, &nsss);
+	if (unlikely(nss < 0)) {
+		if (errno == EIO)
+			nilfs_gc_logger(LOG_ERR,
+					"broken snapshot information. snapshot numbers appeared in a non-ascending order");
+	} else if (unlikely(nss != nsss)) {
+		nilfs_gc_logger(LOG_WARNING,
+				"snapshot count mismatch: %llu != %llu",
+				(unsigned long long)nsss,
+				(unsigned long long)nss);
+	}
+	return nss;
+}
 
-	ss = malloc(sizeof(*ss) * cpstat.cs_nsss);
-	if (unlikely(ss == NULL))
-		return -1;
+/**
+ * nilfs_snapshot_lower_bound - find the first snapshot not below a cno
+ * @ss: checkpoint numbers of snapshots in ascending order
+ * @n: size of @ss array (> 0)
+ * @cno: checkpoint number
+ *
+ * This is a binary search whose loop body compiles to a conditional
+ * move, so it does not suffer from mispredicted branches.
+ */
+static inline size_t nilfs_snapshot_lower_bound(const nilfs_cno_t *ss,
+						size_t n, nilfs_cno_t cno)
+{
+	const nilfs_cno_t *base = ss;
+	size_t half;
 
-	cno = 0;
-	for (i = 0; i < cpstat.cs_nsss; i += n) {
-		n = nilfs_get_cpinfo(nilfs, cno, NILFS_SNAPSHOT, cpinfo,
-				     NILFS_GC_NCPINFO);
-		if (unlikely(n < 0)) {
-			free(ss);
-			return -1;
-		}
-		if (n == 0)
-			break;
-		for (j = 0; j < n; j++) {
-			ss[i + j] = cpinfo[j].ci_cno;
-			if (prev >= ss[i + j]) {
-				nilfs_gc_logger(LOG_ERR,
-						"broken snapshot information. snapshot numbers appeared in a non-ascending order: %llu >= %llu",
-						(unsigned long long)prev,
-						(unsigned long long)ss[i + j]);
-				free(ss);
-				errno = EIO;
-				return -1;
-			}
-			prev = ss[i + j];
-		}
-		nss += n;
-		cno = cpinfo[n - 1].ci_next;
-		if (cno == 0)
-			break;
+	while (n > 1) {
+		half = n / 2;
+		base = (base[half - 1] < cno) ? base + half : base;
+		n -= half;
 	}
-	if (unlikely(cpstat.cs_nsss != nss))
-		nilfs_gc_logger
-			(LOG_WARNING, "snapshot count mismatch: %llu != %llu",
-			 (unsigned long long)cpstat.cs_nsss,
-			 (unsigned long long)nss);
-	*ssp = ss;
-	return nss;
+	return (base - ss) + (*base < cno);
+}
+
+/* below this number of snapshots, search the list without an index */
+#define NILFS_SNAPSHOT_INDEX_MIN	16
+
+/**
+ * struct nilfs_snapshot_index - snapshot list bucketed by checkpoint number
+ * @ss: checkpoint numbers of snapshots in ascending order
+ * @nss: size of @ss array
+ * @base: checkpoint number of the first snapshot
+ * @shift: each bucket covers 2^@shift checkpoint numbers from @base on
+ * @nbuckets: number of buckets, or 0 if the list is not indexed
+ * @buckets: index in @ss of the first snapshot of each bucket, followed
+ *           by @nss
+ */
+struct nilfs_snapshot_index {
+	const nilfs_cno_t *ss;
+	size_t nss;
+	nilfs_cno_t base;
+	unsigned int shift;
+	size_t nbuckets;
+	size_t *buckets;
+};
+
+/**
+ * nilfs_snapshot_index_init - index snapshots for lookups by checkpoint
+ * @ssi: snapshot index
+ * @ss: checkpoint numbers of snapshots in ascending order
+ * @nss: size of @ss array
+ *
+ * The checkpoint numbers from the first to the last snapshot are split
+ * into buckets of equal power-of-two width, no more than there are
+ * snapshots, so that a lookup only searches the snapshots of a single
+ * bucket.  Unless snapshots come in bursts, that is one or two of them
+ * instead of log2(@nss) dependent loads from all over the list.  If the
+ * buckets cannot be allocated, lookups search the whole list.
+ */
+static void nilfs_snapshot_index_init(struct nilfs_snapshot_index *ssi,
+				      const nilfs_cno_t *ss, size_t nss)
+{
+	nilfs_cno_t range;
+	size_t i, b;
+
+	ssi->ss = ss;
+	ssi->nss = nss;
+	ssi->nbuckets = 0;
+	ssi->buckets = NULL;
+	if (nss < NILFS_SNAPSHOT_INDEX_MIN)
+		return;
+
+	ssi->base = ss[0];
+	range = ss[nss - 1] - ss[0];
+	for (ssi->shift = 0; (range >> ssi->shift) >= nss; ssi->shift++)
+		;
+	b = (range >> ssi->shift) + 1;
+	ssi->buckets = malloc(sizeof(*ssi->buckets) * (b + 1));
+	if (unlikely(!ssi->buckets))
+		return;
+	ssi->nbuckets = b;
+
+	for (i = 0, b = 0; i < nss; i++)
+		while (b <= ((ss[i] - ssi->base) >> ssi->shift))
+			ssi->buckets[b++] = i;
+	ssi->buckets[b] = nss;
+}
+
+static void nilfs_snapshot_index_destroy(struct nilfs_snapshot_index *ssi)
+{
+	free(ssi->buckets);
+}
+
+/**
+ * nilfs_snapshot_index_lookup - find the first snapshot not below a cno
+ * @ssi: snapshot index
+ * @cno: checkpoint number
+ *
+ * Return: index in the snapshot list of the first snapshot not below
+ * @cno, or the number of snapshots if there is none.
+ */
+static size_t
+nilfs_snapshot_index_lookup(const struct nilfs_snapshot_index *ssi,
+			    nilfs_cno_t cno)
+{
+	size_t b, start, end;
+
+	if (ssi->nbuckets == 0)
+		return ssi->nss == 0 ? 0 :
+			nilfs_snapshot_lower_bound(ssi->ss, ssi->nss, cno);
+	if (cno <= ssi->base)
+		return 0;
+	b = (cno - ssi->base) >> ssi->shift;
+	if (b >= ssi->nbuckets)
+		return ssi->nss;
+
+	/* snapshots before the bucket are below @cno, those after it not */
+	start = ssi->buckets[b];
+	end = ssi->buckets[b + 1];
+	if (start == end)
+		return start;
+	return start + nilfs_snapshot_lower_bound(ssi->ss + start,
+						  end - start, cno);
 }
 
 /*
  * nilfs_vdesc_is_live - judge if a virtual block address is live or dead
  * @vdesc: descriptor object of the virtual block address
  * @protect: the minimum of checkpoint numbers to be protected
- * @ss: checkpoint numbers of snapshots
- * @n: size of @ss array
+ * @ssi: index of the checkpoint numbers of snapshots
  * @last_hit: the last snapshot number hit
  */
 static int nilfs_vdesc_is_live(const struct nilfs_vdesc *vdesc,
-			       nilfs_cno_t protect, const nilfs_cno_t *ss,
-			       size_t n, nilfs_cno_t *last_hit)
+			       nilfs_cno_t protect,
+			       const struct nilfs_snapshot_index *ssi,
+			       nilfs_cno_t *last_hit)
 {
-	long low, high, index;
+	const nilfs_cno_t *ss = ssi->ss;
+	size_t n = ssi->nss, index;
 
 	if (vdesc->vd_cno == 0) {
 		/*
@@ -519,22 +812,57 @@ static int nilfs_vdesc_is_live(const struct nilfs_vdesc *vdesc,
 	    *last_hit < vdesc->vd_period.p_end)
 		return 1;
 
-	low = 0;
-	high = n - 1;
-	index = 0;
-	while (low <= high) {
-		index = (low + high) / 2;
-		if (ss[index] < vdesc->vd_period.p_start) {
-			/* drop snapshot numbers ss[low] .. ss[index] */
-			low = index + 1;
-		} else if (ss[index] >= vdesc->vd_period.p_end) {
-			/* drop snapshot numbers ss[index] .. ss[high] */
-			high = index - 1;
-		} else {
-			/* ss[index] is in the range [p_start, p_end) */
-			*last_hit = ss[index];
-			return 1;
-		}
+	/* look for a snapshot number in the range [p_start, p_end) */
+	index = nilfs_snapshot_index_lookup(ssi, vdesc->vd_period.p_start);
+	if (index < n && ss[index] < vdesc->vd_period.p_end) {
+		*last_hit = ss[index];
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * struct nilfs_toss_vdesc_arg - context of nilfs_toss_vdesc()
+ * @periodv: vector object to store deletable checkpoint numbers (periods)
+ * @vblocknrv: vector object to store deletable virtual block numbers
+ * @protcno: start number of checkpoint to be protected
+ * @ssi: index of the checkpoint numbers of snapshots
+ * @last_hit: the last snapshot number hit
+ */
+struct nilfs_toss_vdesc_arg {
+	struct nilfs_vector *periodv;
+	struct nilfs_vector *vblocknrv;
+	nilfs_cno_t protcno;
+	struct nilfs_snapshot_index ssi;
+	nilfs_cno_t last_hit;
+};
+
+static int nilfs_toss_vdesc(void *prev, void *elem, void *arg)
+{
+	struct nilfs_toss_vdesc_arg *toss = arg;
+	struct nilfs_vdesc *vdesc = elem;
+	struct nilfs_period *periodp;
+	uint64_t *vblocknrp;
+
+	if (nilfs_vdesc_is_live(vdesc, toss->protcno, &toss->ssi,
+				&toss->last_hit))
+		return 1;
+
+	/* Add the virtual block number to the candidate for deletion. */
+	vblocknrp = nilfs_vector_get_new_element(toss->vblocknrv);
+	if (unlikely(!vblocknrp))
+		return -1;
+	*vblocknrp = vdesc->vd_vblocknr;
+
+	/*
+	 * Add the period to the candidate for deletion unless the file
+	 * is cpfile or sufile.
+	 */
+	if (vdesc->vd_cno != 0) {
+		periodp = nilfs_vector_get_new_element(toss->periodv);
+		if (unlikely(!periodp))
+			return -1;
+		*periodp = vdesc->vd_period;
 	}
 	return 0;
 }
@@ -546,68 +874,81 @@ static int nilfs_vdesc_is_live(const struct nilfs_vdesc *vdesc,
  * @periodv: vector object to store deletable checkpoint numbers (periods)
  * @vblocknrv: vector object to store deletable virtual block numbers
  * @protcno: start number of checkpoint to be protected
+ * @ss: checkpoint numbers of snapshots
+ * @nss: size of @ss array
  *
  * nilfs_cleanerd_toss_vdescs() deselects virtual block numbers of files
  * other than the DAT file.
  */
-static int nilfs_toss_vdescs(struct nilfs *nilfs,
-			     struct nilfs_vector *vdescv,
+static int nilfs_toss_vdescs(struct nilfs_vector *vdescv,
 			     struct nilfs_vector *periodv,
 			     struct nilfs_vector *vblocknrv,
-			     nilfs_cno_t protcno)
+			     nilfs_cno_t protcno, const nilfs_cno_t *ss,
+			     size_t nss)
 {
-	struct nilfs_vdesc *vdesc;
-	struct nilfs_period *periodp;
-	uint64_t *vblocknrp;
-	nilfs_cno_t *ss, last_hit;
-	ssize_t n;
-	int i, j, ret;
-
-	ss = NULL;
-	n = nilfs_get_snapshot(nilfs, &ss);
-	if (unlikely(n < 0))
-		return n;
+	struct nilfs_toss_vdesc_arg toss;
+	int ret;
 
-	last_hit = 0;
-	for (i = 0; i < nilfs_vector_get_size(vdescv); i++) {
-		for (j = i; j < nilfs_vector_get_size(vdescv); j++) {
-			vdesc = nilfs_vector_get_element(vdescv, j);
-			assert(vdesc != NULL);
-			if (nilfs_vdesc_is_live(vdesc, protcno, ss, n,
-						&last_hit))
-				break;
+	toss.periodv = periodv;
+	toss.vblocknrv = vblocknrv;
+	toss.protcno = protcno;
+	nilfs_snapshot_index_init(&toss.ssi, ss, nss);
+	toss.last_hit = 0;
+	ret = nilfs_vector_filter(vdescv, nilfs_toss_vdesc, &toss);
+	nilfs_snapshot_index_destroy(&toss.ssi);
+	return ret;
+}
 
-			/*
-			 * Add the virtual block number to the candidate
-			 * for deletion.
-			 */
-			vblocknrp = nilfs_vector_get_new_element(vblocknrv);
-			if (unlikely(!vblocknrp)) {
-				ret = -1;
-				goto out;
-			}
-			*vblocknrp = vdesc->vd_vblocknr;
-
-			/*
-			 * Add the period to the candidate for deletion
-			 * unless the file is cpfile or sufile.
-			 */
-			if (vdesc->vd_cno != 0) {
-				periodp = nilfs_vector_get_new_element(periodv);
-				if (unlikely(!periodp)) {
-					ret = -1;
-					goto out;
-				}
-				*periodp = vdesc->vd_period;
-			}
-		}
-		if (j > i)
-			nilfs_vector_delete_elements(vdescv, i, j - i);
+/**
+ * nilfs_sort_vdescs - order live virtual blocks for the kernel
+ * @vdescv: vector object storing (descriptors of) live virtual blocks
+ * @order: order of the blocks (NILFS_RECLAIM_ORDER_*)
+ *
+ * The kernel gathers the moved blocks into one GC inode per inode and
+ * checkpoint.  Each new GC inode is added to the head of its list of GC
+ * inodes, so they are written out in the reverse order of their first
+ * appearance in the array.  Sorting on the birth checkpoint of the
+ * blocks thus lays out the copies by age class, the youngest first,
+ * instead of interleaving old and young data of different victims as
+ * the disk order does.
+ */
+static void nilfs_sort_vdescs(struct nilfs_vector *vdescv, int order)
+{
+	int (*compar)(const void *, const void *);
+	const struct nilfs_vector_key *keys;
+	int nkeys;
+
+	switch (order) {
+	case NILFS_RECLAIM_ORDER_AGE:
+		keys = nilfs_vdesc_age_keys;
+		nkeys = ARRAY_SIZE(nilfs_vdesc_age_keys);
+		compar = nilfs_comp_vdesc_age;
+		break;
+	case NILFS_RECLAIM_ORDER_FILE:
+		keys = nilfs_vdesc_file_keys;
+		nkeys = ARRAY_SIZE(nilfs_vdesc_file_keys);
+		compar = nilfs_comp_vdesc_file;
+		break;
+	default:
+		keys = nilfs_vdesc_blocknr_key;
+		nkeys = ARRAY_SIZE(nilfs_vdesc_blocknr_key);
+		compar = nilfs_comp_vdesc_blocknr;
+		break;
 	}
-	ret = 0;
- out:
-	free(ss);
-	return ret;
+
+	if (nilfs_vector_sort_keys(vdescv, keys, nkeys) < 0)
+		nilfs_vector_sort(vdescv, compar);
+}
+
+static int nilfs_merge_period(void *prev, void *elem, void *arg)
+{
+	struct nilfs_period *base = prev, *target = elem;
+
+	if (base == NULL || base->p_end < target->p_start)
+		return 1;
+	if (base->p_end < target->p_end)
+		base->p_end = target->p_end;
+	return 0;
 }
 
 /**
@@ -616,27 +957,10 @@ static int nilfs_toss_vdescs(struct nilfs *nilfs,
  */
 static void nilfs_unify_period(struct nilfs_vector *periodv)
 {
-	struct nilfs_period *base, *target;
-	int i, j;
-
-	nilfs_vector_sort(periodv, nilfs_comp_period);
-
-	for (i = 0; i < nilfs_vector_get_size(periodv); i++) {
-		base = nilfs_vector_get_element(periodv, i);
-		assert(base != NULL);
-		for (j = i + 1; j < nilfs_vector_get_size(periodv); j++) {
-			target = nilfs_vector_get_element(periodv, j);
-			assert(target != NULL);
-			if (base->p_end < target->p_start)
-				break;
-			if (base->p_end < target->p_end)
-				base->p_end = target->p_end;
-		}
-
-		if (j > i + 1)
-			nilfs_vector_delete_elements(periodv, i + 1,
-						     j - i - 1);
-	}
+	if (nilfs_vector_sort_keys(periodv, nilfs_period_key,
+				   ARRAY_SIZE(nilfs_period_key)) < 0)
+		nilfs_vector_sort(periodv, nilfs_comp_period);
+	nilfs_vector_filter(periodv, nilfs_merge_period, NULL);
 }
 
 /**
@@ -651,12 +975,16 @@ static int nilfs_get_bdesc(struct nilfs *nilfs, struct nilfs_vector *bdescv)
 	ssize_t n;
 	int i;
 
-	nilfs_vector_sort(bdescv, nilfs_comp_bdesc);
+	if (nilfs_vector_sort_keys(bdescv, nilfs_bdesc_keys,
+				   ARRAY_SIZE(nilfs_bdesc_keys)) < 0)
+		nilfs_vector_sort(bdescv, nilfs_comp_bdesc);
 
 	bdescs = nilfs_vector_get_data(bdescv);
 	nbdescs = nilfs_vector_get_size(bdescv);
 	for (i = 0; i < nbdescs; i += n) {
-		count = min_t(size_t, nbdescs - i, NILFS_GC_NBDESCS);
+		count = min_t(size_t, nbdescs - i,
+			      nilfs_get_ioctl_batch(nilfs,
+						    NILFS_IOCTL_BATCH_BDESCS));
 		n = nilfs_get_bdescs(nilfs, bdescs + i, count);
 		if (unlikely(n < 0))
 			return -1;
@@ -681,47 +1009,102 @@ static int nilfs_bdesc_is_live(struct nilfs_bdesc *bdesc)
  * This function deselects disk block numbers of the DAT file which
  * don't belong to the latest DAT file.
  */
+static int nilfs_toss_bdesc(void *prev, void *elem, void *arg)
+{
+	return nilfs_bdesc_is_live(elem);
+}
+
 static int nilfs_toss_bdescs(struct nilfs_vector *bdescv)
 {
-	struct nilfs_bdesc *bdesc;
-	int i, j;
+	return nilfs_vector_filter(bdescv, nilfs_toss_bdesc, NULL);
+}
 
-	for (i = 0; i < nilfs_vector_get_size(bdescv); i++) {
-		for (j = i; j < nilfs_vector_get_size(bdescv); j++) {
-			bdesc = nilfs_vector_get_element(bdescv, j);
-			assert(bdesc != NULL);
-			if (nilfs_bdesc_is_live(bdesc))
-				break;
-		}
-		if (j > i)
-			nilfs_vector_delete_elements(bdescv, i, j - i);
+/**
+ * struct nilfs_reclaim_batch - reclaim request of a set of segments
+ * @vdescv: descriptors of live virtual blocks to be moved
+ * @bdescv: descriptors of live DAT file blocks to be moved
+ * @periodv: deletable checkpoint numbers (periods)
+ * @vblocknrv: deletable virtual block numbers
+ * @supv: usage updates of deferred segments
+ * @segnumv: requested segments; the selected ones come first
+ * @segv: state of the selected segments at the preparation
+ * @ssv: checkpoint numbers of snapshots at the preparation
+ * @protseq: start of sequence number of protected segments
+ * @protcno: start number of checkpoint to be protected
+ * @nselected: number of selected segments
+ * @reclaimable_blocks: number of reclaimable blocks in selected segments
+ * @stat: statistics of the preparation
+ */
+struct nilfs_reclaim_batch {
+	struct nilfs_vector *vdescv;
+	struct nilfs_vector *bdescv;
+	struct nilfs_vector *periodv;
+	struct nilfs_vector *vblocknrv;
+	struct nilfs_vector *supv;
+	struct nilfs_vector *segnumv;
+	struct nilfs_vector *segv;
+	struct nilfs_vector *ssv;
+	uint64_t protseq;
+	nilfs_cno_t protcno;
+	size_t nselected;
+	uint32_t reclaimable_blocks;
+	struct nilfs_reclaim_stat stat;
+};
+
+/**
+ * nilfs_reclaim_batch_create - create a reclaim batch object
+ */
+struct nilfs_reclaim_batch *nilfs_reclaim_batch_create(void)
+{
+	struct nilfs_reclaim_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (unlikely(!batch))
+		return NULL;
+
+	batch->vdescv = nilfs_vector_create(sizeof(struct nilfs_vdesc));
+	batch->bdescv = nilfs_vector_create(sizeof(struct nilfs_bdesc));
+	batch->periodv = nilfs_vector_create(sizeof(struct nilfs_period));
+	batch->vblocknrv = nilfs_vector_create(sizeof(uint64_t));
+	batch->supv = nilfs_vector_create(sizeof(struct nilfs_suinfo_update));
+	batch->segnumv = nilfs_vector_create(sizeof(uint64_t));
+	batch->segv = nilfs_vector_create(sizeof(struct nilfs_reclaim_seg));
+	batch->ssv = nilfs_vector_create(sizeof(nilfs_cno_t));
+	if (unlikely(!batch->vdescv || !batch->bdescv || !batch->periodv ||
+		     !batch->vblocknrv || !batch->supv || !batch->segnumv ||
+		     !batch->segv || !batch->ssv)) {
+		nilfs_reclaim_batch_destroy(batch);
+		return NULL;
 	}
-	return 0;
+	return batch;
 }
 
 /**
- * nilfs_xreclaim_segment - reclaim segments (enhanced API)
- * @nilfs: nilfs object
- * @segnums: array of segment numbers storing selected segments
- * @nsegs: size of the @segnums array
- * @dryrun: dry-run flag
- * @params: reclaim parameters
- * @stat: reclaim statistics
+ * nilfs_reclaim_batch_destroy - destroy a reclaim batch object
+ * @batch: reclaim batch object
  */
-int nilfs_xreclaim_segment(struct nilfs *nilfs,
-			   uint64_t *segnums, size_t nsegs, int dryrun,
-			   const struct nilfs_reclaim_params *params,
-			   struct nilfs_reclaim_stat *stat)
+void nilfs_reclaim_batch_destroy(struct nilfs_reclaim_batch *batch)
 {
-	struct nilfs_vector *vdescv, *bdescv, *periodv, *vblocknrv, *supv;
-	sigset_t sigset, oldset, waitset;
-	nilfs_cno_t protcno;
-	ssize_t n, i, ret = -1;
-	size_t nblocks;
-	uint32_t reclaimable_blocks;
-	struct nilfs_suinfo_update *sup;
-	struct timeval tv;
+	if (batch == NULL)
+		return;
+
+	nilfs_vector_destroy(batch->vdescv);
+	nilfs_vector_destroy(batch->bdescv);
+	nilfs_vector_destroy(batch->periodv);
+	nilfs_vector_destroy(batch->vblocknrv);
+	nilfs_vector_destroy(batch->supv);
+	nilfs_vector_destroy(batch->segnumv);
+	nilfs_vector_destroy(batch->segv);
+	nilfs_vector_destroy(batch->ssv);
+	free(batch);
+}
 
+/**
+ * nilfs_reclaim_params_valid - check reclaim parameters
+ * @params: reclaim parameters
+ */
+static int nilfs_reclaim_params_valid(const struct nilfs_reclaim_params *params)
+{
 	if (unlikely(!(params->flags & NILFS_RECLAIM_PARAM_PROTSEQ) ||
 	    (params->flags & (~0UL << __NR_NILFS_RECLAIM_PARAMS)))) {
 		/*
@@ -729,106 +1112,227 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 		 * parameters are rejected.
 		 */
 		errno = EINVAL;
-		return -1;
+		return 0;
 	}
-
-	if (nsegs == 0)
+	if (unlikely((params->flags & NILFS_RECLAIM_PARAM_ORDER) &&
+		     (params->order < 0 ||
+		      params->order >= __NR_NILFS_RECLAIM_ORDERS))) {
+		errno = EINVAL;
 		return 0;
-
-	vdescv = nilfs_vector_create(sizeof(struct nilfs_vdesc));
-	bdescv = nilfs_vector_create(sizeof(struct nilfs_bdesc));
-	periodv = nilfs_vector_create(sizeof(struct nilfs_period));
-	vblocknrv = nilfs_vector_create(sizeof(uint64_t));
-	supv = nilfs_vector_create(sizeof(struct nilfs_suinfo_update));
-	if (unlikely(!vdescv || !bdescv || !periodv || !vblocknrv || !supv))
-		goto out_vec;
-
-	sigemptyset(&sigset);
-	sigaddset(&sigset, SIGINT);
-	sigaddset(&sigset, SIGTERM);
-	ret = sigprocmask(SIG_BLOCK, &sigset, &oldset);
-	if (unlikely(ret < 0)) {
-		nilfs_gc_logger(LOG_ERR, "cannot block signals: %s",
-				strerror(errno));
-		goto out_vec;
 	}
+	return 1;
+}
 
-	ret = nilfs_lock_cleaner(nilfs);
-	if (unlikely(ret < 0))
-		goto out_sig;
-
-	/* count blocks */
-	n = nilfs_acc_blocks(nilfs, segnums, nsegs, params->protseq, vdescv,
-			     bdescv);
-	if (unlikely(n < 0)) {
-		ret = n;
-		goto out_lock;
-	}
-	if (stat) {
-		stat->cleaned_segs = n;
-		stat->protected_segs = nsegs - n;
-		stat->deferred_segs = 0;
-	}
-	if (n == 0) {
-		ret = 0;
-		goto out_lock;
+/**
+ * nilfs_reclaim_batch_fill - collect live blocks of segments into a batch
+ * @nilfs: nilfs object
+ * @batch: reclaim batch object
+ * @segnums: array of segment numbers to be reclaimed
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @refresh: flag to reread the list of snapshots
+ *
+ * This does everything but the final clean_segments ioctl, and only
+ * reads the file system.
+ */
+static int nilfs_reclaim_batch_fill(struct nilfs *nilfs,
+				    struct nilfs_reclaim_batch *batch,
+				    const uint64_t *segnums, size_t nsegs,
+				    const struct nilfs_reclaim_params *params,
+				    int refresh)
+{
+	const nilfs_cno_t *ss;
+	nilfs_cno_t *cnop;
+	uint64_t *segnump;
+	ssize_t n, nss, i;
+	size_t nblocks;
+	int ret;
+
+	nilfs_vector_clear(batch->vdescv);
+	nilfs_vector_clear(batch->bdescv);
+	nilfs_vector_clear(batch->periodv);
+	nilfs_vector_clear(batch->vblocknrv);
+	nilfs_vector_clear(batch->segnumv);
+	nilfs_vector_clear(batch->segv);
+	nilfs_vector_clear(batch->ssv);
+	memset(&batch->stat, 0, sizeof(batch->stat));
+	batch->protseq = params->protseq;
+	batch->protcno = (params->flags & NILFS_RECLAIM_PARAM_PROTCNO) ?
+		params->protcno : NILFS_CNO_MAX;
+	batch->nselected = 0;
+	batch->reclaimable_blocks = 0;
+
+	for (i = 0; i < nsegs; i++) {
+		segnump = nilfs_vector_get_new_element(batch->segnumv);
+		if (unlikely(!segnump))
+			return -1;
+		*segnump = segnums[i];
 	}
 
+	/* count blocks */
+	n = nilfs_acc_blocks(nilfs, nilfs_vector_get_data(batch->segnumv),
+			     nsegs, batch->protseq,
+			     nilfs_reclaim_sumcache(params), batch->vdescv,
+			     batch->bdescv, batch->segv);
+	if (unlikely(n < 0))
+		return -1;
+
+	batch->nselected = n;
+	batch->stat.cleaned_segs = n;
+	batch->stat.protected_segs = nsegs - n;
+	if (n == 0)
+		return 0;
+
 	/* toss virtual blocks */
-	ret = nilfs_get_vdesc(nilfs, vdescv);
+	ret = nilfs_get_vdesc(nilfs, batch->vdescv);
 	if (unlikely(ret < 0))
-		goto out_lock;
+		return -1;
 
-	nblocks = nilfs_vector_get_size(vdescv);
-	protcno = (params->flags & NILFS_RECLAIM_PARAM_PROTCNO) ?
-		params->protcno : NILFS_CNO_MAX;
+	nss = nilfs_get_snapshot(nilfs, refresh, &ss);
+	if (unlikely(nss < 0))
+		return -1;
 
-	ret = nilfs_toss_vdescs(nilfs, vdescv, periodv, vblocknrv, protcno);
+	for (i = 0; i < nss; i++) {
+		cnop = nilfs_vector_get_new_element(batch->ssv);
+		if (unlikely(!cnop))
+			return -1;
+		*cnop = ss[i];
+	}
+
+	nblocks = nilfs_vector_get_size(batch->vdescv);
+	ret = nilfs_toss_vdescs(batch->vdescv, batch->periodv,
+				batch->vblocknrv, batch->protcno, ss, nss);
 	if (unlikely(ret < 0))
-		goto out_lock;
+		return -1;
 
-	if (stat) {
-		stat->live_vblks = nilfs_vector_get_size(vdescv);
-		stat->defunct_vblks = nblocks - stat->live_vblks;
-		stat->freed_vblks = nilfs_vector_get_size(vblocknrv);
-	}
+	batch->stat.live_vblks = nilfs_vector_get_size(batch->vdescv);
+	batch->stat.defunct_vblks = nblocks - batch->stat.live_vblks;
+	batch->stat.freed_vblks = nilfs_vector_get_size(batch->vblocknrv);
 
-	nilfs_vector_sort(vdescv, nilfs_comp_vdesc_blocknr);
-	nilfs_unify_period(periodv);
+	nilfs_sort_vdescs(batch->vdescv,
+			  (params->flags & NILFS_RECLAIM_PARAM_ORDER) ?
+			  params->order : NILFS_RECLAIM_ORDER_BLOCKNR);
+	nilfs_unify_period(batch->periodv);
 
 	/* toss DAT file blocks */
-	ret = nilfs_get_bdesc(nilfs, bdescv);
+	ret = nilfs_get_bdesc(nilfs, batch->bdescv);
 	if (unlikely(ret < 0))
-		goto out_lock;
+		return -1;
 
-	nblocks = nilfs_vector_get_size(bdescv);
-	ret = nilfs_toss_bdescs(bdescv);
+	nblocks = nilfs_vector_get_size(batch->bdescv);
+	ret = nilfs_toss_bdescs(batch->bdescv);
 	if (unlikely(ret < 0))
-		goto out_lock;
+		return -1;
+
+	batch->reclaimable_blocks = (nilfs_get_blocks_per_segment(nilfs) * n) -
+		(nilfs_vector_get_size(batch->vdescv) +
+		 nilfs_vector_get_size(batch->bdescv));
+
+	batch->stat.live_pblks = nilfs_vector_get_size(batch->bdescv);
+	batch->stat.defunct_pblks = nblocks - batch->stat.live_pblks;
+	batch->stat.live_blks = batch->stat.live_vblks +
+		batch->stat.live_pblks;
+	batch->stat.defunct_blks = batch->reclaimable_blocks;
+	return 0;
+}
+
+/**
+ * nilfs_reclaim_batch_is_current - test if a prepared batch can be used
+ * @nilfs: nilfs object
+ * @batch: reclaim batch object
+ * @params: reclaim parameters of the submission
+ *
+ * A batch stays usable as long as its segments have not been written or
+ * freed, no snapshot has been made or dropped, and the protection has
+ * not been extended: blocks found dead stay dead, and live blocks that
+ * die meanwhile are just moved as the kernel would do anyway.
+ *
+ * Return: 1 if @batch is current, 0 if it must be prepared again, or -1
+ * on error.
+ */
+static int nilfs_reclaim_batch_is_current(struct nilfs *nilfs,
+					  const struct nilfs_reclaim_batch *batch,
+					  const struct nilfs_reclaim_params *params)
+{
+	const struct nilfs_reclaim_seg *seg;
+	const nilfs_cno_t *ss;
+	struct nilfs_suinfo si;
+	nilfs_cno_t protcno;
+	uint64_t seqnum;
+	ssize_t nss;
+	int i, ret;
+
+	protcno = (params->flags & NILFS_RECLAIM_PARAM_PROTCNO) ?
+		params->protcno : NILFS_CNO_MAX;
+	if (protcno < batch->protcno ||
+	    !cnt64_ge(params->protseq, batch->protseq))
+		return 0;
 
-	reclaimable_blocks = (nilfs_get_blocks_per_segment(nilfs) * n) -
-			(nilfs_vector_get_size(vdescv) +
-			nilfs_vector_get_size(bdescv));
+	if (batch->nselected == 0)
+		return 1;
 
-	if (stat) {
-		stat->live_pblks = nilfs_vector_get_size(bdescv);
-		stat->defunct_pblks = nblocks - stat->live_pblks;
+	nss = nilfs_get_snapshot(nilfs, 1, &ss);
+	if (unlikely(nss < 0))
+		return -1;
+	if (nss != nilfs_vector_get_size(batch->ssv) ||
+	    (nss > 0 && memcmp(ss, nilfs_vector_get_data(batch->ssv),
+			       sizeof(*ss) * nss) != 0))
+		return 0;
+
+	for (i = 0; i < batch->nselected; i++) {
+		seg = nilfs_vector_get_element(batch->segv, i);
+		ret = nilfs_get_suinfo(nilfs, seg->segnum, &si, 1);
+		if (unlikely(ret < 0))
+			return -1;
+		if (!nilfs_suinfo_reclaimable(&si) ||
+		    si.sui_lastmod != seg->lastmod ||
+		    si.sui_nblocks != seg->nblocks)
+			return 0;
+		if (seg->seqnum == 0)
+			continue;
 
-		stat->live_blks = stat->live_vblks + stat->live_pblks;
-		stat->defunct_blks = reclaimable_blocks;
+		ret = nilfs_get_segment_seqnum(nilfs, seg->segnum, &seqnum);
+		if (unlikely(ret < 0))
+			return -1;
+		if (seqnum != seg->seqnum)
+			return 0;
 	}
-	if (dryrun)
-		goto out_lock;
+	return 1;
+}
+
+/**
+ * nilfs_reclaim_batch_commit - hand a filled batch over to the kernel
+ * @nilfs: nilfs object
+ * @batch: reclaim batch object
+ * @params: reclaim parameters
+ * @stat: reclaim statistics
+ *
+ * The caller must hold the cleaner lock with SIGINT and SIGTERM blocked.
+ */
+static int nilfs_reclaim_batch_commit(struct nilfs *nilfs,
+				      struct nilfs_reclaim_batch *batch,
+				      const struct nilfs_reclaim_params *params,
+				      struct nilfs_reclaim_stat *stat)
+{
+	uint64_t *segnums = nilfs_vector_get_data(batch->segnumv);
+	size_t n = batch->nselected;
+	struct nilfs_suinfo_update *sup;
+	sigset_t waitset;
+	struct timeval tv;
+	int i, ret;
+
+	if (n == 0)
+		return 0;
 
 	ret = sigpending(&waitset);
 	if (unlikely(ret < 0)) {
 		nilfs_gc_logger(LOG_ERR, "cannot test signals: %s",
 				strerror(errno));
-		goto out_lock;
+		return -1;
 	}
 	if (sigismember(&waitset, SIGINT) || sigismember(&waitset, SIGTERM)) {
 		nilfs_gc_logger(LOG_DEBUG, "interrupted");
-		goto out_lock;
+		return 0;
 	}
 
 	/*
@@ -837,7 +1341,8 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 	 */
 	if ((params->flags & NILFS_RECLAIM_PARAM_MIN_RECLAIMABLE_BLKS) &&
 			nilfs_opt_test_set_suinfo(nilfs) &&
-			reclaimable_blocks < params->min_reclaimable_blks * n) {
+			batch->reclaimable_blocks <
+			params->min_reclaimable_blks * n) {
 		if (stat) {
 			stat->deferred_segs = n;
 			stat->cleaned_segs = 0;
@@ -845,12 +1350,13 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 
 		ret = gettimeofday(&tv, NULL);
 		if (unlikely(ret < 0))
-			goto out_lock;
+			return -1;
 
+		nilfs_vector_clear(batch->supv);
 		for (i = 0; i < n; ++i) {
-			sup = nilfs_vector_get_new_element(supv);
+			sup = nilfs_vector_get_new_element(batch->supv);
 			if (unlikely(!sup))
-				goto out_lock;
+				return -1;
 
 			sup->sup_segnum = segnums[i];
 			sup->sup_flags = 0;
@@ -858,15 +1364,16 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 			sup->sup_sui.sui_lastmod = tv.tv_sec;
 		}
 
-		ret = nilfs_set_suinfo(nilfs, nilfs_vector_get_data(supv), n);
+		ret = nilfs_set_suinfo(nilfs, nilfs_vector_get_data(batch->supv),
+				       n);
 
 		if (ret == 0)
-			goto out_lock;
+			return 0;
 
 		if (unlikely(ret < 0 && errno != ENOTTY)) {
 			nilfs_gc_logger(LOG_ERR, "cannot set suinfo: %s",
 					strerror(errno));
-			goto out_lock;
+			return -1;
 		}
 
 		/* errno == ENOTTY */
@@ -881,19 +1388,76 @@ int nilfs_xreclaim_segment(struct nilfs *nilfs,
 	}
 
 	ret = nilfs_clean_segments(nilfs,
-				   nilfs_vector_get_data(vdescv),
-				   nilfs_vector_get_size(vdescv),
-				   nilfs_vector_get_data(periodv),
-				   nilfs_vector_get_size(periodv),
-				   nilfs_vector_get_data(vblocknrv),
-				   nilfs_vector_get_size(vblocknrv),
-				   nilfs_vector_get_data(bdescv),
-				   nilfs_vector_get_size(bdescv),
+				   nilfs_vector_get_data(batch->vdescv),
+				   nilfs_vector_get_size(batch->vdescv),
+				   nilfs_vector_get_data(batch->periodv),
+				   nilfs_vector_get_size(batch->periodv),
+				   nilfs_vector_get_data(batch->vblocknrv),
+				   nilfs_vector_get_size(batch->vblocknrv),
+				   nilfs_vector_get_data(batch->bdescv),
+				   nilfs_vector_get_size(batch->bdescv),
 				   segnums, n);
 	if (unlikely(ret < 0)) {
 		nilfs_gc_logger(LOG_ERR, "cannot clean segments: %s",
 				strerror(errno));
 	}
+	return ret;
+}
+
+/**
+ * nilfs_xreclaim_segment - reclaim segments (enhanced API)
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers storing selected segments
+ * @nsegs: size of the @segnums array
+ * @dryrun: dry-run flag
+ * @params: reclaim parameters
+ * @stat: reclaim statistics
+ */
+int nilfs_xreclaim_segment(struct nilfs *nilfs,
+			   uint64_t *segnums, size_t nsegs, int dryrun,
+			   const struct nilfs_reclaim_params *params,
+			   struct nilfs_reclaim_stat *stat)
+{
+	struct nilfs_reclaim_batch *batch;
+	sigset_t sigset, oldset;
+	int ret = -1;
+
+	if (unlikely(!nilfs_reclaim_params_valid(params)))
+		return -1;
+
+	if (nsegs == 0)
+		return 0;
+
+	batch = nilfs_reclaim_batch_create();
+	if (unlikely(!batch))
+		return -1;
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	ret = sigprocmask(SIG_BLOCK, &sigset, &oldset);
+	if (unlikely(ret < 0)) {
+		nilfs_gc_logger(LOG_ERR, "cannot block signals: %s",
+				strerror(errno));
+		goto out_batch;
+	}
+
+	ret = nilfs_lock_cleaner(nilfs);
+	if (unlikely(ret < 0))
+		goto out_sig;
+
+	/* blocks are only deleted with a freshly read snapshot list */
+	ret = nilfs_reclaim_batch_fill(nilfs, batch, segnums, nsegs, params,
+				       !dryrun);
+	if (unlikely(ret < 0))
+		goto out_lock;
+
+	memcpy(segnums, nilfs_vector_get_data(batch->segnumv),
+	       sizeof(*segnums) * nsegs);
+	if (stat)
+		*stat = batch->stat;
+	if (!dryrun)
+		ret = nilfs_reclaim_batch_commit(nilfs, batch, params, stat);
 
 out_lock:
 	if (unlikely(nilfs_unlock_cleaner(nilfs) < 0)) {
@@ -905,18 +1469,717 @@ out_lock:
 out_sig:
 	sigprocmask(SIG_SETMASK, &oldset, NULL);
 
-out_vec:
-	nilfs_vector_destroy(vdescv);
-	nilfs_vector_destroy(bdescv);
-	nilfs_vector_destroy(periodv);
-	nilfs_vector_destroy(vblocknrv);
-	nilfs_vector_destroy(supv);
+out_batch:
+	nilfs_reclaim_batch_destroy(batch);
 	/*
 	 * Flags of valid fields in stat->exflags must be unset.
 	 */
 	return ret;
 }
 
+/**
+ * nilfs_prepare_reclaim - prepare reclaim of segments in advance
+ * @nilfs: nilfs object
+ * @batch: reclaim batch object to store the request
+ * @segnums: array of segment numbers to be reclaimed
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ *
+ * This reads the segment summaries, the DAT and the snapshot list, and
+ * collects the live blocks of the segments into @batch, without taking
+ * the cleaner lock.  It is meant to run on a nilfs object of its own
+ * while another batch is being cleaned, so that the summaries of the
+ * next segments are parsed while the kernel copies blocks.  The batch
+ * is handed to the kernel with nilfs_submit_reclaim().
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_prepare_reclaim(struct nilfs *nilfs,
+			  struct nilfs_reclaim_batch *batch,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params)
+{
+	if (unlikely(!nilfs_reclaim_params_valid(params)))
+		return -1;
+
+	return nilfs_reclaim_batch_fill(nilfs, batch, segnums, nsegs, params,
+					1);
+}
+
+/**
+ * nilfs_submit_reclaim - reclaim segments prepared in advance
+ * @nilfs: nilfs object
+ * @batch: reclaim batch object filled by nilfs_prepare_reclaim()
+ * @params: reclaim parameters
+ * @segnums: array to store the segment numbers of @batch
+ * @stat: reclaim statistics
+ *
+ * Under the cleaner lock, the segments, the snapshot list and the
+ * protection of @batch are checked against the current state first.
+ * If any of them changed since the preparation, the batch is prepared
+ * again on the spot.  Then the segments are cleaned in the same way as
+ * nilfs_xreclaim_segment(), which also defines the order of @segnums
+ * and the contents of @stat.  @segnums must have room for all the
+ * segments passed to nilfs_prepare_reclaim().
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_submit_reclaim(struct nilfs *nilfs,
+			 struct nilfs_reclaim_batch *batch,
+			 const struct nilfs_reclaim_params *params,
+			 uint64_t *segnums, struct nilfs_reclaim_stat *stat)
+{
+	size_t nsegs = nilfs_vector_get_size(batch->segnumv);
+	sigset_t sigset, oldset;
+	int ret;
+
+	if (unlikely(!nilfs_reclaim_params_valid(params)))
+		return -1;
+
+	if (nsegs == 0)
+		return 0;
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	ret = sigprocmask(SIG_BLOCK, &sigset, &oldset);
+	if (unlikely(ret < 0)) {
+		nilfs_gc_logger(LOG_ERR, "cannot block signals: %s",
+				strerror(errno));
+		return -1;
+	}
+
+	ret = nilfs_lock_cleaner(nilfs);
+	if (unlikely(ret < 0))
+		goto out_sig;
+
+	memcpy(segnums, nilfs_vector_get_data(batch->segnumv),
+	       sizeof(*segnums) * nsegs);
+
+	ret = nilfs_reclaim_batch_is_current(nilfs, batch, params);
+	if (unlikely(ret < 0))
+		goto out_lock;
+	if (ret == 0) {
+		nilfs_gc_logger(LOG_DEBUG, "prepared segments changed");
+		ret = nilfs_reclaim_batch_fill(nilfs, batch, segnums, nsegs,
+					       params, 1);
+		if (unlikely(ret < 0))
+			goto out_lock;
+		memcpy(segnums, nilfs_vector_get_data(batch->segnumv),
+		       sizeof(*segnums) * nsegs);
+	}
+
+	if (stat)
+		*stat = batch->stat;
+	ret = nilfs_reclaim_batch_commit(nilfs, batch, params, stat);
+
+out_lock:
+	if (unlikely(nilfs_unlock_cleaner(nilfs) < 0)) {
+		nilfs_gc_logger(LOG_CRIT, "failed to unlock cleaner: %s",
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+out_sig:
+	sigprocmask(SIG_SETMASK, &oldset, NULL);
+	return ret;
+}
+
+/**
+ * struct nilfs_segref - reference from a segment number to its statistics
+ * @segnum: segment number
+ * @stat: statistics of the segment
+ * @info: details of the segment (optional)
+ */
+struct nilfs_segref {
+	uint64_t segnum;
+	struct nilfs_reclaim_stat *stat;
+	struct nilfs_assess_info *info;
+};
+
+static int nilfs_comp_segref(const void *elem1, const void *elem2)
+{
+	const struct nilfs_segref *ref1 = elem1, *ref2 = elem2;
+
+	return (ref1->segnum < ref2->segnum) ? -1 :
+		(ref1->segnum == ref2->segnum) ? 0 : 1;
+}
+
+/**
+ * nilfs_lookup_segref - find the reference to the segment containing a block
+ * @refs: array of segment references sorted by segment number
+ * @nrefs: size of @refs array
+ * @blocknr: disk block number
+ * @blocks_per_segment: number of blocks per segment
+ */
+static const struct nilfs_segref *
+nilfs_lookup_segref(const struct nilfs_segref *refs, size_t nrefs,
+		    uint64_t blocknr, uint32_t blocks_per_segment)
+{
+	struct nilfs_segref key;
+
+	key.segnum = blocknr / blocks_per_segment;
+	return bsearch(&key, refs, nrefs, sizeof(*refs), nilfs_comp_segref);
+}
+
+/**
+ * nilfs_get_suinfo_segnums - get usage information of listed segments
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array
+ * @si: array to store the usage information corresponding to @segnums
+ *
+ * Runs of consecutive segment numbers are fetched with one request each.
+ */
+static int nilfs_get_suinfo_segnums(struct nilfs *nilfs,
+				    const uint64_t *segnums, size_t nsegs,
+				    struct nilfs_suinfo *si)
+{
+	size_t i, run;
+	ssize_t n;
+
+	for (i = 0; i < nsegs; i += run) {
+		for (run = 1; i + run < nsegs; run++)
+			if (segnums[i + run] != segnums[i] + run)
+				break;
+		n = nilfs_get_suinfo(nilfs, segnums[i], &si[i], run);
+		if (unlikely(n < 0))
+			return -1;
+		if (unlikely(n < run)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * nilfs_assess_note_live - account a live virtual block in the details
+ * @info: details of the segment
+ * @vdesc: descriptor of the live block
+ * @protcno: start number of checkpoint to be protected
+ *
+ * A block whose period already ended is counted as live only while the
+ * end lies past @protcno, so it turns reclaimable once the protection
+ * checkpoint reaches the end; the earliest such end is kept.  Blocks
+ * held by snapshots do not expire with the protection period.
+ */
+static void nilfs_assess_note_live(struct nilfs_assess_info *info,
+				   const struct nilfs_vdesc *vdesc,
+				   nilfs_cno_t protcno)
+{
+	nilfs_cno_t end = vdesc->vd_period.p_end;
+
+	info->birth_cno += vdesc->vd_period.p_start;	/* divided later */
+	if (vdesc->vd_cno == 0 || end == NILFS_CNO_MAX || end <= protcno)
+		return;
+	if (!(info->flags & NILFS_ASSESS_INFO_EXPIRE) ||
+	    end < info->expire_cno) {
+		info->expire_cno = end;
+		info->flags |= NILFS_ASSESS_INFO_EXPIRE;
+	}
+}
+
+/**
+ * nilfs_assess_chunk - assess a bounded number of segments at once
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array (NILFS_GC_NASSESS at most)
+ * @protseq: start of sequence number of protected segments
+ * @protcno: start number of checkpoint to be protected
+ * @ss: checkpoint numbers of snapshots
+ * @nss: size of @ss array
+ * @cache: summary cache (optional)
+ * @vdescv: vector object to store (descriptors of) virtual block numbers
+ * @bdescv: vector object to store (descriptors of) disk block numbers
+ * @si: array to store usage information of the segments at the start
+ * @seqnums: array to store sequence numbers of the segments read
+ * @stats: array of per-segment statistics corresponding to @segnums
+ * @infos: array of per-segment details corresponding to @segnums
+ * (optional)
+ *
+ * Block descriptors of all the segments are gathered into the shared
+ * vectors so that vinfo and bdescs ioctls are issued in full batches.
+ * The results are attributed back to each segment from the disk block
+ * number of the descriptor.  @seqnums is only set for segments whose
+ * summaries were read or looked up in @cache, and 0 is stored for the
+ * others.  The vinfo lookup also yields the checkpoint each live block
+ * was written in, whose mean is reported in @infos as the birth of the
+ * segment, and the checkpoint at which the first block counted as live
+ * only for its protection expires.
+ */
+static int nilfs_assess_chunk(struct nilfs *nilfs,
+			      const uint64_t *segnums, size_t nsegs,
+			      uint64_t protseq, nilfs_cno_t protcno,
+			      const nilfs_cno_t *ss, size_t nss,
+			      struct nilfs_sumcache *cache,
+			      struct nilfs_vector *vdescv,
+			      struct nilfs_vector *bdescv,
+			      struct nilfs_suinfo *si, uint64_t *seqnums,
+			      struct nilfs_reclaim_stat *stats,
+			      struct nilfs_assess_info *infos)
+{
+	struct nilfs_segref refs[NILFS_GC_NASSESS];
+	const struct nilfs_segref *ref;
+	struct nilfs_segment segments[NILFS_GC_NSEGREAD];
+	uint64_t readv[NILFS_GC_NSEGREAD];
+	size_t indexv[NILFS_GC_NSEGREAD];
+	struct nilfs_reclaim_stat *st;
+	struct nilfs_snapshot_index ssi;
+	struct nilfs_vdesc *vdesc;
+	struct nilfs_bdesc *bdesc;
+	uint32_t blocks_per_segment = nilfs_get_blocks_per_segment(nilfs);
+	nilfs_cno_t last_hit = 0;
+	size_t nrefs = 0, count, nread, vstart, bstart, j, k;
+	int i, ret;
+
+	nilfs_vector_clear(vdescv);
+	nilfs_vector_clear(bdescv);
+
+	ret = nilfs_get_suinfo_segnums(nilfs, segnums, nsegs, si);
+	if (unlikely(ret < 0))
+		return -1;
+
+	for (i = 0; i < nsegs; i += count) {
+		count = min_t(size_t, nsegs - i, NILFS_GC_NSEGREAD);
+		nread = 0;
+		for (j = i; j < i + count; j++) {
+			seqnums[j] = 0;
+			if (!nilfs_suinfo_reclaimable(&si[j])) {
+				stats[j].protected_segs = 1;
+				continue;
+			}
+			stats[j].cleaned_segs = 1;
+			if (nilfs_suinfo_empty(&si[j])) {
+				/* scrapped segment; no valid blocks */
+				stats[j].defunct_blks = blocks_per_segment;
+				continue;
+			}
+			ret = nilfs_acc_blocks_cached(nilfs, cache, segnums[j],
+						      si[j].sui_nblocks,
+						      protseq, &seqnums[j],
+						      vdescv, bdescv);
+			if (unlikely(ret < 0))
+				return -1;
+			if (ret == 0) {
+				readv[nread] = segnums[j];
+				indexv[nread++] = j;
+			} else if (cnt64_ge(seqnums[j], protseq)) {
+				stats[j].cleaned_segs = 0;
+				stats[j].protected_segs = 1;
+			} else {
+				refs[nrefs].segnum = segnums[j];
+				refs[nrefs].stat = &stats[j];
+				refs[nrefs].info = infos ? &infos[j] : NULL;
+				nrefs++;
+			}
+		}
+		if (nread == 0)
+			continue;
+
+		ret = nilfs_get_segment_summaries(nilfs, readv, nread,
+						  segments);
+		if (unlikely(ret < 0))
+			return -1;
+
+		for (k = 0; k < nread; k++) {
+			j = indexv[k];
+			seqnums[j] = segments[k].seqnum;
+			if (cnt64_ge(segments[k].seqnum, protseq)) {
+				stats[j].cleaned_segs = 0;
+				stats[j].protected_segs = 1;
+				continue;
+			}
+			vstart = nilfs_vector_get_size(vdescv);
+			bstart = nilfs_vector_get_size(bdescv);
+			ret = nilfs_acc_blocks_segment(&segments[k],
+						       si[j].sui_nblocks,
+						       vdescv, bdescv);
+			if (unlikely(ret < 0))
+				break;
+			if (cache)
+				nilfs_sumcache_insert(cache, segnums[j],
+						      seqnums[j],
+						      si[j].sui_nblocks,
+						      vdescv, vstart,
+						      bdescv, bstart);
+
+			refs[nrefs].segnum = segnums[j];
+			refs[nrefs].stat = &stats[j];
+			refs[nrefs].info = infos ? &infos[j] : NULL;
+			nrefs++;
+		}
+		if (unlikely(nilfs_put_segments(segments, nread) < 0 ||
+			     ret < 0))
+			return -1;
+	}
+	if (nrefs == 0)
+		return 0;
+
+	qsort(refs, nrefs, sizeof(*refs), nilfs_comp_segref);
+
+	ret = nilfs_get_vdesc(nilfs, vdescv);
+	if (unlikely(ret < 0))
+		return -1;
+
+	nilfs_snapshot_index_init(&ssi, ss, nss);
+	for (i = 0; i < nilfs_vector_get_size(vdescv); i++) {
+		vdesc = nilfs_vector_get_element(vdescv, i);
+		ref = nilfs_lookup_segref(refs, nrefs, vdesc->vd_blocknr,
+					  blocks_per_segment);
+		assert(ref != NULL);
+		st = ref->stat;
+		if (nilfs_vdesc_is_live(vdesc, protcno, &ssi, &last_hit)) {
+			st->live_vblks++;
+			if (ref->info)
+				nilfs_assess_note_live(ref->info, vdesc,
+						       protcno);
+		} else {
+			st->defunct_vblks++;
+			st->freed_vblks++;
+		}
+	}
+	nilfs_snapshot_index_destroy(&ssi);
+
+	ret = nilfs_get_bdesc(nilfs, bdescv);
+	if (unlikely(ret < 0))
+		return -1;
+
+	for (i = 0; i < nilfs_vector_get_size(bdescv); i++) {
+		bdesc = nilfs_vector_get_element(bdescv, i);
+		ref = nilfs_lookup_segref(refs, nrefs, bdesc->bd_oblocknr,
+					  blocks_per_segment);
+		assert(ref != NULL);
+		st = ref->stat;
+		if (nilfs_bdesc_is_live(bdesc))
+			st->live_pblks++;
+		else
+			st->defunct_pblks++;
+	}
+
+	for (i = 0; i < nrefs; i++) {
+		st = refs[i].stat;
+		st->live_blks = st->live_vblks + st->live_pblks;
+		st->defunct_blks = blocks_per_segment - st->live_blks;
+		if (refs[i].info && st->live_vblks > 0) {
+			refs[i].info->birth_cno /= st->live_vblks;
+			refs[i].info->flags |= NILFS_ASSESS_INFO_BIRTH;
+		}
+	}
+	return 0;
+}
+
+/**
+ * nilfs_segment_changed - test if a segment changed since it was assessed
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @si: usage information of the segment taken before the assessment
+ * @seqnum: sequence number of the segment read by the assessment
+ * @si2: current usage information of the segment
+ *
+ * Any log written to the segment updates its lastmod and block count,
+ * and freeing it clears its dirty flag.  A segment that was freed and
+ * rewritten within the same second with the same number of blocks is
+ * caught by the sequence number, which is only read for segments whose
+ * summaries were parsed.
+ */
+static int nilfs_segment_changed(struct nilfs *nilfs, uint64_t segnum,
+				 const struct nilfs_suinfo *si, uint64_t seqnum,
+				 const struct nilfs_suinfo *si2)
+{
+	uint64_t seqnum2;
+
+	if (si2->sui_lastmod != si->sui_lastmod ||
+	    si2->sui_nblocks != si->sui_nblocks ||
+	    si2->sui_flags != si->sui_flags)
+		return 1;
+	if (seqnum == 0)
+		return 0;
+	if (unlikely(nilfs_get_segment_seqnum(nilfs, segnum, &seqnum2) < 0))
+		return -1;
+	return seqnum2 != seqnum;
+}
+
+/**
+ * nilfs_assess_chunk_nolock - assess segments without the cleaner lock
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array (NILFS_GC_NASSESS at most)
+ * @protseq: start of sequence number of protected segments
+ * @protcno: start number of checkpoint to be protected
+ * @ss: checkpoint numbers of snapshots
+ * @nss: size of @ss array
+ * @vdescv: vector object to store (descriptors of) virtual block numbers
+ * @bdescv: vector object to store (descriptors of) disk block numbers
+ * @stats: array of per-segment statistics corresponding to @segnums
+ * @infos: array of per-segment details corresponding to @segnums
+ * (optional)
+ *
+ * The GC may reclaim, and the log writer may reuse, any of the segments
+ * while they are being assessed.  Each segment is therefore checked
+ * afterwards and the ones that changed are assessed once more.  If a
+ * segment changes again, it is busy; it is reported as protected.
+ */
+static int nilfs_assess_chunk_nolock(struct nilfs *nilfs,
+				     const uint64_t *segnums, size_t nsegs,
+				     uint64_t protseq, nilfs_cno_t protcno,
+				     const nilfs_cno_t *ss, size_t nss,
+				     struct nilfs_sumcache *cache,
+				     struct nilfs_vector *vdescv,
+				     struct nilfs_vector *bdescv,
+				     struct nilfs_reclaim_stat *stats,
+				     struct nilfs_assess_info *infos)
+{
+	struct nilfs_suinfo si[NILFS_GC_NASSESS], si2[NILFS_GC_NASSESS];
+	uint64_t seqnums[NILFS_GC_NASSESS], retry[NILFS_GC_NASSESS];
+	size_t index[NILFS_GC_NASSESS];
+	struct nilfs_reclaim_stat rstats[NILFS_GC_NASSESS];
+	struct nilfs_assess_info rinfos[NILFS_GC_NASSESS];
+	size_t i, nretry = 0;
+	int pass, ret;
+
+	ret = nilfs_assess_chunk(nilfs, segnums, nsegs, protseq, protcno,
+				 ss, nss, cache, vdescv, bdescv, si, seqnums,
+				 stats, infos);
+	if (unlikely(ret < 0))
+		return -1;
+
+	for (pass = 0; pass < 2; pass++) {
+		const uint64_t *sn = pass ? retry : segnums;
+		size_t n = pass ? nretry : nsegs, nchanged = 0;
+
+		ret = nilfs_get_suinfo_segnums(nilfs, sn, n, si2);
+		if (unlikely(ret < 0))
+			return -1;
+
+		for (i = 0; i < n; i++) {
+			ret = nilfs_segment_changed(nilfs, sn[i], &si[i],
+						    seqnums[i], &si2[i]);
+			if (unlikely(ret < 0))
+				return -1;
+			if (!ret) {
+				if (pass) {
+					stats[index[i]] = rstats[i];
+					if (infos)
+						infos[index[i]] = rinfos[i];
+				}
+				continue;
+			}
+			/* summaries parsed in flux may have been cached */
+			if (cache)
+				nilfs_sumcache_invalidate(cache, sn[i]);
+			if (pass) {
+				/* still changing; leave it to a later scan */
+				memset(&stats[index[i]], 0, sizeof(*stats));
+				stats[index[i]].protected_segs = 1;
+				if (infos)
+					memset(&infos[index[i]], 0,
+					       sizeof(*infos));
+				continue;
+			}
+			index[nchanged] = i;
+			retry[nchanged++] = sn[i];
+		}
+		if (pass || nchanged == 0)
+			break;
+
+		nretry = nchanged;
+		memset(rstats, 0, sizeof(*rstats) * nretry);
+		memset(rinfos, 0, sizeof(*rinfos) * nretry);
+		ret = nilfs_assess_chunk(nilfs, retry, nretry, protseq,
+					 protcno, ss, nss, cache, vdescv,
+					 bdescv, si, seqnums, rstats,
+					 infos ? rinfos : NULL);
+		if (unlikely(ret < 0))
+			return -1;
+	}
+	return 0;
+}
+
+static int __nilfs_assess_segments(struct nilfs *nilfs,
+				   const uint64_t *segnums, size_t nsegs,
+				   const struct nilfs_reclaim_params *params,
+				   struct nilfs_reclaim_stat *stats,
+				   struct nilfs_assess_info *infos,
+				   int nolock)
+{
+	struct nilfs_suinfo si[NILFS_GC_NASSESS];
+	uint64_t seqnums[NILFS_GC_NASSESS];
+	struct nilfs_sumcache *cache = nilfs_reclaim_sumcache(params);
+	struct nilfs_vector *vdescv, *bdescv;
+	sigset_t sigset, oldset;
+	const nilfs_cno_t *ss;
+	nilfs_cno_t protcno;
+	ssize_t nss;
+	size_t i, count;
+	int ret = -1;
+
+	if (unlikely(!(params->flags & NILFS_RECLAIM_PARAM_PROTSEQ) ||
+	    (params->flags & (~0UL << __NR_NILFS_RECLAIM_PARAMS)))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (nsegs == 0)
+		return 0;
+
+	memset(stats, 0, sizeof(*stats) * nsegs);
+	if (infos)
+		memset(infos, 0, sizeof(*infos) * nsegs);
+	protcno = (params->flags & NILFS_RECLAIM_PARAM_PROTCNO) ?
+		params->protcno : NILFS_CNO_MAX;
+
+	vdescv = nilfs_vector_create(sizeof(struct nilfs_vdesc));
+	bdescv = nilfs_vector_create(sizeof(struct nilfs_bdesc));
+	if (unlikely(!vdescv || !bdescv))
+		goto out_vec;
+
+	if (nolock) {
+		nss = nilfs_get_snapshot(nilfs, 0, &ss);
+		if (unlikely(nss < 0))
+			goto out_vec;
+
+		for (i = 0; i < nsegs; i += count) {
+			count = min_t(size_t, nsegs - i, NILFS_GC_NASSESS);
+			ret = nilfs_assess_chunk_nolock(nilfs, segnums + i,
+							count, params->protseq,
+							protcno, ss, nss,
+							cache, vdescv, bdescv,
+							stats + i,
+							infos ? infos + i :
+							NULL);
+			if (unlikely(ret < 0))
+				break;
+		}
+		goto out_vec;
+	}
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	ret = sigprocmask(SIG_BLOCK, &sigset, &oldset);
+	if (unlikely(ret < 0)) {
+		nilfs_gc_logger(LOG_ERR, "cannot block signals: %s",
+				strerror(errno));
+		goto out_vec;
+	}
+
+	ret = nilfs_lock_cleaner(nilfs);
+	if (unlikely(ret < 0))
+		goto out_sig;
+
+	nss = nilfs_get_snapshot(nilfs, 0, &ss);
+	if (unlikely(nss < 0)) {
+		ret = -1;
+		goto out_lock;
+	}
+
+	for (i = 0; i < nsegs; i += count) {
+		count = min_t(size_t, nsegs - i, NILFS_GC_NASSESS);
+		ret = nilfs_assess_chunk(nilfs, segnums + i, count,
+					 params->protseq, protcno, ss, nss,
+					 cache, vdescv, bdescv, si, seqnums,
+					 stats + i, infos ? infos + i : NULL);
+		if (unlikely(ret < 0))
+			break;
+	}
+
+out_lock:
+	if (unlikely(nilfs_unlock_cleaner(nilfs) < 0)) {
+		nilfs_gc_logger(LOG_CRIT, "failed to unlock cleaner: %s",
+				strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+out_sig:
+	sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+out_vec:
+	nilfs_vector_destroy(vdescv);
+	nilfs_vector_destroy(bdescv);
+	return ret;
+}
+
+/**
+ * nilfs_assess_segments - assess multiple segments at once
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed (without duplicates)
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @stats: array of statistics to store the result of each segment
+ *
+ * This is a bulk version of nilfs_assess_segment().  Unlike calling
+ * it for each segment, the cleaner lock is taken and the snapshot list
+ * is read only once, and descriptors of blocks in different segments
+ * are merged into full batches of vinfo and bdescs requests.  Each
+ * element of @stats receives the statistics of the corresponding
+ * segment; a segment deselected as protected or unreclaimable has
+ * protected_segs set to 1 and cleaned_segs set to 0.
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_assess_segments(struct nilfs *nilfs,
+			  const uint64_t *segnums, size_t nsegs,
+			  const struct nilfs_reclaim_params *params,
+			  struct nilfs_reclaim_stat *stats)
+{
+	return __nilfs_assess_segments(nilfs, segnums, nsegs, params, stats,
+				       NULL, 0);
+}
+
+/**
+ * nilfs_assess_segments_nolock - assess segments without the cleaner lock
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed (without duplicates)
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @stats: array of statistics to store the result of each segment
+ *
+ * This is a read-only variant of nilfs_assess_segments() for monitoring
+ * and segment selection.  It neither takes the cleaner lock nor blocks
+ * signals, so it can run concurrently with a reclaim or other tools.
+ * Segments that change while they are assessed are detected afterwards
+ * from their usage information and sequence numbers and assessed again;
+ * a segment that keeps changing is reported as protected.  The snapshot
+ * list cached in @nilfs is used.
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_assess_segments_nolock(struct nilfs *nilfs,
+				 const uint64_t *segnums, size_t nsegs,
+				 const struct nilfs_reclaim_params *params,
+				 struct nilfs_reclaim_stat *stats)
+{
+	return __nilfs_assess_segments(nilfs, segnums, nsegs, params, stats,
+				       NULL, 1);
+}
+
+/**
+ * nilfs_xassess_segments_nolock - assess segments in detail without lock
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers to be assessed (without duplicates)
+ * @nsegs: size of the @segnums array
+ * @params: reclaim parameters
+ * @stats: array of statistics to store the result of each segment
+ * @infos: array to store details of each segment
+ *
+ * This is an extended version of nilfs_assess_segments_nolock() that
+ * also reports, in the corresponding element of @infos, details of each
+ * segment that do not fit in struct nilfs_reclaim_stat.  Fields whose
+ * flag is not set in the flags of an element are not valid.
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_xassess_segments_nolock(struct nilfs *nilfs,
+				  const uint64_t *segnums, size_t nsegs,
+				  const struct nilfs_reclaim_params *params,
+				  struct nilfs_reclaim_stat *stats,
+				  struct nilfs_assess_info *infos)
+{
+	return __nilfs_assess_segments(nilfs, segnums, nsegs, params, stats,
+				       infos, 1);
+}
+
 /**
  * nilfs_reclaim_segment - reclaim segments
  * @nilfs: nilfs object
@@ -66,10 +66,18 @@
 #include <time.h>
 #endif	/* HAVE_TIME_H */
 
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif	/* HAVE_SYS_UIO_H */
+
 #if HAVE_LINUX_TYPES_H
 #include <linux/types.h>
 #endif	/* HAVE_LINUX_TYPES_H */
 
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif	/* HAVE_LIBURING */
+
 #include <linux/nilfs2_ondisk.h>
 #include <errno.h>
 #include <assert.h>
@@ -91,6 +99,19 @@
  * @n_mincno: the minimum of valid checkpoint numbers
  * @n_sems: array of semaphores
  *     sems[0] protects garbage collection process
+ * @n_ss: cached checkpoint numbers of snapshots
+ * @n_nss: number of entries in @n_ss
+ * @n_ss_nsss: number of snapshots in cpstat when @n_ss was read
+ * @n_ss_cno: latest checkpoint number when @n_ss was read
+ * @n_ss_valid: flag to indicate that @n_ss holds a complete snapshot list
+ * @n_map: read-only mapping of the whole device, MAP_FAILED if it is not
+ *         available, or NULL if it has not been tried
+ * @n_mapsize: size of @n_map
+ * @n_segpool: pool of segment buffers (NULL until the first use)
+ * @n_ring: io_uring instance reading segments in batches, or NULL
+ * @n_ring_tried: flag to indicate that setting up @n_ring has been tried
+ * @n_iob: batch size states of ioctl requests (NILFS_IOCTL_BATCH_*)
+ * @n_iob_target: latency target of adaptive batch sizes in nanoseconds
  */
 struct nilfs {
 	struct nilfs_super_block *n_sb;
@@ -102,11 +123,24 @@ struct nilfs {
 	int n_opts;
 	nilfs_cno_t n_mincno;
 	sem_t *n_sems[1];
+	nilfs_cno_t *n_ss;
+	size_t n_nss;
+	uint64_t n_ss_nsss;
+	nilfs_cno_t n_ss_cno;
+	int n_ss_valid;
+	void *n_map;
+	size_t n_mapsize;
+	struct nilfs_segpool *n_segpool;
+	struct nilfs_ring *n_ring;
+	int n_ring_tried;
+	struct nilfs_ioctl_batch *n_iob;
+	uint64_t n_iob_target;
 };
 
 enum {
 	NILFS_OPT_MMAP,
 	NILFS_OPT_SET_SUINFO,
+	NILFS_OPT_HUGEPAGE,
 	__NR_NILFS_OPT,
 };
 
@@ -114,6 +148,8 @@ enum {
 #define MNTOPT_RW	"rw"
 #define MNTOPT_RO	"ro"
 
+#define NILFS_IOCTL_LATENCY_DEFAULT	1000	/* usecs per adaptive batch */
+
 #ifndef LINE_MAX
 #define LINE_MAX	2048
 #endif	/* LINE_MAX */
@@ -359,6 +395,538 @@ int nilfs_opt_clear(struct nilfs *nilfs, unsigned int index)
 	return 0;
 }
 
+/**
+ * struct nilfs_ioctl_batch - batch size state of an ioctl request
+ * @nitems: number of items requested per call
+ * @adaptive: flag to adapt @nitems to the latency target
+ * @stat: statistics of the calls
+ *
+ * This lives outside of the nilfs object so that it can be updated
+ * through the const nilfs objects that the getters of information take.
+ */
+struct nilfs_ioctl_batch {
+	size_t nitems;
+	int adaptive;
+	struct nilfs_ioctl_stat stat;
+};
+
+/**
+ * nilfs_set_ioctl_batch - set the number of items per ioctl request
+ * @nilfs: nilfs object
+ * @type: type of the request (NILFS_IOCTL_BATCH_*)
+ * @nitems: number of items per call, or NILFS_IOCTL_BATCH_AUTO
+ *
+ * With NILFS_IOCTL_BATCH_AUTO, the number starts from the default and
+ * is doubled while a full call takes less than half the latency target,
+ * and halved when a call exceeds it.  Explicit numbers are clamped to
+ * the range from NILFS_IOCTL_BATCH_MIN to NILFS_IOCTL_BATCH_MAX.
+ */
+int nilfs_set_ioctl_batch(struct nilfs *nilfs, unsigned int type,
+			  size_t nitems)
+{
+	struct nilfs_ioctl_batch *iob;
+
+	if (unlikely(type >= __NR_NILFS_IOCTL_BATCH)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	iob = &nilfs->n_iob[type];
+	if (nitems == NILFS_IOCTL_BATCH_AUTO) {
+		if (!iob->adaptive)
+			iob->nitems = NILFS_IOCTL_BATCH_DEFAULT;
+		iob->adaptive = 1;
+	} else {
+		iob->nitems = max_t(size_t, NILFS_IOCTL_BATCH_MIN,
+				    min_t(size_t, nitems,
+					  NILFS_IOCTL_BATCH_MAX));
+		iob->adaptive = 0;
+	}
+	return 0;
+}
+
+/**
+ * nilfs_get_ioctl_batch - get the number of items per ioctl request
+ * @nilfs: nilfs object
+ * @type: type of the request (NILFS_IOCTL_BATCH_*)
+ *
+ * Callers splitting a large request should size each call with this,
+ * since it changes over time in the adaptive mode.
+ */
+size_t nilfs_get_ioctl_batch(const struct nilfs *nilfs, unsigned int type)
+{
+	if (unlikely(type >= __NR_NILFS_IOCTL_BATCH))
+		return NILFS_IOCTL_BATCH_DEFAULT;
+	return nilfs->n_iob[type].nitems;
+}
+
+/**
+ * nilfs_set_ioctl_latency - set the latency target of adaptive batches
+ * @nilfs: nilfs object
+ * @usecs: target time of an ioctl call in microseconds
+ */
+int nilfs_set_ioctl_latency(struct nilfs *nilfs, unsigned long usecs)
+{
+	if (unlikely(usecs == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	nilfs->n_iob_target = (uint64_t)usecs * 1000;
+	return 0;
+}
+
+/**
+ * nilfs_get_ioctl_stat - get statistics of ioctl requests
+ * @nilfs: nilfs object
+ * @type: type of the request (NILFS_IOCTL_BATCH_*)
+ * @stat: buffer to store the statistics accumulated since the open
+ */
+int nilfs_get_ioctl_stat(const struct nilfs *nilfs, unsigned int type,
+			 struct nilfs_ioctl_stat *stat)
+{
+	if (unlikely(type >= __NR_NILFS_IOCTL_BATCH)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*stat = nilfs->n_iob[type].stat;
+	return 0;
+}
+
+/**
+ * nilfs_copy_options - copy options and tunables to another nilfs object
+ * @dst: nilfs object to be set up
+ * @src: nilfs object to copy from
+ *
+ * This is meant for helper threads opening the same file system on
+ * their own.  Statistics are not copied.
+ */
+void nilfs_copy_options(struct nilfs *dst, const struct nilfs *src)
+{
+	int i;
+
+	dst->n_opts = src->n_opts;
+	dst->n_iob_target = src->n_iob_target;
+	for (i = 0; i < __NR_NILFS_IOCTL_BATCH; i++) {
+		dst->n_iob[i].nitems = src->n_iob[i].nitems;
+		dst->n_iob[i].adaptive = src->n_iob[i].adaptive;
+	}
+}
+
+static inline void nilfs_ioctl_start(struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/**
+ * nilfs_ioctl_done - account a completed ioctl request
+ * @nilfs: nilfs object
+ * @type: type of the request (NILFS_IOCTL_BATCH_*)
+ * @nitems: number of items requested
+ * @start: time when the request was issued
+ */
+static void nilfs_ioctl_done(const struct nilfs *nilfs, unsigned int type,
+			     size_t nitems, const struct timespec *start)
+{
+	struct nilfs_ioctl_batch *iob = &nilfs->n_iob[type];
+	struct timespec now;
+	int64_t delta;
+	uint64_t elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	delta = (int64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+		(now.tv_nsec - start->tv_nsec);
+	elapsed = delta > 0 ? delta : 0;
+
+	iob->stat.ncalls++;
+	iob->stat.nitems += nitems;
+	iob->stat.nsecs += elapsed;
+
+	/* only full calls tell how long a batch takes */
+	if (!iob->adaptive || nitems < iob->nitems)
+		return;
+	if (elapsed * 2 <= nilfs->n_iob_target)
+		iob->nitems = min_t(size_t, iob->nitems * 2,
+				    NILFS_IOCTL_BATCH_MAX);
+	else if (elapsed > nilfs->n_iob_target)
+		iob->nitems = max_t(size_t, iob->nitems / 2,
+				    NILFS_IOCTL_BATCH_MIN);
+}
+
+/**
+ * struct nilfs_segbuf - header of a segment buffer
+ * @next: next free buffer in the pool
+ * @pool: pool owning the buffer
+ * @slot: index of the buffer in the table registered with the ring of
+ *        @pool, or -1 if it is not registered
+ *
+ * The header is placed right before the buffer in a page of its own, so
+ * that the buffer stays page-aligned.
+ */
+struct nilfs_segbuf {
+	struct nilfs_segbuf *next;
+	struct nilfs_segpool *pool;
+	int slot;
+};
+
+/**
+ * struct nilfs_segpool - pool of segment buffers
+ * @free: list of free buffers
+ * @nfree: number of buffers in @free
+ * @nbusy: number of buffers handed out to segment objects, and of
+ *         segment objects located in the mapping of the device
+ * @bufsize: size of each buffer, which is that of a full segment
+ * @hdrsize: size of the area preceding each buffer for its header
+ * @orphaned: flag to indicate that the nilfs object has been closed
+ * @map: mapping of the whole device handed over by the closed nilfs
+ *       object, or NULL
+ * @mapsize: size of @map
+ * @ring: ring that buffers of the pool are registered with, or NULL
+ *
+ * Buffers of released segments are kept for the following reads instead
+ * of being freed, up to NILFS_SEGPOOL_NFREE_MAX.  A pool belongs to a
+ * single nilfs object, which is not shared between threads, so it needs
+ * no locking.  The pool outlives the nilfs object if some segment
+ * objects still use its buffers or the mapping of the device; it then
+ * takes over the mapping, and both go away when the last of those
+ * segments is put.
+ */
+struct nilfs_segpool {
+	struct nilfs_segbuf *free;
+	size_t nfree;
+	size_t nbusy;
+	size_t bufsize;
+	size_t hdrsize;
+	int orphaned;
+	void *map;
+	size_t mapsize;
+	struct nilfs_ring *ring;
+};
+
+#define NILFS_SEGPOOL_NFREE_MAX		16
+
+static inline struct nilfs_segbuf *nilfs_segbuf_of(void *addr)
+{
+	return (struct nilfs_segbuf *)addr - 1;
+}
+
+#ifdef HAVE_LIBURING
+#define NILFS_RING_DEPTH	64	/* entries of the submission queue */
+#define NILFS_RING_NSLOTS	64	/* slots of the buffer table */
+
+/**
+ * struct nilfs_ring - io_uring instance reading segments in batches
+ * @ring: io_uring instance
+ * @fixed: flag to indicate that buffers can be registered with @ring
+ * @slots: buffer registered in each slot of the table, or NULL
+ *
+ * Pool buffers are registered with the ring when they are first read
+ * into, and stay registered until they are freed, so the pages of a
+ * buffer are pinned once instead of on every read.  Buffers that find
+ * no free slot are read without registration.
+ */
+struct nilfs_ring {
+	struct io_uring ring;
+	int fixed;
+	struct nilfs_segbuf *slots[NILFS_RING_NSLOTS];
+};
+
+/**
+ * nilfs_ring_get - get the io_uring instance of a nilfs object
+ * @nilfs: nilfs object
+ *
+ * The ring is set up at the first call and kept until the nilfs object
+ * is closed.
+ *
+ * Return: the ring, or NULL if io_uring is not available.
+ */
+static struct nilfs_ring *nilfs_ring_get(struct nilfs *nilfs)
+{
+	struct nilfs_ring *ring;
+	int errsv = errno;
+
+	if (nilfs->n_ring != NULL || nilfs->n_ring_tried)
+		return nilfs->n_ring;
+
+	nilfs->n_ring_tried = 1;
+	ring = calloc(1, sizeof(*ring));
+	if (unlikely(ring == NULL))
+		goto out;
+
+	if (io_uring_queue_init(NILFS_RING_DEPTH, &ring->ring, 0) < 0) {
+		free(ring);
+		goto out;
+	}
+	ring->fixed = io_uring_register_buffers_sparse(
+		&ring->ring, NILFS_RING_NSLOTS) == 0;
+
+	nilfs->n_ring = ring;
+	if (nilfs->n_segpool != NULL)
+		nilfs->n_segpool->ring = ring;
+out:
+	errno = errsv;
+	return nilfs->n_ring;
+}
+
+/**
+ * nilfs_ring_destroy - tear down the io_uring instance of a nilfs object
+ * @nilfs: nilfs object
+ *
+ * Reads still in flight are waited for, and the buffer table goes away
+ * with the ring.  The ring is not set up again for @nilfs.
+ */
+static void nilfs_ring_destroy(struct nilfs *nilfs)
+{
+	struct nilfs_ring *ring = nilfs->n_ring;
+
+	if (ring == NULL)
+		return;
+
+	if (nilfs->n_segpool != NULL)
+		nilfs->n_segpool->ring = NULL;
+	io_uring_queue_exit(&ring->ring);
+	free(ring);
+	nilfs->n_ring = NULL;
+}
+
+/**
+ * nilfs_ring_register - register a pool buffer with the ring
+ * @ring: io_uring instance
+ * @buf: header of the buffer
+ *
+ * Return: slot of @buf in the buffer table, or -1 if it is not
+ * registered.
+ */
+static int nilfs_ring_register(struct nilfs_ring *ring,
+			       struct nilfs_segbuf *buf)
+{
+	struct iovec iov;
+	int i;
+
+	if (buf->slot >= 0 || !ring->fixed)
+		return buf->slot;
+
+	for (i = 0; i < NILFS_RING_NSLOTS; i++)
+		if (ring->slots[i] == NULL)
+			break;
+	if (i == NILFS_RING_NSLOTS)
+		return -1;
+
+	iov.iov_base = buf + 1;
+	iov.iov_len = buf->pool->bufsize;
+	if (io_uring_register_buffers_update_tag(&ring->ring, i, &iov, NULL,
+						 1) < 0) {
+		/* e.g. RLIMIT_MEMLOCK is reached; do not try again */
+		ring->fixed = 0;
+		return -1;
+	}
+	ring->slots[i] = buf;
+	buf->slot = i;
+	return i;
+}
+
+static void nilfs_ring_unregister(struct nilfs_ring *ring,
+				  struct nilfs_segbuf *buf)
+{
+	struct iovec iov = { NULL, 0 };
+
+	io_uring_register_buffers_update_tag(&ring->ring, buf->slot, &iov,
+					     NULL, 1);
+	ring->slots[buf->slot] = NULL;
+	buf->slot = -1;
+}
+#else
+static inline void nilfs_ring_destroy(struct nilfs *nilfs)
+{
+}
+#endif	/* HAVE_LIBURING */
+
+static void nilfs_segbuf_free(struct nilfs_segbuf *buf)
+{
+#ifdef HAVE_LIBURING
+	if (buf->slot >= 0 && buf->pool->ring != NULL)
+		nilfs_ring_unregister(buf->pool->ring, buf);
+#endif	/* HAVE_LIBURING */
+	free((char *)(buf + 1) - buf->pool->hdrsize);
+}
+
+static void nilfs_unmap_device(void *map, size_t mapsize)
+{
+#ifdef HAVE_MMAP
+	if (map != NULL)
+		munmap(map, mapsize);
+#endif	/* HAVE_MMAP */
+}
+
+static struct nilfs_segpool *nilfs_segpool_of(struct nilfs *nilfs,
+					      long pagesize)
+{
+	struct nilfs_segpool *pool = nilfs->n_segpool;
+
+	if (pool == NULL) {
+		pool = malloc(sizeof(*pool));
+		if (unlikely(pool == NULL))
+			return NULL;
+		pool->free = NULL;
+		pool->nfree = 0;
+		pool->nbusy = 0;
+		pool->bufsize = (size_t)nilfs_get_blocks_per_segment(nilfs) *
+			nilfs_get_block_size(nilfs);
+		pool->hdrsize = pagesize;
+		pool->orphaned = 0;
+		pool->map = NULL;
+		pool->mapsize = 0;
+		pool->ring = nilfs->n_ring;
+		nilfs->n_segpool = pool;
+	}
+	return pool;
+}
+
+static void *nilfs_segpool_get(struct nilfs *nilfs, size_t segsize,
+			       long pagesize)
+{
+	struct nilfs_segpool *pool;
+	struct nilfs_segbuf *buf;
+	void *base;
+	int ret;
+
+	pool = nilfs_segpool_of(nilfs, pagesize);
+	if (unlikely(pool == NULL))
+		return NULL;
+
+	if (unlikely(segsize > pool->bufsize)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	buf = pool->free;
+	if (buf != NULL) {
+		pool->free = buf->next;
+		pool->nfree--;
+		goto out;
+	}
+
+	ret = posix_memalign(&base, pagesize, pool->hdrsize + pool->bufsize);
+	if (unlikely(ret != 0)) {
+		errno = ret;
+		return NULL;
+	}
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+	if (nilfs_opt_test_hugepage(nilfs))
+		madvise(base + pool->hdrsize, pool->bufsize, MADV_HUGEPAGE);
+#endif	/* HAVE_MADVISE && MADV_HUGEPAGE */
+	buf = nilfs_segbuf_of(base + pool->hdrsize);
+	buf->pool = pool;
+	buf->slot = -1;
+out:
+	buf->next = NULL;
+	pool->nbusy++;
+	return buf + 1;
+}
+
+/**
+ * nilfs_segpool_put - give back a buffer or a reference to the mapping
+ * @pool: segment buffer pool
+ * @addr: buffer taken from @pool, or NULL for a segment located in the
+ *        mapping of the device
+ */
+static void nilfs_segpool_put(struct nilfs_segpool *pool, void *addr)
+{
+	struct nilfs_segbuf *buf;
+
+	pool->nbusy--;
+	if (addr != NULL) {
+		buf = nilfs_segbuf_of(addr);
+		if (!pool->orphaned && pool->nfree < NILFS_SEGPOOL_NFREE_MAX) {
+			buf->next = pool->free;
+			pool->free = buf;
+			pool->nfree++;
+			return;
+		}
+		nilfs_segbuf_free(buf);
+	}
+	if (pool->orphaned && pool->nbusy == 0) {
+		nilfs_unmap_device(pool->map, pool->mapsize);
+		free(pool);
+	}
+}
+
+/**
+ * nilfs_segpool_release - give up a pool with its nilfs object
+ * @pool: segment buffer pool, or NULL if it was never used
+ * @map: mapping of the whole device, or NULL
+ * @mapsize: size of @map
+ *
+ * Free buffers are freed at once.  If segment objects still use the
+ * pool, it is orphaned instead and takes over @map, and both are freed
+ * when the last of those segments is put.
+ */
+static void nilfs_segpool_release(struct nilfs_segpool *pool, void *map,
+				  size_t mapsize)
+{
+	struct nilfs_segbuf *buf;
+
+	if (pool == NULL) {
+		nilfs_unmap_device(map, mapsize);
+		return;
+	}
+
+	while ((buf = pool->free) != NULL) {
+		pool->free = buf->next;
+		nilfs_segbuf_free(buf);
+	}
+	pool->nfree = 0;
+	if (pool->nbusy == 0) {
+		nilfs_unmap_device(map, mapsize);
+		free(pool);
+	} else {
+		pool->orphaned = 1;
+		pool->map = map;
+		pool->mapsize = mapsize;
+	}
+}
+
+/**
+ * nilfs_map_device - get the read-only mapping of the whole device
+ * @nilfs: nilfs object
+ *
+ * The mapping is made at the first call and kept until the nilfs object
+ * is closed, so segments can be accessed by pointer arithmetic instead of
+ * a pair of mmap() and munmap() calls.  It is only tried where the
+ * address space is large enough to hold the device comfortably.
+ *
+ * Return: start address of the mapping, or NULL if it is not available.
+ */
+static void *nilfs_map_device(struct nilfs *nilfs)
+{
+#ifdef HAVE_MMAP
+	uint64_t size;
+	int errsv = errno;
+
+	if (nilfs->n_map != NULL)
+		goto out;
+
+	nilfs->n_map = MAP_FAILED;
+	if (sizeof(void *) < sizeof(uint64_t))
+		goto out;
+
+	size = nilfs_get_nsegments(nilfs) *
+		nilfs_get_blocks_per_segment(nilfs) *
+		nilfs_get_block_size(nilfs);
+	if (unlikely(size == 0 || size > SIZE_MAX))
+		goto out;
+
+	nilfs->n_map = mmap(0, size, PROT_READ, MAP_SHARED,
+			    nilfs->n_devfd, 0);
+	if (nilfs->n_map != MAP_FAILED)
+		nilfs->n_mapsize = size;
+	errno = errsv;
+out:
+	return nilfs->n_map != MAP_FAILED ? nilfs->n_map : NULL;
+#else
+	return NULL;
+#endif	/* HAVE_MMAP */
+}
+
 static int nilfs_open_sem(struct nilfs *nilfs)
 {
 	char semnambuf[NAME_MAX - 4];
@@ -406,7 +974,7 @@ struct nilfs *nilfs_open(const char *dev, const char *dir, int flags)
 {
 	struct nilfs *nilfs;
 	uint64_t features;
-	int ret;
+	int i, ret;
 
 	if (unlikely(!(flags & (NILFS_OPEN_RAW | NILFS_OPEN_RDONLY |
 				NILFS_OPEN_WRONLY | NILFS_OPEN_RDWR)))) {
@@ -426,6 +994,21 @@ struct nilfs *nilfs_open(const char *dev, const char *dir, int flags)
 	nilfs->n_opts = 0;
 	nilfs->n_mincno = NILFS_CNO_MIN;
 	memset(nilfs->n_sems, 0, sizeof(nilfs->n_sems));
+	nilfs->n_ss = NULL;
+	nilfs->n_nss = 0;
+	nilfs->n_ss_valid = 0;
+	nilfs->n_map = NULL;
+	nilfs->n_mapsize = 0;
+	nilfs->n_segpool = NULL;
+	nilfs->n_ring = NULL;
+	nilfs->n_ring_tried = 0;
+	nilfs->n_iob_target = NILFS_IOCTL_LATENCY_DEFAULT * 1000;
+
+	nilfs->n_iob = calloc(__NR_NILFS_IOCTL_BATCH, sizeof(*nilfs->n_iob));
+	if (unlikely(nilfs->n_iob == NULL))
+		goto out_fd;
+	for (i = 0; i < __NR_NILFS_IOCTL_BATCH; i++)
+		nilfs->n_iob[i].nitems = NILFS_IOCTL_BATCH_DEFAULT;
 
 	if (flags & NILFS_OPEN_RAW) {
 		if (dev == NULL) {
@@ -505,6 +1088,7 @@ out_fd:
 	if (nilfs->n_iocfd >= 0)
 		close(nilfs->n_iocfd);
 
+	free(nilfs->n_iob);
 	free(nilfs->n_dev);
 	free(nilfs->n_ioc);
 	free(nilfs->n_sb);
@@ -515,9 +1099,21 @@ out_fd:
 /**
  * nilfs_close - destroy a NILFS object
  * @nilfs: NILFS object
+ *
+ * Segments obtained from the object may still be held after this; the
+ * buffers and the mapping of the device that they use are freed when
+ * the last of them is put.
  */
 void nilfs_close(struct nilfs *nilfs)
 {
+	void *map = NULL;
+
+#ifdef HAVE_MMAP
+	if (nilfs->n_map != MAP_FAILED)
+		map = nilfs->n_map;
+#endif	/* HAVE_MMAP */
+	nilfs_ring_destroy(nilfs);
+	nilfs_segpool_release(nilfs->n_segpool, map, nilfs->n_mapsize);
 	if (nilfs->n_sems[0] != NULL)
 		sem_close(nilfs->n_sems[0]);
 	if (nilfs->n_devfd >= 0)
@@ -525,6 +1121,8 @@ void nilfs_close(struct nilfs *nilfs)
 	if (nilfs->n_iocfd >= 0)
 		close(nilfs->n_iocfd);
 
+	free(nilfs->n_ss);
+	free(nilfs->n_iob);
 	free(nilfs->n_dev);
 	free(nilfs->n_ioc);
 	free(nilfs->n_sb);
@@ -644,6 +1242,7 @@ ssize_t nilfs_get_cpinfo(struct nilfs *nilfs, nilfs_cno_t cno, int mode,
 			 struct nilfs_cpinfo *cpinfo, size_t nci)
 {
 	struct nilfs_argv argv;
+	struct timespec start;
 	int ret;
 
 	if (unlikely(nilfs->n_iocfd < 0)) {
@@ -663,9 +1262,11 @@ ssize_t nilfs_get_cpinfo(struct nilfs *nilfs, nilfs_cno_t cno, int mode,
 	argv.v_size = sizeof(struct nilfs_cpinfo);
 	argv.v_index = cno;
 	argv.v_flags = mode;
+	nilfs_ioctl_start(&start);
 	ret = ioctl(nilfs->n_iocfd, NILFS_IOCTL_GET_CPINFO, &argv);
 	if (unlikely(ret < 0))
 		return -1;
+	nilfs_ioctl_done(nilfs, NILFS_IOCTL_BATCH_CPINFO, nci, &start);
 	if (mode == NILFS_CHECKPOINT && argv.v_nmembs > 0 &&
 	    cno == nilfs->n_mincno) {
 		if (cpinfo[0].ci_cno > nilfs->n_mincno)
@@ -674,6 +1275,104 @@ ssize_t nilfs_get_cpinfo(struct nilfs *nilfs, nilfs_cno_t cno, int mode,
 	return argv.v_nmembs;
 }
 
+/**
+ * nilfs_get_snapshot_list - get checkpoint numbers of snapshots
+ * @nilfs: nilfs object
+ * @refresh: flag to force reading the list from the checkpoint file
+ * @ssp: place to store a pointer to the array of snapshot numbers
+ * @nsssp: place to store the number of snapshots in cpstat, or NULL
+ *
+ * The list is kept in @nilfs and reused as long as the number of
+ * snapshots and the latest checkpoint number in cpstat are unchanged,
+ * so that repeated callers only pay for a GET_CPSTAT.  Since turning one
+ * checkpoint into a snapshot and another back within the same
+ * checkpoint does not change these counters, callers that delete
+ * blocks based on the list should set @refresh.
+ *
+ * If fewer snapshots are found than cpstat counts, the short list is
+ * returned but not kept, so the next call reads it again; callers can
+ * detect this by comparing the return value with *@nsssp.
+ *
+ * The array is owned by @nilfs and stays valid until the next call.
+ *
+ * Return: number of snapshots, or -1 with errno set.  errno is EIO if
+ * the snapshot numbers are not in ascending order.
+ */
+ssize_t nilfs_get_snapshot_list(struct nilfs *nilfs, int refresh,
+				const nilfs_cno_t **ssp, uint64_t *nsssp)
+{
+	struct nilfs_cpinfo *cpinfo = NULL;
+	struct nilfs_cpstat cpstat;
+	nilfs_cno_t cno, *ss, prev = 0;
+	size_t nss = 0, ncpinfo = 0, count;
+	ssize_t n;
+	int i, ret;
+
+	ret = nilfs_get_cpstat(nilfs, &cpstat);
+	if (unlikely(ret < 0))
+		return -1;
+	if (nsssp)
+		*nsssp = cpstat.cs_nsss;
+
+	if (!refresh && nilfs->n_ss_valid &&
+	    nilfs->n_ss_nsss == cpstat.cs_nsss &&
+	    nilfs->n_ss_cno == cpstat.cs_cno)
+		goto out;
+
+	nilfs->n_ss_valid = 0;
+	nilfs->n_nss = 0;
+	if (cpstat.cs_nsss > 0) {
+		ss = realloc(nilfs->n_ss, sizeof(*ss) * cpstat.cs_nsss);
+		if (unlikely(ss == NULL))
+			return -1;
+		nilfs->n_ss = ss;
+
+		cno = 0;
+		while (nss < cpstat.cs_nsss) {
+			count = min_t(uint64_t, cpstat.cs_nsss - nss,
+				      nilfs_get_ioctl_batch(
+					      nilfs, NILFS_IOCTL_BATCH_CPINFO));
+			if (count > ncpinfo) {
+				void *p = realloc(cpinfo,
+						  sizeof(*cpinfo) * count);
+
+				if (unlikely(p == NULL))
+					goto failed;
+				cpinfo = p;
+				ncpinfo = count;
+			}
+			n = nilfs_get_cpinfo(nilfs, cno, NILFS_SNAPSHOT, cpinfo,
+					     count);
+			if (unlikely(n < 0))
+				goto failed;
+			if (n == 0)
+				break;
+			for (i = 0; i < n; i++) {
+				if (unlikely(prev >= cpinfo[i].ci_cno)) {
+					errno = EIO;
+					goto failed;
+				}
+				ss[nss++] = prev = cpinfo[i].ci_cno;
+			}
+			cno = cpinfo[n - 1].ci_next;
+			if (cno == 0)
+				break;
+		}
+		free(cpinfo);
+	}
+	nilfs->n_nss = nss;
+	nilfs->n_ss_nsss = cpstat.cs_nsss;
+	nilfs->n_ss_cno = cpstat.cs_cno;
+	nilfs->n_ss_valid = (nss == cpstat.cs_nsss);
+out:
+	*ssp = nilfs->n_ss;
+	return nilfs->n_nss;
+
+failed:
+	free(cpinfo);
+	return -1;
+}
+
 /**
  * nilfs_delete_checkpoint - delete a checkpoint
  * @nilfs: nilfs object
@@ -787,6 +1486,7 @@ ssize_t nilfs_get_vinfo(const struct nilfs *nilfs,
 			struct nilfs_vinfo *vinfo, size_t nvi)
 {
 	struct nilfs_argv argv;
+	struct timespec start;
 	int ret;
 
 	if (unlikely(nilfs->n_iocfd < 0)) {
@@ -799,9 +1499,11 @@ ssize_t nilfs_get_vinfo(const struct nilfs *nilfs,
 	argv.v_size = sizeof(struct nilfs_vinfo);
 	argv.v_flags = 0;
 	argv.v_index = 0;
+	nilfs_ioctl_start(&start);
 	ret = ioctl(nilfs->n_iocfd, NILFS_IOCTL_GET_VINFO, &argv);
 	if (unlikely(ret < 0))
 		return -1;
+	nilfs_ioctl_done(nilfs, NILFS_IOCTL_BATCH_VINFO, nvi, &start);
 	return argv.v_nmembs;
 }
 
@@ -815,6 +1517,7 @@ ssize_t nilfs_get_bdescs(const struct nilfs *nilfs,
 			 struct nilfs_bdesc *bdescs, size_t nbdescs)
 {
 	struct nilfs_argv argv;
+	struct timespec start;
 	int ret;
 
 	if (unlikely(nilfs->n_iocfd < 0)) {
@@ -827,9 +1530,11 @@ ssize_t nilfs_get_bdescs(const struct nilfs *nilfs,
 	argv.v_size = sizeof(struct nilfs_bdesc);
 	argv.v_flags = 0;
 	argv.v_index = 0;
+	nilfs_ioctl_start(&start);
 	ret = ioctl(nilfs->n_iocfd, NILFS_IOCTL_GET_BDESCS, &argv);
 	if (unlikely(ret < 0))
 		return -1;
+	nilfs_ioctl_done(nilfs, NILFS_IOCTL_BATCH_BDESCS, nbdescs, &start);
 	return argv.v_nmembs;
 }
 
@@ -963,23 +1668,135 @@ int nilfs_thaw(struct nilfs *nilfs)
 }
 
 /**
- * nilfs_get_segment - read or mmap segment to a memory region
+ * nilfs_read_summary - read the summary blocks of a partial segment
+ * @devfd: file descriptor of the device
+ * @addr: buffer as large as the segment
+ * @segstart: byte offset of the segment on the device
+ * @nblocks: number of blocks in the segment
+ * @blkbits: bit shift for block size
+ * @blkoffp: block offset of the partial segment in the segment, which is
+ *           advanced to the next partial segment
+ *
+ * This reads one link of the chain of partial segments and places the
+ * summary where a read of the whole segment would put it.  The chain is
+ * followed while the summary looks sane; the partial segment iterator
+ * does the full validation.  A block at the end of the chain that is
+ * cut short by the end of the device is zero-filled.
+ *
+ * Return: 1 if the chain continues at *@blkoffp, 0 if it ends here, or
+ * -1 on error.
+ */
+static int nilfs_read_summary(int devfd, void *addr, off_t segstart,
+			      uint32_t nblocks, uint32_t blkbits,
+			      uint32_t *blkoffp)
+{
+	const size_t blksize = 1UL << blkbits;
+	struct nilfs_segment_summary *segsum;
+	uint32_t blkoff = *blkoffp, sumblks, psegblks;
+	size_t len;
+	ssize_t ret;
+
+	if (nblocks - blkoff < NILFS_PSEG_MIN_BLOCKS)
+		return 0;
+
+	segsum = addr + ((size_t)blkoff << blkbits);
+	ret = pread(devfd, segsum, blksize,
+		    segstart + ((off_t)blkoff << blkbits));
+	if (unlikely(ret < 0))
+		return -1;
+	if (unlikely(ret < blksize)) {
+		memset((void *)segsum + ret, 0, blksize - ret);
+		return 0;
+	}
+	if (le32_to_cpu(segsum->ss_magic) != NILFS_SEGSUM_MAGIC)
+		return 0;
+
+	/* read the rest of the summary for the checksum */
+	sumblks = min_t(uint64_t, nblocks - blkoff,
+			DIV_ROUND_UP((uint64_t)le32_to_cpu(segsum->ss_sumbytes),
+				     blksize));
+	if (sumblks > 1) {
+		len = (size_t)(sumblks - 1) << blkbits;
+		ret = pread(devfd, (void *)segsum + blksize, len,
+			    segstart + ((off_t)(blkoff + 1) << blkbits));
+		if (unlikely(ret < 0))
+			return -1;
+		if (unlikely(ret < len)) {
+			memset((void *)segsum + blksize + ret, 0, len - ret);
+			return 0;
+		}
+	}
+
+	psegblks = le32_to_cpu(segsum->ss_nblocks);
+	if (psegblks <= sumblks || psegblks > nblocks - blkoff)
+		return 0;
+	*blkoffp = blkoff + psegblks;
+	return 1;
+}
+
+/**
+ * nilfs_read_summaries - read summary blocks of a segment
+ * @devfd: file descriptor of the device
+ * @addr: buffer as large as the segment
+ * @segstart: byte offset of the segment on the device
+ * @nblocks: number of blocks in the segment
+ * @blkbits: bit shift for block size
+ *
+ * This follows the chain of partial segments from the head of the
+ * segment with small reads, so that the partial segment iterator sees
+ * the same data as with a full read.  Payload blocks are left unread.
+ */
+static int nilfs_read_summaries(int devfd, void *addr, off_t segstart,
+				uint32_t nblocks, uint32_t blkbits)
+{
+	uint32_t blkoff = 0;
+	int ret;
+
+	while ((ret = nilfs_read_summary(devfd, addr, segstart, nblocks,
+					 blkbits, &blkoff)) > 0)
+		;
+	return ret;
+}
+
+/**
+ * nilfs_advise_willneed - start reading a range of the device
+ * @devfd: file descriptor of the device
+ * @offset: byte offset of the range
+ * @len: length of the range in bytes
+ *
+ * This is only a hint, so errors are ignored.
+ */
+static inline void nilfs_advise_willneed(int devfd, off_t offset, off_t len)
+{
+#if HAVE_POSIX_FADVISE
+	posix_fadvise(devfd, offset, len, POSIX_FADV_WILLNEED);
+#endif	/* HAVE_POSIX_FADVISE */
+}
+
+/**
+ * nilfs_setup_segment - set up a segment object without reading it
  * @nilfs: nilfs object
  * @segnum: segment number
  * @segment: pointer to a segment object (nilfs_segment struct)
+ * @sumonly: flag to read only summary blocks later
+ *
+ * If the mmap option is set and the device supports it, the segment is
+ * located in the mapping of the whole device, or mapped on its own with
+ * mmap() if the device cannot be mapped as a whole.  Otherwise a buffer
+ * is taken from the segment buffer pool, and the caller reads the
+ * segment into it before calling nilfs_segment_set_seqnum().
  */
-int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
-		      struct nilfs_segment *segment)
+static int nilfs_setup_segment(struct nilfs *nilfs, uint64_t segnum,
+			       struct nilfs_segment *segment, int sumonly)
 {
 	const struct nilfs_super_block *sb = nilfs->n_sb;
-	struct nilfs_segment_summary *segsum;
+	struct nilfs_segpool *pool;
 	long pagesize;
 	uint32_t blocks_per_segment, blkbits, nblocks;
 	uint64_t segblocknr;
 	size_t segsize;
 	off_t segstart;
 	void *addr;
-	ssize_t ret;
 
 	if (unlikely(nilfs->n_devfd < 0 || sb == NULL)) {
 		errno = EBADF;
@@ -1023,6 +1840,21 @@ int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
 		size_t alloc_size, page_offset;
 		int errsv = errno;
 
+		addr = nilfs_map_device(nilfs);
+		if (addr != NULL) {
+			pool = nilfs_segpool_of(nilfs, pagesize);
+			if (unlikely(pool == NULL))
+				return -1;
+			pool->nbusy++;
+			addr += segstart;
+			segment->mmapped = 1;
+			segment->adjusted = 0;
+			segment->sumonly = 0;
+			segment->pooled = 1;
+			segment->pool = pool;
+			goto success;
+		}
+
 		page_offset = segstart % pagesize;
 		alloc_size = roundup(segsize + page_offset, pagesize);
 
@@ -1032,6 +1864,9 @@ int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
 			segment->mmapped = 1;
 			segment->adjusted = (page_offset != 0 ||
 					     alloc_size != pagesize);
+			segment->sumonly = 0;
+			segment->pooled = 0;
+			segment->pool = NULL;
 			goto success;
 		}
 
@@ -1045,24 +1880,21 @@ int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
 	}
 #endif	/* HAVE_MMAP */
 
-	addr = malloc(segsize);
+	addr = nilfs_segpool_get(nilfs, segsize, pagesize);
 	if (unlikely(addr == NULL))
 		return -1;
 
-	ret = pread(nilfs->n_devfd, addr, segsize, segstart);
-	if (unlikely(ret < 0)) {
-		free(addr);
-		return -1;
-	}
 	segment->mmapped = 0;
 	segment->adjusted = 0;
+	segment->sumonly = !!sumonly;
+	segment->pooled = 1;
+	segment->pool = nilfs->n_segpool;
 
 success:
 	segment->addr = addr;
 	segment->segsize = segsize;
 	segment->segnum = segnum;
-	segsum = addr;
-	segment->seqnum = le64_to_cpu(segsum->ss_seq);
+	segment->seqnum = 0;
 	segment->blocknr = segblocknr;
 	segment->nblocks = nblocks;
 	segment->blocks_per_segment = blocks_per_segment;
@@ -1071,12 +1903,407 @@ success:
 	return 0;
 }
 
+static inline off_t nilfs_segment_start(const struct nilfs_segment *segment)
+{
+	return (off_t)segment->blocknr << segment->blkbits;
+}
+
+static inline void nilfs_segment_set_seqnum(struct nilfs_segment *segment)
+{
+	struct nilfs_segment_summary *segsum = segment->addr;
+
+	segment->seqnum = le64_to_cpu(segsum->ss_seq);
+}
+
+static int __nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
+			       struct nilfs_segment *segment, int sumonly)
+{
+	ssize_t ret;
+
+	ret = nilfs_setup_segment(nilfs, segnum, segment, sumonly);
+	if (unlikely(ret < 0))
+		return -1;
+
+	if (!segment->mmapped) {
+		if (sumonly)
+			ret = nilfs_read_summaries(nilfs->n_devfd,
+						   segment->addr,
+						   nilfs_segment_start(segment),
+						   segment->nblocks,
+						   segment->blkbits);
+		else
+			ret = pread(nilfs->n_devfd, segment->addr,
+				    segment->segsize,
+				    nilfs_segment_start(segment));
+		if (unlikely(ret < 0)) {
+			nilfs_segpool_put(segment->pool, segment->addr);
+			return -1;
+		}
+	}
+	nilfs_segment_set_seqnum(segment);
+	return 0;
+}
+
+#define NILFS_READV_MAX	64	/* segments read by one preadv() */
+
+/**
+ * nilfs_read_segments - read the segments of a batch that are not mapped
+ * @nilfs: nilfs object
+ * @segments: array of segment objects set up for reading
+ * @nsegs: number of segments in @segments
+ *
+ * Each run of segments lying next to each other on the device is read
+ * with a single preadv() call.
+ *
+ * Return: 0 on success, or -1 on failure.
+ */
+static int nilfs_read_segments(struct nilfs *nilfs,
+			       struct nilfs_segment *segments, size_t nsegs)
+{
+	struct nilfs_segment *segment;
+	ssize_t ret;
+	size_t i;
+#ifdef HAVE_PREADV
+	struct iovec iov[NILFS_READV_MAX];
+	off_t start, end;
+	size_t j;
+	int niov;
+
+	for (i = 0; i < nsegs; i = j) {
+		j = i + 1;
+		if (segments[i].mmapped)
+			continue;
+
+		start = nilfs_segment_start(&segments[i]);
+		end = start;
+		for (j = i, niov = 0; j < nsegs && niov < NILFS_READV_MAX;
+		     j++, niov++) {
+			segment = &segments[j];
+			if (segment->mmapped ||
+			    nilfs_segment_start(segment) != end)
+				break;
+			iov[niov].iov_base = segment->addr;
+			iov[niov].iov_len = segment->segsize;
+			end += segment->segsize;
+		}
+		ret = preadv(nilfs->n_devfd, iov, niov, start);
+		if (unlikely(ret < 0))
+			return -1;
+	}
+#else
+	for (i = 0; i < nsegs; i++) {
+		segment = &segments[i];
+		if (segment->mmapped)
+			continue;
+		ret = pread(nilfs->n_devfd, segment->addr, segment->segsize,
+			    nilfs_segment_start(segment));
+		if (unlikely(ret < 0))
+			return -1;
+	}
+#endif	/* HAVE_PREADV */
+	return 0;
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * nilfs_ring_read_segments - read a batch of segments through io_uring
+ * @nilfs: nilfs object
+ * @segments: array of segment objects set up for reading
+ * @nsegs: number of segments in @segments
+ *
+ * A read of every segment that is not mapped is queued on the ring, into
+ * its pool buffer registered with the ring if a slot is available, and
+ * the whole batch is submitted with a single system call before any
+ * completion is waited for.  Batches larger than the ring are split.
+ * Short reads are completed with pread().
+ *
+ * If the ring cannot be set up or stops working, it is given up for the
+ * nilfs object and the caller reads the segments without it.
+ *
+ * Return: 0 on success, 1 if the ring is not available, or -1 on
+ * failure.
+ */
+static int nilfs_ring_read_segments(struct nilfs *nilfs,
+				    struct nilfs_segment *segments,
+				    size_t nsegs)
+{
+	struct nilfs_ring *ring = nilfs_ring_get(nilfs);
+	struct nilfs_segment *segment;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	size_t i = 0, off;
+	int nqueued, slot, ret, res, err = 0;
+
+	if (ring == NULL)
+		return 1;
+
+	while (i < nsegs) {
+		for (nqueued = 0; i < nsegs && nqueued < NILFS_RING_DEPTH;
+		     i++) {
+			segment = &segments[i];
+			if (segment->mmapped)
+				continue;
+			sqe = io_uring_get_sqe(&ring->ring);
+			if (unlikely(sqe == NULL))
+				goto broken;
+			slot = nilfs_ring_register(
+				ring, nilfs_segbuf_of(segment->addr));
+			if (slot >= 0)
+				io_uring_prep_read_fixed(
+					sqe, nilfs->n_devfd, segment->addr,
+					segment->segsize,
+					nilfs_segment_start(segment), slot);
+			else
+				io_uring_prep_read(
+					sqe, nilfs->n_devfd, segment->addr,
+					segment->segsize,
+					nilfs_segment_start(segment));
+			io_uring_sqe_set_data(sqe, segment);
+			nqueued++;
+		}
+		if (nqueued == 0)
+			continue;
+
+		ret = io_uring_submit(&ring->ring);
+		if (unlikely(ret != nqueued))
+			goto broken;
+
+		while (nqueued > 0) {
+			ret = io_uring_wait_cqe(&ring->ring, &cqe);
+			if (ret == -EINTR)
+				continue;
+			if (unlikely(ret < 0))
+				goto broken;
+			segment = io_uring_cqe_get_data(cqe);
+			res = cqe->res;
+			io_uring_cqe_seen(&ring->ring, cqe);
+			nqueued--;
+
+			if (unlikely(res < 0)) {
+				err = -res;
+				continue;
+			}
+			off = res;
+			if (unlikely(off < segment->segsize) && err == 0 &&
+			    pread(nilfs->n_devfd, segment->addr + off,
+				  segment->segsize - off,
+				  nilfs_segment_start(segment) + off) < 0)
+				err = errno;
+		}
+		if (unlikely(err)) {
+			errno = err;
+			return -1;
+		}
+	}
+	return 0;
+
+broken:
+	/* the reads in flight are waited for before the ring goes away */
+	nilfs_ring_destroy(nilfs);
+	return 1;
+}
+#else
+static inline int nilfs_ring_read_segments(struct nilfs *nilfs,
+					   struct nilfs_segment *segments,
+					   size_t nsegs)
+{
+	return 1;
+}
+#endif	/* HAVE_LIBURING */
+
+/**
+ * __nilfs_get_segments - read or mmap segments at once
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array
+ * @segments: array of segment objects corresponding to @segnums
+ * @sumonly: flag to read only summary blocks
+ *
+ * Reads of all the segments are issued to the device before waiting for
+ * any of them.  Whole segments are requested with one readahead each,
+ * and then read as one batch through io_uring where liburing is
+ * available and the ring can be set up, or with preadv() otherwise.
+ * Summary chains are followed breadth-first: in every round, the next
+ * summary of each segment is requested for all segments first and then
+ * read, so the device sees as many requests as there are segments
+ * instead of one at a time.
+ */
+static int __nilfs_get_segments(struct nilfs *nilfs, const uint64_t *segnums,
+				size_t nsegs, struct nilfs_segment *segments,
+				int sumonly)
+{
+	const uint32_t done = UINT32_MAX;
+	struct nilfs_segment *segment;
+	uint32_t *blkoffs = NULL;
+	size_t i, n, nactive;
+	ssize_t ret;
+
+	if (nsegs == 0)
+		return 0;
+
+	for (n = 0; n < nsegs; n++) {
+		ret = nilfs_setup_segment(nilfs, segnums[n], &segments[n],
+					  sumonly);
+		if (unlikely(ret < 0))
+			goto failed;
+	}
+
+	if (sumonly) {
+		blkoffs = malloc(sizeof(*blkoffs) * nsegs);
+		if (unlikely(blkoffs == NULL))
+			goto failed;
+	}
+
+	nactive = 0;
+	for (i = 0; i < nsegs; i++) {
+		segment = &segments[i];
+		if (segment->mmapped) {
+			/* head summary; the rest is faulted in on access */
+			nilfs_advise_willneed(nilfs->n_devfd,
+					      nilfs_segment_start(segment),
+					      (off_t)1 << segment->blkbits);
+			if (blkoffs)
+				blkoffs[i] = done;
+		} else if (!sumonly) {
+			nilfs_advise_willneed(nilfs->n_devfd,
+					      nilfs_segment_start(segment),
+					      segment->segsize);
+		} else {
+			blkoffs[i] = 0;
+			nactive++;
+		}
+	}
+
+	if (!sumonly) {
+		ret = nilfs_ring_read_segments(nilfs, segments, nsegs);
+		if (ret > 0)
+			ret = nilfs_read_segments(nilfs, segments, nsegs);
+		if (unlikely(ret < 0))
+			goto failed;
+	}
+
+	while (nactive > 0) {
+		for (i = 0; i < nsegs; i++) {
+			segment = &segments[i];
+			if (blkoffs[i] != done)
+				nilfs_advise_willneed(
+					nilfs->n_devfd,
+					nilfs_segment_start(segment) +
+					((off_t)blkoffs[i] << segment->blkbits),
+					(off_t)1 << segment->blkbits);
+		}
+		for (i = 0; i < nsegs; i++) {
+			segment = &segments[i];
+			if (blkoffs[i] == done)
+				continue;
+			ret = nilfs_read_summary(nilfs->n_devfd, segment->addr,
+						 nilfs_segment_start(segment),
+						 segment->nblocks,
+						 segment->blkbits, &blkoffs[i]);
+			if (unlikely(ret < 0))
+				goto failed;
+			if (ret == 0) {
+				blkoffs[i] = done;
+				nactive--;
+			}
+		}
+	}
+	free(blkoffs);
+
+	for (i = 0; i < nsegs; i++)
+		nilfs_segment_set_seqnum(&segments[i]);
+	return 0;
+
+failed:
+	free(blkoffs);
+	while (n > 0)
+		nilfs_put_segment(&segments[--n]);
+	return -1;
+}
+
+/**
+ * nilfs_get_segment - read or mmap segment to a memory region
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @segment: pointer to a segment object (nilfs_segment struct)
+ */
+int nilfs_get_segment(struct nilfs *nilfs, uint64_t segnum,
+		      struct nilfs_segment *segment)
+{
+	return __nilfs_get_segment(nilfs, segnum, segment, 0);
+}
+
+/**
+ * nilfs_get_segment_summary - read or mmap summaries of segment
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @segment: pointer to a segment object (nilfs_segment struct)
+ *
+ * This is a variant of nilfs_get_segment() for callers that only walk
+ * the segment with the partial segment, file, and block iterators.  If
+ * the segment is mapped with mmap(), it is the same as
+ * nilfs_get_segment().  Otherwise, only the summary blocks of the
+ * partial segments are read instead of the whole segment, and the
+ * contents of payload blocks in the buffer are undefined.
+ */
+int nilfs_get_segment_summary(struct nilfs *nilfs, uint64_t segnum,
+			      struct nilfs_segment *segment)
+{
+	return __nilfs_get_segment(nilfs, segnum, segment, 1);
+}
+
+/**
+ * nilfs_get_segments - read or mmap multiple segments at once
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array
+ * @segments: array of segment objects to store the segments
+ *
+ * This is a batch version of nilfs_get_segment().  Unlike calling it
+ * for each segment, the reads of all the segments are queued on the
+ * device before waiting for the first one.  On failure, no segment is
+ * left to be released.  The segments are released with
+ * nilfs_put_segments() or nilfs_put_segment() one by one.
+ */
+int nilfs_get_segments(struct nilfs *nilfs, const uint64_t *segnums,
+		       size_t nsegs, struct nilfs_segment *segments)
+{
+	return __nilfs_get_segments(nilfs, segnums, nsegs, segments, 0);
+}
+
+/**
+ * nilfs_get_segment_summaries - read or mmap summaries of multiple segments
+ * @nilfs: nilfs object
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array
+ * @segments: array of segment objects to store the segments
+ *
+ * This is a batch version of nilfs_get_segment_summary().  The chains
+ * of summaries are followed in parallel, with the reads of one link of
+ * every chain queued on the device at once.
+ */
+int nilfs_get_segment_summaries(struct nilfs *nilfs, const uint64_t *segnums,
+				size_t nsegs, struct nilfs_segment *segments)
+{
+	return __nilfs_get_segments(nilfs, segnums, nsegs, segments, 1);
+}
+
 /**
  * nilfs_put_segment - free memory used for raw segment access
  * @segment: pointer to the segment object to be cleaned up
+ *
+ * A buffer taken from the segment buffer pool is returned to it, and a
+ * segment located in the mapping of the whole device drops its
+ * reference to the mapping.
  */
 int nilfs_put_segment(struct nilfs_segment *segment)
 {
+	if (segment->pooled) {
+		nilfs_segpool_put(segment->pool, segment->mmapped ? NULL :
+				  segment->addr);
+		return 0;
+	}
+
 	if (segment->mmapped) {
 #ifdef HAVE_MMAP
 		size_t page_offset, size;
@@ -1106,6 +2333,24 @@ int nilfs_put_segment(struct nilfs_segment *segment)
 	return 0;
 }
 
+/**
+ * nilfs_put_segments - release multiple segments
+ * @segments: array of segment objects
+ * @nsegs: size of @segments array
+ *
+ * All the segments are released even if some of them fail.
+ */
+int nilfs_put_segments(struct nilfs_segment *segments, size_t nsegs)
+{
+	int ret = 0;
+	size_t i;
+
+	for (i = 0; i < nsegs; i++)
+		if (unlikely(nilfs_put_segment(&segments[i]) < 0))
+			ret = -1;
+	return ret;
+}
+
 /**
  * nilfs_get_segment_seqnum - get sequence number of segment
  * @nilfs: nilfs object
@@ -1145,6 +2390,64 @@ int nilfs_get_segment_seqnum(const struct nilfs *nilfs, uint64_t segnum,
 	return 0;
 }
 
+/**
+ * nilfs_readahead_segment - start reading a segment in the background
+ * @nilfs: nilfs object
+ * @segnum: segment number
+ * @nblocks: number of blocks written in the segment (sui_nblocks)
+ *
+ * This asks the kernel to bring the written part of the segment into
+ * the page cache of the device without waiting for it, so that a
+ * later nilfs_get_segment() or nilfs_get_segment_summary() does not
+ * block on it.  The summaries of partial segments are interleaved with
+ * their payload blocks, so the whole written part is requested; one
+ * large sequential read costs less than following the chain of
+ * summaries with small dependent reads.
+ *
+ * Return: 0 on success, or -1 on error.
+ */
+int nilfs_readahead_segment(const struct nilfs *nilfs, uint64_t segnum,
+			    uint32_t nblocks)
+{
+#if HAVE_POSIX_FADVISE
+	const struct nilfs_super_block *sb = nilfs->n_sb;
+	uint32_t blocks_per_segment, blkbits;
+	uint64_t segblocknr;
+	int ret;
+
+	if (unlikely(nilfs->n_devfd < 0 || sb == NULL)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (unlikely(segnum >= nilfs_get_nsegments(nilfs))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	blkbits = le32_to_cpu(sb->s_log_block_size) + 10;
+	blocks_per_segment = le32_to_cpu(sb->s_blocks_per_segment);
+	segblocknr = segnum == 0 ? le64_to_cpu(sb->s_first_data_block) :
+		(uint64_t)blocks_per_segment * segnum;
+	nblocks = min_t(uint64_t, nblocks,
+			(uint64_t)blocks_per_segment * (segnum + 1) -
+			segblocknr);
+	if (nblocks == 0)
+		return 0;
+
+	ret = posix_fadvise(nilfs->n_devfd, (off_t)(segblocknr << blkbits),
+			    (off_t)nblocks << blkbits, POSIX_FADV_WILLNEED);
+	if (unlikely(ret != 0)) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif	/* HAVE_POSIX_FADVISE */
+}
+
 nilfs_cno_t nilfs_get_oldest_cno(struct nilfs *nilfs)
 {
 	struct nilfs_cpinfo cpinfo[1];
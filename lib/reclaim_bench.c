@@ -0,0 +1,258 @@
+/*
+ * reclaim_bench.c - time the in-memory steps of a reclaim
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ *
+ * Usage: reclaim_bench [count]...
+ *
+ * Once the periods of the blocks of the victim segments are read from
+ * the DAT, a reclaim drops the descriptors of dead blocks, sorts the
+ * live ones in disk order and merges the periods of the dead ones; see
+ * nilfs_reclaim_batch_fill().  This times those steps of gc.c against
+ * the former ones, which deleted each run of dead descriptors and each
+ * run of merged periods with nilfs_vector_delete_elements() and sorted
+ * with qsort(), for the given numbers of vdescs.  Half of the blocks
+ * are dead, some of the others are held by one of a thousand snapshots,
+ * and the ioctls on either side are left out.
+ */
+
+#include "gc.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define RECLAIM_BENCH_NSS	1000		/* number of snapshots */
+#define RECLAIM_BENCH_PROTCNO	1000000		/* protection checkpoint */
+
+static double reclaim_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the former nilfs_vdesc_is_live() */
+static int reclaim_bench_is_live(const struct nilfs_vdesc *vdesc,
+				 nilfs_cno_t protect, const nilfs_cno_t *ss,
+				 size_t n, nilfs_cno_t *last_hit)
+{
+	long low, high, index;
+
+	if (vdesc->vd_cno == 0)
+		return vdesc->vd_period.p_end == NILFS_CNO_MAX;
+	if (vdesc->vd_period.p_end == vdesc->vd_cno)
+		return 0;
+	if (vdesc->vd_period.p_end == NILFS_CNO_MAX ||
+	    vdesc->vd_period.p_end > protect)
+		return 1;
+	if (n == 0 || vdesc->vd_period.p_start > ss[n - 1] ||
+	    vdesc->vd_period.p_end <= ss[0])
+		return 0;
+	if (*last_hit >= vdesc->vd_period.p_start &&
+	    *last_hit < vdesc->vd_period.p_end)
+		return 1;
+
+	low = 0;
+	high = n - 1;
+	while (low <= high) {
+		index = (low + high) / 2;
+		if (ss[index] < vdesc->vd_period.p_start) {
+			low = index + 1;
+		} else if (ss[index] >= vdesc->vd_period.p_end) {
+			high = index - 1;
+		} else {
+			*last_hit = ss[index];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* the former nilfs_toss_vdescs(), sort and nilfs_unify_period() */
+static int reclaim_bench_old(struct nilfs_vector *vdescv,
+			     struct nilfs_vector *periodv,
+			     struct nilfs_vector *vblocknrv,
+			     const nilfs_cno_t *ss, size_t nss)
+{
+	struct nilfs_vdesc *vdesc;
+	struct nilfs_period *periodp, *base, *target;
+	uint64_t *vblocknrp;
+	nilfs_cno_t last_hit = 0;
+	int i, j;
+
+	for (i = 0; i < nilfs_vector_get_size(vdescv); i++) {
+		for (j = i; j < nilfs_vector_get_size(vdescv); j++) {
+			vdesc = nilfs_vector_get_element(vdescv, j);
+			if (reclaim_bench_is_live(vdesc, RECLAIM_BENCH_PROTCNO,
+						  ss, nss, &last_hit))
+				break;
+			vblocknrp = nilfs_vector_get_new_element(vblocknrv);
+			if (!vblocknrp)
+				return -1;
+			*vblocknrp = vdesc->vd_vblocknr;
+			if (vdesc->vd_cno != 0) {
+				periodp = nilfs_vector_get_new_element(periodv);
+				if (!periodp)
+					return -1;
+				*periodp = vdesc->vd_period;
+			}
+		}
+		if (j > i)
+			nilfs_vector_delete_elements(vdescv, i, j - i);
+	}
+
+	nilfs_vector_sort(vdescv, nilfs_comp_vdesc_blocknr);
+
+	nilfs_vector_sort(periodv, nilfs_comp_period);
+	for (i = 0; i < nilfs_vector_get_size(periodv); i++) {
+		base = nilfs_vector_get_element(periodv, i);
+		for (j = i + 1; j < nilfs_vector_get_size(periodv); j++) {
+			target = nilfs_vector_get_element(periodv, j);
+			if (base->p_end < target->p_start)
+				break;
+			if (base->p_end < target->p_end)
+				base->p_end = target->p_end;
+		}
+		if (j > i + 1)
+			nilfs_vector_delete_elements(periodv, i + 1,
+						     j - i - 1);
+	}
+	return 0;
+}
+
+/* the steps of nilfs_reclaim_batch_fill() */
+static int reclaim_bench_new(struct nilfs_vector *vdescv,
+			     struct nilfs_vector *periodv,
+			     struct nilfs_vector *vblocknrv,
+			     const nilfs_cno_t *ss, size_t nss)
+{
+	if (nilfs_toss_vdescs(vdescv, periodv, vblocknrv,
+			      RECLAIM_BENCH_PROTCNO, ss, nss) < 0)
+		return -1;
+	nilfs_sort_vdescs(vdescv, NILFS_RECLAIM_ORDER_BLOCKNR);
+	nilfs_unify_period(periodv);
+	return 0;
+}
+
+/* vdescs as nilfs_get_vdesc() leaves them, in vblocknr order */
+static int reclaim_bench_fill(struct nilfs_vector *vdescv, size_t n)
+{
+	struct nilfs_vdesc *vdesc;
+	size_t i;
+
+	nilfs_vector_clear(vdescv);
+	for (i = 0; i < n; i++) {
+		vdesc = nilfs_vector_get_new_element(vdescv);
+		if (!vdesc)
+			return -1;
+		memset(vdesc, 0, sizeof(*vdesc));
+		vdesc->vd_ino = 12 + rand() % 64;
+		vdesc->vd_vblocknr = i;
+		vdesc->vd_blocknr = rand();
+		vdesc->vd_offset = i;
+		vdesc->vd_period.p_start = 1 + rand() % RECLAIM_BENCH_PROTCNO;
+		vdesc->vd_period.p_end = (rand() & 1) ? NILFS_CNO_MAX :
+			vdesc->vd_period.p_start + 1 + rand() % 1000;
+		vdesc->vd_cno = vdesc->vd_period.p_start;
+	}
+	return 0;
+}
+
+/**
+ * reclaim_bench_run - time one way of processing vdescs
+ * @v: vectors: vdescs, periods and vblocknrs
+ * @n: number of vdescs
+ * @ss: checkpoint numbers of snapshots
+ * @run: function processing the vdescs
+ *
+ * Return: average time per run in seconds, or a negative value on error.
+ */
+static double reclaim_bench_run(struct nilfs_vector *v[3], size_t n,
+				const nilfs_cno_t *ss,
+				int (*run)(struct nilfs_vector *,
+					   struct nilfs_vector *,
+					   struct nilfs_vector *,
+					   const nilfs_cno_t *, size_t))
+{
+	double elapsed = 0, start;
+	unsigned int runs = 0;
+	int ret;
+
+	do {
+		srand(1);
+		if (reclaim_bench_fill(v[0], n) < 0)
+			return -1;
+		nilfs_vector_clear(v[1]);
+		nilfs_vector_clear(v[2]);
+		start = reclaim_bench_now();
+		ret = run(v[0], v[1], v[2], ss, RECLAIM_BENCH_NSS);
+		elapsed += reclaim_bench_now() - start;
+		if (ret < 0)
+			return -1;
+		runs++;
+	} while (elapsed < 0.2 && runs < 1000);
+	return elapsed / runs;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t defaults[] = { 1024, 4096, 16384, 65536 };
+	static const size_t elemsizes[3] = {
+		sizeof(struct nilfs_vdesc), sizeof(struct nilfs_period),
+		sizeof(uint64_t)
+	};
+	size_t counts[64], ncounts = 0, i;
+	nilfs_cno_t ss[RECLAIM_BENCH_NSS];
+	struct nilfs_vector *v[3];
+	double told, tnew;
+	char *endptr;
+	int j;
+
+	for (j = 1; j < argc && ncounts < 64; j++) {
+		counts[ncounts] = strtoul(argv[j], &endptr, 0);
+		if (*endptr != '\0' || counts[ncounts] == 0) {
+			fprintf(stderr, "%s: invalid count: %s\n", argv[0],
+				argv[j]);
+			return EXIT_FAILURE;
+		}
+		ncounts++;
+	}
+	if (ncounts == 0) {
+		memcpy(counts, defaults, sizeof(defaults));
+		ncounts = ARRAY_SIZE(defaults);
+	}
+
+	for (i = 0; i < RECLAIM_BENCH_NSS; i++)
+		ss[i] = (i + 1) * (RECLAIM_BENCH_PROTCNO / RECLAIM_BENCH_NSS) -
+			rand() % 100;
+
+	for (j = 0; j < 3; j++) {
+		v[j] = nilfs_vector_create(elemsizes[j]);
+		if (!v[j]) {
+			perror("nilfs_vector_create");
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%10s %14s %14s %9s\n", "vdescs", "former (usec)",
+	       "gc.c (usec)", "speedup");
+	for (i = 0; i < ncounts; i++) {
+		told = reclaim_bench_run(v, counts[i], ss, reclaim_bench_old);
+		tnew = reclaim_bench_run(v, counts[i], ss, reclaim_bench_new);
+		if (told < 0 || tnew < 0) {
+			perror("reclaim");
+			return EXIT_FAILURE;
+		}
+		printf("%10zu %14.1f %14.1f %8.1fx\n", counts[i],
+		       told * 1e6, tnew * 1e6, told / tnew);
+	}
+	for (j = 0; j < 3; j++)
+		nilfs_vector_destroy(v[j]);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,310 @@
+/*
+ * sumcache.c - cache of parsed segment summaries
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>	/* memcpy() */
+#endif	/* HAVE_STRING_H */
+
+#include <errno.h>
+#include <pthread.h>
+#include "util.h"
+#include "nilfs_gc.h"	/* struct nilfs_vdesc, struct nilfs_bdesc */
+#include "vector.h"
+#include "sumcache.h"
+
+#define NILFS_SUMCACHE_HASH_BITS	10
+#define NILFS_SUMCACHE_HASH_SIZE	(1UL << NILFS_SUMCACHE_HASH_BITS)
+
+/**
+ * struct nilfs_sumcache_entry - block descriptors of a segment
+ * @hnext: next entry in the same hash chain
+ * @prev: more recently used entry
+ * @next: less recently used entry
+ * @segnum: segment number
+ * @seqnum: sequence number of the segment
+ * @nblocks: number of blocks in the segment when it was parsed
+ * @nvdescs: number of descriptors of virtual block numbers
+ * @nbdescs: number of descriptors of disk block numbers
+ * @size: memory size of the entry
+ *
+ * The descriptors follow the entry in the same allocation, virtual ones
+ * first.
+ */
+struct nilfs_sumcache_entry {
+	struct nilfs_sumcache_entry *hnext;
+	struct nilfs_sumcache_entry *prev;
+	struct nilfs_sumcache_entry *next;
+	uint64_t segnum;
+	uint64_t seqnum;
+	uint32_t nblocks;
+	size_t nvdescs;
+	size_t nbdescs;
+	size_t size;
+};
+
+/**
+ * struct nilfs_sumcache - cache of parsed segment summaries
+ * @lock: mutex protecting the cache
+ * @hash: hash table of entries keyed by segment number
+ * @lru: list head of entries, from the most recently used one
+ * @limit: maximum memory size of the entries
+ * @size: memory size of the entries
+ *
+ * The summaries of a segment do not change until the segment is freed
+ * and rewritten under a new sequence number, or logs are appended to it.
+ * The descriptors collected from them are therefore kept keyed by the
+ * segment number, sequence number and block count of the segment, and
+ * reused in place of reading and parsing the summaries again.  Only the
+ * fields taken from the summaries are meaningful in the cached
+ * descriptors; the others are filled in by the liveness checks every
+ * time.  A cache may be shared by threads using their own nilfs objects.
+ */
+struct nilfs_sumcache {
+	pthread_mutex_t lock;
+	struct nilfs_sumcache_entry *hash[NILFS_SUMCACHE_HASH_SIZE];
+	struct nilfs_sumcache_entry lru;
+	size_t limit;
+	size_t size;
+};
+
+static inline struct nilfs_sumcache_entry **
+nilfs_sumcache_slot(struct nilfs_sumcache *cache, uint64_t segnum)
+{
+	return &cache->hash[segnum & (NILFS_SUMCACHE_HASH_SIZE - 1)];
+}
+
+static inline struct nilfs_vdesc *
+nilfs_sumcache_vdescs(struct nilfs_sumcache_entry *entry)
+{
+	return (struct nilfs_vdesc *)(entry + 1);
+}
+
+static inline struct nilfs_bdesc *
+nilfs_sumcache_bdescs(struct nilfs_sumcache_entry *entry)
+{
+	return (struct nilfs_bdesc *)
+		(nilfs_sumcache_vdescs(entry) + entry->nvdescs);
+}
+
+static void nilfs_sumcache_unlink(struct nilfs_sumcache_entry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void nilfs_sumcache_link(struct nilfs_sumcache *cache,
+				struct nilfs_sumcache_entry *entry)
+{
+	entry->prev = &cache->lru;
+	entry->next = cache->lru.next;
+	cache->lru.next->prev = entry;
+	cache->lru.next = entry;
+}
+
+/**
+ * nilfs_sumcache_remove - remove the entry of a segment
+ * @cache: summary cache (locked)
+ * @segnum: segment number
+ */
+static void nilfs_sumcache_remove(struct nilfs_sumcache *cache,
+				  uint64_t segnum)
+{
+	struct nilfs_sumcache_entry **pp, *entry;
+
+	for (pp = nilfs_sumcache_slot(cache, segnum); *pp != NULL;
+	     pp = &(*pp)->hnext) {
+		entry = *pp;
+		if (entry->segnum == segnum) {
+			*pp = entry->hnext;
+			nilfs_sumcache_unlink(entry);
+			cache->size -= entry->size;
+			free(entry);
+			return;
+		}
+	}
+}
+
+/**
+ * nilfs_sumcache_create - create a cache of parsed segment summaries
+ * @limit: maximum memory size of the cached descriptors in bytes
+ */
+struct nilfs_sumcache *nilfs_sumcache_create(size_t limit)
+{
+	struct nilfs_sumcache *cache;
+
+	cache = malloc(sizeof(*cache));
+	if (unlikely(cache == NULL))
+		return NULL;
+
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->lru.prev = &cache->lru;
+	cache->lru.next = &cache->lru;
+	cache->limit = limit;
+	return cache;
+}
+
+/**
+ * nilfs_sumcache_destroy - destroy a cache of parsed segment summaries
+ * @cache: summary cache
+ */
+void nilfs_sumcache_destroy(struct nilfs_sumcache *cache)
+{
+	struct nilfs_sumcache_entry *entry, *next;
+
+	if (cache == NULL)
+		return;
+
+	for (entry = cache->lru.next; entry != &cache->lru; entry = next) {
+		next = entry->next;
+		free(entry);
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/**
+ * nilfs_sumcache_invalidate - drop cached block descriptors of a segment
+ * @cache: summary cache
+ * @segnum: segment number
+ */
+void nilfs_sumcache_invalidate(struct nilfs_sumcache *cache, uint64_t segnum)
+{
+	pthread_mutex_lock(&cache->lock);
+	nilfs_sumcache_remove(cache, segnum);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * nilfs_sumcache_lookup - collect cached block descriptors of a segment
+ * @cache: summary cache
+ * @segnum: segment number
+ * @seqnum: current sequence number of the segment
+ * @nblocks: current number of blocks in the segment
+ * @vdescv: vector object to store (descriptors of) virtual block numbers
+ * @bdescv: vector object to store (descriptors of) disk block numbers
+ *
+ * Return: 1 if the descriptors were appended to @vdescv and @bdescv, 0
+ * if the segment is not cached under the given key, or -1 on error.
+ */
+int nilfs_sumcache_lookup(struct nilfs_sumcache *cache, uint64_t segnum,
+			  uint64_t seqnum, uint32_t nblocks,
+			  struct nilfs_vector *vdescv,
+			  struct nilfs_vector *bdescv)
+{
+	struct nilfs_sumcache_entry *entry;
+	void *vdescs, *bdescs;
+	size_t vsize, bsize;
+	int ret = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	for (entry = *nilfs_sumcache_slot(cache, segnum); entry != NULL;
+	     entry = entry->hnext)
+		if (entry->segnum == segnum)
+			break;
+	if (entry == NULL || entry->seqnum != seqnum ||
+	    entry->nblocks != nblocks)
+		goto out;
+
+	vsize = nilfs_vector_get_size(vdescv);
+	bsize = nilfs_vector_get_size(bdescv);
+	vdescs = nilfs_vector_insert_elements(vdescv, vsize, entry->nvdescs);
+	bdescs = nilfs_vector_insert_elements(bdescv, bsize, entry->nbdescs);
+	if (unlikely(vdescs == NULL || bdescs == NULL)) {
+		if (vdescs != NULL)
+			nilfs_vector_delete_elements(vdescv, vsize,
+						     entry->nvdescs);
+		ret = -1;
+		goto out;
+	}
+	memcpy(vdescs, nilfs_sumcache_vdescs(entry),
+	       sizeof(struct nilfs_vdesc) * entry->nvdescs);
+	memcpy(bdescs, nilfs_sumcache_bdescs(entry),
+	       sizeof(struct nilfs_bdesc) * entry->nbdescs);
+
+	nilfs_sumcache_unlink(entry);
+	nilfs_sumcache_link(cache, entry);
+	ret = 1;
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
+
+/**
+ * nilfs_sumcache_insert - cache block descriptors of a segment
+ * @cache: summary cache
+ * @segnum: segment number
+ * @seqnum: sequence number of the segment
+ * @nblocks: number of blocks in the segment that were parsed
+ * @vdescv: vector object holding (descriptors of) virtual block numbers
+ * @vstart: index of the first descriptor of the segment in @vdescv
+ * @bdescv: vector object holding (descriptors of) disk block numbers
+ * @bstart: index of the first descriptor of the segment in @bdescv
+ *
+ * The descriptors of the segment are those from @vstart and @bstart to
+ * the ends of the vectors.  Any entry of the segment under another key
+ * is replaced, and the least recently used entries are evicted to keep
+ * the cache within its limit.  A segment that does not fit in the limit
+ * by itself is not cached.
+ */
+int nilfs_sumcache_insert(struct nilfs_sumcache *cache, uint64_t segnum,
+			  uint64_t seqnum, uint32_t nblocks,
+			  struct nilfs_vector *vdescv, size_t vstart,
+			  struct nilfs_vector *bdescv, size_t bstart)
+{
+	struct nilfs_sumcache_entry *entry, **pp;
+	size_t nvdescs, nbdescs, size;
+
+	nvdescs = nilfs_vector_get_size(vdescv) - vstart;
+	nbdescs = nilfs_vector_get_size(bdescv) - bstart;
+	size = sizeof(*entry) + sizeof(struct nilfs_vdesc) * nvdescs +
+		sizeof(struct nilfs_bdesc) * nbdescs;
+
+	if (size > cache->limit) {
+		nilfs_sumcache_invalidate(cache, segnum);
+		return 0;
+	}
+
+	entry = malloc(size);
+	if (unlikely(entry == NULL))
+		return -1;
+
+	entry->segnum = segnum;
+	entry->seqnum = seqnum;
+	entry->nblocks = nblocks;
+	entry->nvdescs = nvdescs;
+	entry->nbdescs = nbdescs;
+	entry->size = size;
+	memcpy(nilfs_sumcache_vdescs(entry),
+	       (struct nilfs_vdesc *)nilfs_vector_get_data(vdescv) + vstart,
+	       sizeof(struct nilfs_vdesc) * nvdescs);
+	memcpy(nilfs_sumcache_bdescs(entry),
+	       (struct nilfs_bdesc *)nilfs_vector_get_data(bdescv) + bstart,
+	       sizeof(struct nilfs_bdesc) * nbdescs);
+
+	pthread_mutex_lock(&cache->lock);
+	nilfs_sumcache_remove(cache, segnum);
+	while (cache->size + size > cache->limit)
+		nilfs_sumcache_remove(cache, cache->lru.prev->segnum);
+	pp = nilfs_sumcache_slot(cache, segnum);
+	entry->hnext = *pp;
+	*pp = entry;
+	nilfs_sumcache_link(cache, entry);
+	cache->size += size;
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+}
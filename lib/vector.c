@@ -158,6 +158,206 @@ int nilfs_vector_delete_elements(struct nilfs_vector *vector,
 	return 0;
 }
 
+/**
+ * nilfs_vector_filter - remove elements in a single pass
+ * @vector: vector
+ * @filter: callback judging whether to keep an element
+ * @arg: argument passed to @filter
+ *
+ * Description: nilfs_vector_filter() calls @filter for each element in
+ * order and compacts the elements for which it returned a positive value
+ * towards the head of @vector, keeping their order.  @prev points to the
+ * last element kept so far, already at its final position, or is NULL;
+ * @filter may merge @elem into it and drop @elem.  Each element is moved
+ * at most once, so this takes linear time regardless of how the removed
+ * elements are distributed.
+ *
+ * If @filter returns a negative value, the filtering stops there and the
+ * element and all the following ones are kept.
+ *
+ * Return Value: On success, 0 is returned. On error, -1 is returned.
+ */
+int nilfs_vector_filter(struct nilfs_vector *vector,
+			int (*filter)(void *prev, void *elem, void *arg),
+			void *arg)
+{
+	const size_t elemsize = vector->v_elemsize;
+	void *src = vector->v_data, *dst = vector->v_data, *prev = NULL;
+	size_t i, rest;
+	int ret = 0;
+
+	for (i = 0; i < vector->v_nelems; i++, src += elemsize) {
+		ret = filter(prev, src, arg);
+		if (unlikely(ret < 0))
+			break;
+		if (ret > 0) {
+			if (dst != src)
+				memcpy(dst, src, elemsize);
+			prev = dst;
+			dst += elemsize;
+		}
+	}
+
+	if (unlikely(ret < 0)) {
+		rest = vector->v_nelems - i;
+		if (dst != src)
+			memmove(dst, src, rest * elemsize);
+		dst += rest * elemsize;
+	}
+	vector->v_nelems = (dst - vector->v_data) / elemsize;
+	return ret < 0 ? -1 : 0;
+}
+
+/* below this number of elements, sort keys with insertion sort */
+#define NILFS_VECTOR_RADIX_MIN	64
+
+struct nilfs_vector_sort_item {
+	uint64_t key;
+	size_t index;
+};
+
+static uint64_t nilfs_vector_load_key(const void *elem,
+				      const struct nilfs_vector_key *key)
+{
+	uint32_t key32;
+	uint64_t key64;
+
+	if (key->k_size == sizeof(key32)) {
+		memcpy(&key32, elem + key->k_offset, sizeof(key32));
+		return key32;
+	}
+	memcpy(&key64, elem + key->k_offset, sizeof(key64));
+	return key64;
+}
+
+static struct nilfs_vector_sort_item *
+nilfs_vector_insertion_sort(struct nilfs_vector_sort_item *items, size_t n)
+{
+	struct nilfs_vector_sort_item item;
+	size_t i, j;
+
+	for (i = 1; i < n; i++) {
+		item = items[i];
+		for (j = i; j > 0 && items[j - 1].key > item.key; j--)
+			items[j] = items[j - 1];
+		items[j] = item;
+	}
+	return items;
+}
+
+/*
+ * Stable LSD radix sort of @n items on 8-bit digits.  Digits that are
+ * the same in all keys, such as the zero upper bytes of block numbers,
+ * are skipped.  Returns whichever of @items and @tmp holds the result.
+ */
+static struct nilfs_vector_sort_item *
+nilfs_vector_radix_sort(struct nilfs_vector_sort_item *items,
+			struct nilfs_vector_sort_item *tmp, size_t n)
+{
+	size_t count[sizeof(uint64_t)][256];
+	struct nilfs_vector_sort_item *swap;
+	size_t i, sum, c;
+	unsigned int d, shift;
+
+	if (n < NILFS_VECTOR_RADIX_MIN)
+		return nilfs_vector_insertion_sort(items, n);
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < n; i++)
+		for (d = 0; d < sizeof(uint64_t); d++)
+			count[d][(items[i].key >> (d * 8)) & 0xff]++;
+
+	for (d = 0; d < sizeof(uint64_t); d++) {
+		shift = d * 8;
+		if (count[d][(items[0].key >> shift) & 0xff] == n)
+			continue;
+
+		for (i = 0, sum = 0; i < 256; i++) {
+			c = count[d][i];
+			count[d][i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++)
+			tmp[count[d][(items[i].key >> shift) & 0xff]++] =
+				items[i];
+
+		swap = items;
+		items = tmp;
+		tmp = swap;
+	}
+	return items;
+}
+
+/**
+ * nilfs_vector_sort_keys - sort elements on integer keys
+ * @vector: vector
+ * @keys: array of keys, the most significant first
+ * @nkeys: number of keys in @keys
+ *
+ * Description: nilfs_vector_sort_keys() sorts elements in ascending
+ * lexicographic order of the unsigned integer keys given by @keys,
+ * without calling a comparison function.  Keys are collected into an
+ * array of (key, index) pairs that is radix sorted once per key from
+ * the least significant one, so that only the pairs move until the
+ * elements are placed once at the end.  The sort is stable.
+ *
+ * Return Value: On success, 0 is returned. On error, -1 is returned
+ * and the vector is left unchanged.
+ */
+int nilfs_vector_sort_keys(struct nilfs_vector *vector,
+			   const struct nilfs_vector_key *keys, int nkeys)
+{
+	const size_t elemsize = vector->v_elemsize;
+	const size_t n = vector->v_nelems;
+	struct nilfs_vector_sort_item *mem, *items, *tmp;
+	void *data;
+	size_t i;
+	int k;
+
+	for (k = 0; k < nkeys; k++) {
+		if (unlikely((keys[k].k_size != sizeof(uint32_t) &&
+			      keys[k].k_size != sizeof(uint64_t)) ||
+			     keys[k].k_offset + keys[k].k_size > elemsize)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (n < 2)
+		return 0;
+
+	mem = malloc(sizeof(*mem) * n * 2);
+	if (unlikely(mem == NULL))
+		return -1;
+
+	data = malloc(elemsize * vector->v_maxelems);
+	if (unlikely(data == NULL)) {
+		free(mem);
+		return -1;
+	}
+
+	items = mem;
+	for (i = 0; i < n; i++)
+		items[i].index = i;
+
+	for (k = nkeys - 1; k >= 0; k--) {
+		for (i = 0; i < n; i++)
+			items[i].key = nilfs_vector_load_key(
+				vector->v_data + elemsize * items[i].index,
+				&keys[k]);
+		tmp = (items == mem) ? mem + n : mem;
+		items = nilfs_vector_radix_sort(items, tmp, n);
+	}
+
+	for (i = 0; i < n; i++)
+		memcpy(data + elemsize * i,
+		       vector->v_data + elemsize * items[i].index, elemsize);
+
+	free(vector->v_data);
+	vector->v_data = data;
+	free(mem);
+	return 0;
+}
+
 void nilfs_vector_clear(struct nilfs_vector *vector)
 {
 	const size_t maxelems = NILFS_VECTOR_INIT_MAXELEMS;
@@ -0,0 +1,587 @@
+/*
+ * vector_test.c - check the vector operations of the GC
+ *
+ * Licensed under LGPLv2: the complete text of the GNU Lesser General
+ * Public License can be found in COPYING file of the nilfs-utils
+ * package.
+ *
+ * The GC used to drop dead descriptors and merge overlapping periods by
+ * deleting runs of elements with nilfs_vector_delete_elements().  The
+ * single-pass nilfs_vector_filter() that replaced it must leave the same
+ * elements in the same order, and must keep everything from the element
+ * at which the callback fails.
+ *
+ * It also used to sort descriptors with qsort() and the comparators that
+ * are still in gc.c.  nilfs_vector_sort_keys() must order them the same
+ * way with the key tables of gc.c, and keep elements with equal keys in
+ * their original order.  nilfs_sort_vdescs() must do so in each order
+ * that a reclaim can ask for.
+ *
+ * Finally, the snapshot index used by nilfs_vdesc_is_live() must give
+ * the same verdicts as a linear scan over the snapshot list.
+ */
+
+#include "gc.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+struct vector_test_elem {
+	uint64_t id;
+	uint64_t start;		/* period start, for merging */
+	uint64_t end;		/* period end, for merging */
+	uint64_t keep;		/* no padding, so elements compare bytewise */
+};
+
+static int nfailures;
+
+static void vector_test_fail(const char *what, size_t n, const char *pattern)
+{
+	if (nfailures++ < 20)
+		fprintf(stderr, "%s: %zu elements, %s pattern: mismatch\n",
+			what, n, pattern);
+}
+
+static int vector_test_fill(struct nilfs_vector *v, size_t n, int pattern)
+{
+	struct vector_test_elem *e;
+	size_t i;
+
+	nilfs_vector_clear(v);
+	for (i = 0; i < n; i++) {
+		e = nilfs_vector_get_new_element(v);
+		if (!e)
+			return -1;
+		e->id = i;
+		e->start = i * 4 + (rand() % 4);
+		e->end = e->start + 1 + (rand() % 16);
+		switch (pattern) {
+		case 0:
+			e->keep = 1;
+			break;
+		case 1:
+			e->keep = 0;
+			break;
+		case 2:
+			e->keep = i & 1;
+			break;
+		case 3:
+			e->keep = (i / 7) & 1;	/* runs of seven */
+			break;
+		default:
+			e->keep = rand() & 1;
+			break;
+		}
+	}
+	return 0;
+}
+
+static const char *vector_test_pattern_name[] = {
+	"keep-all", "drop-all", "alternating", "runs", "random"
+};
+
+#define VECTOR_TEST_NPATTERNS	5
+
+/* the former nilfs_toss_bdescs() loop */
+static void vector_test_toss_ref(struct nilfs_vector *v)
+{
+	struct vector_test_elem *e;
+	size_t i, j;
+
+	for (i = 0; i < nilfs_vector_get_size(v); i++) {
+		for (j = i; j < nilfs_vector_get_size(v); j++) {
+			e = nilfs_vector_get_element(v, j);
+			if (e->keep)
+				break;
+		}
+		if (j > i)
+			nilfs_vector_delete_elements(v, i, j - i);
+	}
+}
+
+/* the former nilfs_unify_period() loop, on sorted periods */
+static void vector_test_merge_ref(struct nilfs_vector *v)
+{
+	struct vector_test_elem *base, *target;
+	size_t i, j;
+
+	for (i = 0; i < nilfs_vector_get_size(v); i++) {
+		base = nilfs_vector_get_element(v, i);
+		for (j = i + 1; j < nilfs_vector_get_size(v); j++) {
+			target = nilfs_vector_get_element(v, j);
+			if (base->end < target->start)
+				break;
+			if (base->end < target->end)
+				base->end = target->end;
+		}
+		if (j > i + 1)
+			nilfs_vector_delete_elements(v, i + 1, j - i - 1);
+	}
+}
+
+static int vector_test_toss(void *prev, void *elem, void *arg)
+{
+	return ((struct vector_test_elem *)elem)->keep;
+}
+
+static int vector_test_merge(void *prev, void *elem, void *arg)
+{
+	struct vector_test_elem *base = prev, *target = elem;
+
+	if (base == NULL || base->end < target->start)
+		return 1;
+	if (base->end < target->end)
+		base->end = target->end;
+	return 0;
+}
+
+struct vector_test_stop_arg {
+	size_t stop;		/* id of the element to fail at */
+	size_t ncalls;
+};
+
+static int vector_test_stop(void *prev, void *elem, void *arg)
+{
+	struct vector_test_stop_arg *sa = arg;
+	struct vector_test_elem *e = elem;
+
+	sa->ncalls++;
+	if (e->id == sa->stop)
+		return -1;
+	return e->keep;
+}
+
+static int vector_test_equal(const struct nilfs_vector *a,
+			     const struct nilfs_vector *b)
+{
+	return nilfs_vector_get_size(a) == nilfs_vector_get_size(b) &&
+		memcmp(nilfs_vector_get_data(a), nilfs_vector_get_data(b),
+		       nilfs_vector_get_size(a) * a->v_elemsize) == 0;
+}
+
+static int vector_test_copy(struct nilfs_vector *dst,
+			    const struct nilfs_vector *src)
+{
+	size_t n = nilfs_vector_get_size(src);
+
+	nilfs_vector_clear(dst);
+	if (n == 0)
+		return 0;
+	if (!nilfs_vector_insert_elements(dst, 0, n))
+		return -1;
+	memcpy(nilfs_vector_get_data(dst), nilfs_vector_get_data(src),
+	       n * src->v_elemsize);
+	return 0;
+}
+
+static int vector_test_stop_case(struct nilfs_vector *v,
+				 struct nilfs_vector *ref, size_t n,
+				 int pattern)
+{
+	struct vector_test_stop_arg sa;
+	struct vector_test_elem *e, *src;
+	size_t i;
+
+	if (n == 0)
+		return 0;
+	sa.stop = rand() % n;
+	sa.ncalls = 0;
+
+	/* expected: kept elements before the failure, then the rest */
+	nilfs_vector_clear(ref);
+	for (i = 0; i < n; i++) {
+		src = nilfs_vector_get_element(v, i);
+		if (i < sa.stop && !src->keep)
+			continue;
+		e = nilfs_vector_get_new_element(ref);
+		if (!e)
+			return -1;
+		*e = *src;
+	}
+
+	if (nilfs_vector_filter(v, vector_test_stop, &sa) != -1 ||
+	    sa.ncalls != sa.stop + 1 || !vector_test_equal(v, ref))
+		vector_test_fail("stop", n, vector_test_pattern_name[pattern]);
+	return 0;
+}
+
+/* a sort order of the GC and the comparator it replaced */
+struct vector_test_order {
+	const char *name;
+	size_t elemsize;
+	const struct nilfs_vector_key *keys;
+	int nkeys;
+	int (*compar)(const void *, const void *);
+	size_t id_offset;	/* field that is no key, to number elements */
+	size_t id_size;
+	int reclaim_order;	/* sort with nilfs_sort_vdescs() unless -1 */
+};
+
+#define VECTOR_TEST_ORDER(name, type, keys, compar, id, reclaim_order)	\
+	{ name, sizeof(type), keys, ARRAY_SIZE(keys), compar,		\
+	  offsetof(type, id), sizeof(((type *)0)->id), reclaim_order }
+
+static const struct vector_test_order vector_test_orders[] = {
+	VECTOR_TEST_ORDER("vblocknr", struct nilfs_vdesc,
+			  nilfs_vdesc_vblocknr_key,
+			  nilfs_comp_vdesc_vblocknr, vd_pad, -1),
+	VECTOR_TEST_ORDER("bdesc", struct nilfs_bdesc, nilfs_bdesc_keys,
+			  nilfs_comp_bdesc, bd_pad, -1),
+	VECTOR_TEST_ORDER("period", struct nilfs_period, nilfs_period_key,
+			  nilfs_comp_period, p_end, -1),
+	VECTOR_TEST_ORDER("blocknr", struct nilfs_vdesc,
+			  nilfs_vdesc_blocknr_key, nilfs_comp_vdesc_blocknr,
+			  vd_pad, NILFS_RECLAIM_ORDER_BLOCKNR),
+	VECTOR_TEST_ORDER("age", struct nilfs_vdesc, nilfs_vdesc_age_keys,
+			  nilfs_comp_vdesc_age, vd_pad,
+			  NILFS_RECLAIM_ORDER_AGE),
+	VECTOR_TEST_ORDER("file", struct nilfs_vdesc, nilfs_vdesc_file_keys,
+			  nilfs_comp_vdesc_file, vd_pad,
+			  NILFS_RECLAIM_ORDER_FILE),
+};
+
+static uint64_t vector_test_rand64(void)
+{
+	return ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ rand();
+}
+
+static void vector_test_store(void *elem, size_t offset, size_t size,
+			      uint64_t val)
+{
+	uint32_t val32 = val;
+
+	if (size == sizeof(val32))
+		memcpy(elem + offset, &val32, sizeof(val32));
+	else
+		memcpy(elem + offset, &val, sizeof(val));
+}
+
+static uint64_t vector_test_load(const void *elem, size_t offset,
+				 size_t size)
+{
+	uint32_t val32;
+	uint64_t val;
+
+	if (size == sizeof(val32)) {
+		memcpy(&val32, elem + offset, sizeof(val32));
+		return val32;
+	}
+	memcpy(&val, elem + offset, sizeof(val));
+	return val;
+}
+
+/*
+ * Fill @v with @n random elements whose keys are below @range, or
+ * anything if @range is 0, numbered in the id field.
+ */
+static int vector_test_fill_keys(struct nilfs_vector *v,
+				 const struct vector_test_order *order,
+				 size_t n, uint64_t range)
+{
+	unsigned char *elem;
+	size_t i, b;
+	int k;
+
+	nilfs_vector_clear(v);
+	for (i = 0; i < n; i++) {
+		elem = nilfs_vector_get_new_element(v);
+		if (!elem)
+			return -1;
+		for (b = 0; b < order->elemsize; b++)
+			elem[b] = rand();
+		for (k = 0; k < order->nkeys; k++)
+			vector_test_store(elem, order->keys[k].k_offset,
+					  order->keys[k].k_size,
+					  range ? vector_test_rand64() % range :
+					  vector_test_rand64());
+		vector_test_store(elem, order->id_offset, order->id_size, i);
+	}
+	return 0;
+}
+
+static int vector_test_equiv(const struct vector_test_order *order,
+			     const void *a, const void *b)
+{
+	return order->compar(a, b) >= 0 && order->compar(b, a) >= 0;
+}
+
+/*
+ * Check that @v, sorted by keys, matches @ref, sorted by the comparator,
+ * element for element up to equal keys, that it is a permutation of
+ * @orig, and that equal keys keep their original order.
+ */
+static int vector_test_sorted(const struct vector_test_order *order,
+			      struct nilfs_vector *v, struct nilfs_vector *ref,
+			      struct nilfs_vector *orig)
+{
+	const size_t n = nilfs_vector_get_size(orig);
+	void *elem, *prev = NULL;
+	uint64_t id, prev_id = 0;
+	size_t i;
+
+	if (nilfs_vector_get_size(v) != n)
+		return 0;
+	for (i = 0; i < n; i++) {
+		elem = nilfs_vector_get_element(v, i);
+		id = vector_test_load(elem, order->id_offset, order->id_size);
+		if (id >= n ||
+		    memcmp(elem, nilfs_vector_get_element(orig, id),
+			   order->elemsize) != 0 ||
+		    !vector_test_equiv(order, elem,
+				       nilfs_vector_get_element(ref, i)))
+			return 0;
+		if (prev && vector_test_equiv(order, prev, elem) &&
+		    prev_id >= id)
+			return 0;
+		prev = elem;
+		prev_id = id;
+	}
+	return 1;
+}
+
+static int vector_test_sort(void)
+{
+	static const size_t sizes[] = {
+		0, 1, 2, 3, 63, 64, 65, 127, 128, 1000, 4096
+	};
+	static const uint64_t ranges[] = { 0, 1000, 4 };
+	static const char *range_name[] = { "wide", "narrow", "duplicate" };
+	const struct vector_test_order *order;
+	struct nilfs_vector *v, *ref, *orig;
+	size_t o, s, r;
+
+	for (o = 0; o < ARRAY_SIZE(vector_test_orders); o++) {
+		order = &vector_test_orders[o];
+		v = nilfs_vector_create(order->elemsize);
+		ref = nilfs_vector_create(order->elemsize);
+		orig = nilfs_vector_create(order->elemsize);
+		if (!v || !ref || !orig)
+			goto out;
+
+		for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+			for (r = 0; r < ARRAY_SIZE(ranges); r++) {
+				if (vector_test_fill_keys(orig, order,
+							  sizes[s],
+							  ranges[r]) < 0 ||
+				    vector_test_copy(v, orig) < 0 ||
+				    vector_test_copy(ref, orig) < 0)
+					goto out;
+				if (order->reclaim_order >= 0)
+					nilfs_sort_vdescs(v,
+							  order->reclaim_order);
+				else if (nilfs_vector_sort_keys(
+						 v, order->keys,
+						 order->nkeys) < 0)
+					goto out;
+				nilfs_vector_sort(ref, order->compar);
+				if (!vector_test_sorted(order, v, ref, orig))
+					vector_test_fail(order->name, sizes[s],
+							 range_name[r]);
+			}
+		}
+		nilfs_vector_destroy(v);
+		nilfs_vector_destroy(ref);
+		nilfs_vector_destroy(orig);
+	}
+	return 0;
+out:
+	nilfs_vector_destroy(v);
+	nilfs_vector_destroy(ref);
+	nilfs_vector_destroy(orig);
+	return -1;
+}
+
+/*
+ * Fill @ss with @n ascending snapshot numbers: spread out if @pattern is
+ * 0, in bursts of consecutive checkpoints if 1, or all but the first
+ * far away from the first if 2.
+ */
+static void vector_test_fill_snapshots(nilfs_cno_t *ss, size_t n,
+				       int pattern)
+{
+	nilfs_cno_t cno = 1 + rand() % 100;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		ss[i] = cno;
+		if (pattern == 1 && rand() % 8 != 0)
+			cno++;
+		else if (pattern == 2 && i == 0)
+			cno += 1ULL << 40;
+		else
+			cno += 1 + rand() % 1000;
+	}
+}
+
+/* nilfs_vdesc_is_live() with a linear scan over the snapshots */
+static int vector_test_is_live_ref(const struct nilfs_vdesc *vdesc,
+				   nilfs_cno_t protect, const nilfs_cno_t *ss,
+				   size_t n)
+{
+	size_t i;
+
+	if (vdesc->vd_cno == 0)
+		return vdesc->vd_period.p_end == NILFS_CNO_MAX;
+	if (vdesc->vd_period.p_end == vdesc->vd_cno)
+		return 0;
+	if (vdesc->vd_period.p_end == NILFS_CNO_MAX ||
+	    vdesc->vd_period.p_end > protect)
+		return 1;
+	for (i = 0; i < n; i++)
+		if (ss[i] >= vdesc->vd_period.p_start &&
+		    ss[i] < vdesc->vd_period.p_end)
+			return 1;
+	return 0;
+}
+
+static void vector_test_fill_vdesc(struct nilfs_vdesc *vdesc,
+				   nilfs_cno_t maxcno)
+{
+	memset(vdesc, 0, sizeof(*vdesc));
+	vdesc->vd_period.p_start = 1 + vector_test_rand64() % maxcno;
+	switch (rand() % 8) {
+	case 0:
+		vdesc->vd_period.p_end = NILFS_CNO_MAX;
+		break;
+	case 1:
+		vdesc->vd_period.p_end = vdesc->vd_period.p_start +
+			1 + vector_test_rand64() % maxcno;
+		break;
+	default:
+		vdesc->vd_period.p_end = vdesc->vd_period.p_start +
+			1 + rand() % 3000;
+		break;
+	}
+	switch (rand() % 16) {
+	case 0:
+		vdesc->vd_cno = 0;
+		break;
+	case 1:
+		vdesc->vd_cno = vdesc->vd_period.p_end;
+		break;
+	default:
+		vdesc->vd_cno = vdesc->vd_period.p_start;
+		break;
+	}
+}
+
+static int vector_test_snapshots(void)
+{
+	static const size_t sizes[] = {
+		0, 1, 2, 15, 16, 17, 100, 1000, 5000
+	};
+	static const char *pattern_name[] = { "spread", "bursty", "far" };
+	struct nilfs_snapshot_index ssi;
+	struct nilfs_vdesc vdesc;
+	nilfs_cno_t *ss, protect, maxcno, cno, last_hit;
+	size_t s, n, i, want;
+	int pattern, fail;
+
+	ss = malloc(sizeof(*ss) * sizes[ARRAY_SIZE(sizes) - 1]);
+	if (!ss)
+		return -1;
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		n = sizes[s];
+		for (pattern = 0; pattern < 3; pattern++) {
+			vector_test_fill_snapshots(ss, n, pattern);
+			maxcno = (n > 0 ? ss[n - 1] : 0) + 2000;
+			nilfs_snapshot_index_init(&ssi, ss, n);
+			fail = 0;
+
+			for (i = 0; i < 20000; i++) {
+				cno = (i & 1) && n > 0 ?
+					ss[rand() % n] - 1 + rand() % 3 :
+					vector_test_rand64() % maxcno;
+				for (want = 0; want < n && ss[want] < cno;
+				     want++)
+					;
+				if (nilfs_snapshot_index_lookup(&ssi, cno) !=
+				    want)
+					fail = 1;
+			}
+
+			last_hit = 0;
+			for (i = 0; i < 20000; i++) {
+				vector_test_fill_vdesc(&vdesc, maxcno);
+				protect = rand() % 4 == 0 ? NILFS_CNO_MAX :
+					vector_test_rand64() % maxcno;
+				if (nilfs_vdesc_is_live(&vdesc, protect, &ssi,
+							&last_hit) !=
+				    vector_test_is_live_ref(&vdesc, protect,
+							    ss, n))
+					fail = 1;
+			}
+			nilfs_snapshot_index_destroy(&ssi);
+			if (fail)
+				vector_test_fail("snapshot", n,
+						 pattern_name[pattern]);
+		}
+	}
+	free(ss);
+	return 0;
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 0, 1, 2, 3, 7, 64, 257, 1000, 4096 };
+	struct nilfs_vector *v, *ref;
+	size_t s, n;
+	int pattern;
+
+	v = nilfs_vector_create(sizeof(struct vector_test_elem));
+	ref = nilfs_vector_create(sizeof(struct vector_test_elem));
+	if (!v || !ref) {
+		perror("nilfs_vector_create");
+		return EXIT_FAILURE;
+	}
+	srand(1);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		n = sizes[s];
+		for (pattern = 0; pattern < VECTOR_TEST_NPATTERNS; pattern++) {
+			const char *name = vector_test_pattern_name[pattern];
+
+			if (vector_test_fill(v, n, pattern) < 0 ||
+			    vector_test_copy(ref, v) < 0)
+				goto out_nomem;
+			vector_test_toss_ref(ref);
+			if (nilfs_vector_filter(v, vector_test_toss,
+						NULL) < 0 ||
+			    !vector_test_equal(v, ref))
+				vector_test_fail("toss", n, name);
+
+			/* the period starts ascend with the ids */
+			if (vector_test_fill(v, n, pattern) < 0 ||
+			    vector_test_copy(ref, v) < 0)
+				goto out_nomem;
+			vector_test_merge_ref(ref);
+			if (nilfs_vector_filter(v, vector_test_merge,
+						NULL) < 0 ||
+			    !vector_test_equal(v, ref))
+				vector_test_fail("merge", n, name);
+
+			if (vector_test_fill(v, n, pattern) < 0 ||
+			    vector_test_stop_case(v, ref, n, pattern) < 0)
+				goto out_nomem;
+		}
+	}
+
+	nilfs_vector_destroy(v);
+	nilfs_vector_destroy(ref);
+
+	if (vector_test_sort() < 0 || vector_test_snapshots() < 0)
+		goto out_nomem;
+
+	if (nfailures) {
+		fprintf(stderr, "%d mismatches\n", nfailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+
+out_nomem:
+	perror("vector");
+	return EXIT_FAILURE;
+}
@@ -54,6 +54,7 @@
 #include <errno.h>
 #include <assert.h>
 #include "nilfs.h"
+#include "nilfs_gc.h"	/* NILFS_RECLAIM_ORDER_* */
 #include "util.h"
 #include "cldconfig.h"
 
@@ -401,12 +402,31 @@ static int nilfs_cldconfig_handle_selection_policy_segregation(struct nilfs_cldc
 	return 0;
 }
 
+static int nilfs_cldconfig_handle_selection_policy_cost_benefit_age(
+	struct nilfs_cldconfig *cf, char **tokens, size_t ntoks)
+{
+	cf->cf_selection_policy = NILFS_SELECTION_POLICY_COST_BENEFIT_AGE;
+	cf->cf_policy_name = "cost-benefit-age";
+	return 0;
+}
+
+static int nilfs_cldconfig_handle_selection_policy_adaptive(
+	struct nilfs_cldconfig *cf, char **tokens, size_t ntoks)
+{
+	cf->cf_selection_policy = NILFS_SELECTION_POLICY_ADAPTIVE;
+	cf->cf_policy_name = "adaptive";
+	return 0;
+}
+
 static const struct nilfs_cldconfig_polhandle
 nilfs_cldconfig_polhandle_table[] = {
 	{"timestamp",      nilfs_cldconfig_handle_selection_policy_timestamp},
 	{"greedy",         nilfs_cldconfig_handle_selection_policy_greedy},
 	{"cost-benefit",   nilfs_cldconfig_handle_selection_policy_cost_benefit},
+	{"cost-benefit-age",
+	 nilfs_cldconfig_handle_selection_policy_cost_benefit_age},
   {"segregation",   nilfs_cldconfig_handle_selection_policy_segregation},
+	{"adaptive",       nilfs_cldconfig_handle_selection_policy_adaptive},
 };
 
 
@@ -472,6 +492,30 @@ nilfs_cldconfig_handle_mc_nsegments_per_clean(struct nilfs_cldconfig *config,
 	return 0;
 }
 
+static int
+nilfs_cldconfig_handle_evaluation_threads(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n == 0) {
+		syslog(LOG_WARNING, "%s: %s: too small, use 1",
+		       tokens[0], tokens[1]);
+		n = 1;
+	} else if (n > NILFS_CLDCONFIG_EVALUATION_THREADS_MAX) {
+		syslog(LOG_WARNING, "%s: %s: too large, use the maximum value",
+		       tokens[0], tokens[1]);
+		n = NILFS_CLDCONFIG_EVALUATION_THREADS_MAX;
+	}
+
+	config->cf_evaluation_threads = n;
+	return 0;
+}
+
 static unsigned long long
 nilfs_convert_size_to_blocks_per_segment(struct nilfs *nilfs,
 					 struct nilfs_param *param)
@@ -562,6 +606,219 @@ static int nilfs_cldconfig_handle_use_set_suinfo(struct nilfs_cldconfig *config,
 	return 0;
 }
 
+static int
+nilfs_cldconfig_handle_pipelined_cleaning(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	config->cf_pipelined_cleaning = 1;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_summary_cache_size(struct nilfs_cldconfig *config,
+					  char **tokens, size_t ntoks,
+					  struct nilfs *nilfs)
+{
+	struct nilfs_param param;
+
+	if (nilfs_cldconfig_get_size_argument(tokens, ntoks, &param) < 0)
+		return 0;
+
+	if (param.unit == NILFS_SIZE_UNIT_PERCENT) {
+		syslog(LOG_WARNING, "%s: %s: ratio not allowed",
+		       tokens[0], tokens[1]);
+		return 0;
+	}
+	config->cf_summary_cache_size = nilfs_convert_units_to_bytes(&param);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_ioctl_batch_size(struct nilfs_cldconfig *config,
+					char **tokens, size_t ntoks,
+					struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (strcmp(tokens[1], "auto") == 0) {
+		config->cf_ioctl_batch_size = 0;
+		return 0;
+	}
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n < NILFS_IOCTL_BATCH_MIN || n > NILFS_IOCTL_BATCH_MAX) {
+		syslog(LOG_WARNING, "%s: %s: out of range, must be %d to %d",
+		       tokens[0], tokens[1], NILFS_IOCTL_BATCH_MIN,
+		       NILFS_IOCTL_BATCH_MAX);
+		return 0;
+	}
+	config->cf_ioctl_batch_size = n;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_ioctl_batch_latency(struct nilfs_cldconfig *config,
+					   char **tokens, size_t ntoks,
+					   struct nilfs *nilfs)
+{
+	struct timespec ts;
+
+	if (nilfs_cldconfig_get_time_argument(tokens, ntoks, &ts) < 0)
+		return 0;
+
+	if (ts.tv_sec == 0 && ts.tv_nsec < 1000) {
+		syslog(LOG_WARNING, "%s: %s: too small",
+		       tokens[0], tokens[1]);
+		return 0;
+	}
+	config->cf_ioctl_batch_latency = ts;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_telemetry_ring_size(struct nilfs_cldconfig *config,
+					   char **tokens, size_t ntoks,
+					   struct nilfs *nilfs)
+{
+	struct nilfs_param param;
+
+	if (nilfs_cldconfig_get_size_argument(tokens, ntoks, &param) < 0)
+		return 0;
+
+	if (param.unit == NILFS_SIZE_UNIT_PERCENT) {
+		syslog(LOG_WARNING, "%s: %s: ratio not allowed",
+		       tokens[0], tokens[1]);
+		return 0;
+	}
+	config->cf_telemetry_ring_size = nilfs_convert_units_to_bytes(&param);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_telemetry_histogram_interval(
+	struct nilfs_cldconfig *config, char **tokens, size_t ntoks,
+	struct nilfs *nilfs)
+{
+	return nilfs_cldconfig_get_time_argument(
+		tokens, ntoks, &config->cf_telemetry_histogram_interval);
+}
+
+static int
+nilfs_cldconfig_handle_selection_mode(struct nilfs_cldconfig *config,
+				      char **tokens, size_t ntoks,
+				      struct nilfs *nilfs)
+{
+	if (strcmp(tokens[1], "exact") == 0)
+		config->cf_selection_mode = NILFS_SELECTION_MODE_EXACT;
+	else if (strcmp(tokens[1], "sample") == 0)
+		config->cf_selection_mode = NILFS_SELECTION_MODE_SAMPLE;
+	else
+		syslog(LOG_WARNING, "%s: %s: unknown selection mode",
+		       tokens[0], tokens[1]);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_selection_sample_size(struct nilfs_cldconfig *config,
+					     char **tokens, size_t ntoks,
+					     struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n == 0) {
+		syslog(LOG_WARNING, "%s: %s: too small, use 1",
+		       tokens[0], tokens[1]);
+		n = 1;
+	} else if (n > NILFS_CLDCONFIG_SELECTION_SAMPLE_SIZE_MAX) {
+		syslog(LOG_WARNING, "%s: %s: too large, use the maximum value",
+		       tokens[0], tokens[1]);
+		n = NILFS_CLDCONFIG_SELECTION_SAMPLE_SIZE_MAX;
+	}
+
+	config->cf_selection_sample_size = n;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_selection_seed(struct nilfs_cldconfig *config,
+				      char **tokens, size_t ntoks,
+				      struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	config->cf_selection_seed = n;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_reclaim_order(struct nilfs_cldconfig *config,
+				     char **tokens, size_t ntoks,
+				     struct nilfs *nilfs)
+{
+	if (strcmp(tokens[1], "blocknr") == 0)
+		config->cf_reclaim_order = NILFS_RECLAIM_ORDER_BLOCKNR;
+	else if (strcmp(tokens[1], "age") == 0)
+		config->cf_reclaim_order = NILFS_RECLAIM_ORDER_AGE;
+	else if (strcmp(tokens[1], "file") == 0)
+		config->cf_reclaim_order = NILFS_RECLAIM_ORDER_FILE;
+	else
+		syslog(LOG_WARNING, "%s: %s: unknown reclaim order",
+		       tokens[0], tokens[1]);
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_adaptive_window(struct nilfs_cldconfig *config,
+				       char **tokens, size_t ntoks,
+				       struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n == 0) {
+		syslog(LOG_WARNING, "%s: %s: too small, use 1",
+		       tokens[0], tokens[1]);
+		n = 1;
+	} else if (n > NILFS_CLDCONFIG_ADAPTIVE_WINDOW_MAX) {
+		syslog(LOG_WARNING, "%s: %s: too large, use the maximum value",
+		       tokens[0], tokens[1]);
+		n = NILFS_CLDCONFIG_ADAPTIVE_WINDOW_MAX;
+	}
+
+	config->cf_adaptive_window = n;
+	return 0;
+}
+
+static int
+nilfs_cldconfig_handle_adaptive_margin(struct nilfs_cldconfig *config,
+				       char **tokens, size_t ntoks,
+				       struct nilfs *nilfs)
+{
+	unsigned long n;
+
+	if (nilfs_cldconfig_get_ulong_argument(tokens, ntoks, &n) < 0)
+		return 0;
+
+	if (n >= 100) {
+		syslog(LOG_WARNING, "%s: %s: too large, use 99",
+		       tokens[0], tokens[1]);
+		n = 99;
+	}
+
+	config->cf_adaptive_margin = n;
+	return 0;
+}
+
 static const struct nilfs_cldconfig_log_priority
 nilfs_cldconfig_log_priority_table[] = {
 	{"emerg",	LOG_EMERG},
@@ -657,6 +914,58 @@ nilfs_cldconfig_keyword_table[] = {
 		"use_set_suinfo", 1, 1,
 		nilfs_cldconfig_handle_use_set_suinfo
 	},
+	{
+		"evaluation_threads", 2, 2,
+		nilfs_cldconfig_handle_evaluation_threads
+	},
+	{
+		"pipelined_cleaning", 1, 1,
+		nilfs_cldconfig_handle_pipelined_cleaning
+	},
+	{
+		"summary_cache_size", 2, 2,
+		nilfs_cldconfig_handle_summary_cache_size
+	},
+	{
+		"ioctl_batch_size", 2, 2,
+		nilfs_cldconfig_handle_ioctl_batch_size
+	},
+	{
+		"ioctl_batch_latency", 2, 2,
+		nilfs_cldconfig_handle_ioctl_batch_latency
+	},
+	{
+		"telemetry_ring_size", 2, 2,
+		nilfs_cldconfig_handle_telemetry_ring_size
+	},
+	{
+		"telemetry_histogram_interval", 2, 2,
+		nilfs_cldconfig_handle_telemetry_histogram_interval
+	},
+	{
+		"selection_mode", 2, 2,
+		nilfs_cldconfig_handle_selection_mode
+	},
+	{
+		"selection_sample_size", 2, 2,
+		nilfs_cldconfig_handle_selection_sample_size
+	},
+	{
+		"selection_seed", 2, 2,
+		nilfs_cldconfig_handle_selection_seed
+	},
+	{
+		"reclaim_order", 2, 2,
+		nilfs_cldconfig_handle_reclaim_order
+	},
+	{
+		"adaptive_window", 2, 2,
+		nilfs_cldconfig_handle_adaptive_window
+	},
+	{
+		"adaptive_margin", 2, 2,
+		nilfs_cldconfig_handle_adaptive_margin
+	},
 };
 
 static int nilfs_cldconfig_handle_keyword(struct nilfs_cldconfig *config,
@@ -729,6 +1038,24 @@ static void nilfs_cldconfig_set_default(struct nilfs_cldconfig *config,
 	param.unit = NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS_UNIT;
 	config->cf_mc_min_reclaimable_blocks =
 		nilfs_convert_size_to_blocks_per_segment(nilfs, &param);
+	config->cf_evaluation_threads = NILFS_CLDCONFIG_EVALUATION_THREADS;
+	config->cf_pipelined_cleaning = NILFS_CLDCONFIG_PIPELINED_CLEANING;
+	config->cf_summary_cache_size = NILFS_CLDCONFIG_SUMMARY_CACHE_SIZE;
+	config->cf_ioctl_batch_size = NILFS_CLDCONFIG_IOCTL_BATCH_SIZE;
+	config->cf_ioctl_batch_latency.tv_sec = 0;
+	config->cf_ioctl_batch_latency.tv_nsec =
+		NILFS_CLDCONFIG_IOCTL_BATCH_LATENCY_NSEC;
+	config->cf_telemetry_ring_size = NILFS_CLDCONFIG_TELEMETRY_RING_SIZE;
+	config->cf_telemetry_histogram_interval.tv_sec =
+		NILFS_CLDCONFIG_TELEMETRY_HISTOGRAM_INTERVAL;
+	config->cf_telemetry_histogram_interval.tv_nsec = 0;
+	config->cf_selection_mode = NILFS_CLDCONFIG_SELECTION_MODE;
+	config->cf_selection_sample_size =
+		NILFS_CLDCONFIG_SELECTION_SAMPLE_SIZE;
+	config->cf_selection_seed = NILFS_CLDCONFIG_SELECTION_SEED;
+	config->cf_reclaim_order = NILFS_CLDCONFIG_RECLAIM_ORDER;
+	config->cf_adaptive_window = NILFS_CLDCONFIG_ADAPTIVE_WINDOW;
+	config->cf_adaptive_margin = NILFS_CLDCONFIG_ADAPTIVE_MARGIN;
   config->cf_policy_name = "timestamp";
   config->cf_log_file = "/var/log/nilfs/";
 }
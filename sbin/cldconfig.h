@@ -71,6 +71,24 @@ enum nilfs_size_unit {
  * @cf_min_reclaimable_blocks: minimum reclaimable blocks for cleaning
  * @cf_mc_min_reclaimable_blocks: minimum reclaimable blocks for cleaning
  * if clean segments < min_clean_segments
+ * @cf_evaluation_threads: number of threads assessing segments
+ * @cf_pipelined_cleaning: flag that enables pipelined cleaning
+ * @cf_summary_cache_size: memory size of the segment summary cache
+ * @cf_ioctl_batch_size: number of items per information ioctl, or zero to
+ * adapt it to @cf_ioctl_batch_latency
+ * @cf_ioctl_batch_latency: target time of an information ioctl
+ * @cf_telemetry_ring_size: size of the telemetry ring file (0 disables it)
+ * @cf_telemetry_histogram_interval: interval of utilization histograms
+ * @cf_selection_mode: how victim segments are searched for
+ * @cf_selection_sample_size: number of segments drawn per cycle in sample
+ * mode
+ * @cf_selection_seed: seed of the random sequence used in sample mode
+ * @cf_reclaim_order: order in which live blocks are moved
+ * (NILFS_RECLAIM_ORDER_*)
+ * @cf_adaptive_window: number of cleaning steps over which the adaptive
+ * policy measures the write cost of a policy
+ * @cf_adaptive_margin: improvement of the write cost in percent that the
+ * adaptive policy requires to switch policies
  */
 struct nilfs_cldconfig {
 	int cf_selection_policy;
@@ -90,6 +108,19 @@ struct nilfs_cldconfig {
 	int cf_log_priority;
 	unsigned long cf_min_reclaimable_blocks;
 	unsigned long cf_mc_min_reclaimable_blocks;
+	int cf_evaluation_threads;
+	int cf_pipelined_cleaning;
+	unsigned long long cf_summary_cache_size;
+	unsigned long cf_ioctl_batch_size;
+	struct timespec cf_ioctl_batch_latency;
+	unsigned long long cf_telemetry_ring_size;
+	struct timespec cf_telemetry_histogram_interval;
+	int cf_selection_mode;
+	unsigned long cf_selection_sample_size;
+	uint64_t cf_selection_seed;
+	int cf_reclaim_order;
+	unsigned long cf_adaptive_window;
+	unsigned long cf_adaptive_margin;
 };
 
 enum nilfs_selection_policy {
@@ -97,9 +128,16 @@ enum nilfs_selection_policy {
 	NILFS_SELECTION_POLICY_GREEDY = 1,
 	NILFS_SELECTION_POLICY_COST_BENEFIT = 2,
   NILFS_SELECTION_POLICY_SEGREGATION = 3,
+	NILFS_SELECTION_POLICY_COST_BENEFIT_AGE = 4,
+	NILFS_SELECTION_POLICY_ADAPTIVE = 5,
 	__NR_NILFS_SELECTION_POLICY
 };
 
+enum nilfs_selection_mode {
+	NILFS_SELECTION_MODE_EXACT = 0,	/* evaluate every candidate */
+	NILFS_SELECTION_MODE_SAMPLE,	/* evaluate a random sample */
+};
+
 #define NILFS_CLDCONFIG_PROTECTION_PERIOD		3600
 #define NILFS_CLDCONFIG_MIN_CLEAN_SEGMENTS		10
 #define NILFS_CLDCONFIG_MIN_CLEAN_SEGMENTS_UNIT		NILFS_SIZE_UNIT_PERCENT
@@ -118,8 +156,24 @@ enum nilfs_selection_policy {
 #define NILFS_CLDCONFIG_MIN_RECLAIMABLE_BLOCKS_UNIT	NILFS_SIZE_UNIT_PERCENT
 #define NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS	1
 #define NILFS_CLDCONFIG_MC_MIN_RECLAIMABLE_BLOCKS_UNIT	NILFS_SIZE_UNIT_PERCENT
+#define NILFS_CLDCONFIG_EVALUATION_THREADS		1
+#define NILFS_CLDCONFIG_PIPELINED_CLEANING		0
+#define NILFS_CLDCONFIG_SUMMARY_CACHE_SIZE		(32ULL << 20)
+#define NILFS_CLDCONFIG_IOCTL_BATCH_SIZE		512
+#define NILFS_CLDCONFIG_IOCTL_BATCH_LATENCY_NSEC	1000000
+#define NILFS_CLDCONFIG_TELEMETRY_RING_SIZE		(8ULL << 20)
+#define NILFS_CLDCONFIG_TELEMETRY_HISTOGRAM_INTERVAL	60
+#define NILFS_CLDCONFIG_SELECTION_MODE	NILFS_SELECTION_MODE_EXACT
+#define NILFS_CLDCONFIG_SELECTION_SAMPLE_SIZE		1024
+#define NILFS_CLDCONFIG_SELECTION_SEED			0
+#define NILFS_CLDCONFIG_RECLAIM_ORDER		NILFS_RECLAIM_ORDER_BLOCKNR
+#define NILFS_CLDCONFIG_ADAPTIVE_WINDOW			16
+#define NILFS_CLDCONFIG_ADAPTIVE_MARGIN			10
 
 #define NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX	32
+#define NILFS_CLDCONFIG_EVALUATION_THREADS_MAX	64
+#define NILFS_CLDCONFIG_SELECTION_SAMPLE_SIZE_MAX	65536
+#define NILFS_CLDCONFIG_ADAPTIVE_WINDOW_MAX		256
 
 struct nilfs;
 
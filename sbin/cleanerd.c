@@ -65,11 +65,20 @@
 #include <mqueue.h>
 #endif	/* HAVE_MQUEUE_H */
 
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif	/* HAVE_SYS_MMAN_H */
+
+#if HAVE_SYS_STATVFS_H
+#include <sys/statvfs.h>
+#endif	/* HAVE_SYS_STATVFS_H */
+
 #if HAVE_POLL_H
 #include <poll.h>
 #endif	/* HAVE_POLL_H */
 
 #include <errno.h>
+#include <math.h>	/* isnan, NAN */
 #include <signal.h>
 #include <setjmp.h>
 #include <assert.h>
@@ -85,6 +94,9 @@
 #include "cleaner_msg.h"
 #include "cldconfig.h"
 #include "cnormap.h"
+#include "sumcache.h"
+#include "telemetry.h"
+#include "gcpipe.h"
 #include "realpath.h"
 
 
@@ -92,6 +104,7 @@
 #define SYSCONFDIR		"/etc"
 #endif	/* SYSCONFDIR */
 #define NILFS_CLEANERD_CONFFILE	SYSCONFDIR "/nilfs_cleanerd.conf"
+#define NILFS_CLEANERD_TELEMETRY_FILE	"telemetry.ring"
 
 
 #ifdef _GNU_SOURCE
@@ -175,6 +188,13 @@ struct nilfs_cleaning_policy *nilfs_get_policy(const char *name)
 	return NULL;
 }
 
+struct nilfs_cleaning_policy *nilfs_get_policy_at(int index)
+{
+	if (index < 0 || index >= num_registered_policies)
+		return NULL;
+	return registered_policies[index];
+}
+
 static void nilfs_cleanerd_version(const char *progname)
 {
 	printf("%s (%s %s)\n", progname, PACKAGE, PACKAGE_VERSION);
@@ -194,6 +214,19 @@ static void nilfs_cleanerd_set_log_priority(struct nilfs_cleanerd *cleanerd)
 	setlogmask(LOG_UPTO(cleanerd->config.cf_log_priority));
 }
 
+static void nilfs_cleanerd_set_ioctl_batch(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldconfig *config = &cleanerd->config;
+	const struct timespec *ts = &config->cf_ioctl_batch_latency;
+	int i;
+
+	nilfs_set_ioctl_latency(cleanerd->nilfs,
+				ts->tv_sec * 1000000UL + ts->tv_nsec / 1000);
+	for (i = 0; i < __NR_NILFS_IOCTL_BATCH; i++)
+		nilfs_set_ioctl_batch(cleanerd->nilfs, i,
+				      config->cf_ioctl_batch_size);
+}
+
 static void nilfs_cleanerd_dump(struct nilfs_cleanerd *cleanerd)
 {
 	struct timespec ts;
@@ -245,6 +278,47 @@ skip_monotonic_clock:
 	syslog(LOG_DEBUG, "=================================================");
 }
 
+/**
+ * nilfs_cleanerd_open_telemetry - open the telemetry ring
+ * @cleanerd: cleanerd object
+ *
+ * The ring is placed in the log directory.  Telemetry is optional, so
+ * failing to open it is only reported.
+ */
+static void nilfs_cleanerd_open_telemetry(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cldconfig *config = &cleanerd->config;
+	char path[PATH_MAX];
+	int ret;
+
+	if (config->cf_telemetry_ring_size == 0)
+		return;
+
+	ret = snprintf(path, sizeof(path), "%s" NILFS_CLEANERD_TELEMETRY_FILE,
+		       config->cf_log_file);
+	if (unlikely(ret >= sizeof(path))) {
+		syslog(LOG_WARNING, "telemetry ring path too long");
+		return;
+	}
+
+	cleanerd->telemetry = nilfs_telemetry_open(
+		path, min_t(unsigned long long, config->cf_telemetry_ring_size,
+			    SIZE_MAX),
+		nilfs_get_blocks_per_segment(cleanerd->nilfs),
+		nilfs_get_nsegments(cleanerd->nilfs));
+	if (unlikely(cleanerd->telemetry == NULL))
+		syslog(LOG_WARNING, "cannot open telemetry ring %s: %m", path);
+
+	/* sample a histogram in the first cycle */
+	timespecclear(&cleanerd->histogram_time);
+}
+
+static void nilfs_cleanerd_close_telemetry(struct nilfs_cleanerd *cleanerd)
+{
+	nilfs_telemetry_close(cleanerd->telemetry);
+	cleanerd->telemetry = NULL;
+}
+
 /**
  * nilfs_cleanerd_config - load configuration file
  * @cleanerd: cleanerd object
@@ -273,6 +347,42 @@ static int nilfs_cleanerd_config(struct nilfs_cleanerd *cleanerd,
 		nilfs_opt_clear_set_suinfo(cleanerd->nilfs);
 
 	nilfs_cleanerd_set_log_priority(cleanerd);
+	nilfs_cleanerd_set_ioctl_batch(cleanerd);
+
+	ret = nilfs_segtable_set_threads(cleanerd->segtable,
+					 config->cf_evaluation_threads);
+	if (unlikely(ret < 0))
+		syslog(LOG_WARNING,
+		       "cannot start all segment evaluation threads");
+
+	/* restart the preparer so that it picks up the options above */
+	nilfs_gcpipe_destroy(cleanerd->gcpipe);
+	cleanerd->gcpipe = NULL;
+
+	nilfs_sumcache_destroy(cleanerd->sumcache);
+	cleanerd->sumcache = NULL;
+	if (config->cf_summary_cache_size > 0) {
+		cleanerd->sumcache = nilfs_sumcache_create(
+			min_t(unsigned long long, config->cf_summary_cache_size,
+			      SIZE_MAX));
+		if (unlikely(cleanerd->sumcache == NULL))
+			syslog(LOG_WARNING,
+			       "cannot create segment summary cache: %m");
+	}
+	cleanerd->segtable->sumcache = cleanerd->sumcache;
+
+	nilfs_cleanerd_close_telemetry(cleanerd);
+	nilfs_cleanerd_open_telemetry(cleanerd);
+
+	/* restart the sample sequence so that runs can be reproduced */
+	cleanerd->sample_state = config->cf_selection_seed;
+
+	if (config->cf_pipelined_cleaning) {
+		cleanerd->gcpipe = nilfs_gcpipe_create(cleanerd->nilfs);
+		if (unlikely(cleanerd->gcpipe == NULL))
+			syslog(LOG_WARNING,
+			       "cannot start pipelined cleaning: %m");
+	}
 
 	if (protection_period != ULONG_MAX) {
 		syslog(LOG_INFO, "override protection period to %lu",
@@ -329,11 +439,11 @@ static int nilfs_cleanerd_open_queue(struct nilfs_cleanerd *cleanerd,
 
 	if (S_ISBLK(stbuf.st_mode)) {
 		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu",
+			       NILFS_CLEANER_QUEUE_PREFIX "-%llu",
 			       (unsigned long long)stbuf.st_rdev);
 	} else if (S_ISREG(stbuf.st_mode) || S_ISDIR(stbuf.st_mode)) {
 		ret = snprintf(nambuf, sizeof(nambuf),
-			       "/nilfs-cleanerq-%llu-%llu",
+			       NILFS_CLEANER_QUEUE_PREFIX "-%llu-%llu",
 			       (unsigned long long)stbuf.st_dev,
 			       (unsigned long long)stbuf.st_ino);
 	} else {
@@ -382,6 +492,118 @@ static void nilfs_cleanerd_close_queue(struct nilfs_cleanerd *cleanerd)
 #define PATH_MAX	8192
 #endif	/* PATH_MAX */
 
+/**
+ * nilfs_cleanerd_open_stats - create the shared statistics page
+ * @cleanerd: cleanerd object
+ *
+ * The page is named after the device in the same way as the receive
+ * queue, so it must be called after nilfs_cleanerd_open_queue().  The
+ * statistics are only informational; failing to publish them is not
+ * an error.
+ */
+static void nilfs_cleanerd_open_stats(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cleaner_stats_page *page;
+	char nambuf[NAME_MAX - 4];
+	int fd, ret;
+
+	ret = snprintf(nambuf, sizeof(nambuf), NILFS_CLEANER_STATS_PREFIX "%s",
+		       cleanerd->recvq_name +
+		       strlen(NILFS_CLEANER_QUEUE_PREFIX));
+	assert(ret < sizeof(nambuf));
+
+	/* readers of a stale page notice that its owner is gone */
+	shm_unlink(nambuf);
+	fd = shm_open(nambuf, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (unlikely(fd < 0))
+		goto failed;
+
+	ret = ftruncate(fd, sizeof(*page));
+	if (unlikely(ret < 0))
+		goto failed_unlink;
+
+	page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED,
+		    fd, 0);
+	if (unlikely(page == MAP_FAILED))
+		goto failed_unlink;
+
+	cleanerd->stats_name = strdup(nambuf);
+	if (unlikely(!cleanerd->stats_name)) {
+		munmap(page, sizeof(*page));
+		goto failed_unlink;
+	}
+	close(fd);
+
+	page->version = NILFS_CLEANER_STATS_VERSION;
+	page->size = sizeof(page->stats);
+	page->seq = 0;
+	page->pid = getpid();
+	__atomic_store_n(&page->magic, NILFS_CLEANER_STATS_MAGIC,
+			 __ATOMIC_RELEASE);
+	cleanerd->stats_page = page;
+	return;
+
+failed_unlink:
+	close(fd);
+	shm_unlink(nambuf);
+failed:
+	syslog(LOG_WARNING, "cannot create statistics page %s: %m", nambuf);
+}
+
+static void nilfs_cleanerd_close_stats(struct nilfs_cleanerd *cleanerd)
+{
+	if (cleanerd->stats_page) {
+		munmap(cleanerd->stats_page, sizeof(*cleanerd->stats_page));
+		shm_unlink(cleanerd->stats_name);
+		free(cleanerd->stats_name);
+		cleanerd->stats_page = NULL;
+		cleanerd->stats_name = NULL;
+	}
+}
+
+/**
+ * nilfs_cleanerd_publish_stats - copy statistics to the shared page
+ * @cleanerd: cleanerd object
+ *
+ * The sequence counter of the page is odd while the statistics are
+ * being copied, which tells readers to retry (seqlock).
+ */
+static void nilfs_cleanerd_publish_stats(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cleaner_stats_page *page = cleanerd->stats_page;
+	struct timespec ts;
+	uint32_t seq;
+
+	if (!page)
+		return;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) == 0)
+		cleanerd->stats.update_time =
+			(uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	seq = page->seq;
+	__atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&page->stats, &cleanerd->stats, sizeof(page->stats));
+	__atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * nilfs_cleanerd_nsecs_since - get the time elapsed since a moment
+ * @start: monotonic time of the moment
+ */
+static uint64_t nilfs_cleanerd_nsecs_since(const struct timespec *start)
+{
+	struct timespec now;
+	int64_t delta;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return 0;
+	delta = (int64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+		(now.tv_nsec - start->tv_nsec);
+	return delta > 0 ? delta : 0;
+}
+
 static __attribute__((noinline)) char *get_canonical_path(const char *path)
 {
 	char buf[PATH_MAX + 2], *canonical = NULL;
@@ -424,9 +646,15 @@ nilfs_cleanerd_create(const char *dev, const char *dir, const char *conffile)
 		goto out_nilfs;
 	}
 
+	cleanerd->segtable = nilfs_segtable_create(cleanerd->nilfs);
+	if (unlikely(cleanerd->segtable == NULL)) {
+		syslog(LOG_ERR, "failed to create segment table: %m");
+		goto out_cnormap;
+	}
+
 	cleanerd->conffile = strdup(conffile ? : NILFS_CLEANERD_CONFFILE);
 	if (unlikely(cleanerd->conffile == NULL))
-		goto out_cnormap;
+		goto out_segtable;
 
 	ret = nilfs_cleanerd_config(cleanerd, NULL);
 	if (unlikely(ret < 0))
@@ -457,12 +685,20 @@ nilfs_cleanerd_create(const char *dev, const char *dir, const char *conffile)
 	if (unlikely(ret < 0))
 		goto out_conffile;
 
+	nilfs_cleanerd_open_stats(cleanerd);
+	nilfs_cleanerd_publish_stats(cleanerd);
+
 	/* success */
 	return cleanerd;
 
 	/* error */
 out_conffile:
+	nilfs_gcpipe_destroy(cleanerd->gcpipe);
 	free(cleanerd->conffile);
+out_segtable:
+	nilfs_segtable_destroy(cleanerd->segtable);
+	nilfs_sumcache_destroy(cleanerd->sumcache);
+	nilfs_cleanerd_close_telemetry(cleanerd);
 out_cnormap:
 	nilfs_cnormap_destroy(cleanerd->cnormap);
 out_nilfs:
@@ -475,8 +711,15 @@ out_cleanerd:
 
 static void nilfs_cleanerd_destroy(struct nilfs_cleanerd *cleanerd)
 {
+	nilfs_cleanerd_close_stats(cleanerd);
 	nilfs_cleanerd_close_queue(cleanerd);
+	if (cleanerd->policy->destroy)
+		cleanerd->policy->destroy(cleanerd->policy);
 	free(cleanerd->conffile);
+	nilfs_gcpipe_destroy(cleanerd->gcpipe);
+	nilfs_segtable_destroy(cleanerd->segtable);
+	nilfs_sumcache_destroy(cleanerd->sumcache);
+	nilfs_cleanerd_close_telemetry(cleanerd);
 	nilfs_cnormap_destroy(cleanerd->cnormap);
 	nilfs_close(cleanerd->nilfs);
 	free(cleanerd);
@@ -505,6 +748,26 @@ static long nilfs_cleanerd_ncleansegs(struct nilfs_cleanerd *cleanerd)
 		cleanerd->mm_ncleansegs : cleanerd->ncleansegs;
 }
 
+/*
+ * With pipelined cleaning, the runners-up of a cycle are selected as
+ * well to be prepared for the next cycle.
+ */
+#define NILFS_CLEANERD_NCANDIDATES_MAX	\
+	(2 * NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX)
+
+static size_t nilfs_cleanerd_nbatch(struct nilfs_cleanerd *cleanerd)
+{
+	return min_t(size_t, max_t(long, nilfs_cleanerd_ncleansegs(cleanerd), 1),
+		     NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX);
+}
+
+static size_t nilfs_cleanerd_ncandidates(struct nilfs_cleanerd *cleanerd)
+{
+	size_t nbatch = nilfs_cleanerd_nbatch(cleanerd);
+
+	return cleanerd->gcpipe ? 2 * nbatch : nbatch;
+}
+
 static struct timespec *
 nilfs_cleanerd_cleaning_interval(struct nilfs_cleanerd *cleanerd)
 {
@@ -591,6 +854,473 @@ static int nilfs_shrink_protected_region(struct nilfs *nilfs)
 	return ret;
 }
 
+/**
+ * struct nilfs_cleanerd_topk - bounded selection of the best candidates
+ * @compare: comparison function of the policy (negative if better)
+ * @size: number of candidates held in @cands
+ * @capacity: maximum number of candidates to be held
+ * @cands: binary heap of candidates whose root is the worst one held
+ */
+struct nilfs_cleanerd_topk {
+	int (*compare)(const void *, const void *);
+	size_t size;
+	size_t capacity;
+	struct nilfs_segment_candidate cands[NILFS_CLEANERD_NCANDIDATES_MAX];
+};
+
+static void nilfs_cleanerd_topk_init(struct nilfs_cleanerd_topk *topk,
+				     int (*compare)(const void *,
+						    const void *),
+				     size_t capacity)
+{
+	topk->compare = compare;
+	topk->size = 0;
+	topk->capacity = min_t(size_t, max_t(size_t, capacity, 1),
+			       NILFS_CLEANERD_NCANDIDATES_MAX);
+}
+
+static void nilfs_cleanerd_topk_swap(struct nilfs_cleanerd_topk *topk,
+				     size_t i, size_t j)
+{
+	struct nilfs_segment_candidate tmp = topk->cands[i];
+
+	topk->cands[i] = topk->cands[j];
+	topk->cands[j] = tmp;
+}
+
+static void nilfs_cleanerd_topk_sift_down(struct nilfs_cleanerd_topk *topk,
+					  size_t i)
+{
+	size_t child, worst;
+
+	for (;;) {
+		worst = i;
+		child = 2 * i + 1;
+		if (child < topk->size &&
+		    topk->compare(&topk->cands[child], &topk->cands[worst]) > 0)
+			worst = child;
+		child++;
+		if (child < topk->size &&
+		    topk->compare(&topk->cands[child], &topk->cands[worst]) > 0)
+			worst = child;
+		if (worst == i)
+			break;
+		nilfs_cleanerd_topk_swap(topk, i, worst);
+		i = worst;
+	}
+}
+
+/**
+ * nilfs_cleanerd_topk_push - offer a candidate to the top-K selection
+ * @topk: top-K selection
+ * @cand: evaluated candidate
+ *
+ * The candidate is kept if fewer than @topk->capacity candidates are
+ * held or it is better than the worst one held, which is evicted.
+ * Metadata of a dropped candidate is freed here.
+ */
+static void nilfs_cleanerd_topk_push(struct nilfs_cleanerd_topk *topk,
+				     const struct nilfs_segment_candidate *cand)
+{
+	size_t i, parent;
+
+	if (topk->size < topk->capacity) {
+		i = topk->size++;
+		topk->cands[i] = *cand;
+		while (i > 0) {
+			parent = (i - 1) / 2;
+			if (topk->compare(&topk->cands[i],
+					  &topk->cands[parent]) <= 0)
+				break;
+			nilfs_cleanerd_topk_swap(topk, i, parent);
+			i = parent;
+		}
+		return;
+	}
+
+	if (topk->compare(cand, &topk->cands[0]) >= 0) {
+		free(cand->metadata);
+		return;
+	}
+	free(topk->cands[0].metadata);
+	topk->cands[0] = *cand;
+	nilfs_cleanerd_topk_sift_down(topk, 0);
+}
+
+static void nilfs_cleanerd_topk_release(struct nilfs_cleanerd_topk *topk)
+{
+	size_t i;
+
+	for (i = 0; i < topk->size; i++)
+		free(topk->cands[i].metadata);
+	topk->size = 0;
+}
+
+/**
+ * nilfs_cleanerd_topk_drain - store selected segments in policy order
+ * @topk: top-K selection
+ * @segnums: array to store segment numbers
+ */
+static size_t nilfs_cleanerd_topk_drain(struct nilfs_cleanerd_topk *topk,
+					uint64_t *segnums)
+{
+	size_t i, n = topk->size;
+
+	qsort(topk->cands, n, sizeof(topk->cands[0]), topk->compare);
+	for (i = 0; i < n; i++)
+		segnums[i] = topk->cands[i].segnum;
+	nilfs_cleanerd_topk_release(topk);
+	return n;
+}
+
+/**
+ * struct nilfs_cleanerd_batch - segments gathered for batch evaluation
+ * @n: number of segments gathered
+ * @segnumv: segment numbers
+ * @lastmodv: lastmod of the segments
+ * @livev: live block counts of the segments
+ * @scorev: scores of the segments
+ */
+#define NILFS_CLEANERD_NBATCH	1024
+
+struct nilfs_cleanerd_batch {
+	size_t n;
+	uint64_t segnumv[NILFS_CLEANERD_NBATCH];
+	double lastmodv[NILFS_CLEANERD_NBATCH];
+	double livev[NILFS_CLEANERD_NBATCH];
+	double scorev[NILFS_CLEANERD_NBATCH];
+};
+
+static void nilfs_cleanerd_init_env(struct nilfs_cleanerd *cleanerd,
+				    const struct nilfs_sustat *sustat,
+				    int64_t now, int64_t prottime,
+				    int64_t oldest,
+				    struct nilfs_policy_env *env)
+{
+	env->now = now;
+	env->prottime = prottime;
+	env->nongc_ctime = sustat->ss_nongc_ctime;
+	env->blocks_per_segment =
+		nilfs_get_blocks_per_segment(cleanerd->nilfs);
+	env->oldest = oldest;
+}
+
+/**
+ * nilfs_cleanerd_batch_add - gather a segment for batch evaluation
+ * @batch: batch of segments
+ * @segtable: segment table
+ * @segnum: segment number
+ *
+ * Return: 1 if the segment was added, or 0 if its live block count is
+ * not known.
+ */
+static int nilfs_cleanerd_batch_add(struct nilfs_cleanerd_batch *batch,
+				    const struct nilfs_segtable *segtable,
+				    uint64_t segnum)
+{
+	ssize_t live;
+
+	if (nilfs_segtable_get_live(segtable, segnum, &live) <= 0)
+		return 0;
+
+	batch->segnumv[batch->n] = segnum;
+	batch->lastmodv[batch->n] = segtable->lastmod[segnum];
+	batch->livev[batch->n] = live;
+	batch->n++;
+	return 1;
+}
+
+/**
+ * nilfs_cleanerd_policy - get the policy that selects segments this cycle
+ * @cleanerd: cleanerd object
+ *
+ * A meta policy such as the adaptive one hands the selection over to
+ * one of the other policies, and may pick another one after any
+ * cleaning step.
+ */
+static struct nilfs_cleaning_policy *
+nilfs_cleanerd_policy(struct nilfs_cleanerd *cleanerd)
+{
+	struct nilfs_cleaning_policy *policy = cleanerd->policy;
+
+	while (policy->delegate)
+		policy = policy->delegate(policy);
+	return policy;
+}
+
+/**
+ * nilfs_cleanerd_batch_flush - score a batch and offer it to top-K
+ * @cleanerd: cleanerd object
+ * @env: cycle-wide inputs of the policy
+ * @batch: batch of segments
+ * @topk: top-K selection to be fed with eligible candidates
+ */
+static void nilfs_cleanerd_batch_flush(struct nilfs_cleanerd *cleanerd,
+				       const struct nilfs_policy_env *env,
+				       struct nilfs_cleanerd_batch *batch,
+				       struct nilfs_cleanerd_topk *topk)
+{
+	struct nilfs_cleaning_policy *policy = nilfs_cleanerd_policy(cleanerd);
+	struct nilfs_segment_candidate cand;
+	size_t i;
+
+	policy->evaluate_batch(policy, env, batch->n, batch->lastmodv,
+			       batch->livev, batch->scorev);
+	for (i = 0; i < batch->n; i++) {
+		if (isnan(batch->scorev[i]))
+			continue;  /* not eligible */
+		cand.segnum = batch->segnumv[i];
+		cand.score = batch->scorev[i];
+		cand.metadata = NULL;
+		cand.util = batch->livev[i] / env->blocks_per_segment;
+		nilfs_cleanerd_topk_push(topk, &cand);
+	}
+	batch->n = 0;
+}
+
+/**
+ * nilfs_cleanerd_evaluate_batch - score segments with batch evaluation
+ * @cleanerd: cleanerd object
+ * @env: cycle-wide inputs of the policy
+ * @topk: top-K selection to be fed with eligible candidates
+ *
+ * Reclaimable segments whose live block count is known are gathered
+ * into dense arrays and scored by the evaluate_batch method of the
+ * policy, NILFS_CLEANERD_NBATCH segments at a time.
+ */
+static void nilfs_cleanerd_evaluate_batch(struct nilfs_cleanerd *cleanerd,
+					  const struct nilfs_policy_env *env,
+					  struct nilfs_cleanerd_topk *topk)
+{
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_cleanerd_batch batch;
+	uint64_t segnum;
+
+	batch.n = 0;
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		if (nilfs_cleanerd_batch_add(&batch, segtable, segnum) &&
+		    batch.n == NILFS_CLEANERD_NBATCH)
+			nilfs_cleanerd_batch_flush(cleanerd, env, &batch, topk);
+	}
+	if (batch.n > 0)
+		nilfs_cleanerd_batch_flush(cleanerd, env, &batch, topk);
+}
+
+/**
+ * nilfs_cleanerd_walk_next - get the next segment in a walk order
+ * @segtable: segment table
+ * @walk: walk order (NILFS_POLICY_WALK_*)
+ * @segnum: current segment, or NILFS_SEGTABLE_NIL to start the walk
+ */
+static uint64_t nilfs_cleanerd_walk_next(const struct nilfs_segtable *segtable,
+					 int walk, uint64_t segnum)
+{
+	switch (walk) {
+	case NILFS_POLICY_WALK_LIVE:
+		return nilfs_segtable_live_next(segtable, segnum);
+	case NILFS_POLICY_WALK_NEWEST:
+		return segnum == NILFS_SEGTABLE_NIL ? segtable->newest :
+			segtable->aprev[segnum];
+	default:
+		return segnum == NILFS_SEGTABLE_NIL ? segtable->oldest :
+			segtable->anext[segnum];
+	}
+}
+
+/**
+ * nilfs_cleanerd_walk_index - score segments in the order of the index
+ * @cleanerd: cleanerd object
+ * @env: cycle-wide inputs of the policy
+ * @topk: top-K selection to be fed with eligible candidates
+ *
+ * Segments are scored in batches along the walk order of the policy.
+ * After each batch, the walk ends if the top-K selection is full and
+ * the best score the rest of the walk can have loses to the worst
+ * candidate held.  The batches start at the size of the selection and
+ * double, so a cycle that finds its victims early only scores a few
+ * times as many segments as it selects.
+ */
+static void nilfs_cleanerd_walk_index(struct nilfs_cleanerd *cleanerd,
+				      const struct nilfs_policy_env *env,
+				      struct nilfs_cleanerd_topk *topk)
+{
+	struct nilfs_cleaning_policy *policy = nilfs_cleanerd_policy(cleanerd);
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_segment_candidate bound;
+	struct nilfs_cleanerd_batch batch;
+	uint64_t segnum;
+	size_t limit = topk->capacity;
+	ssize_t live;
+
+	batch.n = 0;
+	segnum = nilfs_cleanerd_walk_next(segtable, policy->walk,
+					  NILFS_SEGTABLE_NIL);
+	while (segnum != NILFS_SEGTABLE_NIL) {
+		if (batch.n == 0 && topk->size == topk->capacity) {
+			/* the live walk is ordered by bucket */
+			live = 0;
+			nilfs_segtable_get_live(segtable, segnum, &live);
+			live = min_t(ssize_t, live, segtable->nbuckets - 1);
+			bound.segnum = 0;	/* wins ties */
+			bound.score = policy->bound(policy, env, live,
+						    segtable->lastmod[segnum]);
+			if (topk->compare(&bound, &topk->cands[0]) > 0)
+				break;
+		}
+
+		if (nilfs_cleanerd_batch_add(&batch, segtable, segnum) &&
+		    batch.n == limit) {
+			nilfs_cleanerd_batch_flush(cleanerd, env, &batch, topk);
+			limit = min_t(size_t, 2 * limit, NILFS_CLEANERD_NBATCH);
+		}
+		segnum = nilfs_cleanerd_walk_next(segtable, policy->walk,
+						  segnum);
+	}
+	if (batch.n > 0)
+		nilfs_cleanerd_batch_flush(cleanerd, env, &batch, topk);
+}
+
+/**
+ * nilfs_cleanerd_random - get the next number of the sample sequence
+ * @cleanerd: cleanerd object
+ *
+ * This is splitmix64; it is cheap, and the sequence only depends on the
+ * selection_seed option.
+ */
+static uint64_t nilfs_cleanerd_random(struct nilfs_cleanerd *cleanerd)
+{
+	uint64_t z;
+
+	z = (cleanerd->sample_state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static int nilfs_cleanerd_comp_segnum(const void *elem1, const void *elem2)
+{
+	const uint64_t *segnum1 = elem1, *segnum2 = elem2;
+
+	return (*segnum1 < *segnum2) ? -1 : (*segnum1 == *segnum2) ? 0 : 1;
+}
+
+/**
+ * nilfs_cleanerd_unique_segnums - sort segment numbers and drop duplicates
+ * @segnums: array of segment numbers
+ * @n: number of segment numbers in @segnums
+ *
+ * Return: number of distinct segment numbers left in @segnums.
+ */
+static size_t nilfs_cleanerd_unique_segnums(uint64_t *segnums, size_t n)
+{
+	size_t i, j;
+
+	if (n == 0)
+		return 0;
+
+	qsort(segnums, n, sizeof(segnums[0]), nilfs_cleanerd_comp_segnum);
+	for (i = 1, j = 1; i < n; i++) {
+		if (segnums[i] != segnums[j - 1])
+			segnums[j++] = segnums[i];
+	}
+	return j;
+}
+
+/**
+ * nilfs_cleanerd_refresh_segtable - refresh the whole segment table
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ *
+ * This sweeps the segment usage file at most once per cycle, and only
+ * when something needs the whole table; in sample mode, the selection
+ * reloads just the segments it draws.
+ */
+static int nilfs_cleanerd_refresh_segtable(struct nilfs_cleanerd *cleanerd,
+					   const struct nilfs_sustat *sustat)
+{
+	int ret;
+
+	if (cleanerd->segtable_fresh)
+		return 0;
+	ret = nilfs_segtable_refresh(cleanerd->segtable, sustat);
+	if (unlikely(ret < 0))
+		return -1;
+	cleanerd->segtable_fresh = 1;
+	return 0;
+}
+
+/**
+ * nilfs_cleanerd_sampling - test if this cycle selects from a sample
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ *
+ * Sampling needs a table that was refreshed in full before and still
+ * has the size of the volume, so the first cycle and the one after a
+ * resize sweep the whole segment usage file.
+ */
+static int nilfs_cleanerd_sampling(struct nilfs_cleanerd *cleanerd,
+				   const struct nilfs_sustat *sustat)
+{
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+
+	return cleanerd->config.cf_selection_mode ==
+		NILFS_SELECTION_MODE_SAMPLE &&
+		!nilfs_cleanerd_policy(cleanerd)->select &&
+		segtable->nsegs == sustat->ss_nsegs &&
+		segtable->nsegs > cleanerd->config.cf_selection_sample_size;
+}
+
+/**
+ * nilfs_cleanerd_draw_sample - draw reclaimable segments at random
+ * @cleanerd: cleanerd object
+ * @sample: array to store the sample, of @size entries
+ * @size: number of segments to be drawn
+ *
+ * Segment numbers are drawn uniformly, their usage is reloaded into the
+ * segment table, and those not reclaimable are thrown back.  The rest
+ * of the table is not read, so the I/O of a cycle depends on @size
+ * rather than on the size of the volume.  The number of draws is
+ * limited to four times @size so that a volume with few reclaimable
+ * segments does not stall the cycle; the sample is smaller in that
+ * case.
+ *
+ * Return: number of distinct segments in @sample, in ascending order,
+ * or -1 if the segment usage cannot be read.
+ */
+static ssize_t nilfs_cleanerd_draw_sample(struct nilfs_cleanerd *cleanerd,
+					  uint64_t *sample, size_t size)
+{
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_suinfo si;
+	uint64_t ndraws = 0;
+	size_t i, n = 0, base, ndrawn;
+	int ret;
+
+	while (n < size && ndraws < 4 * (uint64_t)size) {
+		base = n;
+		ndrawn = min_t(uint64_t, size - n, 4 * (uint64_t)size - ndraws);
+		for (i = 0; i < ndrawn; i++)
+			sample[base + i] = nilfs_cleanerd_random(cleanerd) %
+				segtable->nsegs;
+		ndraws += ndrawn;
+
+		ndrawn = nilfs_cleanerd_unique_segnums(&sample[base], ndrawn);
+		ret = nilfs_segtable_refresh_of(segtable, &sample[base],
+						ndrawn);
+		if (unlikely(ret < 0))
+			return -1;
+
+		for (i = 0; i < ndrawn; i++) {
+			nilfs_segtable_get_suinfo(segtable, sample[base + i],
+						  &si);
+			if (nilfs_suinfo_reclaimable(&si))
+				sample[n++] = sample[base + i];
+		}
+		n = nilfs_cleanerd_unique_segnums(sample, n);
+	}
+	return n;
+}
+
 /**
  * nilfs_cleanerd_select_segments - select segments to be reclaimed
  * @cleanerd: cleanerd object
@@ -598,8 +1328,16 @@ static int nilfs_shrink_protected_region(struct nilfs *nilfs)
  * @segnums: array of segment numbers to store selected segments
  * @prottimep: place to store lower limit of protected period
  * @oldestp: place to store the oldest mod-time
+ *
+ * In sample mode, only the usage of a random sample of segments is
+ * read, and only the reclaimable ones among them are assessed and
+ * scored, so the I/O of a cycle follows the sample size rather than
+ * the size of the volume.  The victims are the best of the sample
+ * rather than the best of the volume, and the oldest mod-time is taken
+ * from a victim index in which the segments not drawn since the last
+ * full refresh keep their usage as of that refresh.  Policies with
+ * their own select method always see the whole volume.
  */
-#define NILFS_CLEANERD_NSUINFO	512
 #define NILFS_CLEANERD_NULLTIME INT64_MAX
 
 static ssize_t
@@ -609,126 +1347,143 @@ nilfs_cleanerd_select_segments(struct nilfs_cleanerd *cleanerd,
 			       int64_t *prottimep, 
 			       int64_t *oldestp)
 {
-	struct nilfs_cleaning_policy *policy = cleanerd->policy;
-	struct nilfs_vector *candidates;
-	struct nilfs_segment_candidate *cand;
-	struct nilfs_suinfo si[NILFS_CLEANERD_NSUINFO];
-	struct timespec ts, ts2;
+	struct nilfs_cleaning_policy *policy = nilfs_cleanerd_policy(cleanerd);
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_cleanerd_topk topk;
+	struct nilfs_segment_candidate cand;
+	struct nilfs_policy_env env;
+	struct nilfs_suinfo si;
+	struct timespec ts, ts2, start, *pt;
 	int64_t prottime, oldest, now;
-	uint64_t segnum;
-	size_t count, nsegs;
-	ssize_t nssegs, n;
-	int ret, i, eligible;
-	
-  syslog(LOG_INFO, "selecting segments to clean using policy: %s", policy->name);
-	/* If policy has custom select function, use it */
+	nilfs_cno_t protcno;
+	uint64_t segnum, *sample = NULL;
+	size_t i, nsample = 0;
+	ssize_t nssegs;
+	int ret, eligible;
+
+	syslog(LOG_INFO, "selecting segments to clean using policy: %s", policy->name);
 
-  /* Calculate protection time */
+	/* Calculate protection time */
 	ret = clock_gettime(CLOCK_REALTIME, &ts);
 	if (unlikely(ret < 0)) {
 		nssegs = -1;
 		goto out;
 	}
-	timespecsub(&ts, nilfs_cleanerd_protection_period(cleanerd), &ts2);
+	pt = nilfs_cleanerd_protection_period(cleanerd);
+	timespecsub(&ts, pt, &ts2);
 	now = ts.tv_sec;
 	prottime = ts2.tv_sec;
-	oldest = NILFS_CLEANERD_NULLTIME;
-  nsegs = nilfs_cleanerd_ncleansegs(cleanerd);
-  for (segnum = 0; segnum < sustat->ss_nsegs; segnum += n) {
-    count = min_t(uint64_t, sustat->ss_nsegs - segnum,
-			      NILFS_CLEANERD_NSUINFO);
-    n = nilfs_get_suinfo(cleanerd->nilfs, segnum, si, count);
-		if (unlikely(n < 0)) {
-			nssegs = n;
+
+	/*
+	 * Live block counts are evaluated against the protection
+	 * checkpoint so that the segment table can keep results of
+	 * segments whose usage has not changed since the last cycle.
+	 */
+	ret = nilfs_cnormap_track_back(cleanerd->cnormap, pt->tv_sec,
+				       &protcno);
+	if (unlikely(ret < 0)) {
+		syslog(LOG_ERR,
+		       "cannot get checkpoint number from protection period (%llu): %m",
+		       (unsigned long long)pt->tv_sec);
+		nssegs = -1;
+		goto out;
+	}
+	if (nilfs_cleanerd_sampling(cleanerd, sustat)) {
+		nsample = cleanerd->config.cf_selection_sample_size;
+		sample = malloc(sizeof(*sample) * nsample);
+		if (unlikely(!sample)) {
+			nssegs = -1;
+			goto out;
+		}
+		nssegs = nilfs_cleanerd_draw_sample(cleanerd, sample,
+						    nsample);
+		if (unlikely(nssegs < 0))
+			goto out;
+		nsample = nssegs;
+	} else {
+		ret = nilfs_cleanerd_refresh_segtable(cleanerd, sustat);
+		if (unlikely(ret < 0)) {
+			nssegs = -1;
 			goto out;
 		}
+	}
 
-		for (i = 0; i < n; i++) {
-			if (!nilfs_suinfo_reclaimable(&si[i]))
-				continue;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (sample)
+		ret = nilfs_segtable_update_live_of(segtable, sustat, protcno,
+						    sample, nsample);
+	else
+		ret = nilfs_segtable_update_live(segtable, sustat, protcno);
+	cleanerd->stats.assess_nsecs += nilfs_cleanerd_nsecs_since(&start);
+	if (unlikely(ret < 0)) {
+		nssegs = -1;
+		goto out;
+	}
+
+	oldest = nilfs_segtable_oldest_lastmod(segtable,
+					       NILFS_CLEANERD_NULLTIME);
 
-			/* Track oldest segment */
-			if (si[i].sui_lastmod < oldest)
-				oldest = si[i].sui_lastmod;
-    }
-    if (unlikely(n == 0))
-			break;
-  }
 	if (policy->select) {
-    syslog(LOG_INFO, "Using custom select function for policy: %s", policy->name);
-    *oldestp = oldest;
-    *prottimep = prottime;
-		return policy->select(policy, cleanerd, sustat, now, 
+		syslog(LOG_INFO, "Using custom select function for policy: %s", policy->name);
+		*oldestp = oldest;
+		*prottimep = prottime;
+		return policy->select(policy, cleanerd, sustat, now,
 				      segnums, prottime);
-  }
-  syslog(LOG_INFO, "No select policy provided, using generic selection method");
+	}
+	syslog(LOG_INFO, "No select policy provided, using generic selection method");
 
 	/* Generic selection using policy's evaluate function */
 
-	candidates = nilfs_vector_create(sizeof(struct nilfs_segment_candidate));
-	if (unlikely(!candidates))
-		return -1;
+	nilfs_cleanerd_topk_init(&topk, policy->compare,
+				 nilfs_cleanerd_ncandidates(cleanerd));
 
-	/* Evaluate all segments using policy */
-	for (segnum = 0; segnum < sustat->ss_nsegs; segnum += n) {
-		count = min_t(uint64_t, sustat->ss_nsegs - segnum,
-			      NILFS_CLEANERD_NSUINFO);
-		n = nilfs_get_suinfo(cleanerd->nilfs, segnum, si, count);
-		if (unlikely(n < 0)) {
-			nssegs = n;
-			goto out;
+	nilfs_cleanerd_init_env(cleanerd, sustat, now, prottime, oldest,
+				&env);
+	if (sample) {
+		for (i = 0; i < nsample; i++) {
+			nilfs_segtable_get_suinfo(segtable, sample[i], &si);
+			memset(&cand, 0, sizeof(cand));
+			eligible = policy->evaluate_segment(
+				policy, cleanerd, sustat, &si,
+				sample[i], now, prottime, &cand);
+			if (eligible)
+				nilfs_cleanerd_topk_push(&topk, &cand);
 		}
+		goto drain;
+	}
+	if (policy->evaluate_batch && policy->bound &&
+	    policy->walk != NILFS_POLICY_WALK_NONE) {
+		nilfs_cleanerd_walk_index(cleanerd, &env, &topk);
+		goto drain;
+	}
+	if (policy->evaluate_batch) {
+		nilfs_cleanerd_evaluate_batch(cleanerd, &env, &topk);
+		goto drain;
+	}
 
-		for (i = 0; i < n; i++) {
-			if (!nilfs_suinfo_reclaimable(&si[i]))
-				continue;
-
-			/* Track oldest segment */
-			if (si[i].sui_lastmod < oldest)
-				oldest = si[i].sui_lastmod;
+	/* Evaluate all segments using policy */
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (!nilfs_suinfo_reclaimable(&si))
+			continue;
 
-			/* Ask policy to evaluate this segment */
-			cand = nilfs_vector_get_new_element(candidates);
-			if (unlikely(cand == NULL)) {
-				nssegs = -1;
-				goto out;
-			}
+		/* Ask policy to evaluate this segment */
+		memset(&cand, 0, sizeof(cand));
+		eligible = policy->evaluate_segment(
+			policy, cleanerd, sustat, &si,
+			segnum, now, prottime, &cand);
+		if (eligible)
+			nilfs_cleanerd_topk_push(&topk, &cand);
+	}
 
-			eligible = policy->evaluate_segment(
-				policy, cleanerd, sustat, &si[i],
-				segnum + i, now, prottime, cand);
+drain:
+	/* Select top N segments in the order of the policy */
+	nssegs = nilfs_cleanerd_topk_drain(&topk, segnums);
 
-			if (!eligible) {
-				/* Remove from vector if not eligible */
-				nilfs_vector_delete_element(candidates,
-							    nilfs_vector_get_size(candidates) - 1);
-			}
-		}
-		
-		if (unlikely(n == 0))
-			break;
-	}
-	
-	/* Sort using policy's comparison function */
-	nilfs_vector_sort(candidates, policy->compare);
-	
-	/* Select top N segments */
-	nssegs = min_t(size_t, nilfs_vector_get_size(candidates), 2);
-	for (i = 0; i < nssegs; i++) {
-		cand = nilfs_vector_get_element(candidates, i);
-		assert(cand != NULL);
-		segnums[i] = cand->segnum;
-    
-		/* Free policy metadata if allocated */
-		if (cand->metadata)
-			free(cand->metadata);
-	}
-	
 	*prottimep = prottime;
 	*oldestp = oldest;
-	
 out:
-	nilfs_vector_destroy(candidates);
+	free(sample);
 	return nssegs;
 }
 
@@ -1444,27 +2199,18 @@ static ssize_t
 nilfs_cleanerd_count_inuse_segments(struct nilfs_cleanerd *cleanerd,
 				    struct nilfs_sustat *sustat)
 {
-	struct nilfs_suinfo si[NILFS_CLEANERD_NSUINFO];
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_suinfo si;
 	uint64_t segnum;
-	unsigned long rest, count;
-	ssize_t nsi, i;
 	ssize_t nfound = 0;
 
-	segnum = 0;
-	rest = sustat->ss_nsegs;
-	while (rest > 0 && segnum < sustat->ss_nsegs) {
-		count = min_t(unsigned long, rest, NILFS_CLEANERD_NSUINFO);
-		nsi = nilfs_get_suinfo(cleanerd->nilfs, segnum, si, count);
-		if (unlikely(nsi < 0)) {
-			syslog(LOG_ERR, "cannot get segment usage info: %m");
-			return -1;
-		}
-		for (i = 0; i < nsi; i++, segnum++) {
-			if (nilfs_suinfo_reclaimable(&si[i])) {
-				nfound++;
-				rest--;
-			}
-		}
+	if (unlikely(nilfs_cleanerd_refresh_segtable(cleanerd, sustat) < 0))
+		return -1;
+
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (nilfs_suinfo_reclaimable(&si))
+			nfound++;
 	}
 	return nfound; /* return the number of found segments */
 }
@@ -1531,13 +2277,114 @@ static void nilfs_cleanerd_progress(struct nilfs_cleanerd *cleanerd, int nsegs)
 	}
 }
 
+/**
+ * nilfs_cleanerd_readahead - start reading segments about to be cleaned
+ * @cleanerd: cleanerd object
+ * @segnums: array of segment numbers
+ * @nsegs: number of segments in @segnums
+ *
+ * Reads of all the segments are queued at once right after selection so
+ * that parsing their summaries rarely waits for the disk.
+ */
+static void nilfs_cleanerd_readahead(struct nilfs_cleanerd *cleanerd,
+				     const uint64_t *segnums, size_t nsegs)
+{
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	size_t i;
+
+	for (i = 0; i < nsegs; i++) {
+		if (unlikely(nilfs_readahead_segment(
+				     cleanerd->nilfs, segnums[i],
+				     segtable->nblocks[segnums[i]]) < 0)) {
+			syslog(LOG_DEBUG, "cannot read ahead segment %llu: %m",
+			       (unsigned long long)segnums[i]);
+			break;
+		}
+	}
+}
+
+/**
+ * nilfs_cleanerd_pipeline_segments - arrange segments for pipelined cleaning
+ * @cleanerd: cleanerd object
+ * @segnums: selected segments in policy order, which receives the
+ *           segments to be cleaned in this cycle
+ * @nsegs: number of selected segments
+ * @nextv: array to store the segments to be prepared for the next cycle
+ * @nnextp: place to store the number of segments in @nextv
+ * @preparedp: place to store whether the segments to be cleaned in this
+ *             cycle have been prepared
+ *
+ * A batch prepared in the previous cycle consists of the runners-up of
+ * that cycle, so it is cleaned in place of the best candidates of this
+ * cycle, and the best candidates not in it are prepared next.  Without
+ * a prepared batch, the best candidates are cleaned and the runners-up
+ * are prepared.
+ */
+static size_t nilfs_cleanerd_pipeline_segments(struct nilfs_cleanerd *cleanerd,
+					       uint64_t *segnums, size_t nsegs,
+					       uint64_t *nextv, size_t *nnextp,
+					       int *preparedp)
+{
+	uint64_t prepv[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	size_t nbatch = nilfs_cleanerd_nbatch(cleanerd);
+	size_t nprep, i, j, n = 0;
+
+	nprep = nilfs_gcpipe_take(cleanerd->gcpipe, prepv);
+	if (nprep == 0 || nsegs == 0) {
+		*preparedp = 0;
+		if (nsegs > nbatch) {
+			n = nsegs - nbatch;
+			memcpy(nextv, segnums + nbatch, sizeof(*nextv) * n);
+			nsegs = nbatch;
+		}
+		*nnextp = n;
+		return nsegs;
+	}
+
+	for (i = 0; i < nsegs && n < nbatch; i++) {
+		for (j = 0; j < nprep; j++)
+			if (segnums[i] == prepv[j])
+				break;
+		if (j == nprep)
+			nextv[n++] = segnums[i];
+	}
+	*nnextp = n;
+	*preparedp = 1;
+	memcpy(segnums, prepv, sizeof(*segnums) * nprep);
+	return nprep;
+}
+
+/**
+ * nilfs_cleanerd_ioctl_stat - sum up statistics of information ioctls
+ * @cleanerd: cleanerd object
+ * @stat: buffer to store the sums
+ */
+static void nilfs_cleanerd_ioctl_stat(struct nilfs_cleanerd *cleanerd,
+				      struct nilfs_ioctl_stat *stat)
+{
+	struct nilfs_ioctl_stat st;
+	int i;
+
+	memset(stat, 0, sizeof(*stat));
+	for (i = 0; i < __NR_NILFS_IOCTL_BATCH; i++) {
+		if (nilfs_get_ioctl_stat(cleanerd->nilfs, i, &st) < 0)
+			continue;
+		stat->ncalls += st.ncalls;
+		stat->nitems += st.nitems;
+		stat->nsecs += st.nsecs;
+	}
+}
+
 static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 					 uint64_t *segnums, size_t nsegs,
-					 uint64_t protseq, size_t *ndone)
+					 int prepared, const uint64_t *nextv,
+					 size_t nnext, uint64_t protseq,
+					 size_t *ndone)
 {
 	struct nilfs_reclaim_params params;
 	struct nilfs_reclaim_stat stat;
-	struct timespec *pt;
+	struct nilfs_ioctl_stat ios0, ios;
+	struct timespec start, *pt;
 	int ret, i, sumsegs;
 
 	params.flags = NILFS_RECLAIM_PARAM_PROTSEQ |
@@ -1546,6 +2393,14 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 	params.min_reclaimable_blks =
 			nilfs_cleanerd_min_reclaimable_blocks(cleanerd);
 	params.protseq = protseq;
+	if (cleanerd->sumcache) {
+		params.flags |= NILFS_RECLAIM_PARAM_SUMCACHE;
+		params.sumcache = cleanerd->sumcache;
+	}
+	if (cleanerd->config.cf_reclaim_order != NILFS_RECLAIM_ORDER_BLOCKNR) {
+		params.flags |= NILFS_RECLAIM_PARAM_ORDER;
+		params.order = cleanerd->config.cf_reclaim_order;
+	}
 
 	pt = nilfs_cleanerd_protection_period(cleanerd);
 
@@ -1560,9 +2415,24 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 	syslog(LOG_DEBUG, "got cno %llu from protection period %lu",
 	       (unsigned long long)params.protcno, (unsigned long)pt->tv_sec);
 
+	if (cleanerd->gcpipe) {
+		/* read the next segments while the kernel cleans these */
+		ret = nilfs_gcpipe_post(cleanerd->gcpipe, nextv, nnext,
+					&params);
+		if (unlikely(ret < 0))
+			syslog(LOG_WARNING, "cannot prepare next segments: %m");
+	}
+
+	nilfs_cleanerd_ioctl_stat(cleanerd, &ios0);
 	memset(&stat, 0, sizeof(stat));
-	ret = nilfs_xreclaim_segment(cleanerd->nilfs, segnums, nsegs, 0,
-				     &params, &stat);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (prepared)
+		ret = nilfs_gcpipe_submit(cleanerd->gcpipe, cleanerd->nilfs,
+					  &params, segnums, &stat);
+	else
+		ret = nilfs_xreclaim_segment(cleanerd->nilfs, segnums, nsegs,
+					     0, &params, &stat);
+	cleanerd->stats.clean_nsecs += nilfs_cleanerd_nsecs_since(&start);
 	if (unlikely(ret < 0)) {
 		if (errno == ENOMEM) {
 			nilfs_cleanerd_reduce_ncleansegs_for_retry(cleanerd);
@@ -1575,7 +2445,19 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 
 	*ndone = 0;
 
+	cleanerd->stats.segs_cleaned += stat.cleaned_segs;
+	cleanerd->stats.segs_deferred += stat.deferred_segs;
+	cleanerd->stats.segs_protected += stat.protected_segs;
+	cleanerd->stats.live_blks += stat.live_blks;
+	cleanerd->stats.defunct_blks += stat.defunct_blks;
+	cleanerd->stats.bytes_read += (uint64_t)
+		(stat.live_blks + stat.defunct_blks) *
+		nilfs_get_block_size(cleanerd->nilfs);
+
 	if (stat.cleaned_segs > 0) {
+		if (cleanerd->policy->feedback)
+			cleanerd->policy->feedback(cleanerd->policy, &stat);
+
 		for (i = 0; i < stat.cleaned_segs; i++)
 			syslog(LOG_DEBUG, "segment %llu cleaned",
 			       (unsigned long long)segnums[i]);
@@ -1585,6 +2467,16 @@ static int nilfs_cleanerd_clean_segments(struct nilfs_cleanerd *cleanerd,
 		cleanerd->retry_cleaning = 0;
 
 		*ndone += stat.cleaned_segs;
+
+		nilfs_cleanerd_ioctl_stat(cleanerd, &ios);
+		syslog(LOG_DEBUG,
+		       "%llu info ioctls (%llu items, %llu usecs) per segment",
+		       (unsigned long long)(ios.ncalls - ios0.ncalls) /
+		       stat.cleaned_segs,
+		       (unsigned long long)(ios.nitems - ios0.nitems) /
+		       stat.cleaned_segs,
+		       (unsigned long long)(ios.nsecs - ios0.nsecs) / 1000 /
+		       stat.cleaned_segs);
 	}
 
 	if (stat.deferred_segs > 0) {
@@ -1622,120 +2514,137 @@ out:
 	return ret;
 }
 
-static void nilfs_workload_logger(
-  struct nilfs_cleanerd *cleanerd, 
-  ssize_t nsegs, 
-  uint64_t* segnums
-) {
-  FILE *logf = NULL;
-  FILE *logw = NULL;
-  char path[512], path_w[512], mnt_path[512];
-  struct nilfs *nilfs = cleanerd->nilfs;
-  struct nilfs_cldconfig *config = &cleanerd->config;
-  struct nilfs_cnormap *cnormap = cleanerd->cnormap;
-  struct nilfs_sustat sustat;
-  nilfs_cno_t protcno;
-  uint64_t nsegments, blocks_per_segment;
-  ssize_t live_blocks;
-  int ret;
-  double disk_utilization;
-  
-  if (config->cf_log_file == NULL) {
-    config->cf_log_file = "/var/log/nilfs/";
-  }
-  snprintf(path, sizeof(path),
-        "%sdata.log", config->cf_log_file);
-  syslog(LOG_INFO, "Writing segment utilization log to %s", path);
-
-  logf = fopen(path, "a");
-  if (!logf) {
-    syslog(LOG_ERR, "Failed to open log file: %s", path);
-    goto out_free;
-  }
-  setvbuf(logf, NULL, _IOFBF, 1 << 20);
-
-  snprintf(path, sizeof(path),
-          "%swrite_cost.log", config->cf_log_file);
-  syslog(LOG_INFO, "Writing cleaned segment utilization log to %s", path);
-  snprintf(mnt_path, sizeof(mnt_path),
-          "/root/nilfs_mnt");
-  logw = fopen(path, "a");
-  if (!logw) {
-    syslog(LOG_ERR, "Failed to open log file: %s", path);
-    goto out_free;
-  }
-
-  nsegments = nilfs_get_nsegments(nilfs);
-  blocks_per_segment = nilfs_get_blocks_per_segment(nilfs);
-  ret = nilfs_cnormap_track_back(cnormap, 0, &protcno);
-  if (ret < 0) {
-    syslog(LOG_ERR, "Error getting current checkpoint number");
-    goto out_free;
-  }
-  if (nilfs_get_sustat(nilfs, &sustat) < 0) {
-    syslog(LOG_ERR, "Error getting segment status");
-    goto out_free;
-  }
-
-  setvbuf(logw, NULL, _IOFBF, 1 << 20);
-  #include <sys/statvfs.h>
-  struct statvfs stat;
-
-  if (statvfs(mnt_path, &stat) != 0) {
-      perror("statvfs failed");
-      return -1.0;
-  }
-  unsigned long total_blocks = stat.f_blocks;
-  unsigned long available_blocks = stat.f_bavail;
-  unsigned long used_blocks = total_blocks - available_blocks;
-  disk_utilization = (double)used_blocks / (double)total_blocks;
-  double total_wc = 0.0;
-
-  for (uint64_t segnum = 0; segnum < nsegments; segnum++) {
-    struct nilfs_reclaim_stat stat;
-    ret = assess_segment_if_dirty(
-      nilfs,
-      &sustat,
-      segnum,
-      protcno,
-      &stat
-    );
-    if (!ret) {
-      continue;
-    }
-    live_blocks = stat.live_blks;
-
-    if (live_blocks >= 0) {
-        double util = (double)live_blocks / blocks_per_segment * 100.0;
-        fprintf(logf, "%lu,%zd,%.2f\n", segnum, live_blocks, util);
-    } else if (live_blocks == -2) {
-        // "Protected" means it contains data recently written or held by a snapshot
-        // For Ousterhout's math, this is effectively 100% utilization (cannot be cleaned)
-        fprintf(logf, "%lu,%zd,100.00\n", segnum, live_blocks);
-    } else {
-        syslog(LOG_ERR, "Error accessing segment %lu\n", segnum);
-    }
-    if (nsegs > 0) {
-      // nssegs is guaranteed to be < 32
-      for (ssize_t i = 0; i < nsegs; i++) {
-        if (segnums[i] == segnum) {
-          double util = (double)live_blocks / blocks_per_segment;
-          total_wc += 2.0/(1.0-util);
-          break;
-        }
-      }
-    }
-    if (nsegs > 0) {
-      fprintf(logw, "%ld,%.4f,%.4f\n", nsegs, total_wc / (double)nsegs, disk_utilization);
-    }
-  }
-  out_free:
-  if (logf) {
-    fclose(logf);
-  }
-  if (logw) {
-    fclose(logw);
-  }
+/**
+ * nilfs_cleanerd_telemetry_time - get wall clock time for records
+ */
+static uint64_t nilfs_cleanerd_telemetry_time(void)
+{
+	struct timespec ts;
+
+	if (unlikely(clock_gettime(CLOCK_REALTIME, &ts) < 0))
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * nilfs_cleanerd_record_cycle - record segments selected in a cycle
+ * @cleanerd: cleanerd object
+ * @segnums: array of selected segment numbers
+ * @nsegs: number of selected segments
+ *
+ * The write cost 2 / (1 - u) of each segment follows from the live
+ * block counts of the segment table, which are current for selected
+ * segments, so the record costs no extra scan.
+ */
+static void nilfs_cleanerd_record_cycle(struct nilfs_cleanerd *cleanerd,
+					const uint64_t *segnums, int nsegs)
+{
+	struct nilfs_telemetry_cycle rec;
+	uint32_t blocks_per_segment;
+	struct statvfs stfs;
+	double util, total = 0;
+	ssize_t live_blocks;
+	int i, n = 0;
+
+	if (!cleanerd->telemetry || nsegs <= 0)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.type = NILFS_TELEMETRY_REC_CYCLE;
+	rec.hdr.time = nilfs_cleanerd_telemetry_time();
+	rec.hdr.cycle = cleanerd->stats.ncycles;
+	rec.nsegs = nsegs;
+	rec.reclaim_order = cleanerd->config.cf_reclaim_order;
+
+	blocks_per_segment = nilfs_get_blocks_per_segment(cleanerd->nilfs);
+	for (i = 0; i < nsegs; i++) {
+		if (nilfs_segtable_get_live(cleanerd->segtable, segnums[i],
+					    &live_blocks) <= 0)
+			live_blocks = 0;
+		if (i < NILFS_TELEMETRY_NSEGS) {
+			rec.segnums[i] = segnums[i];
+			rec.live[i] = live_blocks;
+		}
+		util = (double)live_blocks / blocks_per_segment;
+		if (util < 1.0) {
+			total += 2.0 / (1.0 - util);
+			n++;
+		}
+	}
+	rec.write_cost = n > 0 ? total / n : NAN;
+
+	if (statvfs(nilfs_get_root_path(cleanerd->nilfs), &stfs) == 0 &&
+	    stfs.f_blocks > 0)
+		rec.disk_util = (double)(stfs.f_blocks - stfs.f_bavail) /
+			stfs.f_blocks;
+	else
+		rec.disk_util = NAN;
+
+	nilfs_telemetry_append(cleanerd->telemetry, &rec.hdr, sizeof(rec));
+}
+
+/**
+ * nilfs_cleanerd_record_histogram - record utilization of in-use segments
+ * @cleanerd: cleanerd object
+ * @sustat: status information on segments
+ *
+ * Walking all segments is the costly part of telemetry, so the
+ * histogram is sampled at the configured interval rather than every
+ * cycle; in sample mode, this is also when the whole segment table is
+ * reloaded.  Segments that cannot be reclaimed or whose live blocks are
+ * unknown in this cycle (e.g. within the protection period) are counted
+ * as full.
+ */
+static void nilfs_cleanerd_record_histogram(struct nilfs_cleanerd *cleanerd,
+					    const struct nilfs_sustat *sustat)
+{
+	struct nilfs_segtable *segtable = cleanerd->segtable;
+	struct nilfs_telemetry_histogram rec;
+	uint32_t blocks_per_segment;
+	struct nilfs_suinfo si;
+	struct timespec now;
+	ssize_t live_blocks;
+	uint64_t segnum, pct;
+	int ret;
+
+	if (!cleanerd->telemetry)
+		return;
+
+	if (unlikely(clock_gettime(CLOCK_MONOTONIC, &now) < 0))
+		return;
+	if (timespeccmp(&now, &cleanerd->histogram_time, <))
+		return;
+	timespecadd(&now, &cleanerd->config.cf_telemetry_histogram_interval,
+		    &cleanerd->histogram_time);
+
+	if (unlikely(nilfs_cleanerd_refresh_segtable(cleanerd, sustat) < 0))
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.hdr.type = NILFS_TELEMETRY_REC_HISTOGRAM;
+	rec.hdr.time = nilfs_cleanerd_telemetry_time();
+	rec.hdr.cycle = cleanerd->stats.ncycles;
+
+	blocks_per_segment = nilfs_get_blocks_per_segment(cleanerd->nilfs);
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (nilfs_suinfo_clean(&si))
+			continue;
+
+		rec.nsegs++;
+		ret = nilfs_segtable_get_live(segtable, segnum, &live_blocks);
+		if (ret <= 0) {
+			rec.nprotected++;
+			pct = NILFS_TELEMETRY_NBUCKETS - 1;
+		} else {
+			pct = (uint64_t)live_blocks * 100 / blocks_per_segment;
+			if (pct > NILFS_TELEMETRY_NBUCKETS - 1)
+				pct = NILFS_TELEMETRY_NBUCKETS - 1;
+		}
+		rec.counts[pct]++;
+	}
+
+	nilfs_telemetry_append(cleanerd->telemetry, &rec.hdr, sizeof(rec));
 }
 
 /**
@@ -1746,10 +2655,12 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 {
 	struct nilfs_sustat sustat;
 	int64_t prottime = 0, oldest = 0;
-	uint64_t segnums[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	uint64_t segnums[NILFS_CLEANERD_NCANDIDATES_MAX];
+	uint64_t nextv[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	struct timespec start;
 	sigset_t sigset;
-	size_t ndone;
-	int ns, ret;
+	size_t ndone, nnext;
+	int ns, ret, prepared;
 
 	sigemptyset(&sigset);
 	ret = sigprocmask(SIG_SETMASK, &sigset, NULL);
@@ -1785,6 +2696,7 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 
 	while (!cleanerd->shutdown) {
 		cleanerd->no_timeout = 0;
+		cleanerd->stats.ncycles++;
 
 		ret = sigprocmask(SIG_BLOCK, &sigset, NULL);
 		if (unlikely(ret < 0)) {
@@ -1800,27 +2712,60 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 			return -1;
 		}
 
-		if (nilfs_cleanerd_check_state(cleanerd, &sustat))
+		/*
+		 * In sample mode, the selection reloads the usage of the
+		 * segments it draws; the others are reloaded only when
+		 * something needs the whole table.
+		 */
+		cleanerd->segtable_fresh = 0;
+		if (!nilfs_cleanerd_sampling(cleanerd, &sustat)) {
+			ret = nilfs_cleanerd_refresh_segtable(cleanerd,
+							      &sustat);
+			if (unlikely(ret < 0)) {
+				syslog(LOG_ERR,
+				       "cannot get segment usage info: %m");
+				return -1;
+			}
+		}
+
+		if (nilfs_cleanerd_check_state(cleanerd, &sustat)) {
+			if (cleanerd->gcpipe)
+				nilfs_gcpipe_cancel(cleanerd->gcpipe);
 			goto sleep;
+		}
 
 		/* starts garbage collection */
 		syslog(LOG_DEBUG, "ncleansegs = %llu",
 		       (unsigned long long)sustat.ss_ncleansegs);
 
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		ns = nilfs_cleanerd_select_segments(
 			cleanerd, &sustat, segnums, &prottime, &oldest);
+		cleanerd->stats.select_nsecs +=
+			nilfs_cleanerd_nsecs_since(&start);
 		if (unlikely(ns < 0)) {
 			syslog(LOG_ERR, "cannot select segments: %m");
 			return -1;
 		}
-    nilfs_workload_logger(cleanerd, ns, segnums);
+		prepared = 0;
+		nnext = 0;
+		if (cleanerd->gcpipe)
+			ns = nilfs_cleanerd_pipeline_segments(
+				cleanerd, segnums, ns, nextv, &nnext,
+				&prepared);
+		if (!prepared)
+			nilfs_cleanerd_readahead(cleanerd, segnums, ns);
+		nilfs_cleanerd_readahead(cleanerd, nextv, nnext);
+		nilfs_cleanerd_record_cycle(cleanerd, segnums, ns);
+		nilfs_cleanerd_record_histogram(cleanerd, &sustat);
 		syslog(LOG_DEBUG, "%d segment%s selected to be cleaned",
 		       ns, (ns <= 1) ? "" : "s");
+		cleanerd->stats.segs_selected += ns;
 		ndone = 0;
 		if (ns > 0) {
 			ret = nilfs_cleanerd_clean_segments(
-				cleanerd, segnums, ns, sustat.ss_prot_seq,
-				&ndone);
+				cleanerd, segnums, ns, prepared, nextv, nnext,
+				sustat.ss_prot_seq, &ndone);
 			if (unlikely(ret < 0))
 				return -1;
 		} else {
@@ -1834,13 +2779,18 @@ static int nilfs_cleanerd_clean_loop(struct nilfs_cleanerd *cleanerd)
 			return -1;
 
 sleep:
+		nilfs_cleanerd_publish_stats(cleanerd);
+
 		ret = sigprocmask(SIG_UNBLOCK, &sigset, NULL);
 		if (unlikely(ret < 0)) {
 			syslog(LOG_ERR, "cannot set signal mask: %m");
 			return -1;
 		}
 
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		ret = nilfs_cleanerd_wait(cleanerd);
+		cleanerd->stats.sleep_nsecs +=
+			nilfs_cleanerd_nsecs_since(&start);
 		if (unlikely(ret < 0))
 			return -1;
 	}
@@ -1936,7 +2886,9 @@ int main(int argc, char *argv[])
 	nilfs_register_policy(&nilfs_policy_timestamp);
 	nilfs_register_policy(&nilfs_policy_greedy);
 	nilfs_register_policy(&nilfs_policy_cost_benefit);
+	nilfs_register_policy(&nilfs_policy_cost_benefit_age);
   nilfs_register_policy(&nilfs_policy_hot_cold);
+	nilfs_register_policy(&nilfs_policy_adaptive);
 
 	ret = oom_adjust();
 	if (unlikely(ret < 0))
@@ -15,13 +15,21 @@
 #include <mqueue.h>
 #include <uuid/uuid.h>
 #include "nilfs.h"
+#include "nilfs_cleaner.h"
 #include "cldconfig.h"
 #include "nilfs_cleaning_policy.h"
+#include "segtable.h"
+
+struct nilfs_cleaner_stats_page;
+struct nilfs_telemetry;
 
 /**
  * struct nilfs_cleanerd - nilfs cleaner daemon
  * @nilfs: nilfs object
  * @cnormap: checkpoint number reverse mapper
+ * @segtable: in-memory segment usage table
+ * @gcpipe: preparer of the next reclaim (NULL unless pipelined)
+ * @sumcache: cache of parsed segment summaries (NULL if disabled)
  * @config: config structure
  * @conffile: configuration file name
  * @policy: cleaning policy
@@ -49,10 +57,20 @@
  * @mm_protection_period: protection period (manual mode)
  * @mm_cleaning_interval: cleaning interval (manual mode)
  * @mm_min_reclaimable_blocks: min. number of reclaimable blocks (manual mode)
+ * @stats: statistics accumulated since start
+ * @stats_page: shared page publishing @stats (NULL if unavailable)
+ * @stats_name: name of the shared memory object of @stats_page
+ * @telemetry: telemetry ring (NULL if disabled)
+ * @histogram_time: time the next utilization histogram is due (monotonic)
+ * @sample_state: state of the random sequence drawing segment samples
+ * @segtable_fresh: @segtable was refreshed in full in this cycle
  */
 struct nilfs_cleanerd {
 	struct nilfs *nilfs;
 	struct nilfs_cnormap *cnormap;
+	struct nilfs_segtable *segtable;
+	struct nilfs_gcpipe *gcpipe;
+	struct nilfs_sumcache *sumcache;
 	struct nilfs_cldconfig config;
 	char *conffile;
 	struct nilfs_cleaning_policy *policy;
@@ -79,6 +97,13 @@ struct nilfs_cleanerd {
 	struct timespec mm_protection_period;
 	struct timespec mm_cleaning_interval;
 	unsigned long mm_min_reclaimable_blocks;
+	struct nilfs_cleaner_stats stats;
+	struct nilfs_cleaner_stats_page *stats_page;
+	char *stats_name;
+	struct nilfs_telemetry *telemetry;
+	struct timespec histogram_time;
+	uint64_t sample_state;
+	int segtable_fresh;
 };
 
 #endif /* NILFS_CLEANERD_H */
@@ -0,0 +1,282 @@
+/*
+ * gcpipe.c - background preparation of reclaims of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include "nilfs.h"
+#include "util.h"
+#include "nilfs_gc.h"
+#include "cldconfig.h"
+#include "gcpipe.h"
+
+/* states of the background job */
+enum {
+	NILFS_GCPIPE_IDLE = 0,	/* no job */
+	NILFS_GCPIPE_POSTED,	/* job posted or being prepared */
+	NILFS_GCPIPE_READY,	/* batch prepared */
+	NILFS_GCPIPE_FAILED,	/* preparation failed */
+};
+
+/**
+ * struct nilfs_gcpipe - preparer of the next reclaim
+ * @thread: thread ID of the preparer
+ * @lock: mutex protecting the fields below up to @stop
+ * @cond: condition signaled when @state changes or the preparer stops
+ * @state: state of the job (NILFS_GCPIPE_*)
+ * @stop: flag telling the preparer to exit
+ * @params: reclaim parameters of the job
+ * @nsegs: number of segments of the job
+ * @segnums: segment numbers of the job
+ * @next: batch being prepared by the job, or prepared by it
+ * @cur: batch taken by the cleaner, which only the cleaner touches
+ * @nilfs: nilfs object private to the preparer
+ *
+ * The cleaner posts the segments it expects to reclaim in the next cycle
+ * right before it hands the current ones to the kernel, so that their
+ * summaries and block information are read while the kernel moves the
+ * live blocks of the current ones.  In the next cycle, the prepared
+ * batch is taken, swapping @next and @cur, and submitted after it has
+ * been checked against the state of the file system at that point.
+ */
+struct nilfs_gcpipe {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int state;
+	int stop;
+	struct nilfs_reclaim_params params;
+	size_t nsegs;
+	uint64_t segnums[NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX];
+	struct nilfs_reclaim_batch *next;
+	struct nilfs_reclaim_batch *cur;
+	struct nilfs *nilfs;
+};
+
+static void *nilfs_gcpipe_main(void *arg)
+{
+	struct nilfs_gcpipe *gcpipe = arg;
+	int ret;
+
+	pthread_mutex_lock(&gcpipe->lock);
+	for (;;) {
+		while (!gcpipe->stop && gcpipe->state != NILFS_GCPIPE_POSTED)
+			pthread_cond_wait(&gcpipe->cond, &gcpipe->lock);
+		if (gcpipe->stop)
+			break;
+		pthread_mutex_unlock(&gcpipe->lock);
+
+		ret = nilfs_prepare_reclaim(gcpipe->nilfs, gcpipe->next,
+					    gcpipe->segnums, gcpipe->nsegs,
+					    &gcpipe->params);
+		if (unlikely(ret < 0))
+			syslog(LOG_WARNING, "cannot prepare segments: %m");
+
+		pthread_mutex_lock(&gcpipe->lock);
+		gcpipe->state = ret < 0 ? NILFS_GCPIPE_FAILED :
+			NILFS_GCPIPE_READY;
+		pthread_cond_broadcast(&gcpipe->cond);
+	}
+	pthread_mutex_unlock(&gcpipe->lock);
+	return NULL;
+}
+
+/**
+ * nilfs_gcpipe_create - start a preparer of reclaims
+ * @nilfs: nilfs object of the cleaner
+ *
+ * The preparer opens the file system on its own so that its reads do
+ * not share a file descriptor with the cleaner.  Options of @nilfs are
+ * copied to it.
+ */
+struct nilfs_gcpipe *nilfs_gcpipe_create(struct nilfs *nilfs)
+{
+	struct nilfs_gcpipe *gcpipe;
+	sigset_t sigset, oldset;
+
+	gcpipe = malloc(sizeof(*gcpipe));
+	if (unlikely(gcpipe == NULL))
+		return NULL;
+
+	memset(gcpipe, 0, sizeof(*gcpipe));
+	gcpipe->next = nilfs_reclaim_batch_create();
+	gcpipe->cur = nilfs_reclaim_batch_create();
+	if (unlikely(!gcpipe->next || !gcpipe->cur))
+		goto out_batch;
+
+	gcpipe->nilfs = nilfs_open(nilfs_get_dev(nilfs),
+				   nilfs_get_root_path(nilfs),
+				   NILFS_OPEN_RAW | NILFS_OPEN_RDONLY |
+				   NILFS_OPEN_GCLK);
+	if (unlikely(gcpipe->nilfs == NULL))
+		goto out_batch;
+
+	nilfs_copy_options(gcpipe->nilfs, nilfs);
+
+	pthread_mutex_init(&gcpipe->lock, NULL);
+	pthread_cond_init(&gcpipe->cond, NULL);
+
+	/* signals are handled by the main thread only */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &oldset);
+	errno = pthread_create(&gcpipe->thread, NULL, nilfs_gcpipe_main,
+			       gcpipe);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (unlikely(errno != 0))
+		goto out_thread;
+
+	return gcpipe;
+
+out_thread:
+	pthread_cond_destroy(&gcpipe->cond);
+	pthread_mutex_destroy(&gcpipe->lock);
+	nilfs_close(gcpipe->nilfs);
+out_batch:
+	nilfs_reclaim_batch_destroy(gcpipe->next);
+	nilfs_reclaim_batch_destroy(gcpipe->cur);
+	free(gcpipe);
+	return NULL;
+}
+
+/**
+ * nilfs_gcpipe_destroy - stop a preparer of reclaims
+ * @gcpipe: preparer
+ *
+ * A job being prepared is completed before the preparer exits, and any
+ * prepared batch is discarded.
+ */
+void nilfs_gcpipe_destroy(struct nilfs_gcpipe *gcpipe)
+{
+	if (gcpipe == NULL)
+		return;
+
+	pthread_mutex_lock(&gcpipe->lock);
+	gcpipe->stop = 1;
+	pthread_cond_broadcast(&gcpipe->cond);
+	pthread_mutex_unlock(&gcpipe->lock);
+	pthread_join(gcpipe->thread, NULL);
+
+	pthread_cond_destroy(&gcpipe->cond);
+	pthread_mutex_destroy(&gcpipe->lock);
+	nilfs_close(gcpipe->nilfs);
+	nilfs_reclaim_batch_destroy(gcpipe->next);
+	nilfs_reclaim_batch_destroy(gcpipe->cur);
+	free(gcpipe);
+}
+
+/**
+ * nilfs_gcpipe_cancel - discard the posted job
+ * @gcpipe: preparer
+ *
+ * This waits for the job if it is being prepared.
+ */
+void nilfs_gcpipe_cancel(struct nilfs_gcpipe *gcpipe)
+{
+	pthread_mutex_lock(&gcpipe->lock);
+	while (gcpipe->state == NILFS_GCPIPE_POSTED)
+		pthread_cond_wait(&gcpipe->cond, &gcpipe->lock);
+	gcpipe->state = NILFS_GCPIPE_IDLE;
+	pthread_mutex_unlock(&gcpipe->lock);
+}
+
+/**
+ * nilfs_gcpipe_post - start preparing the reclaim of segments
+ * @gcpipe: preparer
+ * @segnums: array of segment numbers to be reclaimed next
+ * @nsegs: size of @segnums array
+ * @params: reclaim parameters
+ *
+ * A job that has not been taken yet is discarded.
+ */
+int nilfs_gcpipe_post(struct nilfs_gcpipe *gcpipe,
+		      const uint64_t *segnums, size_t nsegs,
+		      const struct nilfs_reclaim_params *params)
+{
+	if (unlikely(nsegs > NILFS_CLDCONFIG_NSEGMENTS_PER_CLEAN_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nilfs_gcpipe_cancel(gcpipe);
+	if (nsegs == 0)
+		return 0;
+
+	pthread_mutex_lock(&gcpipe->lock);
+	memcpy(gcpipe->segnums, segnums, sizeof(*segnums) * nsegs);
+	gcpipe->nsegs = nsegs;
+	gcpipe->params = *params;
+	gcpipe->state = NILFS_GCPIPE_POSTED;
+	pthread_cond_broadcast(&gcpipe->cond);
+	pthread_mutex_unlock(&gcpipe->lock);
+	return 0;
+}
+
+/**
+ * nilfs_gcpipe_take - take the prepared batch
+ * @gcpipe: preparer
+ * @segnums: array to store the segment numbers of the batch
+ *
+ * This waits for the posted job if it is still being prepared.  The
+ * taken batch is handed to the kernel with nilfs_gcpipe_submit().
+ *
+ * Return: number of segments of the taken batch, or 0 if no batch has
+ * been prepared.
+ */
+size_t nilfs_gcpipe_take(struct nilfs_gcpipe *gcpipe, uint64_t *segnums)
+{
+	struct nilfs_reclaim_batch *batch;
+	size_t nsegs = 0;
+
+	pthread_mutex_lock(&gcpipe->lock);
+	while (gcpipe->state == NILFS_GCPIPE_POSTED)
+		pthread_cond_wait(&gcpipe->cond, &gcpipe->lock);
+	if (gcpipe->state == NILFS_GCPIPE_READY) {
+		batch = gcpipe->cur;
+		gcpipe->cur = gcpipe->next;
+		gcpipe->next = batch;
+		nsegs = gcpipe->nsegs;
+		memcpy(segnums, gcpipe->segnums, sizeof(*segnums) * nsegs);
+	}
+	gcpipe->state = NILFS_GCPIPE_IDLE;
+	pthread_mutex_unlock(&gcpipe->lock);
+	return nsegs;
+}
+
+/**
+ * nilfs_gcpipe_submit - reclaim the taken batch
+ * @gcpipe: preparer
+ * @nilfs: nilfs object of the cleaner
+ * @params: reclaim parameters
+ * @segnums: array to store the segment numbers in the reclaimed order
+ * @stat: reclaim statistics
+ *
+ * This may run while the preparer works on the next job.
+ */
+int nilfs_gcpipe_submit(struct nilfs_gcpipe *gcpipe, struct nilfs *nilfs,
+			const struct nilfs_reclaim_params *params,
+			uint64_t *segnums, struct nilfs_reclaim_stat *stat)
+{
+	return nilfs_submit_reclaim(nilfs, gcpipe->cur, params, segnums, stat);
+}
@@ -0,0 +1,29 @@
+/*
+ * gcpipe.h - background preparation of reclaims of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef NILFS_GCPIPE_H
+#define NILFS_GCPIPE_H
+
+#include <stdint.h>	/* uint64_t */
+#include <sys/types.h>	/* ssize_t */
+#include "nilfs.h"	/* struct nilfs */
+#include "nilfs_gc.h"	/* struct nilfs_reclaim_params, etc */
+
+struct nilfs_gcpipe;
+
+struct nilfs_gcpipe *nilfs_gcpipe_create(struct nilfs *nilfs);
+void nilfs_gcpipe_destroy(struct nilfs_gcpipe *gcpipe);
+int nilfs_gcpipe_post(struct nilfs_gcpipe *gcpipe,
+		      const uint64_t *segnums, size_t nsegs,
+		      const struct nilfs_reclaim_params *params);
+size_t nilfs_gcpipe_take(struct nilfs_gcpipe *gcpipe, uint64_t *segnums);
+int nilfs_gcpipe_submit(struct nilfs_gcpipe *gcpipe, struct nilfs *nilfs,
+			const struct nilfs_reclaim_params *params,
+			uint64_t *segnums, struct nilfs_reclaim_stat *stat);
+void nilfs_gcpipe_cancel(struct nilfs_gcpipe *gcpipe);
+
+#endif /* NILFS_GCPIPE_H */
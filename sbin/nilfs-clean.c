@@ -81,9 +81,11 @@ static const struct option long_option[] = {
 	{"stop", no_argument, NULL, 'b'},
 	{"suspend", no_argument, NULL, 's'},
 	{"speed", required_argument, NULL, 'S'},
+	{"stats", no_argument, NULL, 't'},
 	{"min-reclaimable-blocks", required_argument, NULL, 'm'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"version", no_argument, NULL, 'V'},
+	{"watch", no_argument, NULL, 'w'},
 	{NULL, 0, NULL, 0}
 };
 #define NILFS_CLEAN_USAGE						\
@@ -103,13 +105,15 @@ static const struct option long_option[] = {
 	"  -s, --suspend\t\tsuspend cleaner\n"				\
 	"  -S, --speed=COUNT[/SECONDS]\n"				\
 	"               \t\tset GC speed\n"				\
+	"  -t, --stats\t\tdisplay cleaner statistics\n"		\
 	"  -v, --verbose\t\tverbose mode\n"				\
-	"  -V, --version\t\tdisplay version and exit\n"
+	"  -V, --version\t\tdisplay version and exit\n"			\
+	"  -w, --watch\t\tdisplay cleaner statistics every second\n"
 #else
 #define NILFS_CLEAN_USAGE						  \
 	"Usage: %s [-b] [-c [conffile]] [-h] [-l] [-m blocks]\n"	  \
 	"          [-p protection-period] [-q] [-r] [-s] [-S gc-speed]\n" \
-	"          [-v] [-V] [device]\n"
+	"          [-t] [-v] [-V] [-w] [device]\n"
 #endif	/* _GNU_SOURCE */
 
 
@@ -121,12 +125,20 @@ enum {
 	NILFS_CLEAN_CMD_RELOAD,
 	NILFS_CLEAN_CMD_STOP,
 	NILFS_CLEAN_CMD_SHUTDOWN,
+	NILFS_CLEAN_CMD_STATS,
 };
 
+#define NILFS_CLEAN_WATCH_INTERVAL	1	/* seconds */
+#define NILFS_CLEAN_WATCH_NLINES	20	/* lines per header */
+#define NILFS_CLEAN_WATCH_HEADER					\
+	"cycles select  clean  defer   prot     live  defunct  read-KB " \
+	"sel-ms ass-ms cln-ms slp-ms"
+
 /* options */
 static char *progname;
 static int show_version_only;
 static int verbose;
+static int watch_stats;
 static int clean_cmd = NILFS_CLEAN_CMD_RUN;
 static const char *conffile;
 
@@ -287,6 +299,105 @@ static int nilfs_clean_do_shutdown(struct nilfs_cleaner *cleaner)
 	return 0;
 }
 
+static int nilfs_clean_get_stats(struct nilfs_cleaner *cleaner,
+				 struct nilfs_cleaner_stats *stats)
+{
+	int ret;
+
+	ret = nilfs_cleaner_get_stats(cleaner, stats);
+	if (unlikely(ret < 0)) {
+		if (errno == ENOENT)
+			myprintf(_("Error: no statistics published on %s.\n"),
+				 nilfs_cleaner_device(cleaner));
+		else
+			myprintf(_("Error: cannot get cleaner statistics: %s\n"),
+				 strerror(errno));
+	}
+	return ret;
+}
+
+static void nilfs_clean_print_stats(const struct nilfs_cleaner_stats *stats)
+{
+	printf(_("cycles:              %llu\n"),
+	       (unsigned long long)stats->ncycles);
+	printf(_("selected segments:   %llu\n"),
+	       (unsigned long long)stats->segs_selected);
+	printf(_("cleaned segments:    %llu\n"),
+	       (unsigned long long)stats->segs_cleaned);
+	printf(_("deferred segments:   %llu\n"),
+	       (unsigned long long)stats->segs_deferred);
+	printf(_("protected segments:  %llu\n"),
+	       (unsigned long long)stats->segs_protected);
+	printf(_("moved live blocks:   %llu\n"),
+	       (unsigned long long)stats->live_blks);
+	printf(_("freed blocks:        %llu\n"),
+	       (unsigned long long)stats->defunct_blks);
+	printf(_("read bytes:          %llu\n"),
+	       (unsigned long long)stats->bytes_read);
+	printf(_("select time:         %llu.%03llu s\n"),
+	       (unsigned long long)stats->select_nsecs / 1000000000,
+	       (unsigned long long)stats->select_nsecs / 1000000 % 1000);
+	printf(_("assess time:         %llu.%03llu s\n"),
+	       (unsigned long long)stats->assess_nsecs / 1000000000,
+	       (unsigned long long)stats->assess_nsecs / 1000000 % 1000);
+	printf(_("clean time:          %llu.%03llu s\n"),
+	       (unsigned long long)stats->clean_nsecs / 1000000000,
+	       (unsigned long long)stats->clean_nsecs / 1000000 % 1000);
+	printf(_("sleep time:          %llu.%03llu s\n"),
+	       (unsigned long long)stats->sleep_nsecs / 1000000000,
+	       (unsigned long long)stats->sleep_nsecs / 1000000 % 1000);
+}
+
+static void nilfs_clean_print_stats_delta(const struct nilfs_cleaner_stats *p,
+					  const struct nilfs_cleaner_stats *c)
+{
+	printf("%6llu %6llu %6llu %6llu %6llu %8llu %8llu %8llu "
+	       "%6llu %6llu %6llu %6llu\n",
+	       (unsigned long long)(c->ncycles - p->ncycles),
+	       (unsigned long long)(c->segs_selected - p->segs_selected),
+	       (unsigned long long)(c->segs_cleaned - p->segs_cleaned),
+	       (unsigned long long)(c->segs_deferred - p->segs_deferred),
+	       (unsigned long long)(c->segs_protected - p->segs_protected),
+	       (unsigned long long)(c->live_blks - p->live_blks),
+	       (unsigned long long)(c->defunct_blks - p->defunct_blks),
+	       (unsigned long long)(c->bytes_read - p->bytes_read) >> 10,
+	       (unsigned long long)(c->select_nsecs - p->select_nsecs) /
+	       1000000,
+	       (unsigned long long)(c->assess_nsecs - p->assess_nsecs) /
+	       1000000,
+	       (unsigned long long)(c->clean_nsecs - p->clean_nsecs) /
+	       1000000,
+	       (unsigned long long)(c->sleep_nsecs - p->sleep_nsecs) /
+	       1000000);
+}
+
+static int nilfs_clean_do_stats(struct nilfs_cleaner *cleaner)
+{
+	struct nilfs_cleaner_stats prev, cur;
+	struct timespec interval = { NILFS_CLEAN_WATCH_INTERVAL, 0 };
+	unsigned int nlines;
+
+	if (nilfs_clean_get_stats(cleaner, &cur) < 0)
+		return -1;
+
+	if (!watch_stats) {
+		nilfs_clean_print_stats(&cur);
+		return 0;
+	}
+
+	/* counts and milliseconds per interval, until interrupted */
+	for (nlines = 0; ; nlines++) {
+		prev = cur;
+		nanosleep(&interval, NULL);
+		if (nilfs_clean_get_stats(cleaner, &cur) < 0)
+			return -1;
+		if (nlines % NILFS_CLEAN_WATCH_NLINES == 0)
+			puts(NILFS_CLEAN_WATCH_HEADER);
+		nilfs_clean_print_stats_delta(&prev, &cur);
+		fflush(stdout);
+	}
+}
+
 static int nilfs_clean_request(struct nilfs_cleaner *cleaner)
 {
 	int status = EXIT_FAILURE;
@@ -314,6 +425,9 @@ static int nilfs_clean_request(struct nilfs_cleaner *cleaner)
 	case NILFS_CLEAN_CMD_SHUTDOWN:
 		ret = nilfs_clean_do_shutdown(cleaner);
 		break;
+	case NILFS_CLEAN_CMD_STATS:
+		ret = nilfs_clean_do_stats(cleaner);
+		break;
 	default:
 		goto out;
 	}
@@ -328,8 +442,11 @@ static int nilfs_do_clean(const char *device)
 	struct sigaction act, oldact[3];
 	int status = EXIT_FAILURE;
 
-	nilfs_cleaner = nilfs_cleaner_open(device, NULL,
-					   NILFS_CLEANER_OPEN_QUEUE);
+	/* statistics are read from shared memory without the queue */
+	nilfs_cleaner = nilfs_cleaner_open(
+		device, NULL,
+		clean_cmd == NILFS_CLEAN_CMD_STATS ?
+		0 : NILFS_CLEANER_OPEN_QUEUE);
 	if (unlikely(!nilfs_cleaner))
 		goto out;
 
@@ -451,10 +568,10 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 	int c, ret;
 
 #ifdef _GNU_SOURCE
-	while ((c = getopt_long(argc, argv, "bc::hlm:p:qrsS:vV",
+	while ((c = getopt_long(argc, argv, "bc::hlm:p:qrsS:tvVw",
 				long_option, &option_index)) >= 0) {
 #else
-	while ((c = getopt(argc, argv, "bc::hlm:p:qrsS:vV")) >= 0) {
+	while ((c = getopt(argc, argv, "bc::hlm:p:qrsS:tvVw")) >= 0) {
 #endif	/* _GNU_SOURCE */
 		switch (c) {
 		case 'b':
@@ -503,12 +620,19 @@ static void nilfs_clean_parse_options(int argc, char *argv[])
 			if (nilfs_clean_parse_gcspeed(optarg) < 0)
 				exit(EXIT_FAILURE);
 			break;
+		case 't':
+			clean_cmd = NILFS_CLEAN_CMD_STATS;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
 		case 'V':
 			show_version_only = 1;
 			break;
+		case 'w':
+			clean_cmd = NILFS_CLEAN_CMD_STATS;
+			watch_stats = 1;
+			break;
 		default:
 			nilfs_clean_usage();
 			exit(EXIT_FAILURE);
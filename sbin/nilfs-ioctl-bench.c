@@ -0,0 +1,405 @@
+/*
+ * nilfs-ioctl-bench.c - compare ioctl batch sizes of the GC requests
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The tool assesses, or with -r reclaims, dirty segments of a file
+ * system with each given batch size of the GET_VINFO, GET_BDESCS and
+ * GET_CPINFO requests (see nilfs_set_ioctl_batch()), and prints the
+ * number of calls, the number of items and the time spent in each kind
+ * of request per segment, along with the elapsed time per segment.
+ *
+ * Assessment is read-only and runs over the same segments for every
+ * batch size after a warm-up pass.  Reclaiming moves live blocks, so
+ * each batch size is given a disjoint share of the segments instead.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_ERR_H
+#include <err.h>
+#endif	/* HAVE_ERR_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_LIMITS_H
+#include <limits.h>
+#endif	/* HAVE_LIMITS_H */
+
+#if HAVE_TIME_H
+#include <time.h>
+#endif	/* HAVE_TIME_H */
+
+#include <unistd.h>
+#include <errno.h>
+#include "nilfs.h"
+#include "util.h"
+#include "nilfs_gc.h"
+#include "cnormap.h"
+#include "parser.h"
+
+#define IOCTL_BENCH_USAGE						\
+	"Usage: %s [-r] [-b sizes] [-l loops] [-n nsegs] [-p period]"	\
+	" [-t usecs] [device]\n"					\
+	"  -b  comma-separated batch sizes, or \"auto\""		\
+	" (default: 16,64,512,4096,auto)\n"				\
+	"  -l  assessment passes per batch size (default: 3)\n"		\
+	"  -n  number of segments to use (default: 64)\n"		\
+	"  -p  protection period for -r (default: 3600)\n"		\
+	"  -r  reclaim the segments instead of assessing them\n"	\
+	"  -t  latency target of the adaptive mode in microseconds\n"
+
+#define IOCTL_BENCH_MAX_SIZES	16
+#define IOCTL_BENCH_NSUINFO	512
+
+static const char * const ioctl_bench_type_name[__NR_NILFS_IOCTL_BATCH] = {
+	"vinfo", "bdescs", "cpinfo"
+};
+
+static size_t sizes[IOCTL_BENCH_MAX_SIZES];
+static int nsizes;
+static int reclaim;
+static unsigned long loops = 3;
+static size_t nsegs = 64;
+
+static int ioctl_bench_parse_sizes(char *arg)
+{
+	char *tok, *endptr;
+
+	nsizes = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nsizes == IOCTL_BENCH_MAX_SIZES)
+			return -1;
+		if (strcmp(tok, "auto") == 0) {
+			sizes[nsizes++] = NILFS_IOCTL_BATCH_AUTO;
+			continue;
+		}
+		sizes[nsizes] = strtoul(tok, &endptr, 0);
+		if (*endptr != '\0' || sizes[nsizes] == 0)
+			return -1;
+		nsizes++;
+	}
+	return nsizes > 0 ? 0 : -1;
+}
+
+static double ioctl_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * ioctl_bench_collect - collect reclaimable segments
+ * @nilfs: nilfs object
+ * @segnums: array to store segment numbers
+ * @max: size of @segnums array
+ *
+ * Return: number of segments collected, or -1 on error.
+ */
+static ssize_t ioctl_bench_collect(struct nilfs *nilfs, uint64_t *segnums,
+				   size_t max)
+{
+	struct nilfs_suinfo si[IOCTL_BENCH_NSUINFO];
+	struct nilfs_sustat sustat;
+	uint64_t segnum;
+	ssize_t nsi, i;
+	size_t n = 0;
+
+	if (nilfs_get_sustat(nilfs, &sustat) < 0)
+		return -1;
+
+	for (segnum = 0; segnum < sustat.ss_nsegs && n < max; segnum += nsi) {
+		nsi = nilfs_get_suinfo(nilfs, segnum, si,
+				       min_t(uint64_t,
+					     sustat.ss_nsegs - segnum,
+					     IOCTL_BENCH_NSUINFO));
+		if (nsi < 0)
+			return -1;
+		if (nsi == 0)
+			break;
+		for (i = 0; i < nsi && n < max; i++) {
+			if (nilfs_suinfo_reclaimable(&si[i]) &&
+			    !nilfs_suinfo_empty(&si[i]))
+				segnums[n++] = segnum + i;
+		}
+	}
+	return n;
+}
+
+static int ioctl_bench_set_batch(struct nilfs *nilfs, size_t size)
+{
+	unsigned int type;
+
+	for (type = 0; type < __NR_NILFS_IOCTL_BATCH; type++)
+		if (nilfs_set_ioctl_batch(nilfs, type, size) < 0)
+			return -1;
+	return 0;
+}
+
+static void ioctl_bench_get_stats(struct nilfs *nilfs,
+				  struct nilfs_ioctl_stat *stats)
+{
+	unsigned int type;
+
+	for (type = 0; type < __NR_NILFS_IOCTL_BATCH; type++)
+		nilfs_get_ioctl_stat(nilfs, type, &stats[type]);
+}
+
+static const char *ioctl_bench_name(size_t size, char *buf, size_t len)
+{
+	if (size == NILFS_IOCTL_BATCH_AUTO)
+		return "auto";
+	snprintf(buf, len, "%zu", size);
+	return buf;
+}
+
+static void ioctl_bench_print(size_t size, size_t n, double elapsed,
+			      const struct nilfs_ioctl_stat *before,
+			      const struct nilfs_ioctl_stat *after)
+{
+	char buf[24];
+	const char *name = ioctl_bench_name(size, buf, sizeof(buf));
+	unsigned int type;
+
+	for (type = 0; type < __NR_NILFS_IOCTL_BATCH; type++) {
+		printf("%-6s %6zu %12.1f  %-6s %12.3f %12.1f %12.1f\n",
+		       name, n, elapsed * 1e6 / n,
+		       ioctl_bench_type_name[type],
+		       (double)(after[type].ncalls - before[type].ncalls) / n,
+		       (double)(after[type].nitems - before[type].nitems) / n,
+		       (double)(after[type].nsecs - before[type].nsecs) /
+		       1e3 / n);
+	}
+}
+
+static int ioctl_bench_assess(struct nilfs *nilfs, const uint64_t *segnums,
+			      size_t n, const struct nilfs_sustat *sustat)
+{
+	struct nilfs_ioctl_stat before[__NR_NILFS_IOCTL_BATCH];
+	struct nilfs_ioctl_stat after[__NR_NILFS_IOCTL_BATCH];
+	struct nilfs_reclaim_params params = {
+		.flags = NILFS_RECLAIM_PARAM_PROTSEQ,
+		.protseq = sustat->ss_prot_seq
+	};
+	struct nilfs_reclaim_stat *stats;
+	unsigned long loop;
+	double start;
+	int i, ret = -1;
+
+	stats = malloc(sizeof(*stats) * n);
+	if (!stats)
+		return -1;
+
+	/* warm up the page cache for the segment summaries */
+	if (nilfs_assess_segments(nilfs, segnums, n, &params, stats) < 0)
+		goto out;
+
+	for (i = 0; i < nsizes; i++) {
+		if (ioctl_bench_set_batch(nilfs, sizes[i]) < 0)
+			goto out;
+		ioctl_bench_get_stats(nilfs, before);
+		start = ioctl_bench_now();
+		for (loop = 0; loop < loops; loop++)
+			if (nilfs_assess_segments(nilfs, segnums, n, &params,
+						  stats) < 0)
+				goto out;
+		ioctl_bench_get_stats(nilfs, after);
+		ioctl_bench_print(sizes[i], n * loops,
+				  ioctl_bench_now() - start, before, after);
+	}
+	ret = 0;
+out:
+	free(stats);
+	return ret;
+}
+
+static int ioctl_bench_reclaim(struct nilfs *nilfs, uint64_t *segnums,
+			       size_t n, const struct nilfs_sustat *sustat,
+			       nilfs_cno_t protcno)
+{
+	struct nilfs_ioctl_stat before[__NR_NILFS_IOCTL_BATCH];
+	struct nilfs_ioctl_stat after[__NR_NILFS_IOCTL_BATCH];
+	struct nilfs_reclaim_params params = {
+		.flags = NILFS_RECLAIM_PARAM_PROTSEQ |
+			 NILFS_RECLAIM_PARAM_PROTCNO,
+		.protseq = sustat->ss_prot_seq,
+		.protcno = protcno
+	};
+	struct nilfs_reclaim_stat stat;
+	size_t share = n / nsizes, done;
+	char buf[24];
+	double start;
+	int i;
+
+	if (share == 0) {
+		warnx("too few segments for %d batch sizes", nsizes);
+		return -1;
+	}
+
+	for (i = 0; i < nsizes; i++) {
+		if (ioctl_bench_set_batch(nilfs, sizes[i]) < 0)
+			return -1;
+		memset(&stat, 0, sizeof(stat));
+		ioctl_bench_get_stats(nilfs, before);
+		start = ioctl_bench_now();
+		if (nilfs_xreclaim_segment(nilfs, segnums + i * share, share,
+					   0, &params, &stat) < 0)
+			return -1;
+		ioctl_bench_get_stats(nilfs, after);
+		done = stat.cleaned_segs;
+		if (done == 0) {
+			printf("%-6s no segment reclaimed\n",
+			       ioctl_bench_name(sizes[i], buf, sizeof(buf)));
+			continue;
+		}
+		ioctl_bench_print(sizes[i], done, ioctl_bench_now() - start,
+				  before, after);
+	}
+	return 0;
+}
+
+static int ioctl_bench_get_protcno(struct nilfs *nilfs,
+				   unsigned long period, nilfs_cno_t *protcnop)
+{
+	struct nilfs_cnormap *cnormap;
+	int ret;
+
+	cnormap = nilfs_cnormap_create(nilfs);
+	if (unlikely(!cnormap))
+		return -1;
+	ret = nilfs_cnormap_track_back(cnormap, period, protcnop);
+	nilfs_cnormap_destroy(cnormap);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	char default_sizes[] = "16,64,512,4096,auto";
+	unsigned long period = 3600, usecs = 0;
+	struct nilfs_sustat sustat;
+	struct nilfs *nilfs;
+	uint64_t *segnums;
+	nilfs_cno_t protcno = NILFS_CNO_MAX;
+	char *dev, *progname, *endptr;
+	ssize_t n;
+	int c, ret;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? progname + 1 : argv[0];
+
+	ioctl_bench_parse_sizes(default_sizes);
+	while ((c = getopt(argc, argv, "b:hl:n:p:rt:")) >= 0) {
+		switch (c) {
+		case 'b':
+			if (ioctl_bench_parse_sizes(optarg) < 0)
+				errx(EXIT_FAILURE, "invalid batch sizes");
+			break;
+		case 'l':
+			loops = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || loops == 0)
+				errx(EXIT_FAILURE, "invalid loops: %s",
+				     optarg);
+			break;
+		case 'n':
+			nsegs = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || nsegs == 0)
+				errx(EXIT_FAILURE, "invalid segments: %s",
+				     optarg);
+			break;
+		case 'p':
+			if (nilfs_parse_protection_period(optarg, &period))
+				errx(EXIT_FAILURE,
+				     "invalid protection period: %s", optarg);
+			break;
+		case 'r':
+			reclaim = 1;
+			break;
+		case 't':
+			usecs = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || usecs == 0)
+				errx(EXIT_FAILURE, "invalid latency: %s",
+				     optarg);
+			break;
+		case 'h':
+			fprintf(stderr, IOCTL_BENCH_USAGE, progname);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, IOCTL_BENCH_USAGE, progname);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind > argc - 1)
+		dev = NULL;
+	else if (optind == argc - 1)
+		dev = argv[optind++];
+	else
+		errx(EXIT_FAILURE, "too many arguments");
+
+	nilfs = nilfs_open(dev, NULL, NILFS_OPEN_RAW | NILFS_OPEN_GCLK |
+			   (reclaim ? NILFS_OPEN_RDWR : NILFS_OPEN_RDONLY));
+	if (nilfs == NULL)
+		err(EXIT_FAILURE, "cannot open NILFS on %s", dev ? : "device");
+
+	ret = EXIT_FAILURE;
+	if (usecs && nilfs_set_ioctl_latency(nilfs, usecs) < 0) {
+		warn("cannot set latency target");
+		goto out_close_nilfs;
+	}
+
+	segnums = malloc(sizeof(*segnums) * nsegs);
+	if (!segnums) {
+		warn(NULL);
+		goto out_close_nilfs;
+	}
+
+	n = ioctl_bench_collect(nilfs, segnums, nsegs);
+	if (n < 0) {
+		warn("cannot get segment usage");
+		goto out_free;
+	}
+	if (n == 0) {
+		warnx("no reclaimable segment");
+		goto out_free;
+	}
+	if (nilfs_get_sustat(nilfs, &sustat) < 0) {
+		warn("cannot get segment usage status");
+		goto out_free;
+	}
+	if (reclaim && ioctl_bench_get_protcno(nilfs, period, &protcno) < 0) {
+		warn("cannot get protection checkpoint");
+		goto out_free;
+	}
+
+	printf("%-6s %6s %12s  %-6s %12s %12s %12s\n", "batch", "segs",
+	       "usec/seg", "ioctl", "calls/seg", "items/seg", "usec/seg");
+	if (reclaim)
+		ret = ioctl_bench_reclaim(nilfs, segnums, n, &sustat,
+					  protcno);
+	else
+		ret = ioctl_bench_assess(nilfs, segnums, n, &sustat);
+	if (ret < 0) {
+		warn("benchmark failed");
+		ret = EXIT_FAILURE;
+	} else {
+		ret = EXIT_SUCCESS;
+	}
+
+out_free:
+	free(segnums);
+out_close_nilfs:
+	nilfs_close(nilfs);
+	exit(ret);
+}
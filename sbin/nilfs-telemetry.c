@@ -0,0 +1,306 @@
+/*
+ * nilfs-telemetry.c - decode the telemetry ring of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif	/* HAVE_SYS_MMAN_H */
+
+#include <sys/stat.h>
+#include <errno.h>
+#include "nls.h"
+#include "util.h"
+#include "nilfs_gc.h"	/* NILFS_RECLAIM_ORDER_* */
+#include "telemetry.h"
+
+#ifdef _GNU_SOURCE
+#include <getopt.h>
+static const struct option long_option[] = {
+	{"help", no_argument, NULL, 'h'},
+	{"segments", no_argument, NULL, 's'},
+	{"utilization", no_argument, NULL, 'u'},
+	{"version", no_argument, NULL, 'V'},
+	{NULL, 0, NULL, 0}
+};
+#define NILFS_TELEMETRY_USAGE						\
+	"Usage: %s [options] [file]\n"					\
+	"  -h, --help\t\tdisplay this help and exit\n"			\
+	"  -s, --segments\tprint segments selected in each cycle\n"	\
+	"  -u, --utilization\tprint utilization histograms\n"		\
+	"  -V, --version\t\tdisplay version and exit\n"
+#else
+#define NILFS_TELEMETRY_USAGE						\
+	"Usage: %s [-h] [-s] [-u] [-V] [file]\n"
+#endif	/* _GNU_SOURCE */
+
+#define NILFS_TELEMETRY_DEFAULT_FILE	"/var/log/nilfs/telemetry.ring"
+
+enum {
+	NILFS_TELEMETRY_PRINT_CYCLES,
+	NILFS_TELEMETRY_PRINT_SEGMENTS,
+	NILFS_TELEMETRY_PRINT_HISTOGRAMS,
+};
+
+/* options */
+static char *progname;
+static int print_mode = NILFS_TELEMETRY_PRINT_CYCLES;
+
+static void nilfs_telemetry_usage(void)
+{
+	fprintf(stderr, NILFS_TELEMETRY_USAGE, progname);
+}
+
+static void nilfs_telemetry_print_time(uint64_t time)
+{
+	printf("%llu.%09llu", (unsigned long long)time / 1000000000,
+	       (unsigned long long)time % 1000000000);
+}
+
+static const char *nilfs_telemetry_order_name(uint32_t order)
+{
+	switch (order) {
+	case NILFS_RECLAIM_ORDER_BLOCKNR:
+		return "blocknr";
+	case NILFS_RECLAIM_ORDER_AGE:
+		return "age";
+	case NILFS_RECLAIM_ORDER_FILE:
+		return "file";
+	default:
+		return "unknown";
+	}
+}
+
+static void nilfs_telemetry_print_header(void)
+{
+	switch (print_mode) {
+	case NILFS_TELEMETRY_PRINT_SEGMENTS:
+		printf("cycle,segnum,live,util\n");
+		break;
+	case NILFS_TELEMETRY_PRINT_HISTOGRAMS:
+		printf("cycle,time,util,count\n");
+		break;
+	default:
+		printf("cycle,time,nsegs,write_cost,disk_util,order\n");
+		break;
+	}
+}
+
+static void
+nilfs_telemetry_print_cycle(const struct nilfs_telemetry_header *header,
+			    const struct nilfs_telemetry_cycle *rec)
+{
+	unsigned int i, n;
+
+	if (print_mode == NILFS_TELEMETRY_PRINT_CYCLES) {
+		printf("%llu,", (unsigned long long)rec->hdr.cycle);
+		nilfs_telemetry_print_time(rec->hdr.time);
+		printf(",%u,%.4f,%.4f,%s\n", rec->nsegs, rec->write_cost,
+		       rec->disk_util,
+		       nilfs_telemetry_order_name(rec->reclaim_order));
+		return;
+	}
+
+	n = min_t(unsigned int, rec->nsegs, NILFS_TELEMETRY_NSEGS);
+	for (i = 0; i < n; i++)
+		printf("%llu,%llu,%u,%.2f\n",
+		       (unsigned long long)rec->hdr.cycle,
+		       (unsigned long long)rec->segnums[i], rec->live[i],
+		       (double)rec->live[i] * 100 /
+		       header->blocks_per_segment);
+}
+
+static void
+nilfs_telemetry_print_histogram(const struct nilfs_telemetry_histogram *rec)
+{
+	int i;
+
+	for (i = 0; i < NILFS_TELEMETRY_NBUCKETS; i++) {
+		if (!rec->counts[i])
+			continue;
+		printf("%llu,", (unsigned long long)rec->hdr.cycle);
+		nilfs_telemetry_print_time(rec->hdr.time);
+		printf(",%d,%u\n", i, rec->counts[i]);
+	}
+}
+
+/**
+ * nilfs_telemetry_decode - print records of a telemetry ring
+ * @header: mapped ring file
+ *
+ * The ring may be appended to while it is decoded.  A record is copied
+ * out of its slot first, and printed only if it still carries the
+ * expected number and the writer has not wrapped around to the slot in
+ * the meantime.
+ */
+static void nilfs_telemetry_decode(const struct nilfs_telemetry_header *header)
+{
+	union {
+		struct nilfs_telemetry_rechdr hdr;
+		struct nilfs_telemetry_cycle cycle;
+		struct nilfs_telemetry_histogram histogram;
+		char buf[NILFS_TELEMETRY_RECSIZE];
+	} rec;
+	const char *slot;
+	uint64_t head, n;
+
+	head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	n = head > header->nrecs ? head - header->nrecs : 0;
+
+	nilfs_telemetry_print_header();
+	for ( ; n < head; n++) {
+		slot = (const char *)header +
+			(n % header->nrecs + 1) * NILFS_TELEMETRY_RECSIZE;
+		memcpy(&rec, slot, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (rec.hdr.seq != n ||
+		    __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) >=
+		    n + header->nrecs)
+			continue;	/* overwritten */
+
+		switch (rec.hdr.type) {
+		case NILFS_TELEMETRY_REC_CYCLE:
+			if (print_mode != NILFS_TELEMETRY_PRINT_HISTOGRAMS)
+				nilfs_telemetry_print_cycle(header,
+							    &rec.cycle);
+			break;
+		case NILFS_TELEMETRY_REC_HISTOGRAM:
+			if (print_mode == NILFS_TELEMETRY_PRINT_HISTOGRAMS)
+				nilfs_telemetry_print_histogram(
+					&rec.histogram);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static int nilfs_telemetry_do_decode(const char *path)
+{
+	const struct nilfs_telemetry_header *header;
+	struct stat stbuf;
+	int fd, status = EXIT_FAILURE;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, _("%s: cannot open %s: %s\n"), progname, path,
+			strerror(errno));
+		goto out;
+	}
+
+	if (fstat(fd, &stbuf) < 0) {
+		fprintf(stderr, _("%s: cannot stat %s: %s\n"), progname, path,
+			strerror(errno));
+		goto out_fd;
+	}
+
+	if (stbuf.st_size < NILFS_TELEMETRY_RECSIZE) {
+		fprintf(stderr, _("%s: %s: not a telemetry ring\n"), progname,
+			path);
+		goto out_fd;
+	}
+
+	header = mmap(NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		fprintf(stderr, _("%s: cannot map %s: %s\n"), progname, path,
+			strerror(errno));
+		goto out_fd;
+	}
+
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) !=
+	    NILFS_TELEMETRY_MAGIC ||
+	    header->recsize != NILFS_TELEMETRY_RECSIZE ||
+	    header->nrecs == 0 || header->blocks_per_segment == 0 ||
+	    (header->nrecs + 1) * NILFS_TELEMETRY_RECSIZE > stbuf.st_size) {
+		fprintf(stderr, _("%s: %s: not a telemetry ring\n"), progname,
+			path);
+		goto out_unmap;
+	}
+	if (header->version != NILFS_TELEMETRY_VERSION) {
+		fprintf(stderr, _("%s: %s: unsupported version %u\n"),
+			progname, path, header->version);
+		goto out_unmap;
+	}
+
+	nilfs_telemetry_decode(header);
+	status = EXIT_SUCCESS;
+
+out_unmap:
+	munmap((void *)header, stbuf.st_size);
+out_fd:
+	close(fd);
+out:
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _GNU_SOURCE
+	int option_index;
+#endif	/* _GNU_SOURCE */
+	const char *path = NILFS_TELEMETRY_DEFAULT_FILE;
+	char *last;
+	int c;
+
+	last = strrchr(argv[0], '/');
+	progname = last ? last + 1 : argv[0];
+
+#ifdef _GNU_SOURCE
+	while ((c = getopt_long(argc, argv, "hsuV",
+				long_option, &option_index)) >= 0) {
+#else
+	while ((c = getopt(argc, argv, "hsuV")) >= 0) {
+#endif	/* _GNU_SOURCE */
+		switch (c) {
+		case 'h':
+			nilfs_telemetry_usage();
+			exit(EXIT_SUCCESS);
+		case 's':
+			print_mode = NILFS_TELEMETRY_PRINT_SEGMENTS;
+			break;
+		case 'u':
+			print_mode = NILFS_TELEMETRY_PRINT_HISTOGRAMS;
+			break;
+		case 'V':
+			printf(_("%s version %s\n"), progname,
+			       PACKAGE_VERSION);
+			exit(EXIT_SUCCESS);
+		default:
+			nilfs_telemetry_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc)
+		path = argv[optind++];
+	if (optind < argc) {
+		fprintf(stderr, _("%s: too many arguments\n"), progname);
+		exit(EXIT_FAILURE);
+	}
+
+	exit(nilfs_telemetry_do_decode(path));
+}
@@ -1,3 +1,7 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,27 +15,41 @@
 
 int nilfs_get_live_blk(struct nilfs_cleanerd *cleanerd,
                          const struct nilfs_sustat *sustat,
+                         const struct nilfs_suinfo *si,
                          uint64_t segnum, ssize_t *live_blocks) {
-  struct nilfs_reclaim_stat stat;
-  struct nilfs *nilfs = cleanerd->nilfs;
-  nilfs_cno_t protcno;
-  struct nilfs_cnormap *cnormap = cleanerd->cnormap;
   int ret;
-  ret = nilfs_cnormap_track_back(cnormap, 0, &protcno);
-  memset(&stat, 0, sizeof(stat));
-  ret = assess_segment_if_dirty(
-    nilfs,
-    sustat,
-    segnum,
-    protcno,
-    &stat
-  );
+  /*
+   * Live block counts are brought up to date in bulk once per cycle
+   * by nilfs_segtable_update_live(); just look it up here.
+   */
+  ret = nilfs_segtable_get_live(cleanerd->segtable, segnum, live_blocks);
   if (!ret) {
     return 0; // segment is clean, not eligible
   } else if (ret < 0) {
     syslog(LOG_ERR, "error assessing segment %llu", (unsigned long long)segnum);
     return 0; // on error, treat as not eligible
   }
-  *live_blocks = stat.live_blks;
   return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * nilfs_policy_simd_level - get the SIMD instruction set for batch kernels
+ *
+ * SSE2 is part of the x86-64 baseline; AVX2 is detected at run time so
+ * that the daemon stays usable on older processors.
+ */
+int nilfs_policy_simd_level(void)
+{
+#if defined(__x86_64__) && HAVE_IMMINTRIN_H
+  static int level = -1;
+
+  if (level < 0) {
+    __builtin_cpu_init();
+    level = __builtin_cpu_supports("avx2") ?
+      NILFS_POLICY_SIMD_AVX2 : NILFS_POLICY_SIMD_SSE2;
+  }
+  return level;
+#else
+  return NILFS_POLICY_SIMD_NONE;
+#endif
+}
@@ -0,0 +1,303 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+
+#include "nilfs.h"
+#include "nilfs_gc.h"
+#include "nilfs_cleaner.h"
+#include "nilfs_cleaning_policy.h"
+#include "cleanerd.h"
+
+#define ADAPTIVE_MAX_DELEGATES	16
+
+/*
+ * number of windows after which the figures of a policy not run since
+ * are considered stale and the policy is run again to refresh them
+ */
+#define ADAPTIVE_REPROBE_WINDOWS	16
+
+/**
+ * struct adaptive_sample - outcome of one cleaning step
+ * @moved: number of live blocks copied
+ * @freed: number of dead blocks reclaimed
+ */
+struct adaptive_sample {
+	uint64_t moved;
+	uint64_t freed;
+};
+
+/**
+ * struct adaptive_delegate - policy the adaptive policy can run
+ * @policy: the policy
+ * @samples: ring of the latest cleaning steps run with @policy
+ * @nsamples: number of valid entries in @samples
+ * @head: entry of @samples to be overwritten next
+ * @moved: sum of @moved over @samples
+ * @freed: sum of @freed over @samples
+ * @last_step: cleaning step in which @policy last ran
+ * @tried: flag that tells if @policy has ever run
+ */
+struct adaptive_delegate {
+	struct nilfs_cleaning_policy *policy;
+	struct adaptive_sample *samples;
+	unsigned long nsamples;
+	unsigned long head;
+	uint64_t moved;
+	uint64_t freed;
+	uint64_t last_step;
+	int tried;
+};
+
+/**
+ * struct adaptive_data - state of the adaptive policy
+ * @delegates: policies to choose from
+ * @ndelegates: number of @delegates
+ * @active: index of the policy selecting segments now
+ * @window: number of cleaning steps over which a write cost is measured
+ * @margin: relative improvement of the write cost required to switch
+ * @step: number of cleaning steps seen
+ * @dwell: number of cleaning steps run by the active policy since it
+ *         was chosen
+ */
+struct adaptive_data {
+	struct adaptive_delegate delegates[ADAPTIVE_MAX_DELEGATES];
+	int ndelegates;
+	int active;
+	unsigned long window;
+	double margin;
+	uint64_t step;
+	uint64_t dwell;
+};
+
+/**
+ * adaptive_cost - write cost measured for a policy
+ * @d: delegate
+ *
+ * The write cost is the number of live blocks that had to be copied
+ * for each dead block reclaimed, so lower is better.
+ */
+static double adaptive_cost(const struct adaptive_delegate *d)
+{
+	if (d->freed > 0)
+		return (double)d->moved / d->freed;
+	return d->moved > 0 ? HUGE_VAL : 0.0;
+}
+
+static void adaptive_reset(struct adaptive_delegate *d)
+{
+	d->nsamples = 0;
+	d->head = 0;
+	d->moved = 0;
+	d->freed = 0;
+}
+
+static void adaptive_record(struct adaptive_data *data,
+			    struct adaptive_delegate *d,
+			    uint64_t moved, uint64_t freed)
+{
+	struct adaptive_sample *sample = &d->samples[d->head];
+
+	if (d->nsamples == data->window) {
+		d->moved -= sample->moved;
+		d->freed -= sample->freed;
+	} else {
+		d->nsamples++;
+	}
+	sample->moved = moved;
+	sample->freed = freed;
+	d->moved += moved;
+	d->freed += freed;
+	if (++d->head == data->window)
+		d->head = 0;
+}
+
+/**
+ * adaptive_choose - choose the policy to run next
+ * @data: adaptive policy state
+ *
+ * Every policy is run for a window first.  After that, a policy whose
+ * figures have gone stale is run again for a window, and otherwise the
+ * policy with the lowest write cost takes over if it beats the active
+ * one by more than the margin.
+ */
+static int adaptive_choose(struct adaptive_data *data)
+{
+	struct adaptive_delegate *d;
+	uint64_t stale = (uint64_t)ADAPTIVE_REPROBE_WINDOWS * data->window;
+	int i, best = data->active, oldest = -1;
+
+	for (i = 0; i < data->ndelegates; i++) {
+		if (!data->delegates[i].tried)
+			return i;
+	}
+
+	for (i = 0; i < data->ndelegates; i++) {
+		d = &data->delegates[i];
+		if (i == data->active || data->step - d->last_step <= stale)
+			continue;
+		if (oldest < 0 ||
+		    d->last_step < data->delegates[oldest].last_step)
+			oldest = i;
+	}
+	if (oldest >= 0)
+		return oldest;
+
+	for (i = 0; i < data->ndelegates; i++) {
+		if (adaptive_cost(&data->delegates[i]) <
+		    adaptive_cost(&data->delegates[best]))
+			best = i;
+	}
+	if (best != data->active &&
+	    adaptive_cost(&data->delegates[best]) <
+	    adaptive_cost(&data->delegates[data->active]) *
+	    (1.0 - data->margin))
+		return best;
+	return data->active;
+}
+
+static void adaptive_switch(struct adaptive_data *data, int next)
+{
+	struct adaptive_delegate *cur = &data->delegates[data->active];
+	struct adaptive_delegate *d = &data->delegates[next];
+
+	if (d->tried)
+		syslog(LOG_INFO,
+		       "adaptive: switching from %s (cost %.3f) to %s (cost %.3f)",
+		       cur->policy->name, adaptive_cost(cur),
+		       d->policy->name, adaptive_cost(d));
+	else
+		syslog(LOG_INFO,
+		       "adaptive: switching from %s (cost %.3f) to %s",
+		       cur->policy->name, adaptive_cost(cur),
+		       d->policy->name);
+
+	/* measure the policy afresh under the current workload */
+	adaptive_reset(d);
+	d->tried = 1;
+	data->active = next;
+	data->dwell = 0;
+}
+
+static struct nilfs_cleaning_policy *
+adaptive_delegate(struct nilfs_cleaning_policy *policy)
+{
+	struct adaptive_data *data = policy->policy_data;
+
+	return data->delegates[data->active].policy;
+}
+
+static void adaptive_feedback(struct nilfs_cleaning_policy *policy,
+			      const struct nilfs_reclaim_stat *stat)
+{
+	struct adaptive_data *data = policy->policy_data;
+	struct adaptive_delegate *d = &data->delegates[data->active];
+	int next;
+
+	data->step++;
+	data->dwell++;
+	d->last_step = data->step;
+	adaptive_record(data, d, stat->live_blks, stat->defunct_blks);
+
+	/* let the active policy fill its window before judging it */
+	if (data->dwell < data->window)
+		return;
+
+	next = adaptive_choose(data);
+	if (next != data->active)
+		adaptive_switch(data, next);
+}
+
+static void adaptive_destroy(struct nilfs_cleaning_policy *policy)
+{
+	struct adaptive_data *data = policy->policy_data;
+	struct nilfs_cleaning_policy *p;
+	int i;
+
+	if (!data)
+		return;
+
+	for (i = 0; i < data->ndelegates; i++) {
+		p = data->delegates[i].policy;
+		if (p->destroy)
+			p->destroy(p);
+	}
+	free(data->delegates[0].samples);
+	free(data);
+	policy->policy_data = NULL;
+}
+
+static int adaptive_init(struct nilfs_cleaning_policy *policy,
+			 struct nilfs_cleanerd *cleanerd)
+{
+	struct adaptive_data *data;
+	struct adaptive_sample *samples;
+	struct nilfs_cleaning_policy *p;
+	unsigned long window = cleanerd->config.cf_adaptive_window;
+	int i, n = 0;
+
+	data = calloc(1, sizeof(*data));
+	if (!data)
+		return -ENOMEM;
+
+	/* all other registered policies except meta policies */
+	for (i = 0; (p = nilfs_get_policy_at(i)) != NULL; i++) {
+		if (p == policy || p->delegate)
+			continue;
+		if (n == ADAPTIVE_MAX_DELEGATES)
+			break;
+		if (p->init && p->init(p, cleanerd) < 0) {
+			syslog(LOG_WARNING,
+			       "adaptive: cannot initialize %s, not used",
+			       p->name);
+			continue;
+		}
+		data->delegates[n++].policy = p;
+	}
+	data->ndelegates = n;
+	policy->policy_data = data;
+	if (n == 0) {
+		syslog(LOG_ERR, "adaptive: no policy to delegate to");
+		adaptive_destroy(policy);
+		return -ENOENT;
+	}
+
+	samples = calloc((size_t)n * window, sizeof(*samples));
+	if (!samples) {
+		adaptive_destroy(policy);
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++)
+		data->delegates[i].samples = samples + (size_t)i * window;
+
+	data->window = window;
+	data->margin = cleanerd->config.cf_adaptive_margin / 100.0;
+	data->active = 0;
+	data->delegates[0].tried = 1;
+
+	syslog(LOG_INFO, "adaptive: starting with policy %s",
+	       data->delegates[0].policy->name);
+	return 0;
+}
+
+/* Meta policy that runs whichever policy shows the lowest write cost */
+struct nilfs_cleaning_policy nilfs_policy_adaptive = {
+	.name = "adaptive",
+	.init = adaptive_init,
+	.destroy = adaptive_destroy,
+	.evaluate_segment = NULL,
+	.evaluate_batch = NULL,
+	.compare = NULL,
+	.select = NULL,
+	.walk = NILFS_POLICY_WALK_NONE,
+	.bound = NULL,
+	.delegate = adaptive_delegate,
+	.feedback = adaptive_feedback,
+	.policy_data = NULL
+};
@@ -1,5 +1,10 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string.h>
 #include <syslog.h>
 
@@ -9,6 +14,11 @@
 #include "nilfs_cleaning_policy.h"
 #include "cleanerd.h"
 
+#if defined(__x86_64__) && HAVE_IMMINTRIN_H
+#include <immintrin.h>
+#define NILFS_POLICY_X86_SIMD	1
+#endif
+
 /* Cost-Benefit comparison function: higher score first */
 static int cb_compare(const void *elem1, const void *elem2)
 {
@@ -34,7 +44,7 @@ static int cb_evaluate(struct nilfs_cleaning_policy *policy,
 		       struct nilfs_segment_candidate *candidate)
 {
   ssize_t live_blocks;
-  if (nilfs_get_live_blk(cleanerd, sustat, segnum, &live_blocks) == 0 
+  if (nilfs_get_live_blk(cleanerd, sustat, si, segnum, &live_blocks) == 0 
     || live_blocks < 0) {
     return 0; // segment is clean or error, not eligible
   }
@@ -42,7 +52,7 @@ static int cb_evaluate(struct nilfs_cleaning_policy *policy,
 	uint32_t blocks_per_segment = nilfs_get_blocks_per_segment(cleanerd->nilfs);
 	double u = (double)live_blocks / blocks_per_segment;
 	int64_t age = now - si->sui_lastmod;
-  if (si->sui_lastmod <= 0) {
+  if ((int64_t)si->sui_lastmod <= 0) {
     age = 0; // Indicate unknown age
   }
   // int64_t MIN_VALID_TIME = 1500000000; 
@@ -79,13 +89,195 @@ static int cb_evaluate(struct nilfs_cleaning_policy *policy,
 	return 1;  /* Eligible */
 }
 
+/*
+ * Batch evaluation: score = (1 - u) * age / (1 + u), NaN if protected.
+ * The operations are done in the same order as cb_evaluate() so that
+ * every kernel gives bit-identical scores.
+ */
+static void cb_batch_scalar(const struct nilfs_policy_env *env,
+			    size_t start, size_t n, const double *lastmod,
+			    const double *live, double *scores)
+{
+	double now = env->now, prottime = env->prottime;
+	double bps = env->blocks_per_segment;
+	double u, age;
+	size_t i;
+
+	for (i = start; i < n; i++) {
+		if (lastmod[i] >= prottime && lastmod[i] <= now) {
+			scores[i] = NAN;  /* Protected */
+			continue;
+		}
+		u = live[i] / bps;
+		age = lastmod[i] <= 0 ? 0 : now - lastmod[i];
+		if (age < 0)
+			age = 0;
+		scores[i] = (1.0 - u) * age / (1.0 + u);
+	}
+}
+
+#ifdef NILFS_POLICY_X86_SIMD
+static size_t cb_batch_sse2(const struct nilfs_policy_env *env,
+			    size_t n, const double *lastmod,
+			    const double *live, double *scores)
+{
+	__m128d vnow = _mm_set1_pd(env->now);
+	__m128d vprot = _mm_set1_pd(env->prottime);
+	__m128d vbps = _mm_set1_pd(env->blocks_per_segment);
+	__m128d vnan = _mm_set1_pd(NAN);
+	__m128d vone = _mm_set1_pd(1.0);
+	__m128d vzero = _mm_setzero_pd();
+	__m128d lm, u, age, sc, mask;
+	size_t i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		lm = _mm_loadu_pd(lastmod + i);
+		u = _mm_div_pd(_mm_loadu_pd(live + i), vbps);
+		age = _mm_andnot_pd(_mm_cmple_pd(lm, vzero),
+				    _mm_sub_pd(vnow, lm));
+		age = _mm_max_pd(age, vzero);
+		sc = _mm_div_pd(_mm_mul_pd(_mm_sub_pd(vone, u), age),
+				_mm_add_pd(vone, u));
+		mask = _mm_and_pd(_mm_cmpge_pd(lm, vprot),
+				  _mm_cmple_pd(lm, vnow));
+		sc = _mm_or_pd(_mm_and_pd(mask, vnan),
+			       _mm_andnot_pd(mask, sc));
+		_mm_storeu_pd(scores + i, sc);
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t cb_batch_avx2(const struct nilfs_policy_env *env,
+			    size_t n, const double *lastmod,
+			    const double *live, double *scores)
+{
+	__m256d vnow = _mm256_set1_pd(env->now);
+	__m256d vprot = _mm256_set1_pd(env->prottime);
+	__m256d vbps = _mm256_set1_pd(env->blocks_per_segment);
+	__m256d vnan = _mm256_set1_pd(NAN);
+	__m256d vone = _mm256_set1_pd(1.0);
+	__m256d vzero = _mm256_setzero_pd();
+	__m256d lm, u, age, sc, mask;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		lm = _mm256_loadu_pd(lastmod + i);
+		u = _mm256_div_pd(_mm256_loadu_pd(live + i), vbps);
+		age = _mm256_andnot_pd(_mm256_cmp_pd(lm, vzero, _CMP_LE_OQ),
+				       _mm256_sub_pd(vnow, lm));
+		age = _mm256_max_pd(age, vzero);
+		sc = _mm256_div_pd(_mm256_mul_pd(_mm256_sub_pd(vone, u), age),
+				   _mm256_add_pd(vone, u));
+		mask = _mm256_and_pd(_mm256_cmp_pd(lm, vprot, _CMP_GE_OQ),
+				     _mm256_cmp_pd(lm, vnow, _CMP_LE_OQ));
+		_mm256_storeu_pd(scores + i, _mm256_blendv_pd(sc, vnan, mask));
+	}
+	return i;
+}
+#endif	/* NILFS_POLICY_X86_SIMD */
+
+static void cb_evaluate_batch(struct nilfs_cleaning_policy *policy,
+			      const struct nilfs_policy_env *env,
+			      size_t n, const double *lastmod,
+			      const double *live, double *scores)
+{
+	size_t done = 0;
+
+#ifdef NILFS_POLICY_X86_SIMD
+	if (nilfs_policy_simd_level() >= NILFS_POLICY_SIMD_AVX2)
+		done = cb_batch_avx2(env, n, lastmod, live, scores);
+	else
+		done = cb_batch_sse2(env, n, lastmod, live, scores);
+#endif
+	cb_batch_scalar(env, done, n, lastmod, live, scores);
+}
+
+/*
+ * Along the live walk, (1 - u) / (1 + u) only falls, and no segment is
+ * older than the oldest reclaimable one.  The operations follow
+ * cb_batch_scalar() so that the bound is never below a real score.
+ */
+static double cb_bound(struct nilfs_cleaning_policy *policy,
+		       const struct nilfs_policy_env *env,
+		       double live, double lastmod)
+{
+	double now = env->now;
+	double u = live / (double)env->blocks_per_segment;
+	double age = now - (env->oldest > 0 ? (double)env->oldest : 0);
+
+	if (age < 0)
+		age = 0;
+	return (1.0 - u) * age / (1.0 + u);
+}
+
 /* Policy definition */
 struct nilfs_cleaning_policy nilfs_policy_cost_benefit = {
 	.name = "cost-benefit",
 	.init = NULL,
 	.destroy = NULL,
 	.evaluate_segment = cb_evaluate,
+	.evaluate_batch = cb_evaluate_batch,
+	.compare = cb_compare,
+	.select = NULL,
+	.walk = NILFS_POLICY_WALK_LIVE,
+	.bound = cb_bound,
+	.policy_data = NULL
+};
+
+/*
+ * Variant of cb_evaluate() whose age is that of the live data rather
+ * than of the segment: segments written by the cleaner or deferred get
+ * a fresh lastmod although they hold old, cold blocks.  The protection
+ * period still applies to lastmod, which is what it is about.
+ */
+static int cba_evaluate(struct nilfs_cleaning_policy *policy,
+			struct nilfs_cleanerd *cleanerd,
+			const struct nilfs_sustat *sustat,
+			const struct nilfs_suinfo *si,
+			uint64_t segnum,
+			int64_t now,
+			int64_t prottime,
+			struct nilfs_segment_candidate *candidate)
+{
+	uint32_t blocks_per_segment;
+	ssize_t live_blocks;
+	int64_t birth, age;
+	double u;
+
+	if (si->sui_lastmod >= prottime && si->sui_lastmod <= now)
+		return 0;  /* Protected */
+
+	if (nilfs_get_live_blk(cleanerd, sustat, si, segnum,
+			       &live_blocks) == 0 || live_blocks < 0)
+		return 0;
+	if (nilfs_segtable_get_birth(cleanerd->segtable, cleanerd->cnormap,
+				     segnum, &birth) <= 0)
+		return 0;
+
+	blocks_per_segment = nilfs_get_blocks_per_segment(cleanerd->nilfs);
+	u = (double)live_blocks / blocks_per_segment;
+	age = birth <= 0 ? 0 : now - birth;
+	if (age < 0)
+		age = 0;
+
+	candidate->segnum = segnum;
+	candidate->score = (1.0 - u) * age / (1.0 + u);
+	candidate->metadata = NULL;
+	candidate->util = u;
+	return 1;  /* Eligible */
+}
+
+/* Cost-Benefit on the age of live blocks; every segment is scored */
+struct nilfs_cleaning_policy nilfs_policy_cost_benefit_age = {
+	.name = "cost-benefit-age",
+	.init = NULL,
+	.destroy = NULL,
+	.evaluate_segment = cba_evaluate,
+	.evaluate_batch = NULL,
 	.compare = cb_compare,
 	.select = NULL,
+	.walk = NILFS_POLICY_WALK_NONE,
+	.bound = NULL,
 	.policy_data = NULL
 };
@@ -83,28 +83,16 @@ static int hc_evaluate(struct nilfs_cleaning_policy *policy,
                        struct nilfs_segment_candidate *candidate)
 {
     struct hc_policy_data *pdata = (struct hc_policy_data *)policy->policy_data;
-    struct nilfs *nilfs = cleanerd->nilfs;
-    struct nilfs_reclaim_stat stat;
-    nilfs_cno_t protcno;
+    ssize_t live_blocks;
     int ret;
 
-    /* 1. Track back to find protection checkpoint */
-    ret = nilfs_cnormap_track_back(cleanerd->cnormap, 0, &protcno);
-    if (ret < 0) {
-      syslog(LOG_ERR, "Error getting protection checkpoint number");
-      return 0;
-    }
-
-    memset(&stat, 0, sizeof(stat));
-
-    /* 2. Assess if dirty and get live block count */
-    ret = assess_segment_if_dirty(nilfs, sustat, segnum, protcno, &stat);
-    
+    /* 1. Get live block count (served from the live block cache) */
+    ret = nilfs_get_live_blk(cleanerd, sustat, si, segnum, &live_blocks);
     if (ret <= 0) {
       syslog(LOG_INFO, "Segment %lu is clean or error during assessment", segnum);
       return 0; /* Clean or Error */
     }
-    if (stat.live_blks < 0) {
+    if (live_blocks < 0) {
       syslog(LOG_ERR, "Error assessing live blocks or protected for segment %lu", segnum);
       return 0; /* Protected */
     }
@@ -131,7 +119,7 @@ static int hc_evaluate(struct nilfs_cleaning_policy *policy,
     }
 
     /* 5. Classify: Hot vs Cold */
-    meta->live_blocks = (uint32_t)stat.live_blks;
+    meta->live_blocks = (uint32_t)live_blocks;
     meta->is_hot = (age < pdata->hot_threshold);
     meta->lastmod = si->sui_lastmod;
 
@@ -177,6 +165,7 @@ static ssize_t strict_cluster_select(struct nilfs_cleaning_policy *policy,
                          int64_t prottime)
 {
     struct nilfs *nilfs = cleanerd->nilfs;
+    struct nilfs_segtable *segtable = cleanerd->segtable;
     struct nilfs_segment_candidate *candidates = NULL;
     struct nilfs_suinfo si;
     unsigned long nsegs;
@@ -188,7 +177,7 @@ static ssize_t strict_cluster_select(struct nilfs_cleaning_policy *policy,
     struct timeval tv;
     
     /* 1. Get total number of segments to iterate */
-    nsegs = nilfs_get_nsegments(nilfs);
+    nsegs = segtable->nsegs;
     if (nsegs == 0) return 0;
 
     /* Allocate initial capacity for candidates */
@@ -198,9 +187,9 @@ static ssize_t strict_cluster_select(struct nilfs_cleaning_policy *policy,
     syslog(LOG_INFO, "Hot-Cold Segregation: Scanning %lu segments", nsegs);
     /* 2. Manual Iteration over all segments */
     for (segnum = 0; segnum < nsegs; segnum++) {
-        /* Fetch Segment Usage Info */
-        ret = nilfs_get_suinfo(nilfs, segnum, &si, 1);
-        if (ret < 0) continue; 
+        /* Segment Usage Info from the per-cycle segment table */
+        nilfs_segtable_get_suinfo(segtable, segnum, &si);
+        if (!nilfs_suinfo_reclaimable(&si)) continue;
 
         /* Check eligibility using our evaluate function */
         struct nilfs_segment_candidate cand;
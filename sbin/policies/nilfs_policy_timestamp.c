@@ -1,5 +1,10 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <string.h>
 #include <time.h>
 #include <syslog.h>
@@ -12,6 +17,11 @@
 #include "nilfs_cleaning_policy.h"
 #include "cleanerd.h"
 
+#if defined(__x86_64__) && HAVE_IMMINTRIN_H
+#include <immintrin.h>
+#define NILFS_POLICY_X86_SIMD	1
+#endif
+
 /* Original comparison function */
 static int timestamp_compare(const void *elem1, const void *elem2)
 {
@@ -40,7 +50,7 @@ static int timestamp_evaluate(struct nilfs_cleaning_policy *policy,
 	int64_t thr = sustat->ss_nongc_ctime;
 	int64_t imp;
   ssize_t live_blocks;
-  if (nilfs_get_live_blk(cleanerd, sustat, segnum, &live_blocks) == 0 
+  if (nilfs_get_live_blk(cleanerd, sustat, si, segnum, &live_blocks) == 0 
     || live_blocks < 0) {
     return 0; // segment is clean or error, not eligible
   }
@@ -63,13 +73,128 @@ static int timestamp_evaluate(struct nilfs_cleaning_policy *policy,
 	return 1;  /* Eligible */
 }
 
+/*
+ * Batch evaluation: score = -imp, NaN if not eligible or protected,
+ * where imp is lastmod, or nongc_ctime - 1 for a future lastmod.  The
+ * score is computed as 0 - imp, which is +0 rather than -0 for a zero
+ * lastmod, like the integer negation of timestamp_evaluate().
+ */
+static void timestamp_batch_scalar(const struct nilfs_policy_env *env,
+				   size_t start, size_t n,
+				   const double *lastmod, const double *live,
+				   double *scores)
+{
+	double now = env->now, prottime = env->prottime;
+	double thr = env->nongc_ctime;
+	double imp;
+	size_t i;
+
+	for (i = start; i < n; i++) {
+		imp = lastmod[i] <= now ? lastmod[i] : thr - 1;
+		if (imp >= thr || (lastmod[i] >= prottime && lastmod[i] <= now))
+			scores[i] = NAN;
+		else
+			scores[i] = 0 - imp;
+	}
+}
+
+#ifdef NILFS_POLICY_X86_SIMD
+static size_t timestamp_batch_sse2(const struct nilfs_policy_env *env,
+				   size_t n, const double *lastmod,
+				   double *scores)
+{
+	__m128d vnow = _mm_set1_pd(env->now);
+	__m128d vprot = _mm_set1_pd(env->prottime);
+	__m128d vthr = _mm_set1_pd(env->nongc_ctime);
+	__m128d vthr1 = _mm_set1_pd((double)env->nongc_ctime - 1);
+	__m128d vnan = _mm_set1_pd(NAN);
+	__m128d vzero = _mm_setzero_pd();
+	__m128d lm, imp, past, mask;
+	size_t i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		lm = _mm_loadu_pd(lastmod + i);
+		past = _mm_cmple_pd(lm, vnow);
+		imp = _mm_or_pd(_mm_and_pd(past, lm),
+				_mm_andnot_pd(past, vthr1));
+		mask = _mm_or_pd(_mm_cmpge_pd(imp, vthr),
+				 _mm_and_pd(_mm_cmpge_pd(lm, vprot), past));
+		imp = _mm_sub_pd(vzero, imp);
+		_mm_storeu_pd(scores + i,
+			      _mm_or_pd(_mm_and_pd(mask, vnan),
+					_mm_andnot_pd(mask, imp)));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t timestamp_batch_avx2(const struct nilfs_policy_env *env,
+				   size_t n, const double *lastmod,
+				   double *scores)
+{
+	__m256d vnow = _mm256_set1_pd(env->now);
+	__m256d vprot = _mm256_set1_pd(env->prottime);
+	__m256d vthr = _mm256_set1_pd(env->nongc_ctime);
+	__m256d vthr1 = _mm256_set1_pd((double)env->nongc_ctime - 1);
+	__m256d vnan = _mm256_set1_pd(NAN);
+	__m256d vzero = _mm256_setzero_pd();
+	__m256d lm, imp, past, mask;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		lm = _mm256_loadu_pd(lastmod + i);
+		past = _mm256_cmp_pd(lm, vnow, _CMP_LE_OQ);
+		imp = _mm256_blendv_pd(vthr1, lm, past);
+		mask = _mm256_or_pd(_mm256_cmp_pd(imp, vthr, _CMP_GE_OQ),
+				    _mm256_and_pd(_mm256_cmp_pd(lm, vprot,
+								_CMP_GE_OQ),
+						  past));
+		imp = _mm256_sub_pd(vzero, imp);
+		_mm256_storeu_pd(scores + i, _mm256_blendv_pd(imp, vnan, mask));
+	}
+	return i;
+}
+#endif	/* NILFS_POLICY_X86_SIMD */
+
+static void timestamp_evaluate_batch(struct nilfs_cleaning_policy *policy,
+				     const struct nilfs_policy_env *env,
+				     size_t n, const double *lastmod,
+				     const double *live, double *scores)
+{
+	size_t done = 0;
+
+#ifdef NILFS_POLICY_X86_SIMD
+	if (nilfs_policy_simd_level() >= NILFS_POLICY_SIMD_AVX2)
+		done = timestamp_batch_avx2(env, n, lastmod, scores);
+	else
+		done = timestamp_batch_sse2(env, n, lastmod, scores);
+#endif
+	timestamp_batch_scalar(env, done, n, lastmod, live, scores);
+}
+
+/*
+ * timestamp_compare() prefers the lowest score -imp, that is, the latest
+ * importance, so the walk visits the latest lastmod first.  Segments
+ * after one modified in the past have no later importance than its
+ * lastmod; no bound holds while future lastmods are being visited.
+ */
+static double timestamp_bound(struct nilfs_cleaning_policy *policy,
+			      const struct nilfs_policy_env *env,
+			      double live, double lastmod)
+{
+	return lastmod <= env->now ? -lastmod : -INFINITY;
+}
+
 /* Policy definition */
 struct nilfs_cleaning_policy nilfs_policy_timestamp = {
 	.name = "timestamp",
 	.init = NULL,
 	.destroy = NULL,
 	.evaluate_segment = timestamp_evaluate,
+	.evaluate_batch = timestamp_evaluate_batch,
 	.compare = timestamp_compare,
 	.select = NULL,  /* Use default selection logic */
+	.walk = NILFS_POLICY_WALK_NEWEST,
+	.bound = timestamp_bound,
 	.policy_data = NULL
 };
\ No newline at end of file
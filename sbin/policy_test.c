@@ -0,0 +1,225 @@
+/*
+ * policy_test.c - check the batch scoring kernels of the policies
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The timestamp, greedy and cost-benefit policies score dense batches of
+ * segments with an AVX2 or SSE2 kernel, as far as the CPU has them, and
+ * a scalar loop for the tail.  Each of them must give the score of the
+ * evaluate_segment method bit for bit, and NaN wherever that method
+ * finds the segment ineligible, for every SIMD level and batch length.
+ */
+
+#include "policies/nilfs_policy_timestamp.c"
+#include "policies/nilfs_policy_greedy.c"
+#include "policies/nilfs_policy_cost_benefit.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define POLICY_TEST_BPS		2048	/* blocks per segment */
+#define POLICY_TEST_NSEGS	1000
+#define POLICY_TEST_NROUNDS	20
+
+/* inputs that evaluate_segment takes from elsewhere than its arguments */
+static int policy_test_level;
+static ssize_t policy_test_live;
+
+static int nfailures;
+
+int nilfs_policy_simd_level(void)
+{
+	return policy_test_level;
+}
+
+int nilfs_get_live_blk(struct nilfs_cleanerd *cleanerd,
+		       const struct nilfs_sustat *sustat,
+		       const struct nilfs_suinfo *si,
+		       uint64_t segnum, ssize_t *live_blocks)
+{
+	*live_blocks = policy_test_live;
+	return 1;
+}
+
+uint32_t nilfs_get_blocks_per_segment(const struct nilfs *nilfs)
+{
+	return POLICY_TEST_BPS;
+}
+
+int nilfs_segtable_get_birth(struct nilfs_segtable *segtable,
+			     struct nilfs_cnormap *cnormap, uint64_t segnum,
+			     int64_t *timep)
+{
+	return 0;
+}
+
+struct policy_test_policy {
+	struct nilfs_cleaning_policy *policy;
+	void (*scalar)(const struct nilfs_policy_env *env, size_t start,
+		       size_t n, const double *lastmod, const double *live,
+		       double *scores);
+};
+
+static const struct policy_test_policy policy_test_policies[] = {
+	{ &nilfs_policy_timestamp, timestamp_batch_scalar },
+	{ &nilfs_policy_greedy, greedy_batch_scalar },
+	{ &nilfs_policy_cost_benefit, cb_batch_scalar },
+};
+
+#define POLICY_TEST_NPOLICIES	\
+	(sizeof(policy_test_policies) / sizeof(policy_test_policies[0]))
+
+/*
+ * Draw a lastmod, often on or next to one of the limits that the
+ * policies compare it with.
+ */
+static int64_t policy_test_lastmod(const struct nilfs_policy_env *env)
+{
+	switch (rand() % 12) {
+	case 0:
+		return 0;
+	case 1:
+		return -(rand() % 1000);
+	case 2:
+		return env->prottime;
+	case 3:
+		return env->prottime - 1;
+	case 4:
+		return env->now;
+	case 5:
+		return env->now + 1 + rand() % 1000;	/* in the future */
+	case 6:
+		return env->nongc_ctime;
+	case 7:
+		return env->nongc_ctime - 1;
+	default:
+		return env->now - rand() % 10000000;
+	}
+}
+
+static ssize_t policy_test_live_blocks(void)
+{
+	switch (rand() % 8) {
+	case 0:
+		return 0;
+	case 1:
+		return POLICY_TEST_BPS;
+	default:
+		return rand() % (POLICY_TEST_BPS + 1);
+	}
+}
+
+static void policy_test_check(const char *policy, const char *kernel,
+			      size_t n, size_t offset, const double *got,
+			      const double *want)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (isnan(want[i]) ? isnan(got[i]) :
+		    memcmp(&got[i], &want[i], sizeof(got[i])) == 0)
+			continue;
+		if (nfailures++ < 20)
+			fprintf(stderr,
+				"%s: %s, %zu segments from %zu: segment %zu: got %a, want %a\n",
+				policy, kernel, n, offset, i, got[i],
+				want[i]);
+		return;
+	}
+}
+
+static void policy_test_round(void)
+{
+	static const char *level_name[] = { "none", "sse2", "avx2" };
+	static double lastmod[POLICY_TEST_NSEGS], live[POLICY_TEST_NSEGS];
+	static double want[POLICY_TEST_NSEGS], got[POLICY_TEST_NSEGS];
+	const struct policy_test_policy *p;
+	struct nilfs_segment_candidate cand;
+	struct nilfs_cleanerd cleanerd;
+	struct nilfs_policy_env env;
+	struct nilfs_sustat sustat;
+	struct nilfs_suinfo si;
+	size_t i, k, n, offset;
+	int level, maxlevel = NILFS_POLICY_SIMD_NONE;
+
+#ifdef NILFS_POLICY_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		maxlevel = NILFS_POLICY_SIMD_SSE2;
+	if (__builtin_cpu_supports("avx2"))
+		maxlevel = NILFS_POLICY_SIMD_AVX2;
+#endif
+
+	memset(&cleanerd, 0, sizeof(cleanerd));
+	memset(&sustat, 0, sizeof(sustat));
+	memset(&si, 0, sizeof(si));
+	env.now = 1700000000 + rand() % 100000000;
+	env.prottime = env.now - rand() % 7200;
+	env.nongc_ctime = env.now - 1000 + rand() % 2000;
+	env.blocks_per_segment = POLICY_TEST_BPS;
+	env.oldest = 0;
+	sustat.ss_nongc_ctime = env.nongc_ctime;
+
+	for (i = 0; i < POLICY_TEST_NSEGS; i++) {
+		lastmod[i] = policy_test_lastmod(&env);
+		live[i] = policy_test_live_blocks();
+	}
+
+	for (k = 0; k < POLICY_TEST_NPOLICIES; k++) {
+		p = &policy_test_policies[k];
+		for (i = 0; i < POLICY_TEST_NSEGS; i++) {
+			si.sui_lastmod = lastmod[i];
+			policy_test_live = live[i];
+			if (p->policy->evaluate_segment(
+				    p->policy, &cleanerd, &sustat, &si, i,
+				    env.now, env.prottime, &cand))
+				want[i] = cand.score;
+			else
+				want[i] = NAN;
+		}
+
+		/* every length up to a few vectors, from every alignment */
+		for (n = 0; n <= POLICY_TEST_NSEGS;
+		     n = n < 19 ? n + 1 : n * 7) {
+			for (offset = 0; offset < 4 && offset + n <=
+				     POLICY_TEST_NSEGS; offset++) {
+				p->scalar(&env, 0, n, lastmod + offset,
+					  live + offset, got);
+				policy_test_check(p->policy->name, "scalar",
+						  n, offset, got,
+						  want + offset);
+
+				for (level = NILFS_POLICY_SIMD_NONE;
+				     level <= maxlevel; level++) {
+					policy_test_level = level;
+					p->policy->evaluate_batch(
+						p->policy, &env, n,
+						lastmod + offset,
+						live + offset, got);
+					policy_test_check(p->policy->name,
+							  level_name[level],
+							  n, offset, got,
+							  want + offset);
+				}
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	int i;
+
+	srand(1);
+	for (i = 0; i < POLICY_TEST_NROUNDS; i++)
+		policy_test_round();
+
+	if (nfailures) {
+		fprintf(stderr, "%d mismatches\n", nfailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
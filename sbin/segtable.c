@@ -0,0 +1,1127 @@
+/*
+ * segtable.c - in-memory segment usage table of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_TIME_H
+#include <time.h>
+#endif	/* HAVE_TIME_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include "nilfs.h"
+#include "util.h"
+#include "nilfs_gc.h"
+#include "cnormap.h"
+#include "segtable.h"
+
+#define NILFS_SEGTABLE_NSUINFO	512	/* entries per GET_SUINFO request */
+#define NILFS_SEGTABLE_NASSESS	256	/* segments per bulk assessment */
+
+/**
+ * struct nilfs_segtable_worker - assessment worker thread
+ * @thread: thread ID
+ * @nilfs: nilfs object private to the worker
+ * @pool: pool the worker belongs to
+ */
+struct nilfs_segtable_worker {
+	pthread_t thread;
+	struct nilfs *nilfs;
+	struct nilfs_segtable_pool *pool;
+};
+
+/**
+ * struct nilfs_segtable_pool - pool of assessment worker threads
+ * @lock: mutex protecting the job and the counters below
+ * @work: condition signaled when a job is posted or the pool stops
+ * @done: condition signaled when the last busy worker becomes idle
+ * @segtable: segment table to be updated by the job
+ * @sustat: status information on segments for the job
+ * @nsegs: number of segments in @segtable->pending for the job
+ * @next: index of the first pending segment not yet taken
+ * @nbusy: number of workers assessing a batch
+ * @stop: flag telling workers to exit
+ * @nworkers: number of workers
+ * @workers: array of workers
+ *
+ * The pending segments are handed out in batches of
+ * NILFS_SEGTABLE_NASSESS.  Each batch writes only the table entries of
+ * its own segments, so the table ends up the same regardless of which
+ * thread assessed which batch and in which order.
+ */
+struct nilfs_segtable_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct nilfs_segtable *segtable;
+	const struct nilfs_sustat *sustat;
+	size_t nsegs;
+	size_t next;
+	int nbusy;
+	int stop;
+	int nworkers;
+	struct nilfs_segtable_worker workers[];
+};
+
+static void nilfs_segtable_stop_workers(struct nilfs_segtable *segtable);
+
+/**
+ * nilfs_segtable_create - create a segment table
+ * @nilfs: nilfs object
+ */
+struct nilfs_segtable *nilfs_segtable_create(struct nilfs *nilfs)
+{
+	struct nilfs_segtable *segtable;
+
+	segtable = malloc(sizeof(*segtable));
+	if (unlikely(segtable == NULL))
+		return NULL;
+
+	memset(segtable, 0, sizeof(*segtable));
+	segtable->nilfs = nilfs;
+	segtable->protcno = NILFS_CNO_MAX;
+	segtable->oldest = NILFS_SEGTABLE_NIL;
+	segtable->newest = NILFS_SEGTABLE_NIL;
+	return segtable;
+}
+
+/**
+ * nilfs_segtable_destroy - destroy a segment table
+ * @segtable: segment table
+ */
+void nilfs_segtable_destroy(struct nilfs_segtable *segtable)
+{
+	if (segtable) {
+		nilfs_segtable_stop_workers(segtable);
+		free(segtable->lastmod);
+		free(segtable->nblocks);
+		free(segtable->flags);
+		free(segtable->live);
+		free(segtable->state);
+		free(segtable->seqnum);
+		free(segtable->stamp);
+		free(segtable->cno);
+		free(segtable->pending);
+		free(segtable->lprev);
+		free(segtable->lnext);
+		free(segtable->aprev);
+		free(segtable->anext);
+		free(segtable->bucket);
+		free(segtable->indexed);
+		free(segtable->heads);
+		free(segtable->birth);
+		free(segtable->btime);
+		free(segtable);
+	}
+}
+
+static int nilfs_segtable_realloc(void **colp, size_t size,
+				  uint64_t oldcap, uint64_t newcap)
+{
+	char *col;
+
+	col = realloc(*colp, size * newcap);
+	if (unlikely(col == NULL))
+		return -1;
+	memset(col + size * oldcap, 0, size * (newcap - oldcap));
+	*colp = col;
+	return 0;
+}
+
+/**
+ * nilfs_segtable_extend - extend columns of a segment table
+ * @segtable: segment table
+ * @nsegs: number of segments to be held
+ *
+ * New entries start in the NILFS_SEGTABLE_LIVE_NONE state, out of the
+ * victim index.  On failure,
+ * the columns that were already extended are kept; they are consistent
+ * because @segtable->capacity is only updated on success.
+ */
+static int nilfs_segtable_extend(struct nilfs_segtable *segtable,
+				 uint64_t nsegs)
+{
+	uint64_t oldcap = segtable->capacity;
+
+	if (nilfs_segtable_realloc((void **)&segtable->lastmod,
+				   sizeof(*segtable->lastmod), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->nblocks,
+				   sizeof(*segtable->nblocks), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->flags,
+				   sizeof(*segtable->flags), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->live,
+				   sizeof(*segtable->live), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->state,
+				   sizeof(*segtable->state), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->seqnum,
+				   sizeof(*segtable->seqnum), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->stamp,
+				   sizeof(*segtable->stamp), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->cno,
+				   sizeof(*segtable->cno), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->pending,
+				   sizeof(*segtable->pending), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->lprev,
+				   sizeof(*segtable->lprev), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->lnext,
+				   sizeof(*segtable->lnext), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->aprev,
+				   sizeof(*segtable->aprev), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->anext,
+				   sizeof(*segtable->anext), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->bucket,
+				   sizeof(*segtable->bucket), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->indexed,
+				   sizeof(*segtable->indexed), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->birth,
+				   sizeof(*segtable->birth), oldcap, nsegs) ||
+	    nilfs_segtable_realloc((void **)&segtable->btime,
+				   sizeof(*segtable->btime), oldcap, nsegs))
+		return -1;
+
+	segtable->capacity = nsegs;
+	return 0;
+}
+
+/**
+ * nilfs_segtable_unlink_live - remove a segment from its live block bucket
+ * @segtable: segment table
+ * @segnum: segment number
+ */
+static void nilfs_segtable_unlink_live(struct nilfs_segtable *segtable,
+				       uint64_t segnum)
+{
+	uint64_t prev = segtable->lprev[segnum];
+	uint64_t next = segtable->lnext[segnum];
+
+	if (prev != NILFS_SEGTABLE_NIL)
+		segtable->lnext[prev] = next;
+	else
+		segtable->heads[segtable->bucket[segnum]] = next;
+	if (next != NILFS_SEGTABLE_NIL)
+		segtable->lprev[next] = prev;
+	segtable->indexed[segnum] &= ~NILFS_SEGTABLE_INDEX_LIVE;
+}
+
+static void nilfs_segtable_link_live(struct nilfs_segtable *segtable,
+				     uint64_t segnum, uint32_t bucket)
+{
+	uint64_t head = segtable->heads[bucket];
+
+	segtable->lprev[segnum] = NILFS_SEGTABLE_NIL;
+	segtable->lnext[segnum] = head;
+	if (head != NILFS_SEGTABLE_NIL)
+		segtable->lprev[head] = segnum;
+	segtable->heads[bucket] = segnum;
+	segtable->bucket[segnum] = bucket;
+	segtable->indexed[segnum] |= NILFS_SEGTABLE_INDEX_LIVE;
+}
+
+/**
+ * nilfs_segtable_unlink_age - remove a segment from the age list
+ * @segtable: segment table
+ * @segnum: segment number
+ */
+static void nilfs_segtable_unlink_age(struct nilfs_segtable *segtable,
+				      uint64_t segnum)
+{
+	uint64_t prev = segtable->aprev[segnum];
+	uint64_t next = segtable->anext[segnum];
+
+	if (prev != NILFS_SEGTABLE_NIL)
+		segtable->anext[prev] = next;
+	else
+		segtable->oldest = next;
+	if (next != NILFS_SEGTABLE_NIL)
+		segtable->aprev[next] = prev;
+	else
+		segtable->newest = prev;
+	segtable->indexed[segnum] &= ~NILFS_SEGTABLE_INDEX_AGE;
+}
+
+/**
+ * nilfs_segtable_link_age - insert a segment into the age list
+ * @segtable: segment table
+ * @segnum: segment number
+ *
+ * The position is searched from the newest end since a segment that
+ * changed has almost always just been written.
+ */
+static void nilfs_segtable_link_age(struct nilfs_segtable *segtable,
+				    uint64_t segnum)
+{
+	int64_t lastmod = segtable->lastmod[segnum];
+	uint64_t prev = segtable->newest, next = NILFS_SEGTABLE_NIL;
+
+	while (prev != NILFS_SEGTABLE_NIL && segtable->lastmod[prev] > lastmod) {
+		next = prev;
+		prev = segtable->aprev[prev];
+	}
+	segtable->aprev[segnum] = prev;
+	segtable->anext[segnum] = next;
+	if (prev != NILFS_SEGTABLE_NIL)
+		segtable->anext[prev] = segnum;
+	else
+		segtable->oldest = segnum;
+	if (next != NILFS_SEGTABLE_NIL)
+		segtable->aprev[next] = segnum;
+	else
+		segtable->newest = segnum;
+	segtable->indexed[segnum] |= NILFS_SEGTABLE_INDEX_AGE;
+}
+
+/**
+ * nilfs_segtable_age_in_order - test if a segment is in place in the age list
+ * @segtable: segment table
+ * @segnum: segment number linked in the age list
+ */
+static int nilfs_segtable_age_in_order(const struct nilfs_segtable *segtable,
+				       uint64_t segnum)
+{
+	uint64_t prev = segtable->aprev[segnum];
+	uint64_t next = segtable->anext[segnum];
+	int64_t lastmod = segtable->lastmod[segnum];
+
+	return (prev == NILFS_SEGTABLE_NIL ||
+		segtable->lastmod[prev] <= lastmod) &&
+		(next == NILFS_SEGTABLE_NIL ||
+		 segtable->lastmod[next] >= lastmod);
+}
+
+/**
+ * nilfs_segtable_reindex - bring a segment up to date in the victim index
+ * @segtable: segment table
+ * @segnum: segment number
+ *
+ * This must be called whenever the usage, the live block count, or the
+ * state of the count of a segment may have changed.  Segments beyond
+ * @segtable->nsegs are dropped from the index.
+ */
+static void nilfs_segtable_reindex(struct nilfs_segtable *segtable,
+				   uint64_t segnum)
+{
+	uint8_t want = 0, have = segtable->indexed[segnum];
+	struct nilfs_suinfo si;
+	uint32_t bucket = 0;
+
+	if (segnum < segtable->nsegs) {
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (nilfs_suinfo_reclaimable(&si))
+			want |= NILFS_SEGTABLE_INDEX_AGE;
+		if (want && (segtable->state[segnum] ==
+			     NILFS_SEGTABLE_LIVE_CACHED ||
+			     segtable->state[segnum] ==
+			     NILFS_SEGTABLE_LIVE_CYCLE)) {
+			want |= NILFS_SEGTABLE_INDEX_LIVE;
+			bucket = min_t(uint32_t, segtable->live[segnum],
+				       segtable->nbuckets - 1);
+		}
+	}
+
+	if ((have & NILFS_SEGTABLE_INDEX_AGE) &&
+	    (!(want & NILFS_SEGTABLE_INDEX_AGE) ||
+	     !nilfs_segtable_age_in_order(segtable, segnum))) {
+		nilfs_segtable_unlink_age(segtable, segnum);
+		have &= ~NILFS_SEGTABLE_INDEX_AGE;
+		segtable->nreindexed++;
+	}
+	if ((have & NILFS_SEGTABLE_INDEX_LIVE) &&
+	    (!(want & NILFS_SEGTABLE_INDEX_LIVE) ||
+	     segtable->bucket[segnum] != bucket)) {
+		nilfs_segtable_unlink_live(segtable, segnum);
+		have &= ~NILFS_SEGTABLE_INDEX_LIVE;
+		segtable->nreindexed++;
+	}
+
+	if ((want & NILFS_SEGTABLE_INDEX_AGE) &&
+	    !(have & NILFS_SEGTABLE_INDEX_AGE))
+		nilfs_segtable_link_age(segtable, segnum);
+	if ((want & NILFS_SEGTABLE_INDEX_LIVE) &&
+	    !(have & NILFS_SEGTABLE_INDEX_LIVE))
+		nilfs_segtable_link_live(segtable, segnum, bucket);
+}
+
+struct nilfs_segtable_agekey {
+	int64_t lastmod;
+	uint64_t segnum;
+};
+
+static int nilfs_segtable_comp_agekey(const void *elem1, const void *elem2)
+{
+	const struct nilfs_segtable_agekey *key1 = elem1, *key2 = elem2;
+
+	if (key1->lastmod != key2->lastmod)
+		return key1->lastmod < key2->lastmod ? -1 : 1;
+	return key1->segnum < key2->segnum ? -1 : 1;
+}
+
+/**
+ * nilfs_segtable_build_index - build the victim index from scratch
+ * @segtable: segment table
+ *
+ * This is done in the first refresh; the age list is built by sorting
+ * instead of inserting segments one by one in the order of segment
+ * numbers.
+ */
+static int nilfs_segtable_build_index(struct nilfs_segtable *segtable)
+{
+	struct nilfs_segtable_agekey *keys;
+	struct nilfs_suinfo si;
+	uint64_t segnum, prev = NILFS_SEGTABLE_NIL;
+	size_t i, n = 0;
+
+	segtable->nbuckets =
+		nilfs_get_blocks_per_segment(segtable->nilfs) + 1;
+	segtable->heads = malloc(sizeof(*segtable->heads) *
+				 segtable->nbuckets);
+	keys = malloc(sizeof(*keys) * max_t(uint64_t, segtable->nsegs, 1));
+	if (unlikely(segtable->heads == NULL || keys == NULL)) {
+		free(segtable->heads);
+		segtable->heads = NULL;
+		free(keys);
+		return -1;
+	}
+	for (i = 0; i < segtable->nbuckets; i++)
+		segtable->heads[i] = NILFS_SEGTABLE_NIL;
+
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (!nilfs_suinfo_reclaimable(&si))
+			continue;
+		keys[n].lastmod = segtable->lastmod[segnum];
+		keys[n].segnum = segnum;
+		n++;
+	}
+	qsort(keys, n, sizeof(*keys), nilfs_segtable_comp_agekey);
+
+	for (i = 0; i < n; i++) {
+		segnum = keys[i].segnum;
+		segtable->aprev[segnum] = prev;
+		segtable->anext[segnum] = NILFS_SEGTABLE_NIL;
+		if (prev != NILFS_SEGTABLE_NIL)
+			segtable->anext[prev] = segnum;
+		else
+			segtable->oldest = segnum;
+		segtable->indexed[segnum] = NILFS_SEGTABLE_INDEX_AGE;
+		prev = segnum;
+	}
+	segtable->newest = prev;
+	free(keys);
+
+	/* add live block counts if any */
+	for (segnum = 0; segnum < segtable->nsegs; segnum++)
+		nilfs_segtable_reindex(segtable, segnum);
+	return 0;
+}
+
+/**
+ * nilfs_segtable_load - load usage of a segment into a segment table
+ * @segtable: segment table
+ * @segnum: segment number
+ * @si: usage information read from the segment usage file
+ *
+ * The cached live block count is dropped if the lastmod or nblocks of
+ * the segment changed, or if the count was only valid in the previous
+ * cycle.
+ *
+ * Return: true if the segment may have to be moved in the victim index.
+ */
+static int nilfs_segtable_load(struct nilfs_segtable *segtable,
+			       uint64_t segnum, const struct nilfs_suinfo *si)
+{
+	int changed;
+
+	changed = segtable->lastmod[segnum] != si->sui_lastmod ||
+		segtable->nblocks[segnum] != si->sui_nblocks;
+	if (segtable->state[segnum] != NILFS_SEGTABLE_LIVE_NONE &&
+	    (changed || segtable->state[segnum] != NILFS_SEGTABLE_LIVE_CACHED)) {
+		segtable->state[segnum] = NILFS_SEGTABLE_LIVE_NONE;
+		changed = 1;
+	}
+	if (segtable->flags[segnum] != si->sui_flags)
+		changed = 1;
+	segtable->lastmod[segnum] = si->sui_lastmod;
+	segtable->nblocks[segnum] = si->sui_nblocks;
+	segtable->flags[segnum] = si->sui_flags;
+	return changed;
+}
+
+/**
+ * nilfs_segtable_refresh - reload segment usage into a segment table
+ * @segtable: segment table
+ * @sustat: status information on segments
+ *
+ * This sweeps the segment usage file once.  Cached live block counts
+ * of segments whose lastmod or nblocks changed are dropped, and so are
+ * the counts that were only valid in the previous cycle.  Segments
+ * whose usage or count changed are moved in the victim index.
+ */
+int nilfs_segtable_refresh(struct nilfs_segtable *segtable,
+			   const struct nilfs_sustat *sustat)
+{
+	struct nilfs_suinfo si[NILFS_SEGTABLE_NSUINFO];
+	uint64_t segnum, nsegs = sustat->ss_nsegs, oldnsegs;
+	int indexed = segtable->heads != NULL;
+	size_t count;
+	ssize_t n;
+	int i, ret;
+
+	if (nsegs > segtable->capacity) {
+		ret = nilfs_segtable_extend(segtable, nsegs);
+		if (unlikely(ret < 0))
+			return -1;
+	}
+
+	segtable->nreindexed = 0;
+	for (segnum = 0; segnum < nsegs; segnum += n) {
+		count = min_t(uint64_t, nsegs - segnum,
+			      NILFS_SEGTABLE_NSUINFO);
+		n = nilfs_get_suinfo(segtable->nilfs, segnum, si, count);
+		if (unlikely(n < 0))
+			return -1;
+		if (unlikely(n == 0))
+			break;
+
+		for (i = 0; i < n; i++) {
+			uint64_t j = segnum + i;
+
+			if (nilfs_segtable_load(segtable, j, &si[i]) &&
+			    indexed && j < segtable->nsegs)
+				nilfs_segtable_reindex(segtable, j);
+		}
+	}
+
+	/* forget segments cut off by shrinking the file system */
+	oldnsegs = segtable->nsegs;
+	segtable->nsegs = segnum;
+	if (segnum < oldnsegs)
+		memset(&segtable->state[segnum], NILFS_SEGTABLE_LIVE_NONE,
+		       oldnsegs - segnum);
+
+	if (!indexed)
+		return nilfs_segtable_build_index(segtable);
+
+	/* index segments cut off, or added by growing the file system */
+	for (segnum = min_t(uint64_t, segnum, oldnsegs);
+	     segnum < max_t(uint64_t, segtable->nsegs, oldnsegs); segnum++)
+		nilfs_segtable_reindex(segtable, segnum);
+	return 0;
+}
+
+/**
+ * nilfs_segtable_refresh_of - reload usage of some segments
+ * @segtable: segment table
+ * @segnums: array of distinct segment numbers in ascending order
+ * @nsegs: number of segments in @segnums
+ *
+ * This is nilfs_segtable_refresh() limited to the given segments, for
+ * callers that only look at a sample of them; consecutive segments are
+ * read with a single request.  The entries of the other segments are
+ * left as they were at the last full refresh, including counts that
+ * were only valid in an earlier cycle, so they must not be relied on
+ * until the next one.  Segments beyond the table are ignored; the
+ * table must have been refreshed in full at least once.
+ */
+int nilfs_segtable_refresh_of(struct nilfs_segtable *segtable,
+			      const uint64_t *segnums, size_t nsegs)
+{
+	struct nilfs_suinfo si[NILFS_SEGTABLE_NSUINFO];
+	uint64_t segnum;
+	size_t i, count;
+	ssize_t n, j;
+
+	if (unlikely(segtable->heads == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	segtable->nreindexed = 0;
+	for (i = 0; i < nsegs; i += count) {
+		segnum = segnums[i];
+		count = 1;
+		if (segnum >= segtable->nsegs)
+			continue;
+		while (i + count < nsegs && count < NILFS_SEGTABLE_NSUINFO &&
+		       segnums[i + count] == segnum + count &&
+		       segnum + count < segtable->nsegs)
+			count++;
+
+		n = nilfs_get_suinfo(segtable->nilfs, segnum, si, count);
+		if (unlikely(n < 0))
+			return -1;
+		for (j = 0; j < n; j++) {
+			if (nilfs_segtable_load(segtable, segnum + j, &si[j]))
+				nilfs_segtable_reindex(segtable, segnum + j);
+		}
+	}
+	return 0;
+}
+
+/**
+ * nilfs_segtable_live_valid - test if a cached live block count holds
+ * @segtable: segment table
+ * @segnum: segment number
+ *
+ * A count is evaluated against the protection checkpoint of the cycle
+ * in which it was assessed.  Blocks that were already dead but still
+ * protected then are counted as live, and so are blocks that died
+ * after the assessment.  The count stays exact as long as all of them
+ * are still protected, that is, while the current protection
+ * checkpoint is smaller than both the earliest end checkpoint of the
+ * former and the latest checkpoint number at the assessment.  The
+ * smaller of the two is recorded in @segtable->cno.
+ *
+ * Reading the sequence number costs an I/O, so it is only compared
+ * when the segment may have been rewritten within the second the
+ * assessment started; otherwise an unchanged lastmod already proves
+ * that no log was written to the segment since then.
+ */
+static int nilfs_segtable_live_valid(struct nilfs_segtable *segtable,
+				     uint64_t segnum)
+{
+	uint64_t seqnum;
+
+	if (segtable->protcno >= segtable->cno[segnum])
+		return 0;
+
+	if (segtable->lastmod[segnum] < segtable->stamp[segnum] ||
+	    segtable->nblocks[segnum] == 0)
+		return 1;
+
+	if (nilfs_get_segment_seqnum(segtable->nilfs, segnum, &seqnum) < 0)
+		return 0;
+	return seqnum == segtable->seqnum[segnum];
+}
+
+static void nilfs_segtable_set_live(struct nilfs_segtable *segtable,
+				    uint64_t segnum, uint64_t seqnum,
+				    const struct nilfs_reclaim_stat *stat,
+				    const struct nilfs_assess_info *info)
+{
+	segtable->live[segnum] = stat->live_blks;
+	segtable->birth[segnum] = (info->flags & NILFS_ASSESS_INFO_BIRTH) ?
+		info->birth_cno : 0;
+	segtable->btime[segnum] = NILFS_SEGTABLE_NOTIME;
+	if (stat->cleaned_segs == 0) {
+		/*
+		 * The segment was deselected because it is in the
+		 * protected region; this depends on ss_prot_seq rather
+		 * than the segment itself, so keep it for this cycle only.
+		 */
+		segtable->state[segnum] = NILFS_SEGTABLE_LIVE_CYCLE;
+		return;
+	}
+	segtable->state[segnum] = NILFS_SEGTABLE_LIVE_CACHED;
+	segtable->seqnum[segnum] = seqnum;
+	segtable->stamp[segnum] = segtable->now;
+	segtable->cno[segnum] = segtable->curcno;
+	if ((info->flags & NILFS_ASSESS_INFO_EXPIRE) &&
+	    info->expire_cno < segtable->curcno)
+		segtable->cno[segnum] = info->expire_cno;
+}
+
+/**
+ * nilfs_segtable_assess - assess a batch of segments
+ * @segtable: segment table
+ * @nilfs: nilfs object used by the calling thread
+ * @sustat: status information on segments
+ * @segnums: array of segment numbers
+ * @nsegs: size of @segnums array (NILFS_SEGTABLE_NASSESS at most)
+ *
+ * The batch is assessed with a single bulk request.  If it fails, the
+ * segments are assessed one by one so that a broken segment does not
+ * hide the others; segments that still fail are marked erroneous for
+ * this cycle.  Only the entries of @segnums are written, so batches of
+ * disjoint segments can be assessed concurrently.
+ */
+static void nilfs_segtable_assess(struct nilfs_segtable *segtable,
+				  struct nilfs *nilfs,
+				  const struct nilfs_sustat *sustat,
+				  uint64_t *segnums, size_t nsegs)
+{
+	struct nilfs_reclaim_stat stats[NILFS_SEGTABLE_NASSESS];
+	struct nilfs_assess_info infos[NILFS_SEGTABLE_NASSESS];
+	struct nilfs_reclaim_params params;
+	uint64_t seqnums[NILFS_SEGTABLE_NASSESS];
+	size_t i, n = 0;
+	int ret;
+
+	for (i = 0; i < nsegs; i++) {
+		seqnums[n] = 0;
+		if (segtable->nblocks[segnums[i]] != 0 &&
+		    nilfs_get_segment_seqnum(nilfs, segnums[i],
+					     &seqnums[n]) < 0) {
+			segtable->state[segnums[i]] = NILFS_SEGTABLE_LIVE_ERROR;
+			continue;
+		}
+		segnums[n++] = segnums[i];
+	}
+	if (n == 0)
+		return;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = NILFS_RECLAIM_PARAM_PROTSEQ | NILFS_RECLAIM_PARAM_PROTCNO;
+	params.protseq = sustat->ss_prot_seq;
+	params.protcno = segtable->protcno;
+	if (segtable->sumcache) {
+		params.flags |= NILFS_RECLAIM_PARAM_SUMCACHE;
+		params.sumcache = segtable->sumcache;
+	}
+
+	ret = nilfs_xassess_segments_nolock(nilfs, segnums, n, &params,
+					    stats, infos);
+	if (likely(ret == 0)) {
+		for (i = 0; i < n; i++)
+			nilfs_segtable_set_live(segtable, segnums[i],
+						seqnums[i], &stats[i],
+						&infos[i]);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		ret = nilfs_xassess_segments_nolock(nilfs, &segnums[i], 1,
+						    &params, &stats[i],
+						    &infos[i]);
+		if (unlikely(ret < 0)) {
+			syslog(LOG_ERR, "cannot assess segment %llu: %m",
+			       (unsigned long long)segnums[i]);
+			segtable->state[segnums[i]] = NILFS_SEGTABLE_LIVE_ERROR;
+			continue;
+		}
+		nilfs_segtable_set_live(segtable, segnums[i], seqnums[i],
+					&stats[i], &infos[i]);
+	}
+}
+
+/**
+ * nilfs_segtable_pool_take - take the next batch of the posted job
+ * @pool: worker pool (locked)
+ * @start: place to store the index of the batch in the pending array
+ *
+ * Return: number of segments in the batch, or 0 if nothing is left.
+ */
+static size_t nilfs_segtable_pool_take(struct nilfs_segtable_pool *pool,
+				       size_t *start)
+{
+	size_t count;
+
+	if (pool->next >= pool->nsegs)
+		return 0;
+	count = min_t(size_t, pool->nsegs - pool->next,
+		      NILFS_SEGTABLE_NASSESS);
+	*start = pool->next;
+	pool->next += count;
+	return count;
+}
+
+static void *nilfs_segtable_worker_main(void *arg)
+{
+	struct nilfs_segtable_worker *worker = arg;
+	struct nilfs_segtable_pool *pool = worker->pool;
+	size_t start, count;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stop &&
+		       (count = nilfs_segtable_pool_take(pool, &start)) == 0)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->stop)
+			break;
+
+		pool->nbusy++;
+		pthread_mutex_unlock(&pool->lock);
+
+		nilfs_segtable_assess(pool->segtable, worker->nilfs,
+				      pool->sustat,
+				      &pool->segtable->pending[start], count);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->nbusy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/**
+ * nilfs_segtable_stop_workers - stop and free the worker pool
+ * @segtable: segment table
+ */
+static void nilfs_segtable_stop_workers(struct nilfs_segtable *segtable)
+{
+	struct nilfs_segtable_pool *pool = segtable->pool;
+	int i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nworkers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		nilfs_close(pool->workers[i].nilfs);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	segtable->pool = NULL;
+}
+
+/**
+ * nilfs_segtable_set_threads - set the number of assessing threads
+ * @segtable: segment table
+ * @nthreads: number of threads including the calling one
+ *
+ * The calling thread always takes part in assessments; @nthreads - 1
+ * worker threads are started to help it, each with a nilfs object of
+ * its own so that their ioctls and segment reads do not share a file
+ * descriptor.  Options of the nilfs object of @segtable are copied to
+ * the workers.  If some workers cannot be started, the pool runs with
+ * the ones that could.
+ */
+int nilfs_segtable_set_threads(struct nilfs_segtable *segtable,
+			       int nthreads)
+{
+	struct nilfs_segtable_pool *pool = segtable->pool;
+	const char *dev = nilfs_get_dev(segtable->nilfs);
+	const char *dir = nilfs_get_root_path(segtable->nilfs);
+	struct nilfs_segtable_worker *worker;
+	sigset_t sigset, oldset;
+	int i, ret = 0;
+
+	if (pool && pool->nworkers == nthreads - 1)
+		goto sync_opts;
+
+	nilfs_segtable_stop_workers(segtable);
+	if (nthreads <= 1)
+		return 0;
+
+	pool = malloc(sizeof(*pool) + sizeof(pool->workers[0]) * (nthreads - 1));
+	if (unlikely(pool == NULL))
+		return -1;
+
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->segtable = segtable;
+
+	/* signals are handled by the main thread only */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &oldset);
+
+	for (i = 0; i < nthreads - 1; i++) {
+		worker = &pool->workers[pool->nworkers];
+		worker->pool = pool;
+		worker->nilfs = nilfs_open(dev, dir,
+					   NILFS_OPEN_RAW | NILFS_OPEN_RDONLY |
+					   NILFS_OPEN_GCLK);
+		if (unlikely(worker->nilfs == NULL)) {
+			syslog(LOG_ERR, "cannot open nilfs for worker: %m");
+			ret = -1;
+			break;
+		}
+		errno = pthread_create(&worker->thread, NULL,
+				       nilfs_segtable_worker_main, worker);
+		if (unlikely(errno != 0)) {
+			syslog(LOG_ERR, "cannot create worker thread: %m");
+			nilfs_close(worker->nilfs);
+			ret = -1;
+			break;
+		}
+		pool->nworkers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (pool->nworkers == 0) {
+		pthread_cond_destroy(&pool->done);
+		pthread_cond_destroy(&pool->work);
+		pthread_mutex_destroy(&pool->lock);
+		free(pool);
+		return -1;
+	}
+	segtable->pool = pool;
+
+sync_opts:
+	for (i = 0; i < pool->nworkers; i++) {
+		worker = &pool->workers[i];
+		nilfs_copy_options(worker->nilfs, segtable->nilfs);
+	}
+	return ret;
+}
+
+/**
+ * nilfs_segtable_assess_pending - assess all pending segments
+ * @segtable: segment table
+ * @sustat: status information on segments
+ * @nsegs: number of segments in @segtable->pending
+ *
+ * The batches are shared out among the calling thread and the workers,
+ * and this returns once every batch has been assessed.
+ */
+static void nilfs_segtable_assess_pending(struct nilfs_segtable *segtable,
+					  const struct nilfs_sustat *sustat,
+					  size_t nsegs)
+{
+	struct nilfs_segtable_pool *pool = segtable->pool;
+	size_t start, count;
+
+	if (pool == NULL || nsegs <= NILFS_SEGTABLE_NASSESS) {
+		for (start = 0; start < nsegs; start += count) {
+			count = min_t(size_t, nsegs - start,
+				      NILFS_SEGTABLE_NASSESS);
+			nilfs_segtable_assess(segtable, segtable->nilfs, sustat,
+					      &segtable->pending[start], count);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->sustat = sustat;
+	pool->nsegs = nsegs;
+	pool->next = 0;
+	pthread_cond_broadcast(&pool->work);
+
+	while ((count = nilfs_segtable_pool_take(pool, &start)) > 0) {
+		pthread_mutex_unlock(&pool->lock);
+		nilfs_segtable_assess(segtable, segtable->nilfs, sustat,
+				      &segtable->pending[start], count);
+		pthread_mutex_lock(&pool->lock);
+	}
+	while (pool->nbusy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	pool->nsegs = 0;
+	pool->next = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * nilfs_segtable_do_update_live - bring live block counts up to date
+ * @segtable: segment table
+ * @sustat: status information on segments
+ * @protcno: start number of checkpoint to be protected
+ * @segnums: segments to be brought up to date, or NULL for all
+ * @nsegs: number of segments in @segnums
+ */
+static int nilfs_segtable_do_update_live(struct nilfs_segtable *segtable,
+					 const struct nilfs_sustat *sustat,
+					 nilfs_cno_t protcno,
+					 const uint64_t *segnums, size_t nsegs)
+{
+	struct nilfs_cpstat cpstat;
+	struct nilfs_suinfo si;
+	struct timespec ts;
+	uint64_t segnum;
+	size_t i, n = 0;
+	int ret;
+
+	ret = nilfs_get_cpstat(segtable->nilfs, &cpstat);
+	if (unlikely(ret < 0))
+		return -1;
+
+	ret = clock_gettime(CLOCK_REALTIME, &ts);
+	if (unlikely(ret < 0))
+		return -1;
+
+	if (cpstat.cs_nsss != segtable->nsss) {
+		for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+			if (segtable->state[segnum] !=
+			    NILFS_SEGTABLE_LIVE_CACHED)
+				continue;
+			segtable->state[segnum] = NILFS_SEGTABLE_LIVE_NONE;
+			nilfs_segtable_reindex(segtable, segnum);
+		}
+	}
+
+	segtable->protcno = protcno;
+	segtable->curcno = cpstat.cs_cno;
+	segtable->nsss = cpstat.cs_nsss;
+	segtable->now = ts.tv_sec;
+	segtable->nhits = 0;
+
+	if (segnums == NULL)
+		nsegs = segtable->nsegs;
+	for (i = 0; i < nsegs; i++) {
+		segnum = segnums ? segnums[i] : i;
+		if (unlikely(segnum >= segtable->nsegs))
+			continue;
+
+		nilfs_segtable_get_suinfo(segtable, segnum, &si);
+		if (!nilfs_suinfo_reclaimable(&si))
+			continue;
+
+		if (segtable->state[segnum] == NILFS_SEGTABLE_LIVE_CACHED) {
+			if (nilfs_segtable_live_valid(segtable, segnum)) {
+				segtable->nhits++;
+				continue;
+			}
+			segtable->state[segnum] = NILFS_SEGTABLE_LIVE_NONE;
+			nilfs_segtable_reindex(segtable, segnum);
+		} else if (segtable->state[segnum] !=
+			   NILFS_SEGTABLE_LIVE_NONE) {
+			continue;	/* already assessed in this cycle */
+		}
+
+		segtable->pending[n++] = segnum;
+	}
+	segtable->nassessed = n;
+	nilfs_segtable_assess_pending(segtable, sustat, n);
+
+	/* the workers do not touch the index; file the new counts here */
+	for (i = 0; i < n; i++)
+		nilfs_segtable_reindex(segtable, segtable->pending[i]);
+
+	syslog(LOG_DEBUG, "segment table: %lu live counts reused, %lu assessed",
+	       segtable->nhits, segtable->nassessed);
+	syslog(LOG_DEBUG, "segment table: %lu index entries moved",
+	       segtable->nreindexed);
+	return 0;
+}
+
+/**
+ * nilfs_segtable_update_live - bring live block counts up to date
+ * @segtable: segment table
+ * @sustat: status information on segments
+ * @protcno: start number of checkpoint to be protected
+ *
+ * This assesses every reclaimable segment whose cached live block
+ * count is missing or no longer valid, in bulk, so that a steady-state
+ * cycle only costs assessments of the segments that changed.  Since a
+ * change in the set of snapshots can revive or kill blocks anywhere,
+ * all cached counts are dropped when the number of snapshots changes.
+ * The assessments are spread over the worker threads if any.
+ */
+int nilfs_segtable_update_live(struct nilfs_segtable *segtable,
+			       const struct nilfs_sustat *sustat,
+			       nilfs_cno_t protcno)
+{
+	return nilfs_segtable_do_update_live(segtable, sustat, protcno,
+					     NULL, 0);
+}
+
+/**
+ * nilfs_segtable_update_live_of - bring live block counts of segments
+ *                                 up to date
+ * @segtable: segment table
+ * @sustat: status information on segments
+ * @protcno: start number of checkpoint to be protected
+ * @segnums: array of distinct segment numbers
+ * @nsegs: number of segments in @segnums
+ *
+ * This is nilfs_segtable_update_live() limited to the given segments,
+ * for callers that only look at a sample of them.  Counts of the other
+ * segments are left as they are, and may be unknown in this cycle.
+ */
+int nilfs_segtable_update_live_of(struct nilfs_segtable *segtable,
+				  const struct nilfs_sustat *sustat,
+				  nilfs_cno_t protcno,
+				  const uint64_t *segnums, size_t nsegs)
+{
+	return nilfs_segtable_do_update_live(segtable, sustat, protcno,
+					     segnums, nsegs);
+}
+
+/**
+ * nilfs_segtable_get_live - get the number of live blocks in a segment
+ * @segtable: segment table
+ * @segnum: segment number
+ * @live_blocks: place to store the number of live blocks
+ *
+ * Return: 1 if @live_blocks was set, 0 if the segment is not
+ * reclaimable, or -1 if the count is not available in this cycle.
+ */
+int nilfs_segtable_get_live(const struct nilfs_segtable *segtable,
+			    uint64_t segnum, ssize_t *live_blocks)
+{
+	struct nilfs_suinfo si;
+
+	if (unlikely(segnum >= segtable->nsegs)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nilfs_segtable_get_suinfo(segtable, segnum, &si);
+	if (!nilfs_suinfo_reclaimable(&si))
+		return 0;
+
+	switch (segtable->state[segnum]) {
+	case NILFS_SEGTABLE_LIVE_CACHED:
+	case NILFS_SEGTABLE_LIVE_CYCLE:
+		*live_blocks = segtable->live[segnum];
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * nilfs_segtable_get_birth - get the birth time of data in a segment
+ * @segtable: segment table
+ * @cnormap: checkpoint number mapper
+ * @segnum: segment number
+ * @timep: place to store the time
+ *
+ * The birth time is the creation time of the mean birth checkpoint of
+ * the live blocks found by the last assessment.  Unlike lastmod, it is
+ * not reset when the segment is filled by the cleaner or deferred, so
+ * it tells how old the data really is.  The checkpoint is mapped to a
+ * time on the first call and cached until the segment is assessed
+ * again.  Segments without live virtual blocks fall back to lastmod.
+ *
+ * Return: 1 if @timep was set, 0 if the segment is not reclaimable, or
+ * -1 if its live blocks are not known in this cycle.
+ */
+int nilfs_segtable_get_birth(struct nilfs_segtable *segtable,
+			     struct nilfs_cnormap *cnormap, uint64_t segnum,
+			     int64_t *timep)
+{
+	ssize_t live_blocks;
+	int ret;
+
+	ret = nilfs_segtable_get_live(segtable, segnum, &live_blocks);
+	if (ret <= 0)
+		return ret;
+
+	if (segtable->birth[segnum] == 0) {
+		*timep = segtable->lastmod[segnum];
+		return 1;
+	}
+	if (segtable->btime[segnum] == NILFS_SEGTABLE_NOTIME) {
+		if (unlikely(nilfs_cnormap_cno_to_time(
+				     cnormap, segtable->birth[segnum],
+				     &segtable->btime[segnum]) < 0)) {
+			segtable->btime[segnum] = NILFS_SEGTABLE_NOTIME;
+			*timep = segtable->lastmod[segnum];
+			return 1;
+		}
+	}
+	*timep = segtable->btime[segnum];
+	return 1;
+}
@@ -0,0 +1,202 @@
+/*
+ * segtable.h - in-memory segment usage table of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef NILFS_SEGTABLE_H
+#define NILFS_SEGTABLE_H
+
+#include <stdint.h>	/* uint64_t */
+#include <string.h>	/* memset */
+#include <sys/types.h>	/* ssize_t */
+#include "nilfs.h"	/* nilfs_cno_t, struct nilfs */
+
+struct nilfs_sumcache;
+struct nilfs_segtable_pool;
+struct nilfs_cnormap;
+
+/* states of the cached live block count (live[]) */
+enum {
+	NILFS_SEGTABLE_LIVE_NONE = 0,	/* not assessed or stale */
+	NILFS_SEGTABLE_LIVE_CACHED,	/* valid while its key holds */
+	NILFS_SEGTABLE_LIVE_CYCLE,	/* valid only in the current cycle */
+	NILFS_SEGTABLE_LIVE_ERROR,	/* assessment failed in this cycle */
+};
+
+/* lists of the victim index a segment is linked in (indexed[]) */
+enum {
+	NILFS_SEGTABLE_INDEX_AGE = 0x01,	/* reclaimable segments */
+	NILFS_SEGTABLE_INDEX_LIVE = 0x02,	/* ... with a live count */
+};
+
+#define NILFS_SEGTABLE_NIL	UINT64_MAX	/* end of an index list */
+#define NILFS_SEGTABLE_NOTIME	INT64_MIN	/* birth time not mapped yet */
+
+/**
+ * struct nilfs_segtable - columnar copy of the segment usage file
+ * @nilfs: nilfs object
+ * @nsegs: number of valid entries in the columns
+ * @capacity: number of allocated entries in the columns
+ * @lastmod: sui_lastmod of each segment
+ * @nblocks: sui_nblocks of each segment
+ * @flags: sui_flags of each segment
+ * @live: cached number of live blocks of each segment
+ * @state: state of @live (NILFS_SEGTABLE_LIVE_*)
+ * @seqnum: sequence number of each segment at the assessment
+ * @stamp: wall clock time taken before the assessment of each segment
+ * @cno: checkpoint number up to which the protection checkpoint may
+ * advance before the live block count of each segment goes stale
+ * @pending: segment numbers to be assessed in this cycle
+ * @pool: pool of assessment worker threads (NULL if not used)
+ * @sumcache: cache of parsed segment summaries (NULL if not used)
+ * @protcno: start number of checkpoint to be protected in this cycle
+ * @curcno: latest checkpoint number seen in this cycle
+ * @nsss: number of snapshots seen in this cycle
+ * @now: wall clock time at the beginning of this cycle
+ * @nhits: number of live block counts reused in this cycle
+ * @nassessed: number of segments assessed in this cycle
+ * @lprev: previous segment in the live block bucket of each segment
+ * @lnext: next segment in the live block bucket of each segment
+ * @aprev: next older segment in the age list
+ * @anext: next newer segment in the age list
+ * @bucket: live block bucket each segment is linked in
+ * @indexed: index lists each segment is linked in (NILFS_SEGTABLE_INDEX_*)
+ * @heads: first segment of each live block bucket
+ * @nbuckets: number of live block buckets (blocks per segment + 1)
+ * @oldest: first segment of the age list
+ * @newest: last segment of the age list
+ * @nreindexed: number of segments moved in the victim index this cycle
+ * @birth: mean birth checkpoint of the live blocks of each segment, or 0
+ * if unknown; cached along with @live
+ * @btime: creation time of @birth, or NILFS_SEGTABLE_NOTIME until it is
+ * looked up with nilfs_segtable_get_birth()
+ *
+ * The table is refreshed with a single sweep of the segment usage file
+ * per cleaning cycle and shared by the segment selection, the policies,
+ * manual mode counting, and logging.  @lastmod, @nblocks and @seqnum
+ * key the cached live block counts, while @stamp and @cno bound their
+ * validity; see nilfs_segtable_update_live().
+ *
+ * The table also keeps a victim index across cycles: reclaimable
+ * segments are linked in the age list in the order of lastmod, and
+ * those with a live block count in the bucket of that count.  Only
+ * segments whose usage or count changed are moved, so selection can
+ * walk the index from the most promising end instead of scoring every
+ * segment; see the walk field of struct nilfs_cleaning_policy.
+ */
+struct nilfs_segtable {
+	struct nilfs *nilfs;
+	uint64_t nsegs;
+	uint64_t capacity;
+	int64_t *lastmod;
+	uint32_t *nblocks;
+	uint32_t *flags;
+	uint32_t *live;
+	uint8_t *state;
+	uint64_t *seqnum;
+	int64_t *stamp;
+	nilfs_cno_t *cno;
+	uint64_t *pending;
+	struct nilfs_segtable_pool *pool;
+	struct nilfs_sumcache *sumcache;
+	nilfs_cno_t protcno;
+	nilfs_cno_t curcno;
+	uint64_t nsss;
+	int64_t now;
+	unsigned long nhits;
+	unsigned long nassessed;
+	uint64_t *lprev;
+	uint64_t *lnext;
+	uint64_t *aprev;
+	uint64_t *anext;
+	uint32_t *bucket;
+	uint8_t *indexed;
+	uint64_t *heads;
+	uint32_t nbuckets;
+	uint64_t oldest;
+	uint64_t newest;
+	unsigned long nreindexed;
+	nilfs_cno_t *birth;
+	int64_t *btime;
+};
+
+struct nilfs_segtable *nilfs_segtable_create(struct nilfs *nilfs);
+void nilfs_segtable_destroy(struct nilfs_segtable *segtable);
+int nilfs_segtable_set_threads(struct nilfs_segtable *segtable,
+			       int nthreads);
+int nilfs_segtable_refresh(struct nilfs_segtable *segtable,
+			   const struct nilfs_sustat *sustat);
+int nilfs_segtable_refresh_of(struct nilfs_segtable *segtable,
+			      const uint64_t *segnums, size_t nsegs);
+int nilfs_segtable_update_live(struct nilfs_segtable *segtable,
+			       const struct nilfs_sustat *sustat,
+			       nilfs_cno_t protcno);
+int nilfs_segtable_update_live_of(struct nilfs_segtable *segtable,
+				  const struct nilfs_sustat *sustat,
+				  nilfs_cno_t protcno,
+				  const uint64_t *segnums, size_t nsegs);
+int nilfs_segtable_get_live(const struct nilfs_segtable *segtable,
+			    uint64_t segnum, ssize_t *live_blocks);
+int nilfs_segtable_get_birth(struct nilfs_segtable *segtable,
+			     struct nilfs_cnormap *cnormap, uint64_t segnum,
+			     int64_t *timep);
+
+/**
+ * nilfs_segtable_get_suinfo - reconstruct usage information of a segment
+ * @segtable: segment table
+ * @segnum: segment number
+ * @si: buffer to store the usage information
+ */
+static inline void
+nilfs_segtable_get_suinfo(const struct nilfs_segtable *segtable,
+			  uint64_t segnum, struct nilfs_suinfo *si)
+{
+	memset(si, 0, sizeof(*si));
+	si->sui_lastmod = segtable->lastmod[segnum];
+	si->sui_nblocks = segtable->nblocks[segnum];
+	si->sui_flags = segtable->flags[segnum];
+}
+
+/**
+ * nilfs_segtable_live_next - walk the victim index by live blocks
+ * @segtable: segment table
+ * @segnum: current segment, or NILFS_SEGTABLE_NIL to start the walk
+ *
+ * Segments with a live block count are visited from the fewest live
+ * blocks to the most.
+ *
+ * Return: the next segment, or NILFS_SEGTABLE_NIL at the end.
+ */
+static inline uint64_t
+nilfs_segtable_live_next(const struct nilfs_segtable *segtable,
+			 uint64_t segnum)
+{
+	uint32_t i = 0;
+
+	if (segnum != NILFS_SEGTABLE_NIL) {
+		if (segtable->lnext[segnum] != NILFS_SEGTABLE_NIL)
+			return segtable->lnext[segnum];
+		i = segtable->bucket[segnum] + 1;
+	}
+	for ( ; i < segtable->nbuckets; i++)
+		if (segtable->heads[i] != NILFS_SEGTABLE_NIL)
+			return segtable->heads[i];
+	return NILFS_SEGTABLE_NIL;
+}
+
+/**
+ * nilfs_segtable_oldest_lastmod - get the earliest lastmod of segments
+ * @segtable: segment table
+ * @nulltime: value returned if no segment is reclaimable
+ */
+static inline int64_t
+nilfs_segtable_oldest_lastmod(const struct nilfs_segtable *segtable,
+			      int64_t nulltime)
+{
+	return segtable->oldest == NILFS_SEGTABLE_NIL ? nulltime :
+		segtable->lastmod[segtable->oldest];
+}
+
+#endif /* NILFS_SEGTABLE_H */
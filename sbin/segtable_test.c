@@ -0,0 +1,740 @@
+/*
+ * segtable_test.c - check the victim index of the segment table
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ *
+ * The segment table is driven through many cycles against a fake
+ * segment usage file whose segments are rewritten, resized, freed,
+ * activated, broken and assessed at random.  After each step, every
+ * segment must be linked in exactly the index lists its usage and live
+ * block count call for, in order, and the walks of the policies must
+ * select the same victims as scoring every segment.
+ */
+
+#include "segtable.c"
+#include "policies/nilfs_policy_timestamp.c"
+#include "policies/nilfs_policy_greedy.c"
+#include "policies/nilfs_policy_cost_benefit.c"
+#include "policies/nilfs_cleaning_policy.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SEGTABLE_TEST_BPS	64	/* blocks per segment */
+#define SEGTABLE_TEST_MAXSEGS	3000
+#define SEGTABLE_TEST_NCYCLES	150
+#define SEGTABLE_TEST_NSAMPLE	100
+#define SEGTABLE_TEST_T0	1700000000	/* "now" of the policies */
+
+/* what the fake assessment does with a segment in this cycle */
+enum {
+	SEGTABLE_TEST_FINE = 0,
+	SEGTABLE_TEST_PROTECTED,	/* deselected, counted for the cycle */
+	SEGTABLE_TEST_BROKEN,		/* assessment fails */
+};
+
+/* the fake segment usage file and what lies behind it */
+static struct nilfs_suinfo segtable_test_su[SEGTABLE_TEST_MAXSEGS];
+static uint64_t segtable_test_seqnum[SEGTABLE_TEST_MAXSEGS];
+static uint32_t segtable_test_live[SEGTABLE_TEST_MAXSEGS];
+static uint8_t segtable_test_fate[SEGTABLE_TEST_MAXSEGS];
+static uint8_t segtable_test_touched[SEGTABLE_TEST_MAXSEGS];
+static uint64_t segtable_test_nsegs;
+static struct nilfs_cpstat segtable_test_cpstat;
+static nilfs_cno_t segtable_test_protcno;
+
+static int nfailures;
+
+#define SEGTABLE_TEST_FAIL(fmt, ...)					\
+	do {								\
+		if (nfailures++ < 20)					\
+			fprintf(stderr, "cycle %d: " fmt "\n", cycle,	\
+				##__VA_ARGS__);				\
+	} while (0)
+
+static int cycle;
+
+ssize_t nilfs_get_suinfo(const struct nilfs *nilfs, uint64_t segnum,
+			 struct nilfs_suinfo *suinfo, size_t nsi)
+{
+	size_t n;
+
+	if (segnum >= segtable_test_nsegs)
+		return 0;
+	n = min_t(uint64_t, nsi, segtable_test_nsegs - segnum);
+	memcpy(suinfo, &segtable_test_su[segnum], sizeof(*suinfo) * n);
+	return n;
+}
+
+uint32_t nilfs_get_blocks_per_segment(const struct nilfs *nilfs)
+{
+	return SEGTABLE_TEST_BPS;
+}
+
+int nilfs_get_segment_seqnum(const struct nilfs *nilfs, uint64_t segnum,
+			     uint64_t *seqnum)
+{
+	*seqnum = segtable_test_seqnum[segnum];
+	return 0;
+}
+
+int nilfs_get_cpstat(const struct nilfs *nilfs, struct nilfs_cpstat *cpstat)
+{
+	*cpstat = segtable_test_cpstat;
+	return 0;
+}
+
+int nilfs_xassess_segments_nolock(struct nilfs *nilfs,
+				  const uint64_t *segnums, size_t nsegs,
+				  const struct nilfs_reclaim_params *params,
+				  struct nilfs_reclaim_stat *stats,
+				  struct nilfs_assess_info *infos)
+{
+	uint64_t segnum;
+	size_t i;
+
+	for (i = 0; i < nsegs; i++) {
+		if (segtable_test_fate[segnums[i]] == SEGTABLE_TEST_BROKEN) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	for (i = 0; i < nsegs; i++) {
+		segnum = segnums[i];
+		memset(&stats[i], 0, sizeof(stats[i]));
+		memset(&infos[i], 0, sizeof(infos[i]));
+		stats[i].live_blks = segtable_test_live[segnum];
+		stats[i].cleaned_segs = segtable_test_fate[segnum] !=
+			SEGTABLE_TEST_PROTECTED;
+		if (segnum % 7 == 0) {
+			/* protected dead blocks that expire later on */
+			infos[i].flags = NILFS_ASSESS_INFO_EXPIRE;
+			infos[i].expire_cno = params->protcno + 1 + rand() % 20;
+		}
+	}
+	return 0;
+}
+
+int nilfs_cnormap_cno_to_time(struct nilfs_cnormap *cnormap, nilfs_cno_t cno,
+			      int64_t *timep)
+{
+	*timep = cno;
+	return 0;
+}
+
+/* only needed by nilfs_segtable_set_threads(), which is not used */
+struct nilfs *nilfs_open(const char *dev, const char *dir, int flags)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void nilfs_close(struct nilfs *nilfs)
+{
+}
+
+const char *nilfs_get_dev(const struct nilfs *nilfs)
+{
+	return NULL;
+}
+
+const char *nilfs_get_root_path(const struct nilfs *nilfs)
+{
+	return NULL;
+}
+
+void nilfs_copy_options(struct nilfs *dst, const struct nilfs *src)
+{
+}
+
+static int segtable_test_reclaimable(uint64_t segnum)
+{
+	return segnum < segtable_test_nsegs &&
+		nilfs_suinfo_reclaimable(&segtable_test_su[segnum]);
+}
+
+/* write a segment anew, which changes what the assessment finds */
+static void segtable_test_rewrite(uint64_t segnum)
+{
+	struct nilfs_suinfo *si = &segtable_test_su[segnum];
+
+	si->sui_lastmod = SEGTABLE_TEST_T0 - rand() % 1000000;
+	if (rand() % 20 == 0)
+		si->sui_lastmod = SEGTABLE_TEST_T0 + rand() % 100;
+	if (rand() % 5 == 0)	/* many segments written in one second */
+		si->sui_lastmod = SEGTABLE_TEST_T0 - 500;
+	si->sui_nblocks = 1 + rand() % SEGTABLE_TEST_BPS;
+	si->sui_flags = 1UL << NILFS_SUINFO_DIRTY;
+	segtable_test_seqnum[segnum]++;
+	segtable_test_live[segnum] = rand() % (si->sui_nblocks + 1);
+	if (rand() % 50 == 0)	/* more than a bucket can tell */
+		segtable_test_live[segnum] = SEGTABLE_TEST_BPS + 3;
+	segtable_test_touched[segnum] = 1;
+}
+
+static void segtable_test_mutate(void)
+{
+	struct nilfs_suinfo *si;
+	uint64_t segnum, oldnsegs = segtable_test_nsegs;
+	int i, n = rand() % 100;
+
+	if (rand() % 10 == 0) {
+		/* resize the file system */
+		segtable_test_nsegs = SEGTABLE_TEST_MAXSEGS / 2 +
+			rand() % (SEGTABLE_TEST_MAXSEGS / 2 + 1);
+		for (segnum = oldnsegs; segnum < segtable_test_nsegs;
+		     segnum++) {
+			memset(&segtable_test_su[segnum], 0,
+			       sizeof(segtable_test_su[segnum]));
+			segtable_test_live[segnum] = 0;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		segnum = rand() % segtable_test_nsegs;
+		si = &segtable_test_su[segnum];
+		switch (rand() % 6) {
+		case 0:
+		case 1:
+			segtable_test_rewrite(segnum);
+			break;
+		case 2:
+			/* a log appended within the same second */
+			if (si->sui_nblocks < SEGTABLE_TEST_BPS) {
+				si->sui_nblocks++;
+				segtable_test_seqnum[segnum]++;
+				segtable_test_live[segnum] = rand() %
+					(si->sui_nblocks + 1);
+				segtable_test_touched[segnum] = 1;
+			}
+			break;
+		case 3:
+			si->sui_flags ^= 1UL << NILFS_SUINFO_ACTIVE;
+			break;
+		case 4:
+			si->sui_flags ^= 1UL << NILFS_SUINFO_ERROR;
+			break;
+		default:
+			/* freed, or reused without a change in usage */
+			si->sui_flags ^= 1UL << NILFS_SUINFO_DIRTY;
+			break;
+		}
+	}
+
+	if (rand() % 15 == 0) {
+		/* a snapshot revives or kills blocks anywhere */
+		segtable_test_cpstat.cs_nsss++;
+		for (segnum = 0; segnum < segtable_test_nsegs; segnum++)
+			segtable_test_live[segnum] = rand() %
+				(segtable_test_su[segnum].sui_nblocks + 1);
+	}
+	segtable_test_cpstat.cs_cno += 10;
+	segtable_test_protcno += rand() % 4;
+
+	for (segnum = 0; segnum < segtable_test_nsegs; segnum++) {
+		switch (rand() % 40) {
+		case 0:
+			segtable_test_fate[segnum] = SEGTABLE_TEST_PROTECTED;
+			break;
+		case 1:
+			segtable_test_fate[segnum] = SEGTABLE_TEST_BROKEN;
+			break;
+		default:
+			segtable_test_fate[segnum] = SEGTABLE_TEST_FINE;
+			break;
+		}
+	}
+}
+
+/* a reloaded entry mirrors the file, and no count survives a change */
+static void segtable_test_check_loaded(const struct nilfs_segtable *segtable,
+				       uint64_t segnum)
+{
+	if (segtable->lastmod[segnum] !=
+	    (int64_t)segtable_test_su[segnum].sui_lastmod ||
+	    segtable->nblocks[segnum] != segtable_test_su[segnum].sui_nblocks ||
+	    segtable->flags[segnum] != segtable_test_su[segnum].sui_flags)
+		SEGTABLE_TEST_FAIL("segment %llu: usage not reloaded",
+				   (unsigned long long)segnum);
+	if (segtable->state[segnum] == NILFS_SEGTABLE_LIVE_NONE)
+		;
+	else if (segtable->state[segnum] != NILFS_SEGTABLE_LIVE_CACHED)
+		SEGTABLE_TEST_FAIL("segment %llu: count of the last cycle kept",
+				   (unsigned long long)segnum);
+	else if (segtable_test_touched[segnum])
+		SEGTABLE_TEST_FAIL("segment %llu: count kept over a rewrite",
+				   (unsigned long long)segnum);
+	segtable_test_touched[segnum] = 0;
+}
+
+/* check a full refresh (@sample == NULL), or one of @sample only */
+static void segtable_test_check_refresh(const struct nilfs_segtable *segtable,
+					const uint64_t *sample,
+					size_t nsample)
+{
+	uint64_t segnum;
+	size_t i;
+
+	if (segtable->nsegs != segtable_test_nsegs)
+		SEGTABLE_TEST_FAIL("%llu segments in the table, %llu in the file",
+				   (unsigned long long)segtable->nsegs,
+				   (unsigned long long)segtable_test_nsegs);
+
+	if (sample) {
+		for (i = 0; i < nsample && sample[i] < segtable->nsegs; i++)
+			segtable_test_check_loaded(segtable, sample[i]);
+		return;
+	}
+	for (segnum = 0; segnum < segtable->nsegs; segnum++)
+		segtable_test_check_loaded(segtable, segnum);
+	memset(segtable_test_touched, 0, sizeof(segtable_test_touched));
+}
+
+/* check the count of a segment just brought up to date */
+static void segtable_test_check_count(const struct nilfs_segtable *segtable,
+				      uint64_t segnum)
+{
+	if (!segtable_test_reclaimable(segnum))
+		return;
+
+	switch (segtable->state[segnum]) {
+	case NILFS_SEGTABLE_LIVE_CACHED:
+	case NILFS_SEGTABLE_LIVE_CYCLE:
+		if (segtable->live[segnum] != segtable_test_live[segnum])
+			SEGTABLE_TEST_FAIL("segment %llu: %u live blocks cached, %u real",
+					   (unsigned long long)segnum,
+					   segtable->live[segnum],
+					   segtable_test_live[segnum]);
+		break;
+	case NILFS_SEGTABLE_LIVE_ERROR:
+		if (segtable_test_fate[segnum] != SEGTABLE_TEST_BROKEN)
+			SEGTABLE_TEST_FAIL("segment %llu: failed for no reason",
+					   (unsigned long long)segnum);
+		break;
+	default:
+		SEGTABLE_TEST_FAIL("segment %llu: not assessed",
+				   (unsigned long long)segnum);
+		break;
+	}
+}
+
+/* check an update of all segments (@sample == NULL) or of @sample */
+static void segtable_test_check_live(const struct nilfs_segtable *segtable,
+				     const uint64_t *sample, size_t nsample)
+{
+	uint64_t segnum;
+	size_t i;
+
+	if (sample) {
+		for (i = 0; i < nsample && sample[i] < segtable->nsegs; i++)
+			segtable_test_check_count(segtable, sample[i]);
+		return;
+	}
+	for (segnum = 0; segnum < segtable->nsegs; segnum++)
+		segtable_test_check_count(segtable, segnum);
+}
+
+/* test if the table, as it stands, holds a segment reclaimable */
+static int segtable_test_indexable(const struct nilfs_segtable *segtable,
+				   uint64_t segnum)
+{
+	struct nilfs_suinfo si;
+
+	if (segnum >= segtable->nsegs)
+		return 0;
+	nilfs_segtable_get_suinfo(segtable, segnum, &si);
+	return nilfs_suinfo_reclaimable(&si);
+}
+
+/*
+ * Every segment must be linked in the lists its usage and count in the
+ * table call for, each list must be in order, and the links must agree
+ * both ways.
+ */
+static void segtable_test_check_index(const struct nilfs_segtable *segtable)
+{
+	uint64_t segnum, prev, nage = 0, nlive = 0, n;
+	uint32_t b, bucket;
+	uint8_t want;
+
+	for (segnum = 0; segnum < segtable->capacity; segnum++) {
+		want = 0;
+		bucket = 0;
+		if (segtable_test_indexable(segtable, segnum)) {
+			want = NILFS_SEGTABLE_INDEX_AGE;
+			if (segtable->state[segnum] ==
+			    NILFS_SEGTABLE_LIVE_CACHED ||
+			    segtable->state[segnum] ==
+			    NILFS_SEGTABLE_LIVE_CYCLE) {
+				want |= NILFS_SEGTABLE_INDEX_LIVE;
+				bucket = min_t(uint32_t, segtable->live[segnum],
+					       segtable->nbuckets - 1);
+			}
+		}
+		if (segtable->indexed[segnum] != want)
+			SEGTABLE_TEST_FAIL("segment %llu: in lists %#x, not %#x",
+					   (unsigned long long)segnum,
+					   segtable->indexed[segnum], want);
+		else if ((want & NILFS_SEGTABLE_INDEX_LIVE) &&
+			 segtable->bucket[segnum] != bucket)
+			SEGTABLE_TEST_FAIL("segment %llu: in bucket %u, not %u",
+					   (unsigned long long)segnum,
+					   segtable->bucket[segnum], bucket);
+		if (want & NILFS_SEGTABLE_INDEX_AGE)
+			nage++;
+		if (want & NILFS_SEGTABLE_INDEX_LIVE)
+			nlive++;
+	}
+
+	n = 0;
+	prev = NILFS_SEGTABLE_NIL;
+	for (segnum = segtable->oldest; segnum != NILFS_SEGTABLE_NIL &&
+		     n <= nage; segnum = segtable->anext[segnum], n++) {
+		if (!(segtable->indexed[segnum] & NILFS_SEGTABLE_INDEX_AGE) ||
+		    segtable->aprev[segnum] != prev ||
+		    (prev != NILFS_SEGTABLE_NIL &&
+		     segtable->lastmod[prev] > segtable->lastmod[segnum]))
+			SEGTABLE_TEST_FAIL("age list broken at segment %llu",
+					   (unsigned long long)segnum);
+		prev = segnum;
+	}
+	if (n != nage || segtable->newest != prev)
+		SEGTABLE_TEST_FAIL("%llu segments in the age list, %llu reclaimable",
+				   (unsigned long long)n,
+				   (unsigned long long)nage);
+
+	n = 0;
+	for (b = 0; b < segtable->nbuckets; b++) {
+		prev = NILFS_SEGTABLE_NIL;
+		segnum = segtable->heads[b];
+		for ( ; segnum != NILFS_SEGTABLE_NIL && n <= nlive;
+		     segnum = segtable->lnext[segnum], n++) {
+			if (!(segtable->indexed[segnum] &
+			      NILFS_SEGTABLE_INDEX_LIVE) ||
+			    segtable->lprev[segnum] != prev ||
+			    segtable->bucket[segnum] != b)
+				SEGTABLE_TEST_FAIL("bucket %u broken at segment %llu",
+						   b,
+						   (unsigned long long)segnum);
+			prev = segnum;
+		}
+	}
+	if (n != nlive)
+		SEGTABLE_TEST_FAIL("%llu segments in the buckets, %llu with a count",
+				   (unsigned long long)n,
+				   (unsigned long long)nlive);
+}
+
+/* the same order as nilfs_cleanerd_walk_next() */
+static uint64_t segtable_test_walk_next(const struct nilfs_segtable *segtable,
+					int walk, uint64_t segnum)
+{
+	switch (walk) {
+	case NILFS_POLICY_WALK_LIVE:
+		return nilfs_segtable_live_next(segtable, segnum);
+	case NILFS_POLICY_WALK_NEWEST:
+		return segnum == NILFS_SEGTABLE_NIL ? segtable->newest :
+			segtable->aprev[segnum];
+	default:
+		return segnum == NILFS_SEGTABLE_NIL ? segtable->oldest :
+			segtable->anext[segnum];
+	}
+}
+
+/*
+ * Score a segment as the batch selection does.  Return: 1 if it is a
+ * candidate, or 0 if its count is unknown or the policy rejects it.
+ */
+static int segtable_test_score(struct nilfs_cleaning_policy *policy,
+			       const struct nilfs_policy_env *env,
+			       const struct nilfs_segtable *segtable,
+			       uint64_t segnum,
+			       struct nilfs_segment_candidate *cand)
+{
+	double lastmod, live, score;
+	ssize_t nlive;
+
+	if (nilfs_segtable_get_live(segtable, segnum, &nlive) <= 0)
+		return 0;
+	lastmod = segtable->lastmod[segnum];
+	live = nlive;
+	policy->evaluate_batch(policy, env, 1, &lastmod, &live, &score);
+	if (isnan(score))
+		return 0;
+	memset(cand, 0, sizeof(*cand));
+	cand->segnum = segnum;
+	cand->score = score;
+	return 1;
+}
+
+static void segtable_test_bound(struct nilfs_cleaning_policy *policy,
+				const struct nilfs_policy_env *env,
+				const struct nilfs_segtable *segtable,
+				uint64_t segnum,
+				struct nilfs_segment_candidate *bound)
+{
+	ssize_t live = 0;
+
+	nilfs_segtable_get_live(segtable, segnum, &live);
+	live = min_t(ssize_t, live, segtable->nbuckets - 1);
+	memset(bound, 0, sizeof(*bound));
+	bound->segnum = 0;	/* wins ties */
+	bound->score = policy->bound(policy, env, live,
+				     segtable->lastmod[segnum]);
+}
+
+/* keep the best @k candidates in @held, best first */
+static void segtable_test_hold(struct nilfs_cleaning_policy *policy,
+			       struct nilfs_segment_candidate *held,
+			       size_t *nheld, size_t k,
+			       const struct nilfs_segment_candidate *cand)
+{
+	size_t i = *nheld;
+
+	if (i == k) {
+		if (policy->compare(cand, &held[k - 1]) >= 0)
+			return;
+		i--;
+	} else {
+		(*nheld)++;
+	}
+	for ( ; i > 0 && policy->compare(cand, &held[i - 1]) < 0; i--)
+		held[i] = held[i - 1];
+	held[i] = *cand;
+}
+
+/*
+ * Walk the index in the order of @policy.  It must visit exactly the
+ * segments the full scan can score, in order.  The bound at each step
+ * must not lose to any candidate further down the walk, and a walk
+ * that stops as soon as the bound loses to the worst of the top K
+ * must hold the same top K as the full scan.  The bound is tested
+ * before every segment, which stops no later than the selection of
+ * the daemon does between its batches.
+ */
+static void segtable_test_check_walk(struct nilfs_cleaning_policy *policy,
+				     const struct nilfs_policy_env *env,
+				     const struct nilfs_segtable *segtable)
+{
+	static const size_t topk[] = { 1, 5, 50 };
+	static uint64_t walk[SEGTABLE_TEST_MAXSEGS];
+	static uint8_t seen[SEGTABLE_TEST_MAXSEGS];
+	static struct nilfs_segment_candidate all[SEGTABLE_TEST_MAXSEGS];
+	static struct nilfs_segment_candidate held[50];
+	struct nilfs_segment_candidate cand, bound, best;
+	uint64_t segnum, prev = NILFS_SEGTABLE_NIL;
+	size_t i, j, n = 0, nall = 0, nheld, nwant = 0;
+	int want, have_best = 0;
+	ssize_t live;
+
+	memset(seen, 0, sizeof(seen));
+	for (segnum = segtable_test_walk_next(segtable, policy->walk,
+					      NILFS_SEGTABLE_NIL);
+	     segnum != NILFS_SEGTABLE_NIL && n < segtable->nsegs;
+	     segnum = segtable_test_walk_next(segtable, policy->walk,
+					      segnum)) {
+		if (seen[segnum]++)
+			SEGTABLE_TEST_FAIL("%s: segment %llu walked twice",
+					   policy->name,
+					   (unsigned long long)segnum);
+		if (prev != NILFS_SEGTABLE_NIL &&
+		    (policy->walk == NILFS_POLICY_WALK_LIVE ?
+		     segtable->bucket[prev] > segtable->bucket[segnum] :
+		     policy->walk == NILFS_POLICY_WALK_NEWEST ?
+		     segtable->lastmod[prev] < segtable->lastmod[segnum] :
+		     segtable->lastmod[prev] > segtable->lastmod[segnum]))
+			SEGTABLE_TEST_FAIL("%s: walk out of order at segment %llu",
+					   policy->name,
+					   (unsigned long long)segnum);
+		walk[n++] = segnum;
+		prev = segnum;
+	}
+
+	for (segnum = 0; segnum < segtable->nsegs; segnum++) {
+		if (segtable_test_score(policy, env, segtable, segnum,
+					&all[nall]))
+			nall++;
+		if (policy->walk == NILFS_POLICY_WALK_LIVE)
+			want = nilfs_segtable_get_live(segtable, segnum,
+						       &live) > 0;
+		else
+			want = segtable_test_indexable(segtable, segnum);
+		if (want != seen[segnum])
+			SEGTABLE_TEST_FAIL("%s: segment %llu %s",
+					   policy->name,
+					   (unsigned long long)segnum,
+					   want ? "not walked" : "walked");
+		nwant += want;
+	}
+	if (n != nwant)
+		SEGTABLE_TEST_FAIL("%s: %zu segments walked, %zu wanted",
+				   policy->name, n, nwant);
+
+	/* the bound holds for the rest of the walk */
+	for (i = n; i-- > 0; ) {
+		if (segtable_test_score(policy, env, segtable, walk[i],
+					&cand) &&
+		    (!have_best || policy->compare(&cand, &best) < 0)) {
+			best = cand;
+			have_best = 1;
+		}
+		segtable_test_bound(policy, env, segtable, walk[i], &bound);
+		/* a tie with segment 0 compares as a loss */
+		if (have_best && policy->compare(&bound, &best) > 0 &&
+		    !(best.segnum == 0 && bound.score == best.score))
+			SEGTABLE_TEST_FAIL("%s: bound %a at segment %llu loses to %a of segment %llu",
+					   policy->name, bound.score,
+					   (unsigned long long)walk[i],
+					   best.score,
+					   (unsigned long long)best.segnum);
+	}
+
+	/* stopping early selects what the full scan does */
+	qsort(all, nall, sizeof(all[0]), policy->compare);
+	for (j = 0; j < sizeof(topk) / sizeof(topk[0]); j++) {
+		nheld = 0;
+		for (i = 0; i < n; i++) {
+			if (nheld == topk[j]) {
+				segtable_test_bound(policy, env, segtable,
+						    walk[i], &bound);
+				if (policy->compare(&bound,
+						    &held[nheld - 1]) > 0)
+					break;
+			}
+			if (segtable_test_score(policy, env, segtable,
+						walk[i], &cand))
+				segtable_test_hold(policy, held, &nheld,
+						   topk[j], &cand);
+		}
+		if (nheld != min_t(size_t, nall, topk[j])) {
+			SEGTABLE_TEST_FAIL("%s: top %zu: %zu selected, %zu wanted",
+					   policy->name, topk[j], nheld,
+					   min_t(size_t, nall, topk[j]));
+			continue;
+		}
+		for (i = 0; i < nheld; i++) {
+			if (held[i].segnum != all[i].segnum) {
+				SEGTABLE_TEST_FAIL("%s: top %zu: segment %llu selected in place of %llu",
+						   policy->name, topk[j],
+						   (unsigned long long)
+						   held[i].segnum,
+						   (unsigned long long)
+						   all[i].segnum);
+				break;
+			}
+		}
+	}
+}
+
+/* draw distinct segment numbers in ascending order */
+static size_t segtable_test_sample(uint64_t *sample)
+{
+	uint64_t segnum;
+	size_t n = 0;
+
+	for (segnum = 0; segnum < segtable_test_nsegs + 3 &&
+		     n < SEGTABLE_TEST_NSAMPLE; segnum++) {
+		if (rand() % (segtable_test_nsegs / SEGTABLE_TEST_NSAMPLE) ==
+		    0)
+			sample[n++] = segnum;
+	}
+	return n;
+}
+
+int main(void)
+{
+	struct nilfs_cleaning_policy *policies[] = {
+		&nilfs_policy_greedy,
+		&nilfs_policy_cost_benefit,
+		&nilfs_policy_timestamp,
+	};
+	uint64_t sample[SEGTABLE_TEST_NSAMPLE];
+	struct nilfs_segtable *segtable;
+	struct nilfs_policy_env env;
+	struct nilfs_sustat sustat;
+	uint64_t segnum;
+	size_t i, nsample;
+	int ret;
+
+	srand(1);
+	segtable = nilfs_segtable_create(NULL);
+	if (segtable == NULL) {
+		perror("cannot create segment table");
+		return EXIT_FAILURE;
+	}
+
+	segtable_test_nsegs = SEGTABLE_TEST_MAXSEGS * 3 / 4;
+	for (segnum = 0; segnum < segtable_test_nsegs; segnum++)
+		if (rand() % 4)
+			segtable_test_rewrite(segnum);
+	segtable_test_cpstat.cs_cno = 1000;
+
+	memset(&sustat, 0, sizeof(sustat));
+	for (cycle = 0; cycle < SEGTABLE_TEST_NCYCLES; cycle++) {
+		if (cycle > 0)
+			segtable_test_mutate();
+
+		sustat.ss_nsegs = segtable_test_nsegs;
+		if (cycle % 3 == 2 && segtable->nsegs == segtable_test_nsegs) {
+			/* reload and assess a sample, as sample mode does */
+			nsample = segtable_test_sample(sample);
+			ret = nilfs_segtable_refresh_of(segtable, sample,
+							nsample);
+			if (ret < 0) {
+				perror("cannot refresh segment table");
+				return EXIT_FAILURE;
+			}
+			segtable_test_check_refresh(segtable, sample, nsample);
+			segtable_test_check_index(segtable);
+
+			ret = nilfs_segtable_update_live_of(
+				segtable, &sustat, segtable_test_protcno,
+				sample, nsample);
+			segtable_test_check_live(segtable, sample, nsample);
+		} else {
+			ret = nilfs_segtable_refresh(segtable, &sustat);
+			if (ret < 0) {
+				perror("cannot refresh segment table");
+				return EXIT_FAILURE;
+			}
+			segtable_test_check_refresh(segtable, NULL, 0);
+			segtable_test_check_index(segtable);
+
+			ret = nilfs_segtable_update_live(
+				segtable, &sustat, segtable_test_protcno);
+			segtable_test_check_live(segtable, NULL, 0);
+
+			/* a second pass finds nothing left to assess */
+			if (ret == 0)
+				ret = nilfs_segtable_update_live(
+					segtable, &sustat,
+					segtable_test_protcno);
+			if (segtable->nassessed != 0)
+				SEGTABLE_TEST_FAIL("%lu segments assessed again",
+						   segtable->nassessed);
+		}
+		if (ret < 0) {
+			perror("cannot update live block counts");
+			return EXIT_FAILURE;
+		}
+		segtable_test_check_index(segtable);
+
+		env.now = SEGTABLE_TEST_T0;
+		env.prottime = SEGTABLE_TEST_T0 - 3600;
+		env.nongc_ctime = SEGTABLE_TEST_T0 - 10;
+		env.blocks_per_segment = SEGTABLE_TEST_BPS;
+		env.oldest = nilfs_segtable_oldest_lastmod(segtable, INT64_MAX);
+		for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+			segtable_test_check_walk(policies[i], &env, segtable);
+	}
+	nilfs_segtable_destroy(segtable);
+
+	if (nfailures) {
+		fprintf(stderr, "%d failures\n", nfailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
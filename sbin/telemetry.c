@@ -0,0 +1,181 @@
+/*
+ * telemetry.c - telemetry ring of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif	/* HAVE_CONFIG_H */
+
+#include <stdio.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif	/* HAVE_STDLIB_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif	/* HAVE_UNISTD_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif	/* HAVE_FCNTL_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif	/* HAVE_STRING_H */
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif	/* HAVE_SYS_MMAN_H */
+
+#if HAVE_SYSLOG_H
+#include <syslog.h>
+#endif	/* HAVE_SYSLOG_H */
+
+#include <sys/stat.h>
+#include <errno.h>
+#include "util.h"
+#include "telemetry.h"
+
+/**
+ * struct nilfs_telemetry - telemetry ring
+ * @header: header of the mapped ring file
+ * @mapsize: size of the mapping
+ *
+ * Records are fixed-size slots of a memory-mapped file, so appending
+ * one is a memory copy and the kernel writes them back in the
+ * background.  Decoding them into text is left to nilfs-telemetry(8).
+ */
+struct nilfs_telemetry {
+	struct nilfs_telemetry_header *header;
+	size_t mapsize;
+};
+
+static int nilfs_telemetry_valid(const struct nilfs_telemetry_header *header,
+				 uint64_t nrecs, uint32_t blocks_per_segment,
+				 uint64_t nsegments)
+{
+	return header->magic == NILFS_TELEMETRY_MAGIC &&
+		header->version == NILFS_TELEMETRY_VERSION &&
+		header->recsize == NILFS_TELEMETRY_RECSIZE &&
+		header->nrecs == nrecs &&
+		header->blocks_per_segment == blocks_per_segment &&
+		header->nsegments == nsegments;
+}
+
+/**
+ * nilfs_telemetry_open - open a telemetry ring file
+ * @path: pathname of the ring file
+ * @size: size of the ring file in bytes
+ * @blocks_per_segment: number of blocks per segment
+ * @nsegments: number of segments of the file system
+ *
+ * Records of an existing file of the same geometry are kept and
+ * appended to; otherwise the file is initialized.
+ */
+struct nilfs_telemetry *nilfs_telemetry_open(const char *path, size_t size,
+					     uint32_t blocks_per_segment,
+					     uint64_t nsegments)
+{
+	struct nilfs_telemetry *telemetry;
+	struct nilfs_telemetry_header *header;
+	struct stat stbuf;
+	uint64_t nrecs;
+	int fd, ret;
+
+	BUILD_BUG_ON(sizeof(struct nilfs_telemetry_header) >
+		     NILFS_TELEMETRY_RECSIZE);
+	BUILD_BUG_ON(sizeof(struct nilfs_telemetry_cycle) >
+		     NILFS_TELEMETRY_RECSIZE);
+	BUILD_BUG_ON(sizeof(struct nilfs_telemetry_histogram) >
+		     NILFS_TELEMETRY_RECSIZE);
+
+	nrecs = size / NILFS_TELEMETRY_RECSIZE;
+	if (unlikely(nrecs < 2)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	nrecs--;	/* for the header */
+
+	telemetry = malloc(sizeof(*telemetry));
+	if (unlikely(telemetry == NULL))
+		return NULL;
+	telemetry->mapsize = (nrecs + 1) * NILFS_TELEMETRY_RECSIZE;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (unlikely(fd < 0))
+		goto failed;
+
+	ret = fstat(fd, &stbuf);
+	if (unlikely(ret < 0))
+		goto failed_fd;
+
+	if (stbuf.st_size != telemetry->mapsize) {
+		ret = ftruncate(fd, telemetry->mapsize);
+		if (unlikely(ret < 0))
+			goto failed_fd;
+	}
+
+	header = mmap(NULL, telemetry->mapsize, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, 0);
+	if (unlikely(header == MAP_FAILED))
+		goto failed_fd;
+	close(fd);
+
+	if (!nilfs_telemetry_valid(header, nrecs, blocks_per_segment,
+				   nsegments)) {
+		memset(header, 0, NILFS_TELEMETRY_RECSIZE);
+		header->version = NILFS_TELEMETRY_VERSION;
+		header->recsize = NILFS_TELEMETRY_RECSIZE;
+		header->blocks_per_segment = blocks_per_segment;
+		header->nrecs = nrecs;
+		header->nsegments = nsegments;
+		header->head = 0;
+		__atomic_store_n(&header->magic, NILFS_TELEMETRY_MAGIC,
+				 __ATOMIC_RELEASE);
+	}
+	telemetry->header = header;
+	return telemetry;
+
+failed_fd:
+	close(fd);
+failed:
+	free(telemetry);
+	return NULL;
+}
+
+/**
+ * nilfs_telemetry_close - close a telemetry ring file
+ * @telemetry: telemetry ring
+ */
+void nilfs_telemetry_close(struct nilfs_telemetry *telemetry)
+{
+	if (telemetry == NULL)
+		return;
+
+	munmap(telemetry->header, telemetry->mapsize);
+	free(telemetry);
+}
+
+/**
+ * nilfs_telemetry_append - append a record to a telemetry ring
+ * @telemetry: telemetry ring
+ * @rec: record whose type and fields other than the number are set
+ * @size: size of the record (NILFS_TELEMETRY_RECSIZE at most)
+ */
+void nilfs_telemetry_append(struct nilfs_telemetry *telemetry,
+			    struct nilfs_telemetry_rechdr *rec, size_t size)
+{
+	struct nilfs_telemetry_header *header = telemetry->header;
+	uint64_t seq = header->head;
+	char *slot;
+
+	slot = (char *)header +
+		(seq % header->nrecs + 1) * NILFS_TELEMETRY_RECSIZE;
+	rec->seq = seq;
+	memcpy(slot, rec, size);
+	__atomic_store_n(&header->head, seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,108 @@
+/*
+ * telemetry.h - telemetry ring of NILFS cleaner daemon
+ *
+ * Licensed under GPLv2: the complete text of the GNU General Public
+ * License can be found in COPYING file of the nilfs-utils package.
+ */
+
+#ifndef NILFS_TELEMETRY_H
+#define NILFS_TELEMETRY_H
+
+#include <stdint.h>	/* uint64_t, etc */
+#include <stddef.h>	/* size_t */
+
+#define NILFS_TELEMETRY_MAGIC		0x4e4c544d	/* "NLTM" */
+#define NILFS_TELEMETRY_VERSION		1
+#define NILFS_TELEMETRY_RECSIZE		512	/* bytes per slot */
+#define NILFS_TELEMETRY_NSEGS		32	/* segments per cycle record */
+#define NILFS_TELEMETRY_NBUCKETS	101	/* 0% to 100% in 1% steps */
+
+/**
+ * struct nilfs_telemetry_header - header of a telemetry ring file
+ * @magic: NILFS_TELEMETRY_MAGIC
+ * @version: layout version of the file
+ * @recsize: size of a record slot in bytes
+ * @nrecs: number of record slots following the header
+ * @head: number of records ever appended
+ * @blocks_per_segment: number of blocks per segment
+ * @nsegments: number of segments of the file system
+ *
+ * The header occupies the first slot.  The record numbered n is stored
+ * in slot (n % @nrecs) + 1, and carries its number so that readers can
+ * tell slots overwritten while they were reading.
+ */
+struct nilfs_telemetry_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recsize;
+	uint32_t blocks_per_segment;
+	uint64_t nrecs;
+	uint64_t head;
+	uint64_t nsegments;
+};
+
+enum {
+	NILFS_TELEMETRY_REC_CYCLE = 1,		/* segments of a cycle */
+	NILFS_TELEMETRY_REC_HISTOGRAM,		/* utilization histogram */
+};
+
+/**
+ * struct nilfs_telemetry_rechdr - common header of telemetry records
+ * @type: type of the record (NILFS_TELEMETRY_REC_*)
+ * @pad: padding
+ * @seq: record number
+ * @time: time of the record (nanoseconds since the epoch)
+ * @cycle: cycle number of cleanerd
+ */
+struct nilfs_telemetry_rechdr {
+	uint32_t type;
+	uint32_t pad;
+	uint64_t seq;
+	uint64_t time;
+	uint64_t cycle;
+};
+
+/**
+ * struct nilfs_telemetry_cycle - segments selected in a cycle
+ * @hdr: record header
+ * @nsegs: number of selected segments
+ * @reclaim_order: order of moved blocks (NILFS_RECLAIM_ORDER_*)
+ * @write_cost: mean write cost 2 / (1 - u) of the selected segments
+ * @disk_util: ratio of used blocks of the file system
+ * @segnums: selected segments (first NILFS_TELEMETRY_NSEGS ones)
+ * @live: live blocks of @segnums
+ */
+struct nilfs_telemetry_cycle {
+	struct nilfs_telemetry_rechdr hdr;
+	uint32_t nsegs;
+	uint32_t reclaim_order;
+	double write_cost;
+	double disk_util;
+	uint64_t segnums[NILFS_TELEMETRY_NSEGS];
+	uint32_t live[NILFS_TELEMETRY_NSEGS];
+};
+
+/**
+ * struct nilfs_telemetry_histogram - utilization of in-use segments
+ * @hdr: record header
+ * @nsegs: number of in-use segments
+ * @nprotected: number of them counted as full because they are protected
+ * @counts: number of segments per percent of live blocks
+ */
+struct nilfs_telemetry_histogram {
+	struct nilfs_telemetry_rechdr hdr;
+	uint64_t nsegs;
+	uint64_t nprotected;
+	uint32_t counts[NILFS_TELEMETRY_NBUCKETS];
+};
+
+struct nilfs_telemetry;
+
+struct nilfs_telemetry *nilfs_telemetry_open(const char *path, size_t size,
+					     uint32_t blocks_per_segment,
+					     uint64_t nsegments);
+void nilfs_telemetry_close(struct nilfs_telemetry *telemetry);
+void nilfs_telemetry_append(struct nilfs_telemetry *telemetry,
+			    struct nilfs_telemetry_rechdr *rec, size_t size);
+
+#endif /* NILFS_TELEMETRY_H */
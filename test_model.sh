@@ -4,7 +4,7 @@
 # Configuration
 # ======================
 MOUNT_POINT="/mnt/nilfs"   # change as needed
-DATA_LOG="/var/log/nilfs/data.log"
+TELEMETRY_RING="/var/log/nilfs/telemetry.ring"
 WAIT_TIME=120              # workload runtime in seconds
 
 usage() {
@@ -41,8 +41,10 @@ fi
 # Reset the environment
 # ======================
 
-echo "[+] Removing old NILFS log: $DATA_LOG"
-rm -f "$DATA_LOG"
+echo "[+] Removing old NILFS telemetry: $TELEMETRY_RING"
+rm -f "$TELEMETRY_RING"
+# reopen the ring so that cleanerd starts a new one
+nilfs-clean -c
 
 echo "[+] Clearing mount point: $MOUNT_POINT"
 rm -rf "${MOUNT_POINT:?}/"*
@@ -74,16 +76,12 @@ kill -9 "$WID" 2>/dev/null
 # Save results
 # ======================
 
-if [ ! -f "$DATA_LOG" ]; then
-    echo "Error: data log '$DATA_LOG' not found."
+if [ ! -f "$TELEMETRY_RING" ]; then
+    echo "Error: telemetry ring '$TELEMETRY_RING' not found."
     exit 1
 fi
 
-echo "[+] Copying log to $DEST"
-# Add CSV header and append actual data
-{
-    echo "seg,blk,util"
-    cat "$DATA_LOG"
-} > "$DEST"
+echo "[+] Decoding utilization histograms to $DEST"
+nilfs-telemetry -u "$TELEMETRY_RING" > "$DEST"
 
 echo "[+] Done. Output written to: $DEST"